@@ -1,23 +1,966 @@
+// bench.cpp
+//
+// Benchmark runner for the simulation, without graphics.
+//
+// Usage: bench [key=value ...]
+//
+//   mode=scenarios     Step named scenarios, and report throughput and per phase timings. (default)
+//   mode=tiers         Compare speed and force error of the kernel accuracy tiers.
+//   mode=integrators   Compare energy drift of the integrators at an equal number of force evaluations.
+//   mode=forceerror    Measure the force error of the aggregated solver against exact gravity.
+//   mode=scaling       Strong and weak scaling of a scenario, from 1 up to threads=N workers.
+//   mode=ensemble      Step many small universes of a scenario, one after the other, and then all at once on the workers.
+//   mode=blockcheck    Check that the block integrator with a tiny eta steps like kick-drift-kick, across restarts of its schedule.
+//
+//   scenario=NAME      demo, disk, uniform, merger, cluster, sparse, plummer, hernquist, expdisk, collision, collapse, or all. (default: all)
+//   seed=N             Seed for the scenarios drawn from models, from plummer on. (default: 1)
+//   scale=F            Factor on the scale radii of those scenarios. (default: 1)
+//   stars=N            Number of stars, instead of the default of the scenario.
+//   threads=N          Number of worker threads. (default: number of cores)
+//   steps=N            Number of timed steps. (default: 200)
+//   warmup=N           Number of untimed steps before timing. (default: 20)
+//   tier=NAME          Force kernel tier: approx, newton or precise.
+//   integrator=NAME    euler, kdk, yoshida4 or block.
+//   json=FILE          Write the results as JSON. (default: bench_results.json, or scaling_results.json)
+//   csv=FILE           Write the results as CSV. (default: bench_results.csv, or scaling_results.csv)
+//   counters=1         Read hardware performance counters per phase and per thread, in scenarios mode.
+//                      They go into the JSON, and into bench_counters.csv.
+//   series=FILE        Write the work counters of every timed step to a CSV file, in scenarios mode.
+//   metrics=ADDRESS    Serve live metrics while running, in scenarios mode: unix:PATH, or a localhost TCP port.
+//   universes=N        Number of universes in ensemble mode, each with its own seed, from seed=N up. (default: 4 per thread)
+//                      Their scenario defaults to plummer, with 2000 stars.
+
 #include "stars.h"
+#include "forcekernel.h"
+#include "forceerror.h"
+#include "scenarios.h"
+#include "wallclock.h"
+#include "perfcounters.h"
+#include "stepseries.h"
+#include "metrics.h"
+#include "phasetimers.h"
 #include "threadtracer.h"
 
+// From GBase
+#include "logx.h"
+
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#define MAXBENCHSTARS	120000
+
+//! Max number of threads that we report counters for.
+#define MAXCOUNTEDTHREADS	64
+
+//! Max number of universes in ensemble mode.
+#define MAXUNIVERSES		1024
+
+static float ref_ax[ MAXBENCHSTARS ];
+static float ref_ay[ MAXBENCHSTARS ];
+static float tier_ax[ MAXBENCHSTARS ];
+static float tier_ay[ MAXBENCHSTARS ];
+
+
+//! Settings from the command line.
+static const char* mode = "scenarios";
+static int scenario = -1;
+static int numstars = 0;
+static int numthreads = 0;
+static int numsteps = 200;
+static int numwarmup = 20;
+static const char* jsonname = 0;
+static const char* csvname = 0;
+static bool counters = false;
+static const char* seriesname = 0;
+static const char* metricsaddress = 0;
+static int numuniverses = 0;
+
+static const float dt = 1/120.0f;
+
+
+//! Measurements for one run of a scenario.
+typedef struct
+{
+	int scenario;
+	int stars;
+	int threads;
+	stars_stats_t stats;
+	perfsample_t phases[ PERFPHASE_NUMPHASES ];	//! Counts per phase, summed over the threads.
+	perfsample_t workers[ MAXCOUNTEDTHREADS ];	//! Counts per thread, summed over the phases.
+	int numworkers;
+} benchresult_t;
+
+#define MAXRESULTS	64
+
+static benchresult_t results[ MAXRESULTS ];
+static int numresults = 0;
+
+
+//! Relative error of the forces computed with a tier, against the precise tier, for the current star field.
+static void force_error( int tier, float* rms, float* mx )
+{
+	stars_kernel_tier = KERNEL_PRECISE;
+	const int n = stars_accelerations( ref_ax, ref_ay, MAXBENCHSTARS );
+	stars_kernel_tier = tier;
+	stars_accelerations( tier_ax, tier_ay, MAXBENCHSTARS );
+	double sum = 0.0;
+	float worst = 0.0f;
+	for ( int i=0; i<n; ++i )
+	{
+		const float dx = tier_ax[i] - ref_ax[i];
+		const float dy = tier_ay[i] - ref_ay[i];
+		const float magn = sqrtf( ref_ax[i]*ref_ax[i] + ref_ay[i]*ref_ay[i] );
+		const float err = magn > 0 ? sqrtf( dx*dx + dy*dy ) / magn : 0.0f;
+		sum += err * err;
+		worst = err > worst ? err : worst;
+	}
+	*rms = n ? (float) sqrt( sum / n ) : 0.0f;
+	*mx = worst;
+}
+
+
+//! Run an integrator over a fixed span of simulated time, and report its energy drift and cost.
+static void integrator_drift( int integrator, float h, int steps )
+{
+	scenario_spawn( SCENARIO_DISK, numstars );
+	const int savedintegrator = stars_integrator;
+	const int savedinterval = stars_diagnostics_interval;
+	stars_integrator = integrator;
+	stars_diagnostics_interval = 1;
+	stars_reset_stats();
+
+	stars_diagnostics_t d;
+	double e0 = 0.0;
+	double worst = 0.0;
+	bool first = true;
+	const double t0 = wallclock_seconds();
+	for ( int i=0; i<steps; ++i )
+	{
+		stars_update( h );
+		if ( stars_diagnostics( &d ) )
+		{
+			const double e = d.kinetic + d.potential;
+			if ( first )
+				e0 = e;
+			first = false;
+			const double drift = e0 ? fabs( ( e - e0 ) / e0 ) : 0.0;
+			worst = drift > worst ? drift : worst;
+		}
+	}
+	const double elapsed = wallclock_seconds() - t0;
+	stars_stats_t st;
+	stars_get_stats( &st );
+	stars_diagnostics_interval = savedinterval;
+	stars_integrator = savedintegrator;
+
+	fprintf
+	(
+		stdout, "%-8s dt %.5f %5d steps %8.1f ms %10lld force evaluations  max energy drift %.3g\n",
+		stars_integrator_names[ integrator ], h, steps, 1000.0 * elapsed, st.evaluations, worst
+	);
+}
+
+
+static void run_tiers( void )
+{
+	for ( int tier=0; tier<KERNEL_NUMTIERS; ++tier )
+	{
+		scenario_spawn( SCENARIO_DISK, numstars );
+
+		float rms, mx;
+		force_error( tier, &rms, &mx );
+
+		stars_kernel_tier = tier;
+		const int count = stars_total_count();
+		const double t0 = wallclock_seconds();
+		for ( int i=0; i<numsteps; ++i )
+			stars_update( dt );
+		const double elapsed = wallclock_seconds() - t0;
+		const double sps = elapsed > 0 ? count * (double) numsteps / elapsed : 0.0;
+
+		fprintf
+		(
+			stdout, "%-8s %8.3f ms/step %10.3g stars/s  force error rms %.3g max %.3g\n",
+			forcekernel_tier_names[ tier ], numsteps ? 1000.0 * elapsed / numsteps : 0.0, sps, rms, mx
+		);
+	}
+}
+
+
+static void run_integrators( void )
+{
+	// Energy drift per integrator, at an equal number of force evaluations.
+	// Yoshida's scheme takes three force evaluations per step, so it gets a three times larger step.
+	const int span = numsteps < 3 ? 3 : numsteps;
+	integrator_drift( INTEGRATOR_EULER,    dt,   span   );
+	integrator_drift( INTEGRATOR_KDK,      dt,   span   );
+	integrator_drift( INTEGRATOR_YOSHIDA4, 3*dt, span/3 );
+	// Block steps go from dt up to 16*dt: it does fewer evaluations for the same span.
+	integrator_drift( INTEGRATOR_BLOCK,    dt,   span   );
+}
+
+
+static void run_forceerror( void )
+{
+	// How far the aggregates drift from exact pairwise gravity, on an evolved field.
+	scenario_spawn( scenario >= 0 ? scenario : SCENARIO_DISK, numstars );
+	for ( int i=0; i<numwarmup; ++i )
+		stars_update( dt );
+	stars_kernel_tier = KERNEL_PRECISE;
+	forceerror_t fe;
+	if ( forceerror_measure( &fe ) )
+		forceerror_print( stdout, &fe );
+}
+
+
+//! Keep the counts of the timed steps. Threads that did not count anything, like idle workers, are left out.
+static void collect_counters( benchresult_t& r )
+{
+	r.numworkers = 0;
+	if ( !perfcounters_enabled )
+		return;
+	for ( int p=0; p<PERFPHASE_NUMPHASES; ++p )
+		perfcounters_phase( p, r.phases + p );
+	const int n = perfcounters_numthreads();
+	for ( int t=0; t<n && r.numworkers < MAXCOUNTEDTHREADS; ++t )
+	{
+		perfsample_t& w = r.workers[ r.numworkers ];
+		memset( &w, 0, sizeof( w ) );
+		bool counted = false;
+		for ( int p=0; p<PERFPHASE_NUMPHASES; ++p )
+		{
+			perfsample_t s;
+			if ( perfcounters_thread( t, p, &s ) )
+			{
+				counted = true;
+				for ( int c=0; c<PERFCOUNTER_NUMCOUNTERS; ++c )
+					w.v[ c ] += s.v[ c ];
+			}
+		}
+		r.numworkers += counted ? 1 : 0;
+	}
+}
+
+
+//! Let the metrics listener see the latest step. There is no frame loop, so the phase timers are drained here.
+static void publish_metrics( void )
+{
+	if ( !metrics_enabled )
+		return;
+	phasetimers_collect();
+	metrics_publish();
+}
+
+
+//! Step a scenario, untimed for the warm-up and then timed, and keep the stats.
+static const benchresult_t& run_scenario( int nr, int count, int threads )
+{
+	ASSERT( numresults < MAXRESULTS );
+	benchresult_t& r = results[ numresults++ ];
+	r.scenario = nr;
+	r.stars = scenario_spawn( nr, count );
+	r.threads = threads;
+	stars_set_threads( threads );
+	for ( int i=0; i<numwarmup; ++i )
+	{
+		stars_update( dt );
+		publish_metrics();
+	}
+	stars_reset_stats();
+	perfcounters_reset();
+	for ( int i=0; i<numsteps; ++i )
+	{
+		stars_update( dt );
+		stepseries_record( scenario_names[ nr ] );
+		publish_metrics();
+	}
+	stars_get_stats( &r.stats );
+	collect_counters( r );
+	return r;
+}
+
+
+#define PERSTEP( S, V )		( (S).steps ? 1000.0 * (V) / (S).steps : 0.0 )
+#define PERSECOND( S, V )	( (S).total > 0 ? (V) / (S).total : 0.0 )
+
+// Counts per step, and instructions per cycle.
+#define COUNTPERSTEP( S, C, R )	( (S).steps ? (double) (C).v[ R ] / (S).steps : 0.0 )
+#define IPC( C )		( (C).v[ PERFCOUNTER_CYCLES ] ? (double) (C).v[ PERFCOUNTER_INSTRUCTIONS ] / (C).v[ PERFCOUNTER_CYCLES ] : 0.0 )
+
+
+static void print_results( FILE* f )
+{
+	fprintf( f, "%-8s %6s %3s %9s %10s %12s  ms/step: %7s %7s %7s %7s %7s %7s\n", "scenario", "stars", "thr", "ms/step", "stars/s", "interacts/s", "aggr", "forces", "drift", "swap", "transit", "ageing" );
+	for ( int i=0; i<numresults; ++i )
+	{
+		const benchresult_t& r = results[ i ];
+		const stars_stats_t& s = r.stats;
+		fprintf
+		(
+			f, "%-8s %6d %3d %9.3f %10.3g %12.3g           %7.3f %7.3f %7.3f %7.3f %7.3f %7.3f\n",
+			scenario_names[ r.scenario ], r.stars, r.threads,
+			PERSTEP( s, s.total ), PERSECOND( s, s.starsteps ), PERSECOND( s, s.interactions ),
+			PERSTEP( s, s.aggregation ), PERSTEP( s, s.forces ), PERSTEP( s, s.drift ),
+			PERSTEP( s, s.swap ), PERSTEP( s, s.transits ), PERSTEP( s, s.ageing )
+		);
+	}
+}
+
+
+static void print_counter_row( FILE* f, const stars_stats_t& s, const char* label, const perfsample_t& c )
+{
+	fprintf( f, "  %-12s", label );
+	for ( int k=0; k<PERFCOUNTER_NUMCOUNTERS; ++k )
+		fprintf( f, " %13.4g", COUNTPERSTEP( s, c, k ) );
+	fprintf( f, " %6.2f\n", IPC( c ) );
+}
+
+
+//! Counts per step, per phase and per thread.
+static void print_counters( FILE* f )
+{
+	for ( int i=0; i<numresults; ++i )
+	{
+		const benchresult_t& r = results[ i ];
+		const stars_stats_t& s = r.stats;
+		fprintf( f, "%s, %d stars, %d threads. Counts per step:\n  %-12s", scenario_names[ r.scenario ], r.stars, r.threads, "" );
+		for ( int k=0; k<PERFCOUNTER_NUMCOUNTERS; ++k )
+			fprintf( f, " %13s", perfcounter_names[ k ] );
+		fprintf( f, " %6s\n", "ipc" );
+		for ( int p=0; p<PERFPHASE_NUMPHASES; ++p )
+			print_counter_row( f, s, perfphase_names[ p ], r.phases[ p ] );
+		for ( int t=0; t<r.numworkers; ++t )
+		{
+			char label[ 16 ];
+			snprintf( label, sizeof( label ), "thread %d", t );
+			print_counter_row( f, s, label, r.workers[ t ] );
+		}
+	}
+	if ( perfcounters_multiplexed() )
+		fprintf( f, "The kernel multiplexed the counters with other events: the counts are scaled up from the time they ran.\n" );
+}
+
+
+static void write_counter_row( FILE* f, const benchresult_t& r, const char* kind, const char* name, const perfsample_t& c )
+{
+	fprintf( f, "%s,%d,%d,%s,%s", scenario_names[ r.scenario ], r.stars, r.threads, kind, name );
+	for ( int k=0; k<PERFCOUNTER_NUMCOUNTERS; ++k )
+		fprintf( f, ",%.6g", COUNTPERSTEP( r.stats, c, k ) );
+	fprintf( f, ",%.4f\n", IPC( c ) );
+}
+
+
+static void write_counters_csv( const char* fname )
+{
+	FILE* f = fopen( fname, "w" );
+	if ( !f )
+	{
+		fprintf( stderr, "Cannot write %s\n", fname );
+		return;
+	}
+	fprintf( f, "scenario,stars,threads,kind,name" );
+	for ( int k=0; k<PERFCOUNTER_NUMCOUNTERS; ++k )
+		fprintf( f, ",%s_per_step", perfcounter_names[ k ] );
+	fprintf( f, ",ipc\n" );
+	for ( int i=0; i<numresults; ++i )
+	{
+		const benchresult_t& r = results[ i ];
+		for ( int p=0; p<PERFPHASE_NUMPHASES; ++p )
+			write_counter_row( f, r, "phase", perfphase_names[ p ], r.phases[ p ] );
+		for ( int t=0; t<r.numworkers; ++t )
+		{
+			char name[ 16 ];
+			snprintf( name, sizeof( name ), "%d", t );
+			write_counter_row( f, r, "thread", name, r.workers[ t ] );
+		}
+	}
+	fclose( f );
+}
+
+
+static void write_json_counts( FILE* f, const stars_stats_t& s, const perfsample_t& c )
+{
+	fprintf( f, "{ " );
+	for ( int k=0; k<PERFCOUNTER_NUMCOUNTERS; ++k )
+		if ( perfcounters_available( k ) )
+			fprintf( f, "\"%s\": %.6g, ", perfcounter_names[ k ], COUNTPERSTEP( s, c, k ) );
+	fprintf( f, "\"ipc\": %.4f }", IPC( c ) );
+}
+
+
+static void write_csv( const char* fname )
+{
+	FILE* f = fopen( fname, "w" );
+	if ( !f )
+	{
+		fprintf( stderr, "Cannot write %s\n", fname );
+		return;
+	}
+	fprintf( f, "scenario,stars,threads,steps,tier,integrator,ms_per_step,stars_per_s,interactions_per_s,evaluations,interactions,aggregation_ms,forces_ms,drift_ms,swap_ms,transits_ms,ageing_ms,sources,nearfield,farfield,padding,crossings,peakcell,peaksources\n" );
+	for ( int i=0; i<numresults; ++i )
+	{
+		const benchresult_t& r = results[ i ];
+		const stars_stats_t& s = r.stats;
+		fprintf
+		(
+			f, "%s,%d,%d,%d,%s,%s,%.4f,%.6g,%.6g,%lld,%lld,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%lld,%lld,%lld,%lld,%lld,%d,%d\n",
+			scenario_names[ r.scenario ], r.stars, r.threads, s.steps,
+			forcekernel_tier_names[ stars_kernel_tier ], stars_integrator_names[ stars_integrator ],
+			PERSTEP( s, s.total ), PERSECOND( s, s.starsteps ), PERSECOND( s, s.interactions ),
+			s.evaluations, s.interactions,
+			PERSTEP( s, s.aggregation ), PERSTEP( s, s.forces ), PERSTEP( s, s.drift ),
+			PERSTEP( s, s.swap ), PERSTEP( s, s.transits ), PERSTEP( s, s.ageing ),
+			s.sources, s.nearfield, s.farfield, s.padding, s.crossings, s.peakcell, s.peaksources
+		);
+	}
+	fclose( f );
+}
+
+
+static void write_json( const char* fname )
+{
+	FILE* f = fopen( fname, "w" );
+	if ( !f )
+	{
+		fprintf( stderr, "Cannot write %s\n", fname );
+		return;
+	}
+	fprintf( f, "{\n" );
+	fprintf( f, "  \"vectorize\": %d,\n", VECTORIZE );
+	fprintf( f, "  \"tier\": \"%s\",\n", forcekernel_tier_names[ stars_kernel_tier ] );
+	fprintf( f, "  \"integrator\": \"%s\",\n", stars_integrator_names[ stars_integrator ] );
+	fprintf( f, "  \"warmup\": %d,\n", numwarmup );
+	fprintf( f, "  \"seed\": %u, \"scale\": %.3f,\n", scenario_seed, scenario_scale );
+	fprintf( f, "  \"results\":\n  [\n" );
+	for ( int i=0; i<numresults; ++i )
+	{
+		const benchresult_t& r = results[ i ];
+		const stars_stats_t& s = r.stats;
+		fprintf( f, "    {\n" );
+		fprintf( f, "      \"scenario\": \"%s\", \"stars\": %d, \"threads\": %d, \"steps\": %d,\n", scenario_names[ r.scenario ], r.stars, r.threads, s.steps );
+		fprintf( f, "      \"ms_per_step\": %.4f, \"stars_per_s\": %.6g, \"interactions_per_s\": %.6g,\n", PERSTEP( s, s.total ), PERSECOND( s, s.starsteps ), PERSECOND( s, s.interactions ) );
+		fprintf( f, "      \"evaluations\": %lld, \"interactions\": %lld,\n", s.evaluations, s.interactions );
+		fprintf( f, "      \"sources\": %lld, \"nearfield\": %lld, \"farfield\": %lld, \"padding\": %lld, \"crossings\": %lld,\n", s.sources, s.nearfield, s.farfield, s.padding, s.crossings );
+		fprintf( f, "      \"peakcell\": %d, \"cellcap\": %d, \"peaksources\": %d, \"maxgathered\": %d,\n", s.peakcell, CELLCAP, s.peaksources, MAXGATHERED );
+		fprintf
+		(
+			f, "      \"phases_ms_per_step\": { \"aggregation\": %.4f, \"forces\": %.4f, \"drift\": %.4f, \"swap\": %.4f, \"transits\": %.4f, \"ageing\": %.4f }%s\n",
+			PERSTEP( s, s.aggregation ), PERSTEP( s, s.forces ), PERSTEP( s, s.drift ),
+			PERSTEP( s, s.swap ), PERSTEP( s, s.transits ), PERSTEP( s, s.ageing ), perfcounters_enabled ? "," : ""
+		);
+		if ( perfcounters_enabled )
+		{
+			fprintf( f, "      \"counters_per_step\":\n      {\n" );
+			fprintf( f, "        \"multiplexed\": %s,\n", perfcounters_multiplexed() ? "true" : "false" );
+			for ( int p=0; p<PERFPHASE_NUMPHASES; ++p )
+			{
+				fprintf( f, "        \"%s\": ", perfphase_names[ p ] );
+				write_json_counts( f, s, r.phases[ p ] );
+				fprintf( f, ",\n" );
+			}
+			fprintf( f, "        \"threads\":\n        [\n" );
+			for ( int t=0; t<r.numworkers; ++t )
+			{
+				fprintf( f, "          " );
+				write_json_counts( f, s, r.workers[ t ] );
+				fprintf( f, "%s\n", t+1 < r.numworkers ? "," : "" );
+			}
+			fprintf( f, "        ]\n      }\n" );
+		}
+		fprintf( f, "    }%s\n", i+1 < numresults ? "," : "" );
+	}
+	fprintf( f, "  ]\n}\n" );
+	fclose( f );
+}
+
+
+//! Time spent per step in the phases that run on the main thread only.
+static double serial_ms( const stars_stats_t& s )
+{
+	return PERSTEP( s, s.aggregation + s.swap + s.transits + s.ageing );
+}
+
+
+//! One point of a scaling study.
+typedef struct
+{
+	bool weak;
+	const benchresult_t* r;
+	double speedup;		//! strong: T(1)/T(n). weak: n*T(1)/T(n), the speedup in stars per second.
+	double efficiency;	//! speedup / n.
+} scalingpoint_t;
+
+
+static void print_scaling( FILE* f, const scalingpoint_t* points, int count )
+{
+	fprintf( f, "%-6s %-8s %7s %4s %9s %8s %6s  serial ms/step: %6s %6s %7s %6s %6s %6s\n", "study", "scenario", "stars", "thr", "ms/step", "speedup", "effic", "aggr", "swap", "transit", "ageing", "total", "share" );
+	for ( int i=0; i<count; ++i )
+	{
+		const scalingpoint_t& p = points[ i ];
+		const stars_stats_t& s = p.r->stats;
+		const double serial = serial_ms( s );
+		const double step = PERSTEP( s, s.total );
+		fprintf
+		(
+			f, "%-6s %-8s %7d %4d %9.3f %8.2f %5.0f%%                  %6.3f %6.3f %7.3f %6.3f %6.3f %5.1f%%\n",
+			p.weak ? "weak" : "strong", scenario_names[ p.r->scenario ], p.r->stars, p.r->threads,
+			step, p.speedup, 100.0 * p.efficiency,
+			PERSTEP( s, s.aggregation ), PERSTEP( s, s.swap ), PERSTEP( s, s.transits ), PERSTEP( s, s.ageing ),
+			serial, step > 0 ? 100.0 * serial / step : 0.0
+		);
+	}
+}
+
+
+static void write_scaling_csv( const char* fname, const scalingpoint_t* points, int count )
+{
+	FILE* f = fopen( fname, "w" );
+	if ( !f )
+	{
+		fprintf( stderr, "Cannot write %s\n", fname );
+		return;
+	}
+	fprintf( f, "study,scenario,stars,threads,steps,ms_per_step,speedup,efficiency,stars_per_s,forces_ms,aggregation_ms,swap_ms,transits_ms,ageing_ms,serial_ms\n" );
+	for ( int i=0; i<count; ++i )
+	{
+		const scalingpoint_t& p = points[ i ];
+		const stars_stats_t& s = p.r->stats;
+		fprintf
+		(
+			f, "%s,%s,%d,%d,%d,%.4f,%.4f,%.4f,%.6g,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+			p.weak ? "weak" : "strong", scenario_names[ p.r->scenario ], p.r->stars, p.r->threads, s.steps,
+			PERSTEP( s, s.total ), p.speedup, p.efficiency, PERSECOND( s, s.starsteps ),
+			PERSTEP( s, s.forces ), PERSTEP( s, s.aggregation ), PERSTEP( s, s.swap ), PERSTEP( s, s.transits ), PERSTEP( s, s.ageing ),
+			serial_ms( s )
+		);
+	}
+	fclose( f );
+}
+
+
+static void write_scaling_json( const char* fname, const scalingpoint_t* points, int count )
+{
+	FILE* f = fopen( fname, "w" );
+	if ( !f )
+	{
+		fprintf( stderr, "Cannot write %s\n", fname );
+		return;
+	}
+	fprintf( f, "{\n" );
+	fprintf( f, "  \"vectorize\": %d,\n", VECTORIZE );
+	fprintf( f, "  \"tier\": \"%s\",\n", forcekernel_tier_names[ stars_kernel_tier ] );
+	fprintf( f, "  \"integrator\": \"%s\",\n", stars_integrator_names[ stars_integrator ] );
+	fprintf( f, "  \"points\":\n  [\n" );
+	for ( int i=0; i<count; ++i )
+	{
+		const scalingpoint_t& p = points[ i ];
+		const stars_stats_t& s = p.r->stats;
+		fprintf
+		(
+			f, "    { \"study\": \"%s\", \"scenario\": \"%s\", \"stars\": %d, \"threads\": %d, \"steps\": %d, \"ms_per_step\": %.4f, \"speedup\": %.4f, \"efficiency\": %.4f,\n",
+			p.weak ? "weak" : "strong", scenario_names[ p.r->scenario ], p.r->stars, p.r->threads, s.steps,
+			PERSTEP( s, s.total ), p.speedup, p.efficiency
+		);
+		fprintf
+		(
+			f, "      \"serial_ms_per_step\": { \"aggregation\": %.4f, \"swap\": %.4f, \"transits\": %.4f, \"ageing\": %.4f, \"total\": %.4f }, \"forces_ms_per_step\": %.4f }%s\n",
+			PERSTEP( s, s.aggregation ), PERSTEP( s, s.swap ), PERSTEP( s, s.transits ), PERSTEP( s, s.ageing ), serial_ms( s ),
+			PERSTEP( s, s.forces ), i+1 < count ? "," : ""
+		);
+	}
+	fprintf( f, "  ]\n}\n" );
+	fclose( f );
+}
+
+
+//! Strong scaling: the same field on 1..numthreads workers. Weak scaling: stars in proportion to the workers.
+static void run_scaling( void )
+{
+	const int nr = scenario >= 0 ? scenario : SCENARIO_DEMO;
+
+	int threadcounts[ 32 ];
+	int numcounts = 0;
+	for ( int t=1; t<numthreads && numcounts < 31; t *= 2 )
+		threadcounts[ numcounts++ ] = t;
+	threadcounts[ numcounts++ ] = numthreads;
+
+	scalingpoint_t points[ 64 ];
+	int numpoints = 0;
+
+	// Strong scaling.
+	const benchresult_t* base = 0;
+	for ( int i=0; i<numcounts; ++i )
+	{
+		const benchresult_t& r = run_scenario( nr, numstars, threadcounts[ i ] );
+		base = base ? base : &r;
+		scalingpoint_t& p = points[ numpoints++ ];
+		p.weak = false;
+		p.r = &r;
+		p.speedup = r.stats.total > 0 ? ( base->stats.total / base->stats.steps ) / ( r.stats.total / r.stats.steps ) : 0.0;
+		p.efficiency = p.speedup / r.threads;
+	}
+
+	// Weak scaling: the star count per worker is what fits in the bench buffers at the highest worker count.
+	const int requested = numstars > 0 ? numstars : scenario_default_counts[ nr ];
+	const int perthread = requested * numthreads > MAXBENCHSTARS ? MAXBENCHSTARS / numthreads : requested;
+	base = 0;
+	for ( int i=0; i<numcounts; ++i )
+	{
+		const int n = threadcounts[ i ];
+		const benchresult_t& r = run_scenario( nr, perthread * n, n );
+		base = base ? base : &r;
+		scalingpoint_t& p = points[ numpoints++ ];
+		p.weak = true;
+		p.r = &r;
+		const double tbase = base->stats.total / base->stats.steps;
+		const double tn = r.stats.total / r.stats.steps;
+		p.speedup = tn > 0 ? n * tbase / tn : 0.0;
+		p.efficiency = p.speedup / n;
+	}
+
+	print_scaling( stdout, points, numpoints );
+	write_scaling_csv( csvname ? csvname : "scaling_results.csv", points, numpoints );
+	write_scaling_json( jsonname ? jsonname : "scaling_results.json", points, numpoints );
+}
+
+
+//! Create the universes of an ensemble, and spawn the scenario in each, with seeds counting up from scenario_seed.
+static void spawn_ensemble( stars_universe_t** universes, int nr, int count )
+{
+	const unsigned int seed = scenario_seed;
+	for ( int u=0; u<numuniverses; ++u )
+	{
+		universes[ u ] = stars_universe_create();
+		stars_universe_select( universes[ u ] );
+		scenario_seed = seed + u;
+		scenario_spawn( nr, count );
+	}
+	scenario_seed = seed;
+	stars_universe_select( 0 );
+}
+
+
+//! Hash of all the stars in the universes, to tell if two runs ended up with the same fields.
+static unsigned long long hash_ensemble( stars_universe_t* const* universes )
+{
+	unsigned long long h = 14695981039346656037ULL;
+	for ( int u=0; u<numuniverses; ++u )
+	{
+		stars_universe_select( universes[ u ] );
+		for ( int cx=0; cx<GRIDRES; ++cx )
+			for ( int cy=0; cy<GRIDRES; ++cy )
+			{
+				const cell_t* cell = stars_cell( cx, cy );
+				const void* arrays[ 5 ] = { cell->px, cell->py, cell->vx, cell->vy, cell->st };
+				for ( int a=0; a<5; ++a )
+				{
+					const unsigned char* b = (const unsigned char*) arrays[ a ];
+					for ( size_t i=0; i<cell->cnt * sizeof( float ); ++i )
+						h = ( h ^ b[ i ] ) * 1099511628211ULL;
+				}
+			}
+	}
+	stars_universe_select( 0 );
+	return h;
+}
+
+
+//! Stars advanced in the universes, summed over the steps since the last reset of their stats. Resets them for the next count.
+static long long ensemble_starsteps( stars_universe_t* const* universes )
+{
+	long long starsteps = 0;
+	for ( int u=0; u<numuniverses; ++u )
+	{
+		stars_universe_select( universes[ u ] );
+		stars_stats_t s;
+		stars_get_stats( &s );
+		starsteps += s.starsteps;
+		stars_reset_stats();
+	}
+	stars_universe_select( 0 );
+	return starsteps;
+}
+
+
+static void free_ensemble( stars_universe_t** universes )
+{
+	for ( int u=0; u<numuniverses; ++u )
+		stars_universe_free( universes[ u ] );
+}
+
+
+//! Many small universes: first each one stepped on its own, with its columns spread over the workers,
+//! then all at once, with each universe stepped whole by a single worker.
+static void run_ensemble( void )
+{
+	const int nr = scenario >= 0 ? scenario : SCENARIO_PLUMMER;
+	const int count = numstars > 0 ? numstars : 2000;
+	numuniverses = numuniverses > 0 ? numuniverses : 4 * numthreads;
+	numuniverses = numuniverses > MAXUNIVERSES ? MAXUNIVERSES : numuniverses;
+	static stars_universe_t* universes[ MAXUNIVERSES ];
+
+	spawn_ensemble( universes, nr, count );
+	for ( int u=0; u<numuniverses; ++u )
+	{
+		stars_universe_select( universes[ u ] );
+		for ( int i=0; i<numwarmup; ++i )
+			stars_update( dt );
+	}
+	ensemble_starsteps( universes );
+	double t0 = wallclock_seconds();
+	for ( int u=0; u<numuniverses; ++u )
+	{
+		stars_universe_select( universes[ u ] );
+		for ( int i=0; i<numsteps; ++i )
+			stars_update( dt );
+	}
+	const double separate = wallclock_seconds() - t0;
+	stars_universe_select( 0 );
+	const long long starsteps = ensemble_starsteps( universes );
+	const unsigned long long separatehash = hash_ensemble( universes );
+	free_ensemble( universes );
+
+	spawn_ensemble( universes, nr, count );
+	stars_ensemble_update( universes, numuniverses, dt, numwarmup );
+	ensemble_starsteps( universes );
+	t0 = wallclock_seconds();
+	stars_ensemble_update( universes, numuniverses, dt, numsteps );
+	const double packed = wallclock_seconds() - t0;
+	const long long packedsteps = ensemble_starsteps( universes );
+	const unsigned long long packedhash = hash_ensemble( universes );
+	free_ensemble( universes );
+
+	fprintf( stdout, "%d universes of %s with %d stars, %d steps on %d threads:\n", numuniverses, scenario_names[ nr ], count, numsteps, numthreads );
+	fprintf( stdout, "%-9s %9.1f ms %10.3g stars/s\n", "separate", 1000.0 * separate, separate > 0 ? starsteps / separate : 0.0 );
+	fprintf( stdout, "%-9s %9.1f ms %10.3g stars/s  %.2fx\n", "ensemble", 1000.0 * packed, packed > 0 ? packedsteps / packed : 0.0, packed > 0 ? separate / packed : 0.0 );
+	fprintf( stdout, "The fields at the end are %s.\n", separatehash == packedhash ? "identical" : "DIFFERENT" );
+}
+
+
+//! Velocity and position of each star in the selected universe, by uid.
+static void stars_by_uid( float* px, float* py, float* vx, float* vy, bool* seen, int maxuid )
+{
+	memset( seen, 0, maxuid * sizeof( bool ) );
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			const cell_t* cell = stars_cell( cx, cy );
+			for ( int i=0; i<cell->cnt; ++i )
+			{
+				const int uid = cell->st[ i ] >> 8;
+				if ( uid < 0 || uid >= maxuid )
+					continue;
+				px[ uid ] = cell->px[ i ];
+				py[ uid ] = cell->py[ i ];
+				vx[ uid ] = cell->vx[ i ];
+				vy[ uid ] = cell->vy[ i ];
+				seen[ uid ] = true;
+			}
+		}
+}
+
+
+//! With an eta that puts every star on the finest level, a block step is a kick-drift-kick step.
+//! Step a universe with each, restarting the block schedule every few steps, as spawning or rewinding does, and compare.
+//! Returns false if they differ by more than rounding.
+static bool run_blockcheck( void )
+{
+	const int nr = scenario >= 0 ? scenario : SCENARIO_PLUMMER;
+	const int count = numstars > 0 ? numstars : 5000;
+	const int restartevery = 8;
+	const int savedintegrator = stars_integrator;
+	const float savedeta = stars_block_eta;
+
+	stars_universe_t* kdk = stars_universe_create();
+	stars_universe_t* block = stars_universe_create();
+	stars_universe_t* both[ 2 ] = { kdk, block };
+	const int integrators[ 2 ] = { INTEGRATOR_KDK, INTEGRATOR_BLOCK };
+	for ( int u=0; u<2; ++u )
+	{
+		stars_universe_select( both[ u ] );
+		scenario_spawn( nr, count );
+	}
+	stars_block_eta = 1e-9f;
+	for ( int i=0; i<numsteps; ++i )
+		for ( int u=0; u<2; ++u )
+		{
+			stars_universe_select( both[ u ] );
+			if ( i % restartevery == 0 )
+			{
+				stars_state_t state;
+				stars_get_state( &state );
+				state.accstale = 1;
+				stars_set_state( &state );
+			}
+			stars_integrator = integrators[ u ];
+			stars_update( dt );
+		}
+	stars_block_eta = savedeta;
+	stars_integrator = savedintegrator;
+
+	stars_state_t state;
+	stars_universe_select( kdk );
+	stars_get_state( &state );
+	const int maxuid = state.numcreated;
+	float* k = (float*) malloc( 8 * maxuid * sizeof( float ) );
+	bool* kseen = (bool*) malloc( 2 * maxuid * sizeof( bool ) );
+	float* b = k + 4 * maxuid;
+	bool* bseen = kseen + maxuid;
+	stars_by_uid( k, k + maxuid, k + 2*maxuid, k + 3*maxuid, kseen, maxuid );
+	stars_universe_select( block );
+	stars_by_uid( b, b + maxuid, b + 2*maxuid, b + 3*maxuid, bseen, maxuid );
+	// The error a restart used to make: a half kick too many.
+	const int n = stars_accelerations( ref_ax, ref_ay, MAXBENCHSTARS );
+	stars_universe_select( 0 );
+
+	float halfkick = 0.0f;
+	for ( int i=0; i<n; ++i )
+	{
+		const float kick = 0.5f * dt * sqrtf( ref_ax[i]*ref_ax[i] + ref_ay[i]*ref_ay[i] );
+		halfkick = kick > halfkick ? kick : halfkick;
+	}
+	float dpos = 0.0f;
+	float dvel = 0.0f;
+	int missing = 0;
+	for ( int uid=0; uid<maxuid; ++uid )
+	{
+		if ( kseen[ uid ] != bseen[ uid ] )
+			missing += 1;
+		if ( !kseen[ uid ] || !bseen[ uid ] )
+			continue;
+		const float dp = fmaxf( fabsf( k[ uid ] - b[ uid ] ), fabsf( k[ maxuid + uid ] - b[ maxuid + uid ] ) );
+		const float dv = fmaxf( fabsf( k[ 2*maxuid + uid ] - b[ 2*maxuid + uid ] ), fabsf( k[ 3*maxuid + uid ] - b[ 3*maxuid + uid ] ) );
+		dpos = dp > dpos ? dp : dpos;
+		dvel = dv > dvel ? dv : dvel;
+	}
+	free( k );
+	free( kseen );
+	stars_universe_free( kdk );
+	stars_universe_free( block );
+
+	const bool ok = !missing && dvel <= 1e-3f * halfkick;
+	fprintf
+	(
+		stdout, "block at eta 1e-9 against kdk, %s with %d stars, %d steps, restarting every %d: max dpos %.3g max dvel %.3g (half kick %.3g), %d missing. %s\n",
+		scenario_names[ nr ], count, numsteps, restartevery, dpos, dvel, halfkick, missing, ok ? "OK" : "FAILED"
+	);
+	return ok;
+}
+
+
+//! Look up a name in a table of names. Returns -1 if it is not there.
+static int find_name( const char* name, const char* const* names, int count )
+{
+	for ( int i=0; i<count; ++i )
+		if ( !strcmp( name, names[ i ] ) )
+			return i;
+	return -1;
+}
+
 
 int main( int argc, char* argv[]  )
 {
 	tt_signin( -1, "mainthread" );
-	const int num = atoi( argv[1] );
-	const bool multithreaded = false;
-	stars_init( multithreaded );
+
+	numthreads = (int) sysconf( _SC_NPROCESSORS_ONLN );
+	for ( int i=1; i<argc; ++i )
+	{
+		const char* a = argv[ i ];
+		bool ok = true;
+		if ( !strncmp( a, "mode=", 5 ) ) mode = a+5;
+		else if ( !strncmp( a, "scenario=", 9 ) )
+		{
+			scenario = scenario_find( a+9 );
+			ok = scenario >= 0 || !strcmp( a+9, "all" );
+		}
+		else if ( !strncmp( a, "stars=", 6 ) ) numstars = atoi( a+6 );
+		else if ( !strncmp( a, "seed=", 5 ) ) scenario_seed = (unsigned int) strtoul( a+5, 0, 10 );
+		else if ( !strncmp( a, "scale=", 6 ) ) { scenario_scale = (float) atof( a+6 ); ok = scenario_scale > 0.0f; }
+		else if ( !strncmp( a, "threads=", 8 ) ) numthreads = atoi( a+8 );
+		else if ( !strncmp( a, "steps=", 6 ) ) numsteps = atoi( a+6 );
+		else if ( !strncmp( a, "warmup=", 7 ) ) numwarmup = atoi( a+7 );
+		else if ( !strncmp( a, "json=", 5 ) ) jsonname = a+5;
+		else if ( !strncmp( a, "csv=", 4 ) ) csvname = a+4;
+		else if ( !strncmp( a, "counters=", 9 ) ) counters = atoi( a+9 ) != 0;
+		else if ( !strncmp( a, "series=", 7 ) ) seriesname = a+7;
+		else if ( !strncmp( a, "metrics=", 8 ) ) metricsaddress = a+8;
+		else if ( !strncmp( a, "universes=", 10 ) ) numuniverses = atoi( a+10 );
+		else if ( !strncmp( a, "tier=", 5 ) )
+		{
+			const int tier = find_name( a+5, forcekernel_tier_names, KERNEL_NUMTIERS );
+			ok = tier >= 0;
+			stars_kernel_tier = ok ? tier : stars_kernel_tier;
+		}
+		else if ( !strncmp( a, "integrator=", 11 ) )
+		{
+			const int integrator = find_name( a+11, stars_integrator_names, INTEGRATOR_NUMMODES );
+			ok = integrator >= 0;
+			stars_integrator = ok ? integrator : stars_integrator;
+		}
+		else ok = false;
+		if ( !ok )
+		{
+			fprintf( stderr, "Bad argument '%s'. See the top of bench.cpp for usage.\n", a );
+			return 1;
+		}
+	}
+	numthreads = numthreads < 1 ? 1 : numthreads;
+
+	stars_init( false );
+	stars_set_threads( numthreads );
 	stars_create();
-	stars_spawn( 30000, 0,0,  0,0,  GRIDRES/2.3, true, true );
-	for ( int i=0; i<num; ++i )
-		stars_update( 1/120.0f );
+
+	int status = 0;
+	if ( counters && !perfcounters_enable( true ) )
+		fprintf( stderr, "Running without hardware performance counters.\n" );
+
+	if ( !strcmp( mode, "tiers" ) )
+		run_tiers();
+	else if ( !strcmp( mode, "integrators" ) )
+		run_integrators();
+	else if ( !strcmp( mode, "forceerror" ) )
+		run_forceerror();
+	else if ( !strcmp( mode, "scenarios" ) )
+	{
+		if ( seriesname )
+			stepseries_open( seriesname );
+		if ( metricsaddress )
+			metrics_listen( metricsaddress );
+		for ( int nr=0; nr<SCENARIO_NUMSCENARIOS; ++nr )
+			if ( scenario < 0 || scenario == nr )
+				run_scenario( nr, numstars, numthreads );
+		print_results( stdout );
+		write_csv( csvname ? csvname : "bench_results.csv" );
+		write_json( jsonname ? jsonname : "bench_results.json" );
+		if ( perfcounters_enabled )
+		{
+			print_counters( stdout );
+			write_counters_csv( "bench_counters.csv" );
+		}
+		stepseries_close();
+		metrics_close();
+	}
+	else if ( !strcmp( mode, "scaling" ) )
+		run_scaling();
+	else if ( !strcmp( mode, "ensemble" ) )
+		run_ensemble();
+	else if ( !strcmp( mode, "blockcheck" ) )
+		status = run_blockcheck() ? 0 : 1;
+	else
+	{
+		fprintf( stderr, "Unknown mode '%s'.\n", mode );
+		return 1;
+	}
+
+	stars_exit();
+	perfcounters_close();
 
 #if defined(linux)
 	tt_report( "bench.json" );
 #endif
 
-	return 0;
+	return status;
 }
-
@@ -0,0 +1,446 @@
+// checkpoint.cpp
+//
+// Saves and restores the whole star field as a binary checkpoint.
+
+#include "checkpoint.h"
+#include "stars.h"
+#include "wallclock.h"
+
+// From GBase
+#include "logx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined( linux )
+#	include <pthread.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#endif
+
+
+int checkpoint_interval = 0;
+
+static const char magic[ 8 ] = { 'N','B','O','D','Y','C','K','P' };
+
+//! Arrays stored per cell, in this order.
+#define NUMARRAYS	8
+
+//! Every cell and every array starts on a boundary of this many bytes.
+#define ALIGNMENT	64
+#define ALIGNUP( X )	( ( (X) + ALIGNMENT-1 ) & ~(uint64_t) ( ALIGNMENT-1 ) )
+
+typedef struct
+{
+	char magic[ 8 ];
+	uint32_t version;
+	uint32_t gridres;
+	uint32_t cellcap;
+	uint32_t numstars;
+	uint64_t filesize;
+	double time;
+	int32_t step;
+	int32_t numcreated;
+	int32_t spawnidx;
+	int32_t integrator;
+	int32_t kerneltier;
+	int32_t blackhole;
+	int32_t blocktick;
+	int32_t accstale;
+} header_t;
+
+typedef struct
+{
+	uint32_t cnt;
+	uint32_t pad;
+	uint64_t offset;	//! from the start of the file.
+} direntry_t;
+
+#define NUMCELLS	( GRIDRES * GRIDRES )
+#define DIRECTORYOFFSET	ALIGNUP( sizeof( header_t ) )
+#define PAYLOADOFFSET	ALIGNUP( DIRECTORYOFFSET + NUMCELLS * sizeof( direntry_t ) )
+
+
+//! Size of the arrays of a cell with cnt stars.
+static uint64_t cell_bytes( int cnt )
+{
+	return NUMARRAYS * ALIGNUP( cnt * sizeof( float ) );
+}
+
+
+//! Copy the field into a buffer with the layout of the file. Returns 0 if out of memory.
+static char* build_image( size_t* sz )
+{
+	uint64_t total = PAYLOADOFFSET;
+	int numstars = 0;
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			const int cnt = stars_cell( cx, cy )->cnt;
+			total += cell_bytes( cnt );
+			numstars += cnt;
+		}
+
+	char* image = (char*) malloc( total );
+	if ( !image )
+		return 0;
+	memset( image, 0, PAYLOADOFFSET );
+
+	stars_state_t state;
+	stars_get_state( &state );
+	header_t* hdr = (header_t*) image;
+	memcpy( hdr->magic, magic, sizeof( magic ) );
+	hdr->version = CHECKPOINT_VERSION;
+	hdr->gridres = GRIDRES;
+	hdr->cellcap = CELLCAP;
+	hdr->numstars = numstars;
+	hdr->filesize = total;
+	hdr->time = state.time;
+	hdr->step = state.step;
+	hdr->numcreated = state.numcreated;
+	hdr->spawnidx = state.spawnidx;
+	hdr->integrator = state.integrator;
+	hdr->kerneltier = state.kerneltier;
+	hdr->blackhole = state.blackhole;
+	hdr->blocktick = state.blocktick;
+	hdr->accstale = state.accstale;
+
+	direntry_t* dir = (direntry_t*) ( image + DIRECTORYOFFSET );
+	uint64_t offset = PAYLOADOFFSET;
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			const cell_t* cell = stars_cell( cx, cy );
+			const int cnt = cell->cnt;
+			direntry_t& entry = dir[ cx * GRIDRES + cy ];
+			entry.cnt = cnt;
+			entry.pad = 0;
+			entry.offset = offset;
+			const void* arrays[ NUMARRAYS ] = { cell->px, cell->py, cell->vx, cell->vy, cell->ax, cell->ay, cell->st, cell->age };
+			const uint64_t stride = ALIGNUP( cnt * sizeof( float ) );
+			for ( int a=0; a<NUMARRAYS; ++a )
+			{
+				char* dst = image + offset + a * stride;
+				memcpy( dst, arrays[ a ], cnt * sizeof( float ) );
+				memset( dst + cnt * sizeof( float ), 0, stride - cnt * sizeof( float ) );
+			}
+			offset += cell_bytes( cnt );
+		}
+	ASSERT( offset == total );
+	*sz = total;
+	return image;
+}
+
+
+//! Write an image under a temporary name, then move it into place.
+static bool write_image( const char* fname, const char* image, size_t sz )
+{
+	char tmpname[ 512 ];
+	snprintf( tmpname, sizeof( tmpname ), "%s.tmp", fname );
+	FILE* f = fopen( tmpname, "wb" );
+	if ( !f )
+	{
+		LOGE( "Cannot write checkpoint %s", tmpname );
+		return false;
+	}
+	const bool ok = fwrite( image, 1, sz, f ) == sz;
+	if ( fclose( f ) != 0 || !ok || rename( tmpname, fname ) != 0 )
+	{
+		LOGE( "Failed to write checkpoint %s", fname );
+		remove( tmpname );
+		return false;
+	}
+	return true;
+}
+
+
+//! Check the header and directory of an image against this build, and against the size of the file.
+static bool validate_image( const char* fname, const char* image, size_t sz )
+{
+	const header_t* hdr = (const header_t*) image;
+	if ( sz < PAYLOADOFFSET || memcmp( hdr->magic, magic, sizeof( magic ) ) )
+	{
+		LOGE( "%s is not a checkpoint.", fname );
+		return false;
+	}
+	if ( hdr->version != CHECKPOINT_VERSION )
+	{
+		LOGE( "Checkpoint %s has version %u, this build reads version %d.", fname, hdr->version, CHECKPOINT_VERSION );
+		return false;
+	}
+	if ( hdr->gridres != GRIDRES || hdr->cellcap > CELLCAP || hdr->filesize != sz )
+	{
+		LOGE( "Checkpoint %s does not match this build: grid %u, cell cap %u, size %llu.", fname, hdr->gridres, hdr->cellcap, (unsigned long long) hdr->filesize );
+		return false;
+	}
+	const direntry_t* dir = (const direntry_t*) ( image + DIRECTORYOFFSET );
+	uint32_t numstars = 0;
+	for ( int i=0; i<NUMCELLS; ++i )
+	{
+		if ( dir[ i ].cnt > CELLCAP || dir[ i ].offset < PAYLOADOFFSET || dir[ i ].offset + cell_bytes( dir[ i ].cnt ) > sz )
+		{
+			LOGE( "Checkpoint %s has a bad entry for cell %d.", fname, i );
+			return false;
+		}
+		numstars += dir[ i ].cnt;
+	}
+	if ( numstars != hdr->numstars )
+	{
+		LOGE( "Checkpoint %s holds %u stars in its cells, but %u in its header.", fname, numstars, hdr->numstars );
+		return false;
+	}
+	return true;
+}
+
+
+//! Replace the field with a validated image.
+static void adopt_image( const char* image )
+{
+	const header_t* hdr = (const header_t*) image;
+	const direntry_t* dir = (const direntry_t*) ( image + DIRECTORYOFFSET );
+	stars_clear();
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			const direntry_t& entry = dir[ cx * GRIDRES + cy ];
+			const int cnt = entry.cnt;
+			const uint64_t stride = ALIGNUP( cnt * sizeof( float ) );
+			const char* base = image + entry.offset;
+			stars_load_cell
+			(
+				cx, cy, cnt,
+				(const float*) ( base + 0*stride ), (const float*) ( base + 1*stride ),
+				(const float*) ( base + 2*stride ), (const float*) ( base + 3*stride ),
+				(const float*) ( base + 4*stride ), (const float*) ( base + 5*stride ),
+				(const int*)   ( base + 6*stride ), (const float*) ( base + 7*stride )
+			);
+		}
+	stars_state_t state;
+	state.numcreated = hdr->numcreated;
+	state.spawnidx = hdr->spawnidx;
+	state.step = hdr->step;
+	state.time = hdr->time;
+	state.integrator = hdr->integrator;
+	state.kerneltier = hdr->kerneltier;
+	state.blackhole = hdr->blackhole;
+	state.blocktick = hdr->blocktick;
+	state.accstale = hdr->accstale;
+	stars_set_state( &state );
+}
+
+
+void checkpoint_after_step( const char* fname )
+{
+	if ( checkpoint_interval <= 0 )
+		return;
+	const int step = stars_get_step_nr();
+	if ( step > 0 && step % checkpoint_interval == 0 )
+		checkpoint_save( fname );
+}
+
+
+#if defined( linux )
+
+// The image that is handed to the writer thread. Guarded by lock.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static pthread_t writer;
+static bool writerstarted = false;
+static bool quit = false;
+static char* pendingimage = 0;
+static size_t pendingsize = 0;
+static char pendingname[ 512 ];
+static int pendingstep = 0;
+
+
+static void* write_loop( void* )
+{
+	pthread_mutex_lock( &lock );
+	while ( true )
+	{
+		while ( !pendingimage && !quit )
+			pthread_cond_wait( &wakeup, &lock );
+		if ( !pendingimage )
+			break;
+		char* image = pendingimage;
+		const size_t sz = pendingsize;
+		const int step = pendingstep;
+		char fname[ 512 ];
+		memcpy( fname, pendingname, sizeof( fname ) );
+		pthread_mutex_unlock( &lock );
+
+		const double t0 = wallclock_seconds();
+		if ( write_image( fname, image, sz ) )
+			LOGI( "Wrote checkpoint of step %d to %s: %.1f MB in %.1f ms.", step, fname, sz / ( 1024.0 * 1024.0 ), 1000 * ( wallclock_seconds() - t0 ) );
+		free( image );
+
+		pthread_mutex_lock( &lock );
+		pendingimage = 0;
+		pthread_cond_broadcast( &done );
+	}
+	pthread_mutex_unlock( &lock );
+	return 0;
+}
+
+
+bool checkpoint_save( const char* fname )
+{
+	pthread_mutex_lock( &lock );
+	const bool busy = pendingimage != 0;
+	pthread_mutex_unlock( &lock );
+	if ( busy )
+	{
+		LOGI( "Skipping checkpoint of step %d: the previous one is still being written.", stars_get_step_nr() );
+		return false;
+	}
+
+	const double t0 = wallclock_seconds();
+	size_t sz = 0;
+	char* image = build_image( &sz );
+	if ( !image )
+	{
+		LOGE( "Out of memory for a checkpoint." );
+		return false;
+	}
+	const double elapsed = wallclock_seconds() - t0;
+
+	pthread_mutex_lock( &lock );
+	if ( !writerstarted )
+	{
+		quit = false;
+		writerstarted = pthread_create( &writer, 0, write_loop, 0 ) == 0;
+	}
+	if ( !writerstarted )
+	{
+		pthread_mutex_unlock( &lock );
+		LOGE( "Cannot start the checkpoint writer, writing on the calling thread." );
+		const bool ok = write_image( fname, image, sz );
+		free( image );
+		return ok;
+	}
+	pendingimage = image;
+	pendingsize = sz;
+	pendingstep = stars_get_step_nr();
+	snprintf( pendingname, sizeof( pendingname ), "%s", fname );
+	pthread_cond_signal( &wakeup );
+	pthread_mutex_unlock( &lock );
+	LOGI( "Took checkpoint of step %d in %.2f ms.", pendingstep, 1000 * elapsed );
+	return true;
+}
+
+
+void checkpoint_wait( void )
+{
+	pthread_mutex_lock( &lock );
+	while ( pendingimage )
+		pthread_cond_wait( &done, &lock );
+	pthread_mutex_unlock( &lock );
+}
+
+
+void checkpoint_exit( void )
+{
+	checkpoint_wait();
+	pthread_mutex_lock( &lock );
+	const bool started = writerstarted;
+	quit = true;
+	pthread_cond_signal( &wakeup );
+	pthread_mutex_unlock( &lock );
+	if ( started )
+		pthread_join( writer, 0 );
+	writerstarted = false;
+}
+
+
+bool checkpoint_load( const char* fname )
+{
+	checkpoint_wait();
+	const int fd = open( fname, O_RDONLY );
+	if ( fd < 0 )
+	{
+		LOGE( "Cannot open checkpoint %s", fname );
+		return false;
+	}
+	struct stat st;
+	if ( fstat( fd, &st ) != 0 || st.st_size < (off_t) PAYLOADOFFSET )
+	{
+		LOGE( "%s is not a checkpoint.", fname );
+		close( fd );
+		return false;
+	}
+	const size_t sz = st.st_size;
+	void* map = mmap( 0, sz, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if ( map == MAP_FAILED )
+	{
+		LOGE( "Cannot map checkpoint %s", fname );
+		return false;
+	}
+	madvise( map, sz, MADV_SEQUENTIAL );
+	const char* image = (const char*) map;
+	const bool ok = validate_image( fname, image, sz );
+	if ( ok )
+	{
+		adopt_image( image );
+		LOGI( "Restored %u stars at step %d from %s", ( (const header_t*) image )->numstars, ( (const header_t*) image )->step, fname );
+	}
+	munmap( map, sz );
+	return ok;
+}
+
+#else
+
+// Without threads, the checkpoint is written on the calling thread.
+
+bool checkpoint_save( const char* fname )
+{
+	size_t sz = 0;
+	char* image = build_image( &sz );
+	if ( !image )
+	{
+		LOGE( "Out of memory for a checkpoint." );
+		return false;
+	}
+	const bool ok = write_image( fname, image, sz );
+	free( image );
+	return ok;
+}
+
+
+void checkpoint_wait( void )
+{
+}
+
+
+void checkpoint_exit( void )
+{
+}
+
+
+bool checkpoint_load( const char* fname )
+{
+	FILE* f = fopen( fname, "rb" );
+	if ( !f )
+	{
+		LOGE( "Cannot open checkpoint %s", fname );
+		return false;
+	}
+	fseek( f, 0, SEEK_END );
+	const long sz = ftell( f );
+	fseek( f, 0, SEEK_SET );
+	char* image = sz > 0 ? (char*) malloc( sz ) : 0;
+	const bool read = image && fread( image, 1, sz, f ) == (size_t) sz;
+	fclose( f );
+	const bool ok = read && validate_image( fname, image, sz );
+	if ( ok )
+		adopt_image( image );
+	free( image );
+	return ok;
+}
+
+#endif
@@ -0,0 +1,37 @@
+// checkpoint.h
+//
+// Saves and restores the whole star field as a binary checkpoint.
+//
+// The file is laid out like the cells in memory, so that a restore maps it and copies each array in one go, without parsing:
+//   a header with the version, grid size and the bookkeeping from stars_get_state(),
+//   a directory of GRIDRES*GRIDRES entries with the star count and file offset of each cell,
+//   then per cell the arrays px, py, vx, vy, ax, ay, st and age, each holding cnt values and starting on a 64 byte boundary.
+// All values are little endian, as written by the machine that runs the simulation.
+//
+// Saving takes a copy of the cells on the calling thread, which is a memcpy per array, and writes it out on a thread of its own.
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#define CHECKPOINT_VERSION	1
+
+//! Save a checkpoint in the background. Returns false if the previous one is still being written, in which case this one is skipped.
+//! The file is written under a temporary name, and renamed when complete, so a crash never leaves a partial checkpoint behind.
+extern bool checkpoint_save( const char* fname );
+
+//! Replace the star field with the contents of a checkpoint. Returns false, and leaves the field alone, if the file is missing or does not match this build.
+extern bool checkpoint_load( const char* fname );
+
+//! Save a checkpoint every this many steps from checkpoint_after_step(). 0 for none.
+extern int checkpoint_interval;
+
+//! Call after each step: saves a checkpoint when the step nr is a multiple of checkpoint_interval.
+extern void checkpoint_after_step( const char* fname );
+
+//! Block until the checkpoint in progress, if any, is written.
+extern void checkpoint_wait( void );
+
+//! Finish writing, and stop the writer thread.
+extern void checkpoint_exit( void );
+
+#endif
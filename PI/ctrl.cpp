@@ -23,6 +23,20 @@ extern "C"
 #include "stars.h"
 #include "cam.h"
 #include "debugdraw.h"
+#include "forcekernel.h"
+#include "diagnostics.h"
+#include "scenarios.h"
+#include "frametimes.h"
+#include "phasetimers.h"
+#include "stepseries.h"
+#include "metrics.h"
+#include "checkpoint.h"
+#include "trajectory.h"
+#include "framepub.h"
+#include "streamserver.h"
+#include "streamclient.h"
+#include "inputlog.h"
+#include "rewind.h"
 
 #if defined(linux)
 #	include "threadtracer.h"
@@ -116,6 +130,16 @@ static void onAspect( const char* m )
 }
 
 
+//! When connected to a stream server, commands that change the stars go there, instead of to the stars shown here.
+static bool forward( const char* m )
+{
+	if ( !streamclient_connected() )
+		return false;
+	streamclient_send( m );
+	return true;
+}
+
+
 static float sprinkle_radius = 0.02f;
 static void onSprinkle( const char* m )
 {
@@ -123,10 +147,19 @@ static void onSprinkle( const char* m )
 	const float y = nfy_flt( m, "y" );
 	const int addrot = nfy_int( m, "addrot" );
 	//const int start = nfy_flt( m, "start" );
-	const float px = cam_pos[0] + x / cam_scl / invaspect;
-	const float py = cam_pos[1] + y / cam_scl;
-	const int cnt = 12;
-	const float rad = sprinkle_radius / cam_scl;
+	// With world=1, x, y and radius are in grid coordinates already, as sent by a stream client.
+	const bool world = nfy_int( m, "world" ) > 0;
+	const float radius = nfy_flt( m, "radius" );
+	const int count = nfy_int( m, "count" );
+	const float px = world ? x : cam_pos[0] + x / cam_scl / invaspect;
+	const float py = world ? y : cam_pos[1] + y / cam_scl;
+	const int cnt = count > MAXSPRINKLE ? MAXSPRINKLE : count > 0 ? count : 12;
+	const float rad = world && radius > 0 ? radius : sprinkle_radius / cam_scl;
+	char cmd[ 160 ];
+	snprintf( cmd, sizeof( cmd ), "sprinkle x=%.9g y=%.9g radius=%.9g addrot=%d count=%d world=1", px, py, rad, addrot > 0 ? 1 : 0, cnt );
+	if ( forward( cmd ) )
+		return;
+	inputlog_record( cmd );
 	stars_sprinkle( cnt, px, py, rad, addrot );
 }
 
@@ -144,6 +177,11 @@ static void onSelect( const char* m )
 	}
 	if ( button == 2 )
 	{
+		char cmd[ 160 ];
+		snprintf( cmd, sizeof( cmd ), "sprinkle x=%.9g y=%.9g radius=%.9g addrot=0 count=1 world=1", px, py, 0.02f );
+		if ( forward( cmd ) )
+			return;
+		inputlog_record( cmd );
 		stars_sprinkle( 1, px, py, 0.02f, false );
 	}
 }
@@ -151,7 +189,11 @@ static void onSelect( const char* m )
 
 static void onClearfield( const char* m )
 {
+	if ( forward( m ) )
+		return;
+	inputlog_record( "clearfield" );
 	stars_clear();
+	rewind_clear();
 }
 
 
@@ -159,8 +201,14 @@ static void onClearcell( const char* m )
 {
 	const float x = nfy_flt( m, "x" );
 	const float y = nfy_flt( m, "y" );
-	const float px = cam_pos[0] + x / cam_scl / invaspect;
-	const float py = cam_pos[1] + y / cam_scl;
+	const bool world = nfy_int( m, "world" ) > 0;
+	const float px = world ? x : cam_pos[0] + x / cam_scl / invaspect;
+	const float py = world ? y : cam_pos[1] + y / cam_scl;
+	char cmd[ 128 ];
+	snprintf( cmd, sizeof( cmd ), "clearcell x=%.9g y=%.9g world=1", px, py );
+	if ( forward( cmd ) )
+		return;
+	inputlog_record( cmd );
 	stars_clear_cell( px, py );
 }
 
@@ -177,22 +225,91 @@ static void onShow( const char* m )
 	const int toggle_grid = nfy_int( m, "toggle_grid" );
 	const int toggle_aggr = nfy_int( m, "toggle_aggr" );
 	const int toggle_help = nfy_int( m, "toggle_help" );
+	const int toggle_timers = nfy_int( m, "toggle_timers" );
+	const int next_cost = nfy_int( m, "next_cost" );
+	const int toggle_owners = nfy_int( m, "toggle_owners" );
 	if ( toggle_grid > 0 ) stars_show_grid = !stars_show_grid;
 	if ( toggle_aggr > 0 ) stars_show_aggr = !stars_show_aggr;
 	if ( toggle_help > 0 ) view_enabled[ VIEWHELP ] = ! view_enabled[ VIEWHELP ];
+	if ( toggle_timers > 0 ) phasetimers_gather = ctrl_show_timers = !ctrl_show_timers;
+	if ( next_cost > 0 )
+	{
+		stars_cost_mode = ( stars_cost_mode + 1 ) % STARS_COST_NUMMODES;
+		LOGI( "Cell cost heatmap: %s", stars_cost_names[ stars_cost_mode ] );
+	}
+	if ( toggle_owners > 0 ) stars_show_owners = !stars_show_owners;
 }
 
 
 static void onBlackhole( const char* m )
 {
+	if ( forward( m ) )
+		return;
 	const int toggle = nfy_int( m, "toggle" );
 	if ( toggle > 0 )
 	{
+		inputlog_record( "blackhole toggle=1" );
 		stars_add_blackhole = !stars_add_blackhole;
 	}
 }
 
 
+static void onKerneltier( const char* m )
+{
+	const int next = nfy_int( m, "next" );
+	const int tier = nfy_int( m, "tier" );
+	if ( tier >= 0 && tier < KERNEL_NUMTIERS )
+		stars_kernel_tier = tier;
+	else if ( next > 0 )
+		stars_kernel_tier = ( stars_kernel_tier + 1 ) % KERNEL_NUMTIERS;
+	char cmd[ 64 ];
+	snprintf( cmd, sizeof( cmd ), "kerneltier tier=%d", stars_kernel_tier );
+	inputlog_record( cmd );
+	LOGI( "Force kernel tier: %s", forcekernel_tier_names[ stars_kernel_tier ] );
+}
+
+
+static void onIntegrator( const char* m )
+{
+	const int next = nfy_int( m, "next" );
+	const int mode = nfy_int( m, "mode" );
+	const float eta = nfy_flt( m, "eta" );
+	if ( eta > 0.0f )
+		stars_block_eta = eta;
+	if ( mode >= 0 && mode < INTEGRATOR_NUMMODES )
+		stars_integrator = mode;
+	else if ( next > 0 )
+		stars_integrator = ( stars_integrator + 1 ) % INTEGRATOR_NUMMODES;
+	char cmd[ 64 ];
+	snprintf( cmd, sizeof( cmd ), "integrator mode=%d eta=%.9g", stars_integrator, stars_block_eta );
+	inputlog_record( cmd );
+	LOGI( "Integrator: %s", stars_integrator_names[ stars_integrator ] );
+}
+
+
+static void onDiagnostics( const char* m )
+{
+	const int toggle = nfy_int( m, "toggle" );
+	const int interval = nfy_int( m, "interval" );
+	if ( interval >= 0 )
+		stars_diagnostics_interval = interval;
+	else if ( toggle > 0 )
+		stars_diagnostics_interval = stars_diagnostics_interval ? 0 : 60;
+	if ( stars_diagnostics_interval )
+	{
+		static bool csvopened = false;
+		if ( !csvopened )
+		{
+			char fname[256];
+			snprintf( fname, sizeof(fname), "%s/diagnostics.csv", ctrl_filesPath );
+			csvopened = diagnostics_open_csv( fname );
+		}
+	}
+	diagnostics_reset();
+	LOGI( "Diagnostics every %d steps.", stars_diagnostics_interval );
+}
+
+
 static void onHuemapping( const char* m )
 {
 	stars_next_hue_mapping();
@@ -201,12 +318,69 @@ static void onHuemapping( const char* m )
 
 static void onSpawndemo( const char* m )
 {
-	const int nr = nfy_int( m, "nr" );
-	stars_clear();
-	if ( nr == 0)
+	if ( forward( m ) )
+		return;
+	static int lastnr = SCENARIO_DEMO;
+	int nr = nfy_int( m, "nr" );
+	// This may come from a stream client, which is not trusted with the size of the field.
+	const int stars = nfy_int( m, "stars" );
+	const int numstars = stars > MAXSTARS ? MAXSTARS : stars;
+	const int next = nfy_int( m, "next" );
+	// The seed is unsigned, and 0 is a seed too: only its absence keeps the current one.
+	char seed[ 16 ] = "";
+	nfy_str( m, "seed", seed, sizeof( seed )-1 );
+	if ( seed[ 0 ] )
+		scenario_seed = (unsigned int) strtoul( seed, 0, 10 );
+	if ( next > 0 )
+		nr = ( lastnr + 1 ) % SCENARIO_NUMSCENARIOS;
+	if ( nr >= 0 && nr < SCENARIO_NUMSCENARIOS )
+	{
+		char cmd[ 96 ];
+		snprintf( cmd, sizeof( cmd ), "spawndemo nr=%d stars=%d seed=%u", nr, numstars > 0 ? numstars : 0, scenario_seed );
+		inputlog_record( cmd );
+		scenario_spawn( nr, numstars );
+		lastnr = nr;
+	}
+	else
+	{
+		inputlog_record( "clearfield" );
+		stars_clear();
+	}
+	rewind_clear();
+}
+
+
+//! Where checkpoints are saved from, and restored to, in the game.
+const char* ctrl_checkpoint_name( void )
+{
+	static char fname[256];
+	snprintf( fname, sizeof(fname), "%s/checkpoint.nbc", ctrl_filesPath );
+	return fname;
+}
+
+
+static void onCheckpoint( const char* m )
+{
+	const int save = nfy_int( m, "save" );
+	const int load = nfy_int( m, "load" );
+	const int interval = nfy_int( m, "interval" );
+	if ( interval >= 0 )
+	{
+		checkpoint_interval = interval;
+		LOGI( "Checkpoint every %d steps.", checkpoint_interval );
+	}
+	if ( save > 0 )
+		checkpoint_save( ctrl_checkpoint_name() );
+	if ( load > 0 && checkpoint_load( ctrl_checkpoint_name() ) )
 	{
-		stars_add_blackhole = true;
-		stars_spawn( 30000, 0,0,  0,0,  GRIDRES/2.3, true, true );
+		diagnostics_reset();
+		rewind_clear();
+		// The restored stars are not in the input log.
+		if ( inputlog_is_open() )
+		{
+			LOGI( "Restoring a checkpoint ends the input recording." );
+			inputlog_close();
+		}
 	}
 }
 
@@ -219,8 +393,127 @@ static void onSplatradius( const char* m )
 }
 
 
+static void onFrametimes( const char* m )
+{
+	const float budget = nfy_flt( m, "budget" );
+	const int reset = nfy_int( m, "reset" );
+	if ( budget > 0.0f )
+		frametimes_budget = 0.001f * budget;
+	if ( reset > 0 )
+		frametimes_reset();
+	LOGI( "Frame budget: %.1f ms.", 1000 * frametimes_budget );
+}
+
+
+static void onStepseries( const char* m )
+{
+	const int toggle = nfy_int( m, "toggle" );
+	if ( toggle <= 0 )
+		return;
+	if ( stepseries_is_open() )
+	{
+		stepseries_close();
+		LOGI( "Stopped recording the step series." );
+		return;
+	}
+	char fname[256];
+	snprintf( fname, sizeof(fname), "%s/stepseries.csv", ctrl_filesPath );
+	if ( stepseries_open( fname ) )
+		LOGI( "Recording the step series to %s", fname );
+}
+
+
+static void onTrajectory( const char* m )
+{
+	const int toggle = nfy_int( m, "toggle" );
+	const int interval = nfy_int( m, "interval" );
+	if ( interval > 0 )
+		trajectory_interval = interval;
+	if ( toggle <= 0 )
+		return;
+	if ( trajectory_is_open() )
+	{
+		trajectory_close();
+		return;
+	}
+	char fname[256];
+	snprintf( fname, sizeof(fname), "%s/trajectory.nbt", ctrl_filesPath );
+	trajectory_open( fname );
+}
+
+
+static void onFramering( const char* m )
+{
+	const int toggle = nfy_int( m, "toggle" );
+	const int interval = nfy_int( m, "interval" );
+	const int capacity = nfy_int( m, "stars" );
+	if ( interval > 0 )
+		framepub_interval = interval;
+	if ( toggle <= 0 )
+		return;
+	if ( framepub_is_open() )
+	{
+		framepub_close();
+		return;
+	}
+	if ( framepub_open( "/nbody", capacity > 0 ? capacity : 0 ) )
+		framepub_publish();
+}
+
+
+static void onInputlog( const char* m )
+{
+	const int toggle = nfy_int( m, "toggle" );
+	if ( toggle <= 0 )
+		return;
+	if ( inputlog_is_open() )
+	{
+		inputlog_close();
+		return;
+	}
+	char fname[256];
+	snprintf( fname, sizeof(fname), "%s/session.nbr", ctrl_filesPath );
+	inputlog_open( fname, 1 / 120.0f );
+}
+
+
+static void onRewind( const char* m )
+{
+	const int toggle = nfy_int( m, "toggle" );
+	const int interval = nfy_int( m, "interval" );
+	const int budget = nfy_int( m, "budget" );
+	const float seconds = nfy_flt( m, "seconds" );
+	const float back = nfy_flt( m, "back" );
+	if ( interval > 0 )
+		rewind_interval = interval;
+	if ( budget > 0 )
+		rewind_budget = budget;
+	if ( seconds > 0.0f )
+		rewind_seconds = seconds;
+	if ( toggle > 0 )
+	{
+		if ( rewind_is_open() )
+			rewind_close();
+		else
+			rewind_open();
+	}
+	// A thin client shows the stars of the server, which has a history of its own.
+	if ( back > 0.0f && !streamclient_connected() && rewind_back( back ) )
+	{
+		diagnostics_reset();
+		if ( inputlog_is_open() )
+		{
+			LOGI( "Rewinding ends the input recording." );
+			inputlog_close();
+		}
+	}
+}
+
+
 static void onPause( const char* m )
 {
+	if ( forward( m ) )
+		return;
 	const int toggle = nfy_int( m, "toggle" );
 	if ( toggle > 0 )
 		ctrl_paused = !ctrl_paused;
@@ -260,9 +553,19 @@ static void ctrl_init( void )
 	nfy_obs_add( "show", onShow );
 	nfy_obs_add( "blackhole", onBlackhole );
 	nfy_obs_add( "huemapping", onHuemapping );
+	nfy_obs_add( "kerneltier", onKerneltier );
+	nfy_obs_add( "integrator", onIntegrator );
+	nfy_obs_add( "diagnostics", onDiagnostics );
 	nfy_obs_add( "spawndemo", onSpawndemo );
 	nfy_obs_add( "splatradius", onSplatradius );
 	nfy_obs_add( "pause", onPause );
+	nfy_obs_add( "frametimes", onFrametimes );
+	nfy_obs_add( "stepseries", onStepseries );
+	nfy_obs_add( "checkpoint", onCheckpoint );
+	nfy_obs_add( "trajectory", onTrajectory );
+	nfy_obs_add( "framering", onFramering );
+	nfy_obs_add( "inputlog", onInputlog );
+	nfy_obs_add( "rewind", onRewind );
 
 	kv_init( ctrl_configPath );
 
@@ -363,7 +666,19 @@ void ctrl_destroy( void )
 
 void ctrl_exit( void )
 {
+	inputlog_close();
+	rewind_close();
+	checkpoint_exit();
+	trajectory_close();
+	framepub_close();
+	streamserver_close();
+	streamclient_close();
 	stars_exit();
+	diagnostics_close_csv();
+	stepseries_close();
+	metrics_close();
+	frametimes_print( stdout );
+	frametimes_write_summary( "frametimes.json" );
 #if defined(linux)
 	tt_report( "threadtracer.json" );
 #endif
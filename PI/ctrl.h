@@ -52,6 +52,9 @@ extern bool ctrl_leaderboardRequested;
 extern bool ctrl_achievementRequested;
 extern bool ctrl_signinoutRequested;
 extern bool ctrl_paused;
+extern bool ctrl_show_timers;
+
+extern const char* ctrl_checkpoint_name( void );
 
 
 // internal
@@ -34,6 +34,18 @@ extern "C"
 //From  PI
 #include "text.h"
 #include "stars.h"
+#include "diagnostics.h"
+#include "phasetimers.h"
+#include "frametimes.h"
+#include "stepseries.h"
+#include "metrics.h"
+#include "checkpoint.h"
+#include "trajectory.h"
+#include "framepub.h"
+#include "streamserver.h"
+#include "streamclient.h"
+#include "rewind.h"
+#include "wallclock.h"
 //#include "space.h"
 #include "cam.h"
 
@@ -56,6 +68,8 @@ static rendercontext_t renderContext;
 
 bool ctrl_paused = false;
 
+bool ctrl_show_timers = false;
+
 #define NUMQ 0
 #if NUMQ
 static GLuint queryID[2][NUMQ];
@@ -214,10 +228,18 @@ static float period = 1/60.0f;
 
 void ctrl_simulate( void )
 {
+	// The previous frame ended with its swap.
+	static bool firstframe = true;
+	if ( !firstframe )
+		frametimes_end_frame();
+	firstframe = false;
+	const double t0 = wallclock_seconds();
+
 	debugdraw_clear();
 
-	// Handle the queued notification messages.
+	// Handle the queued notification messages, and the commands of stream clients.
 	nfy_process_queue();
+	streamserver_process_commands();
 
 	// calculate dt
 	static double last = 0.001 * elapsed_ms_since_start();
@@ -240,15 +262,46 @@ void ctrl_simulate( void )
 
 	sticksignal_update( dt, numsteps );
 
-	for (  int i=0; i<numsteps; ++i )
-		if ( !ctrl_paused )
-			stars_update( dt );
+	stars_stats_t before;
+	stars_get_stats( &before );
+
+	// As a thin client, the stars are stepped by the stream server, and only shown here.
+	if ( streamclient_connected() )
+		streamclient_adopt();
+	else
+		for (  int i=0; i<numsteps; ++i )
+			if ( !ctrl_paused )
+			{
+				stars_update( dt );
+				stepseries_record( "gui" );
+				checkpoint_after_step( ctrl_checkpoint_name() );
+				trajectory_after_step();
+				framepub_after_step();
+				streamserver_after_step();
+				rewind_after_step();
+				// A step may have taken a sample, and the next would overwrite it.
+				stars_diagnostics_t diag;
+				if ( stars_diagnostics( &diag ) )
+					diagnostics_record( &diag );
+			}
+
+	stars_stats_t after;
+	stars_get_stats( &after );
+	frametimes_note( after.steps - before.steps, stars_total_count(), after.crossings - before.crossings );
+	if ( metrics_enabled )
+		metrics_publish();
+
+	if ( stars_cost_mode )
+		stars_draw_cost();
+
+	frametimes_record( FRAMETIME_SIMULATE, wallclock_seconds() - t0 );
 }
 
 
 const char* ctrl_drawFrame( void )
 {
 	TT_SCOPE( "ctrl_drawFrame" );
+	const double t0 = wallclock_seconds();
 	view_update( period );
 
 	glFrontFace( GL_CCW );
@@ -339,6 +392,9 @@ const char* ctrl_drawFrame( void )
 		help_draw();
 	}
 
+	// The phase timers always run, draining them keeps the rings from overflowing.
+	phasetimers_collect();
+
 	// Draw FPS
 	USEVIEW( VIEWMAIN );
 	char str[32];
@@ -347,8 +403,16 @@ const char* ctrl_drawFrame( void )
 	text_draw_string( str, vec3_t(1,-1,0), vec3_t(0.023, 0.04, 0.0 ), "right", "bottom", -1 );
 	snprintf( str, sizeof(str), "%d", stars_total_count() );
 	text_draw_string( str, vec3_t(-1,-1,0), vec3_t(0.024, 0.04, 0.0 ), "left", "bottom", -1 );
+	if ( stars_diagnostics_interval )
+		text_draw_string( diagnostics_summary(), vec3_t(-1,1,0), vec3_t(0.016, 0.03, 0.0 ), "left", "top", -1 );
+	if ( ctrl_show_timers )
+	{
+		text_draw_string( phasetimers_phase_summary(), vec3_t(-1,0.92f,0), vec3_t(0.016, 0.03, 0.0 ), "left", "top", -1 );
+		text_draw_string( phasetimers_busy_summary(), vec3_t(-1,0.86f,0), vec3_t(0.016, 0.03, 0.0 ), "left", "top", -1 );
+	}
 	CHECK_OGL
 	POPGROUPMARKER
+	frametimes_record( FRAMETIME_DRAW, wallclock_seconds() - t0 );
 	return 0;
 }
 
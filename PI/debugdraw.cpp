@@ -9,11 +9,47 @@
 #include "checkogl.h"
 #include "glpr.h"
 
+#include <string.h>
+
 
 static const int maxv = 32768;
 static int numv = 0;
 static float vdata[ maxv ][ 2 ];
 
+typedef struct
+{
+	float x0, y0, x1, y1;
+	int colour;
+} fill_t;
+
+static const int maxfills = 4096;
+static int numfills = 0;
+static fill_t fills[ maxfills ];
+static float filldata[ 6*maxfills ][ 2 ];
+
+//! Kept dim, as they blend additively with the stars.
+static const float palette[ DEBUGDRAW_NUMCOLOURS ][ 3 ] =
+{
+	// heat
+	{ 0.00f, 0.02f, 0.20f },
+	{ 0.00f, 0.10f, 0.25f },
+	{ 0.00f, 0.20f, 0.15f },
+	{ 0.05f, 0.25f, 0.00f },
+	{ 0.20f, 0.25f, 0.00f },
+	{ 0.30f, 0.18f, 0.00f },
+	{ 0.35f, 0.08f, 0.00f },
+	{ 0.45f, 0.00f, 0.00f },
+	// workers
+	{ 0.40f, 0.00f, 0.00f },
+	{ 0.00f, 0.40f, 0.00f },
+	{ 0.00f, 0.00f, 0.50f },
+	{ 0.40f, 0.40f, 0.00f },
+	{ 0.40f, 0.00f, 0.40f },
+	{ 0.00f, 0.40f, 0.40f },
+	{ 0.40f, 0.20f, 0.00f },
+	{ 0.30f, 0.30f, 0.30f },
+};
+
 void debugdraw_init(void)
 {
 	debugdraw_clear();
@@ -23,6 +59,7 @@ void debugdraw_init(void)
 void debugdraw_clear(void)
 {
 	numv = 0;
+	numfills = 0;
 }
 
 
@@ -40,6 +77,20 @@ void debugdraw_line( float frx, float fry, float tox, float toy )
 }
 
 
+void debugdraw_fill( float x0, float y0, float x1, float y1, int colour )
+{
+	if ( numfills < maxfills )
+	{
+		fill_t& f = fills[ numfills++ ];
+		f.x0 = x0;
+		f.y0 = y0;
+		f.x1 = x1;
+		f.y1 = y1;
+		f.colour = colour < 0 ? 0 : colour % DEBUGDRAW_NUMCOLOURS;
+	}
+}
+
+
 void debugdraw_rect( float x0, float y0, float x1, float y1 )
 {
 	debugdraw_line( x0, y0, x1, y0 );
@@ -99,8 +150,67 @@ void debugdraw_arrow( float frx, float fry, float tox, float toy )
 }
 
 
+//! Draw the filled rectangles, one batch per colour, with the colour uniform of the current program.
+static void debugdraw_draw_fills( void )
+{
+	static int colourUniform = glpr_uniform( "colour" );
+
+	// Sort the triangles by colour.
+	int first[ DEBUGDRAW_NUMCOLOURS+1 ];
+	int writer = 0;
+	for ( int c=0; c<DEBUGDRAW_NUMCOLOURS; ++c )
+	{
+		first[ c ] = writer;
+		for ( int i=0; i<numfills; ++i )
+		{
+			const fill_t& f = fills[ i ];
+			if ( f.colour != c )
+				continue;
+			const float v[6][2] =
+			{
+				{ f.x0, f.y0 }, { f.x1, f.y0 }, { f.x1, f.y1 },
+				{ f.x0, f.y0 }, { f.x1, f.y1 }, { f.x0, f.y1 },
+			};
+			memcpy( filldata + writer, v, sizeof( v ) );
+			writer += 6;
+		}
+	}
+	first[ DEBUGDRAW_NUMCOLOURS ] = writer;
+
+	GLuint vao=0;
+	GLuint vbo=0;
+	glGenVertexArrays( 1, &vao );
+	glBindVertexArray( vao );
+	glGenBuffers( 1, &vbo );
+	glBindBuffer( GL_ARRAY_BUFFER, vbo );
+	glBufferData( GL_ARRAY_BUFFER, writer*2*sizeof(float), (void*)filldata, GL_STREAM_DRAW );
+	glVertexAttribPointer( ATTRIB_VERTEX, 2, GL_FLOAT, 0, 2 * sizeof(float), (void*) 0 /* offset in vbo */ );
+	glEnableVertexAttribArray( ATTRIB_VERTEX );
+	CHECK_OGL
+
+	for ( int c=0; c<DEBUGDRAW_NUMCOLOURS; ++c )
+	{
+		const int cnt = first[ c+1 ] - first[ c ];
+		if ( !cnt )
+			continue;
+		glUniform4f( colourUniform, palette[ c ][ 0 ], palette[ c ][ 1 ], palette[ c ][ 2 ], 1 );
+		glDrawArrays( GL_TRIANGLES, first[ c ], cnt );
+	}
+	glUniform4f( colourUniform, 1,1,0,1 );
+
+	glBindVertexArray( 0 );
+	glBindBuffer( GL_ARRAY_BUFFER, 0 );
+	glDeleteBuffers( 1, &vbo );
+	glDeleteVertexArrays( 1, &vao );
+	CHECK_OGL
+}
+
+
 void debugdraw_draw( void )
 {
+	if ( numfills )
+		debugdraw_draw_fills();
+
 	if ( !numv ) return;
 
 	GLuint vao=0;
@@ -25,5 +25,13 @@ extern void debugdraw_angle( float px, float py, float dx, float dy, float ang,
 
 extern bool debugdraw_fat_arrow( float frx, float fry, float tox, float toy, float width );
 
+// Filled rectangles are drawn underneath the lines, in one of these colours.
+// First a ramp from cold to hot, then colours that tell worker threads apart.
+#define DEBUGDRAW_HEATCOLOURS		8
+#define DEBUGDRAW_WORKERCOLOURS		8
+#define DEBUGDRAW_NUMCOLOURS		( DEBUGDRAW_HEATCOLOURS + DEBUGDRAW_WORKERCOLOURS )
+
+extern void debugdraw_fill( float x0, float y0, float x1, float y1, int colour );
+
 #endif
 
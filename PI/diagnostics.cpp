@@ -0,0 +1,102 @@
+// diagnostics.cpp
+//
+// Reports the energy and momentum diagnostics from the simulation to the log, a CSV file and the HUD.
+
+#include "diagnostics.h"
+
+// From GBase
+#include "logx.h"
+
+#include <math.h>
+#include <stdio.h>
+
+
+static FILE* csv = 0;
+
+static bool havereference = false;
+static stars_diagnostics_t reference;
+
+static bool havelatest = false;
+static stars_diagnostics_t latest;
+
+static char summary[ 128 ];
+
+
+bool diagnostics_open_csv( const char* fname )
+{
+	diagnostics_close_csv();
+	csv = fopen( fname, "w" );
+	if ( !csv )
+	{
+		LOGE( "Cannot write diagnostics to %s", fname );
+		return false;
+	}
+	fprintf( csv, "step,time,stars,kinetic,potential,total,drift,px,py,angular\n" );
+	return true;
+}
+
+
+void diagnostics_close_csv( void )
+{
+	if ( csv )
+		fclose( csv );
+	csv = 0;
+}
+
+
+void diagnostics_reset( void )
+{
+	havereference = false;
+	havelatest = false;
+	summary[ 0 ] = 0;
+}
+
+
+double diagnostics_energy_drift( void )
+{
+	if ( !havereference || !havelatest )
+		return 0.0;
+	const double e0 = reference.kinetic + reference.potential;
+	const double e1 = latest.kinetic + latest.potential;
+	return e0 != 0.0 ? ( e1 - e0 ) / fabs( e0 ) : 0.0;
+}
+
+
+void diagnostics_record( const stars_diagnostics_t* d )
+{
+	if ( !havereference || reference.numstars != d->numstars )
+	{
+		reference = *d;
+		havereference = true;
+	}
+	latest = *d;
+	havelatest = true;
+
+	const double total = d->kinetic + d->potential;
+	const double drift = diagnostics_energy_drift();
+	LOGI
+	(
+		"step %d: %d stars, E %.6g (K %.6g U %.6g) drift %.3e, P %.3e,%.3e L %.6g",
+		d->step, d->numstars, total, d->kinetic, d->potential, drift, d->momentum[0], d->momentum[1], d->angular
+	);
+	if ( csv )
+	{
+		fprintf
+		(
+			csv, "%d,%.6f,%d,%.9g,%.9g,%.9g,%.6e,%.6e,%.6e,%.9g\n",
+			d->step, d->time, d->numstars, d->kinetic, d->potential, total, drift, d->momentum[0], d->momentum[1], d->angular
+		);
+		fflush( csv );
+	}
+	snprintf
+	(
+		summary, sizeof(summary), "E %.5g dE %+.1e P %.1e,%.1e L %.5g",
+		total, drift, d->momentum[0], d->momentum[1], d->angular
+	);
+}
+
+
+const char* diagnostics_summary( void )
+{
+	return summary;
+}
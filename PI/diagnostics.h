@@ -0,0 +1,28 @@
+// diagnostics.h
+//
+// Reports the energy and momentum diagnostics from the simulation to the log, a CSV file and the HUD.
+
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include "stars.h"
+
+//! Start writing every sample to a CSV file.
+extern bool diagnostics_open_csv( const char* fname );
+
+//! Stop writing the CSV file.
+extern void diagnostics_close_csv( void );
+
+//! Report a sample from stars_diagnostics(). The first sample, and every sample after the star count changed, becomes the reference for the drift.
+extern void diagnostics_record( const stars_diagnostics_t* d );
+
+//! Forget the reference sample, and the latest sample.
+extern void diagnostics_reset( void );
+
+//! Relative drift of the total energy since the reference sample.
+extern double diagnostics_energy_drift( void );
+
+//! One line summary of the latest sample, for the HUD. Empty if we have no samples.
+extern const char* diagnostics_summary( void );
+
+#endif
@@ -0,0 +1,182 @@
+// forceerror.cpp
+//
+// Runs the aggregated solver and the direct reference solver on the same star field,
+// and reports the relative errors overall, per aggregation level and per cell density.
+
+#include "forceerror.h"
+#include "wallclock.h"
+
+// From GBase
+#include "logx.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+const int forceerror_density_bounds[ FORCEERROR_NUMDENSITYBINS ] =
+{
+	16,
+	32,
+	64,
+	128,
+	256,
+	1024,
+	CELLCAP+1,
+};
+
+
+static int compare_floats( const void* a, const void* b )
+{
+	const float fa = *(const float*) a;
+	const float fb = *(const float*) b;
+	return fa < fb ? -1 : ( fa > fb ? 1 : 0 );
+}
+
+
+//! Summarize errors. Sorts the array in place.
+static errorstats_t summarize( float* errs, int cnt )
+{
+	errorstats_t es;
+	memset( &es, 0, sizeof(es) );
+	es.count = cnt;
+	if ( !cnt )
+		return es;
+	double sum = 0.0;
+	for ( int i=0; i<cnt; ++i )
+		sum += errs[i] * (double) errs[i];
+	qsort( errs, cnt, sizeof(float), compare_floats );
+	es.rms = (float) sqrt( sum / cnt );
+	es.max = errs[ cnt-1 ];
+	es.p50 = errs[ ( cnt-1 ) * 50 / 100 ];
+	es.p90 = errs[ ( cnt-1 ) * 90 / 100 ];
+	es.p99 = errs[ ( cnt-1 ) * 99 / 100 ];
+	return es;
+}
+
+
+static float relative_error( float ax, float ay, float rx, float ry, float refmagn )
+{
+	const float dx = ax - rx;
+	const float dy = ay - ry;
+	return refmagn > 0 ? sqrtf( dx*dx + dy*dy ) / refmagn : 0.0f;
+}
+
+
+bool forceerror_measure( forceerror_t* fe )
+{
+	memset( fe, 0, sizeof(*fe) );
+	const int n = stars_total_count();
+	if ( !n )
+		return false;
+
+	const int numlevels = 1+NUMDIMS;
+	float* app_ax = (float*) malloc( n * sizeof(float) );
+	float* app_ay = (float*) malloc( n * sizeof(float) );
+	float* ref_ax = (float*) malloc( n * sizeof(float) );
+	float* ref_ay = (float*) malloc( n * sizeof(float) );
+	float* app_lx = (float*) malloc( n * numlevels * sizeof(float) );
+	float* app_ly = (float*) malloc( n * numlevels * sizeof(float) );
+	float* ref_lx = (float*) malloc( n * numlevels * sizeof(float) );
+	float* ref_ly = (float*) malloc( n * numlevels * sizeof(float) );
+	float* errs   = (float*) malloc( n * sizeof(float) );
+	float* binned = (float*) malloc( n * sizeof(float) );
+	int*   bins   = (int*)   malloc( n * sizeof(int) );
+	ASSERT( app_ax && app_ay && ref_ax && ref_ay && app_lx && app_ly && ref_lx && ref_ly && errs && binned && bins );
+
+	double t0 = wallclock_seconds();
+	stars_accelerations( app_ax, app_ay, n );
+	fe->solver_seconds = wallclock_seconds() - t0;
+
+	t0 = wallclock_seconds();
+	stars_reference_accelerations( ref_ax, ref_ay, n );
+	fe->reference_seconds = wallclock_seconds() - t0;
+
+	stars_level_accelerations( false, app_lx, app_ly, n );
+	stars_level_accelerations( true,  ref_lx, ref_ly, n );
+
+	// Density bin for each star, in the same cell order as the solvers write them.
+	int writer = 0;
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			const int cnt = stars_cell( cx, cy )->cnt;
+			int bin = 0;
+			while ( bin < FORCEERROR_NUMDENSITYBINS-1 && cnt >= forceerror_density_bounds[ bin ] )
+				bin++;
+			for ( int i=0; i<cnt; ++i )
+				bins[ writer++ ] = bin;
+		}
+	ASSERT( writer == n );
+
+	for ( int i=0; i<n; ++i )
+	{
+		const float magn = sqrtf( ref_ax[i]*ref_ax[i] + ref_ay[i]*ref_ay[i] );
+		errs[i] = relative_error( app_ax[i], app_ay[i], ref_ax[i], ref_ay[i], magn );
+	}
+
+	for ( int b=0; b<FORCEERROR_NUMDENSITYBINS; ++b )
+	{
+		int cnt = 0;
+		for ( int i=0; i<n; ++i )
+			if ( bins[i] == b )
+				binned[ cnt++ ] = errs[i];
+		fe->density[ b ] = summarize( binned, cnt );
+	}
+
+	for ( int l=0; l<numlevels; ++l )
+	{
+		for ( int i=0; i<n; ++i )
+		{
+			const float magn = sqrtf( ref_ax[i]*ref_ax[i] + ref_ay[i]*ref_ay[i] );
+			const int j = i*numlevels + l;
+			binned[i] = relative_error( app_lx[j], app_ly[j], ref_lx[j], ref_ly[j], magn );
+		}
+		fe->level[ l ] = summarize( binned, n );
+	}
+
+	fe->total = summarize( errs, n );
+	fe->numstars = n;
+
+	free( app_ax ); free( app_ay );
+	free( ref_ax ); free( ref_ay );
+	free( app_lx ); free( app_ly );
+	free( ref_lx ); free( ref_ly );
+	free( errs );
+	free( binned );
+	free( bins );
+	return true;
+}
+
+
+static void print_stats( FILE* f, const char* label, const errorstats_t& es )
+{
+	fprintf
+	(
+		f, "  %-18s %7d  rms %9.3g  max %9.3g  p50 %9.3g  p90 %9.3g  p99 %9.3g\n",
+		label, es.count, es.rms, es.max, es.p50, es.p90, es.p99
+	);
+}
+
+
+void forceerror_print( FILE* f, const forceerror_t* fe )
+{
+	fprintf( f, "Force error of the aggregated solver, %d stars (solver %.3fs, reference %.3fs):\n", fe->numstars, fe->solver_seconds, fe->reference_seconds );
+	print_stats( f, "total", fe->total );
+	fprintf( f, " by contribution level (relative to the total force):\n" );
+	for ( int l=0; l<=NUMDIMS; ++l )
+	{
+		char label[32];
+		snprintf( label, sizeof(label), "level %d (%dx%d)", l, cell_sizes[ l ], cell_sizes[ l ] );
+		print_stats( f, l ? label : "level 0 (stars)", fe->level[ l ] );
+	}
+	fprintf( f, " by cell density:\n" );
+	int lo = 0;
+	for ( int b=0; b<FORCEERROR_NUMDENSITYBINS; ++b )
+	{
+		char label[32];
+		snprintf( label, sizeof(label), "%d..%d stars", lo, forceerror_density_bounds[ b ]-1 );
+		print_stats( f, label, fe->density[ b ] );
+		lo = forceerror_density_bounds[ b ];
+	}
+}
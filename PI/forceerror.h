@@ -0,0 +1,44 @@
+// forceerror.h
+//
+// Measures how far the aggregated force solver drifts from exact pairwise gravity.
+
+#ifndef FORCEERROR_H
+#define FORCEERROR_H
+
+#include "stars.h"
+
+#include <stdio.h>
+
+#define FORCEERROR_NUMDENSITYBINS	7
+
+//! Relative force errors over a group of stars.
+typedef struct
+{
+	int count;
+	float rms;
+	float max;
+	float p50;
+	float p90;
+	float p99;
+} errorstats_t;
+
+typedef struct
+{
+	int numstars;
+	errorstats_t total;					//! approximate solver against reference solver.
+	errorstats_t level[ 1+NUMDIMS ];			//! per contribution level, relative to the exact total force.
+	errorstats_t density[ FORCEERROR_NUMDENSITYBINS ];	//! total error, for stars binned by the star count of their cell.
+	double solver_seconds;					//! time spent in the approximate solver.
+	double reference_seconds;				//! time spent in the reference solver.
+} forceerror_t;
+
+//! Upper bounds (exclusive) of the cell star counts for the density bins.
+extern const int forceerror_density_bounds[ FORCEERROR_NUMDENSITYBINS ];
+
+//! Compare the approximate solver against the reference solver, for the current star field.
+extern bool forceerror_measure( forceerror_t* fe );
+
+//! Write a human readable report.
+extern void forceerror_print( FILE* f, const forceerror_t* fe );
+
+#endif
@@ -0,0 +1,287 @@
+// forcekernel.h
+//
+// The inner loop of the gravity solver: sums the pull of a batch of sources on a single star.
+// Every variant returns the sum of scl * d / |d|^3 over all sources; the caller scales by G.
+// The SIMD variants expect source arrays that are 64-byte aligned and padded with zero-mass
+// sources to a multiple of their lane count.
+
+#ifndef FORCEKERNEL_H
+#define FORCEKERNEL_H
+
+#include <math.h>
+#include <immintrin.h>
+
+//! Accuracy tiers for the reciprocal square root in the force kernel.
+enum
+{
+	KERNEL_APPROX,		// raw hardware estimate (rsqrt: 12 bits, rsqrt14: 14 bits.)
+	KERNEL_NEWTON,		// hardware estimate, refined with one Newton-Raphson step.
+	KERNEL_PRECISE,		// full precision square root and division.
+	KERNEL_NUMTIERS
+};
+
+static const char* const forcekernel_tier_names[ KERNEL_NUMTIERS ] =
+{
+	"approx",
+	"newton",
+	"precise",
+};
+
+//! Closest distance at which we evaluate gravity: stops a star from pulling on itself.
+#define FORCEKERNEL_MINDIST	1e-2f
+#define FORCEKERNEL_MINDSQR	( FORCEKERNEL_MINDIST * FORCEKERNEL_MINDIST )
+
+//! Convenience struct, so we can return two floats from a function that sums forces.
+typedef struct
+{
+	float x;
+	float y;
+} force_t;
+
+
+template <int TIER>
+static inline force_t forcekernel_scalar( float curx, float cury, const float* src_x, const float* src_y, const float* src_scl, int numsrc )
+{
+	force_t f = { 0.0f, 0.0f };
+	for ( int s=0; s<numsrc; ++s )
+	{
+		const float dx =  src_x[s] - curx;
+		const float dy =  src_y[s] - cury;
+		const float scl = src_scl[s];
+		const float dsqr = dx*dx + dy*dy;
+#if defined( __SSE__ )
+		if ( TIER != KERNEL_PRECISE )
+		{
+			const float x = dsqr < FORCEKERNEL_MINDSQR ? FORCEKERNEL_MINDSQR : dsqr;
+			float idist = _mm_cvtss_f32( _mm_rsqrt_ss( _mm_set_ss( x ) ) );
+			if ( TIER == KERNEL_NEWTON )
+				idist = idist * ( 1.5f - 0.5f * x * idist * idist );
+			const float magn = scl * ( idist * idist * idist );
+			f.x += magn * dx;
+			f.y += magn * dy;
+			continue;
+		}
+#endif
+		float dist = sqrtf( dsqr );
+		dist = dist < FORCEKERNEL_MINDIST ? FORCEKERNEL_MINDIST : dist;
+		const float magn = scl / ( dist*dist*dist );
+		f.x += magn * dx;
+		f.y += magn * dy;
+	}
+	return f;
+}
+
+
+#if defined( __AVX2__ )
+template <int TIER>
+static inline force_t forcekernel_avx2( float curx, float cury, const float* src_x, const float* src_y, const float* src_scl, int numsrc )
+{
+	const int numbatches = numsrc / 8;
+	const __m256 curx8 = _mm256_set1_ps( curx );
+	const __m256 cury8 = _mm256_set1_ps( cury );
+	const __m256 mindsqr8 = _mm256_set1_ps( FORCEKERNEL_MINDSQR );
+	const __m256 maxidist8 = _mm256_set1_ps( 1.0f / FORCEKERNEL_MINDIST );
+	const __m256 half8 = _mm256_set1_ps( 0.5f );
+	const __m256 threehalves8 = _mm256_set1_ps( 1.5f );
+	const __m256 one8 = _mm256_set1_ps( 1.0f );
+
+	__m256 forcex8 = _mm256_setzero_ps();	// all batches accumulate in these.
+	__m256 forcey8 = _mm256_setzero_ps();
+	for ( int batch=0; batch<numbatches; ++batch )
+	{
+		const __m256 x8   = _mm256_load_ps( src_x + 8*batch );
+		const __m256 y8   = _mm256_load_ps( src_y + 8*batch );
+		const __m256 scl8 = _mm256_load_ps( src_scl + 8*batch );
+		const __m256 dx8  = _mm256_sub_ps ( x8, curx8 );
+		const __m256 dy8  = _mm256_sub_ps ( y8, cury8 );
+		const __m256 dsqr8 = _mm256_add_ps
+		(
+		 	_mm256_mul_ps( dx8, dx8 ),
+			_mm256_mul_ps( dy8, dy8 )
+		);
+		__m256 idist8;
+		if ( TIER == KERNEL_APPROX )
+		{
+			idist8 = _mm256_rsqrt_ps( dsqr8 );
+			idist8 = _mm256_min_ps( idist8, maxidist8 );
+		}
+		else if ( TIER == KERNEL_NEWTON )
+		{
+			const __m256 c8 = _mm256_max_ps( dsqr8, mindsqr8 );
+			const __m256 y0 = _mm256_rsqrt_ps( c8 );
+			const __m256 hxyy = _mm256_mul_ps( _mm256_mul_ps( half8, c8 ), _mm256_mul_ps( y0, y0 ) );
+			idist8 = _mm256_mul_ps( y0, _mm256_sub_ps( threehalves8, hxyy ) );
+		}
+		else
+		{
+			const __m256 c8 = _mm256_max_ps( dsqr8, mindsqr8 );
+			idist8 = _mm256_div_ps( one8, _mm256_sqrt_ps( c8 ) );
+		}
+		const __m256 denom8 = _mm256_mul_ps( _mm256_mul_ps( idist8, idist8 ), idist8 );
+		const __m256 magn8  = _mm256_mul_ps( scl8, denom8 );
+		const __m256 addx8  = _mm256_mul_ps( magn8, dx8 );
+		const __m256 addy8  = _mm256_mul_ps( magn8, dy8 );
+		forcex8 = _mm256_add_ps( forcex8, addx8 );
+		forcey8 = _mm256_add_ps( forcey8, addy8 );
+	}
+	// Now we need to sum all 8 lanes in the force vector.
+	__m256 sumx8 = _mm256_hadd_ps( forcex8, forcex8 );
+	__m256 sumy8 = _mm256_hadd_ps( forcey8, forcey8 );
+	sumx8 = _mm256_hadd_ps( sumx8, sumx8 );
+	sumy8 = _mm256_hadd_ps( sumy8, sumy8 );
+	const __m128 lox4 = _mm256_extractf128_ps( sumx8, 0x00 );
+	const __m128 hix4 = _mm256_extractf128_ps( sumx8, 0x01 );
+	const __m128 loy4 = _mm256_extractf128_ps( sumy8, 0x00 );
+	const __m128 hiy4 = _mm256_extractf128_ps( sumy8, 0x01 );
+	force_t f;
+	f.x = _mm_cvtss_f32( _mm_add_ps( lox4, hix4 ) );
+	f.y = _mm_cvtss_f32( _mm_add_ps( loy4, hiy4 ) );
+	return f;
+}
+#endif
+
+
+#if defined( __AVX512F__ )
+typedef float floatx16 __attribute__((vector_size(4*16)));
+
+template <int TIER>
+static inline force_t forcekernel_avx512( float curx, float cury, const float* src_x, const float* src_y, const float* src_scl, int numsrc )
+{
+	const int numbatches = numsrc / 16;
+	const floatx16 curx16 = _mm512_set1_ps( curx );
+	const floatx16 cury16 = _mm512_set1_ps( cury );
+	const floatx16 mindsqr16 = _mm512_set1_ps( FORCEKERNEL_MINDSQR );
+	const floatx16 maxidist16 = _mm512_set1_ps( 1.0f / FORCEKERNEL_MINDIST );
+	floatx16 forcex16     = _mm512_set1_ps( 0.0f );	// all batches accumulate in these.
+	floatx16 forcey16     = _mm512_set1_ps( 0.0f );
+	for ( int batch=0; batch<numbatches; ++batch )
+	{
+		const floatx16 x16    = _mm512_load_ps( src_x   + 16*batch );
+		const floatx16 y16    = _mm512_load_ps( src_y   + 16*batch );
+		const floatx16 scl16  = _mm512_load_ps( src_scl + 16*batch );
+		const floatx16 dx16   =  x16 - curx16;
+		const floatx16 dy16   =  y16 - cury16;
+		const floatx16 dsqr16 =  dx16*dx16 + dy16*dy16;
+		floatx16 idist16;
+		if ( TIER == KERNEL_APPROX )
+		{
+			idist16 = _mm512_rsqrt14_ps( dsqr16 );
+			idist16 = _mm512_min_ps( idist16, maxidist16 );
+		}
+		else if ( TIER == KERNEL_NEWTON )
+		{
+			const floatx16 c16 = _mm512_max_ps( dsqr16, mindsqr16 );
+			const floatx16 y0 = _mm512_rsqrt14_ps( c16 );
+			idist16 = y0 * ( 1.5f - 0.5f * c16 * y0 * y0 );
+		}
+		else
+		{
+			const floatx16 c16 = _mm512_max_ps( dsqr16, mindsqr16 );
+			idist16 = 1.0f / _mm512_sqrt_ps( c16 );
+		}
+		const floatx16 magn16 = scl16 * ( idist16 * idist16 * idist16 );
+		forcex16 += magn16 * dx16;
+		forcey16 += magn16 * dy16;
+	}
+	// Now we need to sum all 16 lanes in the force vector.
+	force_t f;
+	f.x = _mm512_reduce_add_ps( forcex16 );
+	f.y = _mm512_reduce_add_ps( forcey16 );
+	return f;
+}
+#endif
+
+
+//! The kernel that was selected at compile time with -DVECTORIZE=n.
+template <int TIER>
+static inline force_t forcekernel( float curx, float cury, const float* src_x, const float* src_y, const float* src_scl, int numsrc )
+{
+#if VECTORIZE == 8	// AVX2
+	return forcekernel_avx2<TIER>( curx, cury, src_x, src_y, src_scl, numsrc );
+#elif VECTORIZE == 16	// AVX512
+	return forcekernel_avx512<TIER>( curx, cury, src_x, src_y, src_scl, numsrc );
+#else	// SCALAR CODE
+	return forcekernel_scalar<TIER>( curx, cury, src_x, src_y, src_scl, numsrc );
+#endif
+}
+
+
+// Potential kernels, for the diagnostics: sum of scl / |d| over all sources.
+// These always use a refined reciprocal square root, and a source at distance zero contributes scl / FORCEKERNEL_MINDIST.
+
+static inline float potentialkernel_scalar( float curx, float cury, const float* src_x, const float* src_y, const float* src_scl, int numsrc )
+{
+	float phi = 0.0f;
+	for ( int s=0; s<numsrc; ++s )
+	{
+		const float dx = src_x[s] - curx;
+		const float dy = src_y[s] - cury;
+		float dist = sqrtf( dx*dx + dy*dy );
+		dist = dist < FORCEKERNEL_MINDIST ? FORCEKERNEL_MINDIST : dist;
+		phi += src_scl[s] / dist;
+	}
+	return phi;
+}
+
+
+#if defined( __AVX2__ )
+static inline float potentialkernel_avx2( float curx, float cury, const float* src_x, const float* src_y, const float* src_scl, int numsrc )
+{
+	const int numbatches = numsrc / 8;
+	const __m256 curx8 = _mm256_set1_ps( curx );
+	const __m256 cury8 = _mm256_set1_ps( cury );
+	const __m256 mindsqr8 = _mm256_set1_ps( FORCEKERNEL_MINDSQR );
+	const __m256 half8 = _mm256_set1_ps( 0.5f );
+	const __m256 threehalves8 = _mm256_set1_ps( 1.5f );
+	__m256 phi8 = _mm256_setzero_ps();
+	for ( int batch=0; batch<numbatches; ++batch )
+	{
+		const __m256 dx8  = _mm256_sub_ps( _mm256_load_ps( src_x + 8*batch ), curx8 );
+		const __m256 dy8  = _mm256_sub_ps( _mm256_load_ps( src_y + 8*batch ), cury8 );
+		const __m256 c8   = _mm256_max_ps( _mm256_add_ps( _mm256_mul_ps( dx8, dx8 ), _mm256_mul_ps( dy8, dy8 ) ), mindsqr8 );
+		const __m256 y0   = _mm256_rsqrt_ps( c8 );
+		const __m256 hxyy = _mm256_mul_ps( _mm256_mul_ps( half8, c8 ), _mm256_mul_ps( y0, y0 ) );
+		const __m256 idist8 = _mm256_mul_ps( y0, _mm256_sub_ps( threehalves8, hxyy ) );
+		phi8 = _mm256_add_ps( phi8, _mm256_mul_ps( _mm256_load_ps( src_scl + 8*batch ), idist8 ) );
+	}
+	__m256 sum8 = _mm256_hadd_ps( phi8, phi8 );
+	sum8 = _mm256_hadd_ps( sum8, sum8 );
+	return _mm_cvtss_f32( _mm_add_ps( _mm256_extractf128_ps( sum8, 0x00 ), _mm256_extractf128_ps( sum8, 0x01 ) ) );
+}
+#endif
+
+
+#if defined( __AVX512F__ )
+static inline float potentialkernel_avx512( float curx, float cury, const float* src_x, const float* src_y, const float* src_scl, int numsrc )
+{
+	const int numbatches = numsrc / 16;
+	const floatx16 curx16 = _mm512_set1_ps( curx );
+	const floatx16 cury16 = _mm512_set1_ps( cury );
+	const floatx16 mindsqr16 = _mm512_set1_ps( FORCEKERNEL_MINDSQR );
+	floatx16 phi16 = _mm512_set1_ps( 0.0f );
+	for ( int batch=0; batch<numbatches; ++batch )
+	{
+		const floatx16 dx16 = _mm512_load_ps( src_x + 16*batch ) - curx16;
+		const floatx16 dy16 = _mm512_load_ps( src_y + 16*batch ) - cury16;
+		const floatx16 c16  = _mm512_max_ps( dx16*dx16 + dy16*dy16, mindsqr16 );
+		const floatx16 y0   = _mm512_rsqrt14_ps( c16 );
+		phi16 += _mm512_load_ps( src_scl + 16*batch ) * ( y0 * ( 1.5f - 0.5f * c16 * y0 * y0 ) );
+	}
+	return _mm512_reduce_add_ps( phi16 );
+}
+#endif
+
+
+//! The potential kernel that matches the compile time -DVECTORIZE=n setting.
+static inline float potentialkernel( float curx, float cury, const float* src_x, const float* src_y, const float* src_scl, int numsrc )
+{
+#if VECTORIZE == 8	// AVX2
+	return potentialkernel_avx2( curx, cury, src_x, src_y, src_scl, numsrc );
+#elif VECTORIZE == 16	// AVX512
+	return potentialkernel_avx512( curx, cury, src_x, src_y, src_scl, numsrc );
+#else	// SCALAR CODE
+	return potentialkernel_scalar( curx, cury, src_x, src_y, src_scl, numsrc );
+#endif
+}
+
+#endif
@@ -0,0 +1,147 @@
+// framepub.cpp
+//
+// Publishes the stars of every few steps into a frame ring in shared memory.
+
+#include "framepub.h"
+#include "framering.h"
+#include "stars.h"
+
+// From GBase
+#include "logx.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#if FRAMERING_GRIDRES != GRIDRES
+#	error "FRAMERING_GRIDRES does not match GRIDRES."
+#endif
+
+
+int framepub_interval = 1;
+
+//! Slots in the ring: readers get a frame or three to finish with a slot before it is written again.
+#define NUMSLOTS	4
+
+//! Room for at least this many stars, when the capacity is picked from the current count.
+#define MINCAPACITY	65536
+
+static framering_t ring;
+static int published = 0;
+static int skipped = 0;
+static bool warned = false;
+
+//! Where the column jobs copy to.
+static framering_slot_t* target = 0;
+
+
+//! Copy the stars of a column of cells into the target slot.
+static void copy_column( int cx, void* )
+{
+	float* px = (float*) framering_array( &ring, target, FRAMERING_PX );
+	float* py = (float*) framering_array( &ring, target, FRAMERING_PY );
+	float* vx = (float*) framering_array( &ring, target, FRAMERING_VX );
+	float* vy = (float*) framering_array( &ring, target, FRAMERING_VY );
+	int32_t* uid = (int32_t*) framering_array( &ring, target, FRAMERING_UID );
+	for ( int cy=0; cy<GRIDRES; ++cy )
+	{
+		const cell_t* cell = stars_cell( cx, cy );
+		const int first = target->offsets[ cx*GRIDRES+cy ];
+		const int cnt = cell->cnt;
+		memcpy( px + first, cell->px, cnt * sizeof( float ) );
+		memcpy( py + first, cell->py, cnt * sizeof( float ) );
+		memcpy( vx + first, cell->vx, cnt * sizeof( float ) );
+		memcpy( vy + first, cell->vy, cnt * sizeof( float ) );
+		for ( int i=0; i<cnt; ++i )
+			uid[ first+i ] = cell->st[ i ] >> 8;
+	}
+}
+
+
+bool framepub_open( const char* name, int capacity )
+{
+	framepub_close();
+	if ( capacity <= 0 )
+	{
+		capacity = 2 * stars_total_count();
+		capacity = capacity < MINCAPACITY ? MINCAPACITY : capacity;
+		capacity = capacity > GRIDRES * GRIDRES * CELLCAP ? GRIDRES * GRIDRES * CELLCAP : capacity;
+	}
+	if ( !framering_create( &ring, name, capacity, NUMSLOTS ) )
+		return false;
+	const cell_t* first = stars_cell( 0, 0 );
+	ring.hdr->originx = first->xrng[0];
+	ring.hdr->originy = first->yrng[0];
+	ring.hdr->cellsize = first->xrng[1] - first->xrng[0];
+	published = 0;
+	skipped = 0;
+	warned = false;
+	return true;
+}
+
+
+void framepub_close( void )
+{
+	if ( !ring.hdr )
+		return;
+	LOGI( "Published %d frames to %s, skipped %d.", published, ring.name, skipped );
+	framering_close( &ring );
+}
+
+
+bool framepub_is_open( void )
+{
+	return ring.hdr != 0;
+}
+
+
+int framepub_published( void )
+{
+	return published;
+}
+
+
+int framepub_skipped( void )
+{
+	return skipped;
+}
+
+
+void framepub_after_step( void )
+{
+	if ( !ring.hdr || framepub_interval <= 0 )
+		return;
+	if ( stars_get_step_nr() % framepub_interval == 0 )
+		framepub_publish();
+}
+
+
+bool framepub_publish( void )
+{
+	if ( !ring.hdr )
+		return false;
+	const int numstars = stars_total_count();
+	if ( numstars > (int) ring.hdr->capacity )
+	{
+		if ( !warned )
+			LOGE( "%d stars do not fit the frame ring of %u, skipping frames.", numstars, ring.hdr->capacity );
+		warned = true;
+		skipped += 1;
+		return false;
+	}
+	target = framering_write_begin( &ring );
+	int running = 0;
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			target->offsets[ cx*GRIDRES+cy ] = running;
+			running += stars_cell( cx, cy )->cnt;
+		}
+	target->offsets[ GRIDRES*GRIDRES ] = running;
+	target->numstars = running;
+	target->step = stars_get_step_nr( &target->time );
+	stars_parallel( GRIDRES, copy_column, 0 );
+	framering_write_end( &ring, target );
+	target = 0;
+	published += 1;
+	return true;
+}
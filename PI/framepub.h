@@ -0,0 +1,34 @@
+// framepub.h
+//
+// Publishes the stars of every few steps into a frame ring in shared memory, for viewers and analysis in other processes.
+// See framering.h for the layout, and PI/watch.cpp for a consumer.
+//
+// Publishing copies the arrays of each cell into the next slot of the ring, a column of cells per worker.
+// A frame with more stars than the ring has room for is skipped.
+
+#ifndef FRAMEPUB_H
+#define FRAMEPUB_H
+
+//! Create the ring name, like /nbody, with room for capacity stars per frame, or twice the current count when 0. Returns false if it cannot be created.
+extern bool framepub_open( const char* name, int capacity );
+
+//! Mark the ring closed for the readers, and remove it.
+extern void framepub_close( void );
+
+//! True while publishing.
+extern bool framepub_is_open( void );
+
+//! Publish a frame every this many steps from framepub_after_step(). (default: 1)
+extern int framepub_interval;
+
+//! Call after each step: publishes a frame when the step nr is a multiple of framepub_interval.
+extern void framepub_after_step( void );
+
+//! Publish the stars as they are now. Returns false if the frame was skipped, because it has more stars than the ring has room for.
+extern bool framepub_publish( void );
+
+//! Frames published, and frames skipped, since the ring was created.
+extern int framepub_published( void );
+extern int framepub_skipped( void );
+
+#endif
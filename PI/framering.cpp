@@ -0,0 +1,234 @@
+// framering.cpp
+//
+// A ring of frames in POSIX shared memory, written by one simulation and read in place by any number of other processes.
+
+#include "framering.h"
+
+// From GBase
+#include "logx.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined( linux )
+#	include <fcntl.h>
+#	include <unistd.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#endif
+
+
+static const char magic[ 8 ] = { 'N','B','O','D','Y','S','H','M' };
+
+//! Start of every array, and every slot, on a 64 byte boundary.
+#define ALIGN64( X )	( ( (X) + 63 ) & ~(uint64_t) 63 )
+
+
+#if defined( linux )
+
+//! Whether the header is of this build, and every slot and array it describes lies inside the sz bytes that are mapped.
+//! The sums are arranged so that a corrupt header cannot make them wrap.
+static bool header_fits( const framering_header_t* hdr, size_t sz )
+{
+	if ( hdr->version != FRAMERING_VERSION || hdr->gridres != FRAMERING_GRIDRES )
+		return false;
+	if ( hdr->numslots < 1 || hdr->capacity == 0 || hdr->slotsize < sizeof( framering_slot_t ) )
+		return false;
+	if ( hdr->slotoffset < sizeof( framering_header_t ) || hdr->slotoffset > sz )
+		return false;
+	if ( hdr->numslots > ( sz - hdr->slotoffset ) / hdr->slotsize )
+		return false;
+	const uint64_t arraysize = 4 * (uint64_t) hdr->capacity;
+	for ( int a=0; a<FRAMERING_NUMARRAYS; ++a )
+		if ( hdr->arrayoffset[ a ] < sizeof( framering_slot_t ) || hdr->arrayoffset[ a ] > hdr->slotsize || arraysize > hdr->slotsize - hdr->arrayoffset[ a ] )
+			return false;
+	return true;
+}
+
+
+bool framering_create( framering_t* r, const char* name, int capacity, int numslots )
+{
+	memset( r, 0, sizeof( framering_t ) );
+	if ( capacity <= 0 || numslots < 2 || strlen( name ) >= sizeof( r->name ) )
+	{
+		LOGE( "Cannot create a frame ring %s with %d slots of %d stars.", name, numslots, capacity );
+		return false;
+	}
+	uint64_t slotsize = ALIGN64( sizeof( framering_slot_t ) );
+	uint64_t arrayoffset[ FRAMERING_NUMARRAYS ];
+	for ( int a=0; a<FRAMERING_NUMARRAYS; ++a )
+	{
+		arrayoffset[ a ] = slotsize;
+		slotsize = ALIGN64( slotsize + 4 * (uint64_t) capacity );
+	}
+	const uint64_t slotoffset = ALIGN64( sizeof( framering_header_t ) );
+	const size_t sz = slotoffset + numslots * slotsize;
+
+	// Readers of a previous run keep their mapping of the old object, and see it closed.
+	shm_unlink( name );
+	const int fd = shm_open( name, O_CREAT | O_EXCL | O_RDWR, 0644 );
+	if ( fd < 0 )
+	{
+		LOGE( "Cannot create shared memory %s", name );
+		return false;
+	}
+	if ( ftruncate( fd, sz ) != 0 )
+	{
+		LOGE( "Cannot size shared memory %s to %zu bytes.", name, sz );
+		close( fd );
+		shm_unlink( name );
+		return false;
+	}
+	void* map = mmap( 0, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	close( fd );
+	if ( map == MAP_FAILED )
+	{
+		LOGE( "Cannot map shared memory %s", name );
+		shm_unlink( name );
+		return false;
+	}
+
+	// A new object reads as zeros, so every slot starts out unlocked and empty.
+	framering_header_t* hdr = (framering_header_t*) map;
+	hdr->version = FRAMERING_VERSION;
+	hdr->gridres = FRAMERING_GRIDRES;
+	hdr->numslots = numslots;
+	hdr->capacity = capacity;
+	hdr->slotsize = slotsize;
+	hdr->slotoffset = slotoffset;
+	memcpy( hdr->arrayoffset, arrayoffset, sizeof( arrayoffset ) );
+	hdr->writerpid = (uint32_t) getpid();
+	// Readers check the magic last.
+	__atomic_thread_fence( __ATOMIC_RELEASE );
+	memcpy( hdr->magic, magic, sizeof( magic ) );
+
+	r->hdr = hdr;
+	r->size = sz;
+	r->owner = true;
+	snprintf( r->name, sizeof( r->name ), "%s", name );
+	LOGI( "Created frame ring %s: %d slots of %d stars, %.1f MB.", name, numslots, capacity, sz / ( 1024.0 * 1024.0 ) );
+	return true;
+}
+
+
+bool framering_attach( framering_t* r, const char* name )
+{
+	memset( r, 0, sizeof( framering_t ) );
+	const int fd = shm_open( name, O_RDONLY, 0 );
+	if ( fd < 0 )
+		return false;
+	struct stat st;
+	if ( fstat( fd, &st ) != 0 || st.st_size < (off_t) sizeof( framering_header_t ) )
+	{
+		close( fd );
+		return false;
+	}
+	const size_t sz = st.st_size;
+	void* map = mmap( 0, sz, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if ( map == MAP_FAILED )
+		return false;
+	framering_header_t* hdr = (framering_header_t*) map;
+	// The writer sets the magic last, so the rest of the header is only read once it is there.
+	bool ok = !memcmp( hdr->magic, magic, sizeof( magic ) );
+	__atomic_thread_fence( __ATOMIC_ACQUIRE );
+	ok = ok && header_fits( hdr, sz );
+	if ( !ok )
+	{
+		munmap( map, sz );
+		return false;
+	}
+	r->hdr = hdr;
+	r->size = sz;
+	r->owner = false;
+	snprintf( r->name, sizeof( r->name ), "%s", name );
+	return true;
+}
+
+
+void framering_close( framering_t* r )
+{
+	if ( !r->hdr )
+		return;
+	if ( r->owner )
+	{
+		__atomic_store_n( &r->hdr->closed, 1, __ATOMIC_RELEASE );
+		shm_unlink( r->name );
+	}
+	munmap( r->hdr, r->size );
+	r->hdr = 0;
+	r->size = 0;
+}
+
+#else
+
+bool framering_create( framering_t* r, const char* name, int capacity, int numslots )
+{
+	memset( r, 0, sizeof( framering_t ) );
+	LOGE( "Shared memory frame rings are not supported on this platform." );
+	return false;
+}
+
+
+bool framering_attach( framering_t* r, const char* name )
+{
+	memset( r, 0, sizeof( framering_t ) );
+	return false;
+}
+
+
+void framering_close( framering_t* r )
+{
+	r->hdr = 0;
+}
+
+#endif
+
+
+static inline framering_slot_t* get_slot( const framering_t* r, uint64_t frame )
+{
+	const uint64_t idx = ( frame - 1 ) % r->hdr->numslots;
+	return (framering_slot_t*) ( (char*) r->hdr + r->hdr->slotoffset + idx * r->hdr->slotsize );
+}
+
+
+framering_slot_t* framering_write_begin( framering_t* r )
+{
+	const uint64_t frame = r->hdr->latest + 1;
+	framering_slot_t* slot = get_slot( r, frame );
+	__atomic_store_n( &slot->seq, slot->seq + 1, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_RELEASE );
+	slot->frame = frame;
+	return slot;
+}
+
+
+void framering_write_end( framering_t* r, framering_slot_t* slot )
+{
+	__atomic_store_n( &slot->seq, slot->seq + 1, __ATOMIC_RELEASE );
+	__atomic_store_n( &r->hdr->latest, slot->frame, __ATOMIC_RELEASE );
+}
+
+
+const framering_slot_t* framering_read_begin( const framering_t* r, uint64_t* seq )
+{
+	const uint64_t frame = __atomic_load_n( &r->hdr->latest, __ATOMIC_ACQUIRE );
+	if ( !frame )
+		return 0;
+	const framering_slot_t* slot = get_slot( r, frame );
+	*seq = __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE );
+	return ( *seq & 1 ) ? 0 : slot;
+}
+
+
+bool framering_read_end( const framering_slot_t* slot, uint64_t seq )
+{
+	__atomic_thread_fence( __ATOMIC_ACQUIRE );
+	return __atomic_load_n( &slot->seq, __ATOMIC_RELAXED ) == seq;
+}
+
+
+const void* framering_array( const framering_t* r, const framering_slot_t* slot, int array )
+{
+	return (const char*) slot + r->hdr->arrayoffset[ array ];
+}
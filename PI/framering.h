@@ -0,0 +1,101 @@
+// framering.h
+//
+// A ring of frames in POSIX shared memory, written by one simulation and read in place by any number of other processes.
+//
+// The shared memory object holds a framering_header_t, followed by numslots slots of slotsize bytes each.
+// A slot starts with a framering_slot_t: the step, time and star count of its frame, and per cell the index of its first star.
+// The stars follow, as the arrays px, py, vx, vy and uid of capacity elements each, at the offsets in the header,
+// sorted by cell: the stars of cell cx,cy are elements offsets[ cx*gridres+cy ] .. offsets[ cx*gridres+cy+1 ]-1.
+//
+// The writer fills the slots round robin, so a reader can read the last complete frame while the next one is written.
+// Each slot has a sequence lock: the writer makes seq odd before it touches the slot, and even again when it is done.
+// A reader takes seq before reading, and checks after reading that it is still the same, and was even. If not, the
+// writer got round to the slot meanwhile, and the reader tries again with the newest frame.
+//
+// This part has no dependency on the simulation, so that consumers only need framering.cpp. See framepub.h for the writer.
+
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FRAMERING_VERSION	1
+
+//! Cells along each side of the grid, as GRIDRES in stars.h.
+#define FRAMERING_GRIDRES	32
+
+enum
+{
+	FRAMERING_PX=0,
+	FRAMERING_PY,
+	FRAMERING_VX,
+	FRAMERING_VY,
+	FRAMERING_UID,		//! int32_t, where the others are float.
+	FRAMERING_NUMARRAYS
+};
+
+typedef struct
+{
+	char magic[ 8 ];		//! NBODYSHM
+	uint32_t version;
+	uint32_t gridres;
+	uint32_t numslots;
+	uint32_t capacity;		//! stars per slot.
+	uint64_t slotsize;		//! bytes per slot.
+	uint64_t slotoffset;		//! offset of the first slot from the start of the header.
+	uint64_t arrayoffset[ FRAMERING_NUMARRAYS ];	//! offset of each array from the start of a slot.
+	float originx;			//! low x of the grid.
+	float originy;			//! low y of the grid.
+	float cellsize;			//! width of a cell.
+	uint32_t writerpid;
+	uint64_t latest;		//! number of the newest complete frame, counting from 1. 0 while there is none.
+	uint32_t closed;		//! set when the writer is done. A new writer makes a new object, so detach and attach again.
+	uint32_t reserved;
+} framering_header_t;
+
+typedef struct
+{
+	uint64_t seq;			//! sequence lock: odd while the slot is written.
+	uint64_t frame;			//! number of the frame in the slot. Frame f goes into slot ( f - 1 ) % numslots.
+	int32_t step;
+	uint32_t numstars;
+	double time;
+	uint32_t offsets[ FRAMERING_GRIDRES * FRAMERING_GRIDRES + 1 ];	//! index of the first star of each cell, and the star count at the end.
+} framering_slot_t;
+
+//! A mapping of the ring, by the writer or by a reader.
+typedef struct
+{
+	framering_header_t* hdr;	//! 0 when not mapped.
+	size_t size;
+	bool owner;			//! made with framering_create(): unlinked on close.
+	char name[ 64 ];
+} framering_t;
+
+//! Create the shared memory object name, like /nbody, with numslots slots of capacity stars, and map it for writing.
+//! An object that is left over with that name is replaced. Returns false if it cannot be created.
+extern bool framering_create( framering_t* r, const char* name, int capacity, int numslots );
+
+//! Map an existing ring read only. Returns false if there is none with that name, or it does not match this build, or its header does not fit the size of the object.
+extern bool framering_attach( framering_t* r, const char* name );
+
+//! Unmap the ring. When created by this process, mark it closed for the readers, and remove the name.
+extern void framering_close( framering_t* r );
+
+//! Writer: lock the slot for the next frame, and return it to fill in.
+extern framering_slot_t* framering_write_begin( framering_t* r );
+
+//! Writer: unlock the slot, and make its frame the newest.
+extern void framering_write_end( framering_t* r, framering_slot_t* slot );
+
+//! Reader: the slot with the newest complete frame, and its sequence number in seq. 0 if there is no frame yet, or the writer is in it.
+extern const framering_slot_t* framering_read_begin( const framering_t* r, uint64_t* seq );
+
+//! Reader: whether the slot was left alone since framering_read_begin(). If not, what was read is inconsistent.
+extern bool framering_read_end( const framering_slot_t* slot, uint64_t seq );
+
+//! An array of a slot, in place: FRAMERING_PX, ... The elements are float, or int32_t for FRAMERING_UID.
+extern const void* framering_array( const framering_t* r, const framering_slot_t* slot, int array );
+
+#endif
@@ -0,0 +1,210 @@
+// frametimes.cpp
+//
+// Histograms of the time spent per frame in simulating, drawing and swapping.
+
+#include "frametimes.h"
+#include "wallclock.h"
+
+// From GBase
+#include "logx.h"
+
+#include <math.h>
+#include <string.h>
+
+
+const char* const frametime_names[ FRAMETIME_NUMKINDS ] =
+{
+	"simulate",
+	"draw",
+	"swap",
+	"frame",
+};
+
+float frametimes_budget = 0.020f;
+
+
+//! Buckets are spaced logarithmically: 16 per doubling, from 1us up to 2^20us, about a second.
+#define BUCKETSPEROCTAVE	16
+#define NUMOCTAVES		20
+#define NUMBUCKETS		( BUCKETSPEROCTAVE * NUMOCTAVES )
+
+static int histogram[ FRAMETIME_NUMKINDS ][ NUMBUCKETS ];
+static double maxtime[ FRAMETIME_NUMKINDS ];
+static double sumtime[ FRAMETIME_NUMKINDS ];
+static int numframes = 0;
+
+// The frame that is in progress.
+static double current[ FRAMETIME_NUMKINDS ];
+static int current_steps = 0;
+static int current_stars = 0;
+static long long current_transits = 0;
+
+// Over budget frames are logged at most once per second, so a slow machine does not flood the log.
+static int overbudget = 0;
+static int unlogged = 0;
+static double lastlogged = -1.0;
+
+
+static int bucket_of( double seconds )
+{
+	const double us = seconds * 1e6;
+	if ( us < 1.0 )
+		return 0;
+	const int b = (int) ( BUCKETSPEROCTAVE * log2( us ) );
+	return b < NUMBUCKETS ? b : NUMBUCKETS-1;
+}
+
+
+//! Upper end of a bucket, in seconds.
+static double bucket_limit( int b )
+{
+	return 1e-6 * pow( 2.0, ( b + 1 ) / (double) BUCKETSPEROCTAVE );
+}
+
+
+void frametimes_record( int kind, double seconds )
+{
+	current[ kind ] += seconds;
+}
+
+
+void frametimes_note( int steps, int stars, long long transits )
+{
+	current_steps = steps;
+	current_stars = stars;
+	current_transits = transits;
+}
+
+
+void frametimes_end_frame( void )
+{
+	current[ FRAMETIME_FRAME ] = current[ FRAMETIME_SIMULATE ] + current[ FRAMETIME_DRAW ] + current[ FRAMETIME_SWAP ];
+	for ( int k=0; k<FRAMETIME_NUMKINDS; ++k )
+	{
+		histogram[ k ][ bucket_of( current[ k ] ) ] += 1;
+		maxtime[ k ] = current[ k ] > maxtime[ k ] ? current[ k ] : maxtime[ k ];
+		sumtime[ k ] += current[ k ];
+	}
+	numframes += 1;
+
+	if ( current[ FRAMETIME_FRAME ] > frametimes_budget )
+	{
+		overbudget += 1;
+		const double now = wallclock_seconds();
+		if ( lastlogged < 0 || now - lastlogged >= 1.0 )
+		{
+			LOGI
+			(
+				"Frame %d over budget: %.2f ms (simulate %.2f, draw %.2f, swap %.2f) %d steps, %d stars, %lld transits. %d more since last report.",
+				numframes, 1000 * current[ FRAMETIME_FRAME ],
+				1000 * current[ FRAMETIME_SIMULATE ], 1000 * current[ FRAMETIME_DRAW ], 1000 * current[ FRAMETIME_SWAP ],
+				current_steps, current_stars, current_transits, unlogged
+			);
+			lastlogged = now;
+			unlogged = 0;
+		}
+		else
+			unlogged += 1;
+	}
+
+	memset( current, 0, sizeof( current ) );
+	current_steps = current_stars = 0;
+	current_transits = 0;
+}
+
+
+double frametimes_percentile( int kind, double fraction )
+{
+	if ( !numframes )
+		return 0.0;
+	const double target = fraction * numframes;
+	int cumulative = 0;
+	for ( int b=0; b<NUMBUCKETS; ++b )
+	{
+		cumulative += histogram[ kind ][ b ];
+		if ( cumulative >= target && histogram[ kind ][ b ] )
+		{
+			const double limit = bucket_limit( b );
+			return limit < maxtime[ kind ] ? limit : maxtime[ kind ];
+		}
+	}
+	return maxtime[ kind ];
+}
+
+
+double frametimes_max( int kind )
+{
+	return maxtime[ kind ];
+}
+
+
+int frametimes_count( void )
+{
+	return numframes;
+}
+
+
+void frametimes_print( FILE* f )
+{
+	fprintf( f, "%d frames, %d over the budget of %.1f ms.\n", numframes, overbudget, 1000 * frametimes_budget );
+	fprintf( f, "%-9s %8s %8s %8s %8s %8s\n", "ms", "mean", "p50", "p90", "p99", "max" );
+	for ( int k=0; k<FRAMETIME_NUMKINDS; ++k )
+		fprintf
+		(
+			f, "%-9s %8.2f %8.2f %8.2f %8.2f %8.2f\n",
+			frametime_names[ k ], numframes ? 1000 * sumtime[ k ] / numframes : 0.0,
+			1000 * frametimes_percentile( k, 0.50 ), 1000 * frametimes_percentile( k, 0.90 ),
+			1000 * frametimes_percentile( k, 0.99 ), 1000 * frametimes_max( k )
+		);
+}
+
+
+bool frametimes_write_summary( const char* fname )
+{
+	FILE* f = fopen( fname, "w" );
+	if ( !f )
+	{
+		LOGE( "Cannot write %s", fname );
+		return false;
+	}
+	fprintf( f, "{\n" );
+	fprintf( f, "  \"frames\": %d,\n", numframes );
+	fprintf( f, "  \"budget_ms\": %.3f,\n", 1000 * frametimes_budget );
+	fprintf( f, "  \"over_budget\": %d,\n", overbudget );
+	for ( int k=0; k<FRAMETIME_NUMKINDS; ++k )
+	{
+		fprintf
+		(
+			f, "  \"%s\": { \"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p90_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f,\n",
+			frametime_names[ k ], numframes ? 1000 * sumtime[ k ] / numframes : 0.0,
+			1000 * frametimes_percentile( k, 0.50 ), 1000 * frametimes_percentile( k, 0.90 ),
+			1000 * frametimes_percentile( k, 0.99 ), 1000 * frametimes_max( k )
+		);
+		// The non-empty buckets, as pairs of upper limit in ms and count.
+		fprintf( f, "    \"histogram\": [" );
+		bool first = true;
+		for ( int b=0; b<NUMBUCKETS; ++b )
+			if ( histogram[ k ][ b ] )
+			{
+				fprintf( f, "%s[%.4f,%d]", first ? "" : ",", 1000 * bucket_limit( b ), histogram[ k ][ b ] );
+				first = false;
+			}
+		fprintf( f, "] }%s\n", k+1 < FRAMETIME_NUMKINDS ? "," : "" );
+	}
+	fprintf( f, "}\n" );
+	fclose( f );
+	return true;
+}
+
+
+void frametimes_reset( void )
+{
+	memset( histogram, 0, sizeof( histogram ) );
+	memset( maxtime, 0, sizeof( maxtime ) );
+	memset( sumtime, 0, sizeof( sumtime ) );
+	memset( current, 0, sizeof( current ) );
+	numframes = 0;
+	overbudget = 0;
+	unlogged = 0;
+	lastlogged = -1.0;
+}
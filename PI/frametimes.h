@@ -0,0 +1,53 @@
+// frametimes.h
+//
+// Histograms of the time spent per frame in simulating, drawing and swapping.
+// Frames that go over budget are logged with what the simulation was doing at the time.
+
+#ifndef FRAMETIMES_H
+#define FRAMETIMES_H
+
+#include <stdio.h>
+
+enum
+{
+	FRAMETIME_SIMULATE=0,	//! ctrl_simulate().
+	FRAMETIME_DRAW,		//! ctrl_drawFrame().
+	FRAMETIME_SWAP,		//! swapping the window, if the platform reports it. Includes waiting for vsync.
+	FRAMETIME_FRAME,	//! the sum of the above.
+	FRAMETIME_NUMKINDS
+};
+
+//! Names of the kinds of times, for reports.
+extern const char* const frametime_names[ FRAMETIME_NUMKINDS ];
+
+//! Frames that take longer than this many seconds, in total, are logged. Defaults to 20ms: a 60Hz frame, plus slack for vsync jitter.
+extern float frametimes_budget;
+
+//! Add time spent in the current frame.
+extern void frametimes_record( int kind, double seconds );
+
+//! What the simulation did in the current frame, for the log of over budget frames.
+extern void frametimes_note( int steps, int stars, long long transits );
+
+//! Close the current frame: add its times to the histograms, and log it if it went over budget.
+extern void frametimes_end_frame( void );
+
+//! Time in seconds below which the given fraction of the frames fall, for a kind. Accurate to about 5%.
+extern double frametimes_percentile( int kind, double fraction );
+
+//! Longest time seen for a kind, in seconds.
+extern double frametimes_max( int kind );
+
+//! Number of frames in the histograms.
+extern int frametimes_count( void );
+
+//! Write p50, p90, p99 and max per kind, and the histograms, as JSON. Returns false if the file cannot be written.
+extern bool frametimes_write_summary( const char* fname );
+
+//! Print p50, p90, p99 and max per kind.
+extern void frametimes_print( FILE* f );
+
+//! Forget all frames.
+extern void frametimes_reset( void );
+
+#endif
@@ -0,0 +1,349 @@
+// generators.cpp
+//
+// Star fields drawn from standard models of galaxies and clusters, for benchmarking on realistic distributions.
+
+#include "generators.h"
+#include "stars.h"
+#include "forcekernel.h"
+
+// From GBase
+#include "logx.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+
+const char* const generator_names[ GENERATOR_NUMMODELS ] =
+{
+	"plummer",
+	"hernquist",
+	"expdisk",
+	"uniform",
+};
+
+//! The stars of a model are drawn in this many shares.
+#define NUMSHARES	64
+
+//! Speeds are kept below this fraction of the escape velocity.
+#define MAXESCAPE	0.95
+
+//! Pairs of stars sampled to estimate the potential energy.
+#define NUMPAIRS	( 1 << 18 )
+
+
+//! Random number generator: splitmix64, on a stream per star.
+static inline uint64_t rng_next( uint64_t& s )
+{
+	s += 0x9e3779b97f4a7c15ULL;
+	uint64_t z = s;
+	z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+	z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+	return z ^ ( z >> 31 );
+}
+
+
+//! Uniform in (0,1].
+static inline double rng_uniform( uint64_t& s )
+{
+	return ( ( rng_next( s ) >> 11 ) + 1 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+
+//! Standard normal, with Box-Muller.
+static inline double rng_normal( uint64_t& s )
+{
+	const double u = rng_uniform( s );
+	const double v = rng_uniform( s );
+	return sqrt( -2.0 * log( u ) ) * cos( 2.0 * M_PI * v );
+}
+
+
+// Modified Bessel functions, with the polynomial approximations from Abramowitz and Stegun 9.8.
+
+static double bessel_i0( double x )
+{
+	if ( x <= 3.75 )
+	{
+		const double t = ( x / 3.75 ) * ( x / 3.75 );
+		return 1.0 + t*( 3.5156229 + t*( 3.0899424 + t*( 1.2067492 + t*( 0.2659732 + t*( 0.0360768 + t*0.0045813 ) ) ) ) );
+	}
+	const double t = 3.75 / x;
+	return exp( x ) / sqrt( x ) *
+		( 0.39894228 + t*( 0.01328592 + t*( 0.00225319 + t*( -0.00157565 + t*( 0.00916281 + t*( -0.02057706 + t*( 0.02635537 + t*( -0.01647633 + t*0.00392377 ) ) ) ) ) ) ) );
+}
+
+
+static double bessel_i1( double x )
+{
+	if ( x <= 3.75 )
+	{
+		const double t = ( x / 3.75 ) * ( x / 3.75 );
+		return x * ( 0.5 + t*( 0.87890594 + t*( 0.51498869 + t*( 0.15084934 + t*( 0.02658733 + t*( 0.00301532 + t*0.00032411 ) ) ) ) ) );
+	}
+	const double t = 3.75 / x;
+	return exp( x ) / sqrt( x ) *
+		( 0.39894228 + t*( -0.03988024 + t*( -0.00362018 + t*( 0.00163801 + t*( -0.01031555 + t*( 0.02282967 + t*( -0.02895312 + t*( 0.01787654 + t*-0.00420059 ) ) ) ) ) ) ) );
+}
+
+
+static double bessel_k0( double x )
+{
+	if ( x <= 2.0 )
+	{
+		const double t = ( x / 2.0 ) * ( x / 2.0 );
+		return -log( x / 2.0 ) * bessel_i0( x ) +
+			( -0.57721566 + t*( 0.42278420 + t*( 0.23069756 + t*( 0.03488590 + t*( 0.00262698 + t*( 0.00010750 + t*0.0000074 ) ) ) ) ) );
+	}
+	const double t = 2.0 / x;
+	return exp( -x ) / sqrt( x ) *
+		( 1.25331414 + t*( -0.07832358 + t*( 0.02189568 + t*( -0.01062446 + t*( 0.00587872 + t*( -0.00251540 + t*0.00053208 ) ) ) ) ) );
+}
+
+
+static double bessel_k1( double x )
+{
+	if ( x <= 2.0 )
+	{
+		const double t = ( x / 2.0 ) * ( x / 2.0 );
+		return log( x / 2.0 ) * bessel_i1( x ) + ( 1.0 / x ) *
+			( 1.0 + t*( 0.15443144 + t*( -0.67278579 + t*( -0.18156897 + t*( -0.01919402 + t*( -0.00110404 + t*-0.00004686 ) ) ) ) ) );
+	}
+	const double t = 2.0 / x;
+	return exp( -x ) / sqrt( x ) *
+		( 1.25331414 + t*( 0.23498619 + t*( -0.03655620 + t*( 0.01504268 + t*( -0.00780353 + t*( 0.00325614 + t*-0.00068245 ) ) ) ) ) );
+}
+
+
+//! Fraction of the mass of the model inside radius r. For the spheres, that is in three dimensions, for the disk in the plane.
+static double enclosed_fraction( int model, double r, double a )
+{
+	switch ( model )
+	{
+		case GENERATOR_PLUMMER:
+			return r*r*r / pow( r*r + a*a, 1.5 );
+		case GENERATOR_HERNQUIST:
+			return ( r / ( r + a ) ) * ( r / ( r + a ) );
+		case GENERATOR_EXPDISK:
+			return 1.0 - ( 1.0 + r / a ) * exp( -r / a );
+	}
+	return 1.0;
+}
+
+
+//! Radius of the exponential disk within which a fraction u of its mass lies, by bisection.
+static double expdisk_radius( double u, double rd, double cutoff )
+{
+	double lo = 0.0;
+	double hi = cutoff;
+	for ( int i=0; i<40; ++i )
+	{
+		const double mid = 0.5 * ( lo + hi );
+		if ( enclosed_fraction( GENERATOR_EXPDISK, mid, rd ) < u )
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return 0.5 * ( lo + hi );
+}
+
+
+//! Square of the isotropic velocity dispersion of a Hernquist sphere at radius r (Hernquist 1990, eq. 10.)
+static double hernquist_dispersion_sqr( double gm, double r, double a )
+{
+	const double x = r / a;
+	if ( x < 1e-6 )
+		return 0.0;
+	if ( x > 100.0 )
+		return gm / ( 5.0 * r );	// far out, where the sum below cancels.
+	const double x1 = 1.0 + x;
+	const double s = 12.0 * x * x1*x1*x1 * log1p( 1.0 / x ) - x / x1 * ( 25.0 + x*( 52.0 + x*( 42.0 + x*12.0 ) ) );
+	return gm / ( 12.0 * a ) * ( s > 0.0 ? s : 0.0 );
+}
+
+
+//! Draw a velocity for a sphere with dispersion sigma, below the escape velocity. Only the components in the plane are kept.
+static void sphere_velocity( uint64_t& s, double sigma, double vesc, double& vx, double& vy )
+{
+	const double maxsqr = MAXESCAPE * MAXESCAPE * vesc * vesc;
+	for ( int attempt=0; attempt<16; ++attempt )
+	{
+		vx = sigma * rng_normal( s );
+		vy = sigma * rng_normal( s );
+		const double vz = sigma * rng_normal( s );
+		if ( vx*vx + vy*vy + vz*vz < maxsqr )
+			return;
+	}
+	vx = vy = 0.0;
+}
+
+
+typedef struct
+{
+	const generator_t* g;
+	float* px;
+	float* py;
+	float* vx;
+	float* vy;
+	double maxfraction;	//! fraction of the mass of the model within the cutoff.
+	double gm;		//! G times the mass of the untruncated model.
+} drawing_t;
+
+
+static void draw_star( const drawing_t& d, uint64_t& s, double& x, double& y, double& vx, double& vy )
+{
+	const generator_t& g = *d.g;
+	const double a = g.scale;
+	const double u = d.maxfraction * rng_uniform( s );
+	switch ( g.model )
+	{
+		case GENERATOR_PLUMMER:
+		case GENERATOR_HERNQUIST:
+		{
+			double r;
+			if ( g.model == GENERATOR_PLUMMER )
+				r = a / sqrt( pow( u, -2.0 / 3.0 ) - 1.0 );
+			else
+				r = a * sqrt( u ) / ( 1.0 - sqrt( u ) );
+			// A direction in three dimensions, projected onto the plane.
+			const double cost = 2.0 * rng_uniform( s ) - 1.0;
+			const double phi = 2.0 * M_PI * rng_uniform( s );
+			const double rr = r * sqrt( 1.0 - cost * cost );
+			x = rr * cos( phi );
+			y = rr * sin( phi );
+			double sigma, vesc;
+			if ( g.model == GENERATOR_PLUMMER )
+			{
+				const double ra = sqrt( r*r + a*a );
+				sigma = sqrt( d.gm / ( 6.0 * ra ) );
+				vesc = sqrt( 2.0 * d.gm / ra );
+			}
+			else
+			{
+				sigma = sqrt( hernquist_dispersion_sqr( d.gm, r, a ) );
+				vesc = sqrt( 2.0 * d.gm / ( r + a ) );
+			}
+			sphere_velocity( s, sigma, vesc, vx, vy );
+			break;
+		}
+		case GENERATOR_EXPDISK:
+		{
+			const double r = expdisk_radius( u, a, g.cutoff );
+			const double phi = 2.0 * M_PI * rng_uniform( s );
+			x = r * cos( phi );
+			y = r * sin( phi );
+			// Circular velocity of a razor thin exponential disk (Freeman 1970.)
+			const double q = r / ( 2.0 * a );
+			const double bessel = q > 0.0 ? bessel_i0( q ) * bessel_k0( q ) - bessel_i1( q ) * bessel_k1( q ) : 0.0;
+			const double vc = sqrt( fmax( 0.0, 2.0 * d.gm / a * q * q * bessel ) );
+			const double vr = g.dispersion * vc * rng_normal( s );
+			const double vt = g.spin * vc + g.dispersion * vc * rng_normal( s );
+			const double cp = cos( phi );
+			const double sp = sin( phi );
+			vx = vr * cp - vt * sp;
+			vy = vr * sp + vt * cp;
+			break;
+		}
+		default:
+		{
+			const double r = g.cutoff * sqrt( rng_uniform( s ) );
+			const double phi = 2.0 * M_PI * rng_uniform( s );
+			x = r * cos( phi );
+			y = r * sin( phi );
+			vx = vy = 0.0;
+			break;
+		}
+	}
+}
+
+
+static void draw_share( int share, void* ctx )
+{
+	const drawing_t& d = *(const drawing_t*) ctx;
+	const generator_t& g = *d.g;
+	const int i0 = (int) ( (long long) g.numstars * share / NUMSHARES );
+	const int i1 = (int) ( (long long) g.numstars * ( share+1 ) / NUMSHARES );
+	for ( int i=i0; i<i1; ++i )
+	{
+		uint64_t s = (uint64_t) g.seed * 0xd1b54a32d192ed03ULL ^ (uint64_t) ( i+1 ) * 0x9e3779b97f4a7c15ULL;
+		rng_next( s );
+		double x, y, vx, vy;
+		draw_star( d, s, x, y, vx, vy );
+		d.px[ i ] = (float) ( g.centre[ 0 ] + x );
+		d.py[ i ] = (float) ( g.centre[ 1 ] + y );
+		d.vx[ i ] = (float) ( g.velocity[ 0 ] + vx );
+		d.vy[ i ] = (float) ( g.velocity[ 1 ] + vy );
+	}
+}
+
+
+//! Scale the velocities of the stars around the bulk velocity, to reach the virial ratio.
+static void virialise( const generator_t* g, float* px, float* py, float* vx, float* vy )
+{
+	const int n = g->numstars;
+	if ( n < 2 )
+		return;
+	double kinetic = 0.0;
+	for ( int i=0; i<n; ++i )
+	{
+		const double dvx = vx[ i ] - g->velocity[ 0 ];
+		const double dvy = vy[ i ] - g->velocity[ 1 ];
+		kinetic += 0.5 * ( dvx*dvx + dvy*dvy );
+	}
+	uint64_t s = (uint64_t) g->seed * 0x94d049bb133111ebULL;
+	double sum = 0.0;
+	for ( int p=0; p<NUMPAIRS; ++p )
+	{
+		const int i = (int) ( rng_next( s ) % n );
+		int j = (int) ( rng_next( s ) % ( n-1 ) );
+		j += j >= i;
+		const double dx = px[ i ] - px[ j ];
+		const double dy = py[ i ] - py[ j ];
+		const double d = sqrt( dx*dx + dy*dy );
+		sum += 1.0 / ( d > FORCEKERNEL_MINDIST ? d : FORCEKERNEL_MINDIST );
+	}
+	const double potential = STARS_G * 0.5 * n * ( n-1.0 ) * sum / NUMPAIRS;
+	if ( kinetic <= 0.0 )
+		return;
+	const float f = (float) sqrt( g->virial * potential / kinetic );
+	for ( int i=0; i<n; ++i )
+	{
+		vx[ i ] = g->velocity[ 0 ] + f * ( vx[ i ] - g->velocity[ 0 ] );
+		vy[ i ] = g->velocity[ 1 ] + f * ( vy[ i ] - g->velocity[ 1 ] );
+	}
+	LOGI( "Scaled the velocities of the %s sphere by %.3f to a virial ratio of %.2f.", generator_names[ g->model ], f, g->virial );
+}
+
+
+void generator_defaults( generator_t* g, int model, int numstars, unsigned int seed )
+{
+	memset( g, 0, sizeof( generator_t ) );
+	g->model = model;
+	g->numstars = numstars;
+	g->scale = 1.0f;
+	g->cutoff = GRIDRES / 2.2f;
+	g->dispersion = 0.1f;
+	g->spin = 1.0f;
+	g->virial = 0.5f;
+	g->seed = seed;
+}
+
+
+void generator_run( const generator_t* g, float* px, float* py, float* vx, float* vy, int first )
+{
+	ASSERT( g->model >= 0 && g->model < GENERATOR_NUMMODELS );
+	ASSERT( g->scale > 0.0f && g->cutoff > 0.0f );
+	drawing_t d;
+	d.g = g;
+	d.px = px + first;
+	d.py = py + first;
+	d.vx = vx + first;
+	d.vy = vy + first;
+	d.maxfraction = enclosed_fraction( g->model, g->cutoff, g->scale );
+	// The stars make up the part of the model within the cutoff.
+	d.gm = STARS_G * g->numstars / d.maxfraction;
+	stars_parallel( NUMSHARES, draw_share, &d );
+	const bool sphere = g->model == GENERATOR_PLUMMER || g->model == GENERATOR_HERNQUIST;
+	if ( sphere && g->virial > 0.0f )
+		virialise( g, d.px, d.py, d.vx, d.vy );
+}
@@ -0,0 +1,50 @@
+// generators.h
+//
+// Star fields drawn from standard models of galaxies and clusters, for benchmarking on realistic distributions.
+//
+// The stars move in the plane, under the 1/r^2 gravity of the simulation. The spheres (Plummer and Hernquist) are drawn
+// in three dimensions and projected onto the plane: positions from their cumulative mass profile, and velocities from
+// the isotropic dispersion that solves the Jeans equation for the sphere. That gives the right surface density, but
+// not an equilibrium of the flattened system, which is bound more tightly. So the velocities are then scaled to a virial
+// ratio of 1/2, with the potential energy estimated from a sample of pairs of stars.
+// The exponential disk is thin to begin with, and rotates at the circular velocity of a razor thin exponential disk.
+//
+// Every star draws its random numbers from a stream of its own, seeded with the seed and its index, so the same seed
+// gives the same stars, however many threads draw them.
+
+#ifndef GENERATORS_H
+#define GENERATORS_H
+
+enum
+{
+	GENERATOR_PLUMMER=0,	//! Plummer sphere with scale radius a.
+	GENERATOR_HERNQUIST,	//! Hernquist sphere with scale radius a.
+	GENERATOR_EXPDISK,	//! exponential disk with scale length Rd, in rotation.
+	GENERATOR_UNIFORM,	//! stars at rest, evenly spread over a disk: a cold collapse.
+	GENERATOR_NUMMODELS
+};
+
+//! Names of the models, for reports.
+extern const char* const generator_names[ GENERATOR_NUMMODELS ];
+
+typedef struct
+{
+	int model;		//! GENERATOR_PLUMMER, ...
+	int numstars;
+	float scale;		//! scale radius of the model, in cells. Not used by GENERATOR_UNIFORM.
+	float cutoff;		//! no stars further than this from the centre.
+	float centre[ 2 ];
+	float velocity[ 2 ];	//! bulk velocity, added to that of every star.
+	float dispersion;	//! exponential disk: random velocity per component, as a fraction of the circular velocity.
+	float spin;		//! exponential disk: 1 to rotate counter clockwise, -1 for clockwise.
+	float virial;		//! spheres: scale the velocities to this ratio of kinetic to potential energy. 0 keeps the dispersions of the sphere.
+	unsigned int seed;
+} generator_t;
+
+//! Set the defaults for a model: a single system in the centre of the grid, at rest, with a scale radius of 1.
+extern void generator_defaults( generator_t* g, int model, int numstars, unsigned int seed );
+
+//! Draw the stars of a model into elements first .. first+numstars-1 of the arrays, on the worker threads of the simulation.
+extern void generator_run( const generator_t* g, float* px, float* py, float* vx, float* vy, int first );
+
+#endif
@@ -4,7 +4,7 @@
 #include "glpr.h"
 #include "text.h"
 
-#define NUML	14
+#define NUML	29
 const char* keys[NUML][2] =
 {
 	"F1",		"Toggle Help.",
@@ -21,20 +21,37 @@ const char* keys[NUML][2] =
 	"1..5",		"Set Brush Size.",
 	"C",		"Clear Stars.",
 	"F2",		"Spawn Demo.",
+	"F3",		"Spawn Next Scenario.",
+	"F5",		"Save Checkpoint.",
+	"F9",		"Restore Checkpoint.",
+	"K",		"Cycle Force Accuracy.",
+	"E",		"Toggle Energy Diagnostics.",
+	"I",		"Cycle Integrator.",
+	"T",		"Toggle Phase Timers.",
+	"M",		"Cycle Cost Heatmap.",
+	"W",		"Toggle Worker Ownership.",
+	"S",		"Toggle Step Series Recording.",
+	"R",		"Toggle Trajectory Recording.",
+	"O",		"Toggle Publishing to Shared Memory.",
+	"L",		"Toggle Input Recording.",
+	"V",		"Toggle Rewind History.",
+	"Z",		"Rewind One Second.",
 };
 
 
 void help_draw( void )
 {
+	// Shrink the line spacing when the list no longer fits at the default spacing.
+	const float spacing = NUML * 0.14f > 1.82f ? 1.82f / NUML : 0.14f;
 	for ( int i=0; i<NUML; ++i )
 	{
 		const char* key = keys[i][0];
 		const char* fun = keys[i][1];
-		const float th = 0.08f;
-		const float tw = 0.04f;
+		const float th = 0.08f * spacing / 0.14f;
+		const float tw = 0.04f * spacing / 0.14f;
 
-		text_draw_string( key, vec3_t(-0.68f,0.9f-i*0.14f,0), vec3_t(tw,th,0), "right", "center", -1 );
-		text_draw_string( fun, vec3_t(-0.58f,0.9f-i*0.14f,0), vec3_t(tw,th,0), "left",  "center", -1 );
+		text_draw_string( key, vec3_t(-0.68f,0.9f-i*spacing,0), vec3_t(tw,th,0), "right", "center", -1 );
+		text_draw_string( fun, vec3_t(-0.58f,0.9f-i*spacing,0), vec3_t(tw,th,0), "left",  "center", -1 );
 	}
 }
 
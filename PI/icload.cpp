@@ -0,0 +1,492 @@
+// icload.cpp
+//
+// Loads initial conditions for large fields from a file, instead of spawning them star by star.
+
+#include "icload.h"
+#include "stars.h"
+#include "wallclock.h"
+
+// From GBase
+#include "logx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined( linux )
+#	include <fcntl.h>
+#	include <unistd.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#endif
+
+
+#define NUMCELLS	( GRIDRES * GRIDRES )
+
+//! The file is split into this many shares for binning.
+#define NUMSHARES	64
+
+//! The uid goes in the bits of st above the crossing flags and the level.
+#define MAXUIDS		( 1 << 23 )
+
+//! Size of the blocks in which a CSV file is read.
+#define CSVBLOCK	( 1 << 20 )
+
+
+//! The stars as read from the file, as arrays.
+typedef struct
+{
+	int numstars;
+	const float* px;
+	const float* py;
+	const float* vx;
+	const float* vy;
+	void* map;		//! mapping to release, if any.
+	size_t mapsize;
+	float* owned;		//! memory to release, if any.
+} input_t;
+
+
+static void release_input( input_t& in )
+{
+#if defined( linux )
+	if ( in.map )
+		munmap( in.map, in.mapsize );
+#endif
+	free( in.owned );
+	memset( &in, 0, sizeof( in ) );
+}
+
+
+//! Point the arrays of the input into a binary image.
+static bool adopt_binary( const char* fname, const char* image, size_t sz, input_t& in )
+{
+	const icload_header_t* hdr = (const icload_header_t*) image;
+	if ( hdr->version != ICLOAD_VERSION )
+	{
+		LOGE( "%s has version %u, expected %d.", fname, hdr->version, ICLOAD_VERSION );
+		return false;
+	}
+	const size_t n = hdr->numstars;
+	if ( n >= MAXUIDS || sz < sizeof( icload_header_t ) + 4 * n * sizeof( float ) )
+	{
+		LOGE( "%s is truncated, or holds too many stars: %u.", fname, hdr->numstars );
+		return false;
+	}
+	const float* arrays = (const float*) ( image + sizeof( icload_header_t ) );
+	in.numstars = (int) n;
+	in.px = arrays + 0 * n;
+	in.py = arrays + 1 * n;
+	in.vx = arrays + 2 * n;
+	in.vy = arrays + 3 * n;
+	return true;
+}
+
+
+#if defined( linux )
+
+static bool read_binary( const char* fname, input_t& in )
+{
+	const int fd = open( fname, O_RDONLY );
+	if ( fd < 0 )
+		return false;
+	struct stat st;
+	if ( fstat( fd, &st ) != 0 )
+	{
+		close( fd );
+		return false;
+	}
+	in.mapsize = st.st_size;
+	in.map = mmap( 0, in.mapsize, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if ( in.map == MAP_FAILED )
+	{
+		in.map = 0;
+		LOGE( "Cannot map %s", fname );
+		return false;
+	}
+	madvise( in.map, in.mapsize, MADV_SEQUENTIAL );
+	return adopt_binary( fname, (const char*) in.map, in.mapsize, in );
+}
+
+#else
+
+static bool read_binary( const char* fname, input_t& in )
+{
+	FILE* f = fopen( fname, "rb" );
+	if ( !f )
+		return false;
+	fseek( f, 0, SEEK_END );
+	const long sz = ftell( f );
+	fseek( f, 0, SEEK_SET );
+	in.owned = sz > 0 ? (float*) malloc( sz ) : 0;
+	const bool read = in.owned && fread( in.owned, 1, sz, f ) == (size_t) sz;
+	fclose( f );
+	return read && adopt_binary( fname, (const char*) in.owned, sz, in );
+}
+
+#endif
+
+
+//! Parse the next number of a CSV line, and step over the separator after it. Returns false if there is none.
+static bool parse_value( char*& s, float& v )
+{
+	char* end = 0;
+	v = strtof( s, &end );
+	if ( end == s )
+		return false;
+	s = end;
+	while ( *s == ' ' || *s == '\t' || *s == '\r' )
+		++s;
+	if ( *s == ',' || *s == ';' )
+		++s;
+	return true;
+}
+
+
+static bool read_csv( const char* fname, input_t& in )
+{
+	FILE* f = fopen( fname, "rb" );
+	if ( !f )
+		return false;
+
+	int cap = 1 << 16;
+	float* arrays = (float*) malloc( 4 * cap * sizeof( float ) );
+	int n = 0;
+	int linenr = 0;
+	bool ok = true;
+
+	// One extra byte, to terminate a last line without a newline.
+	char* block = (char*) malloc( CSVBLOCK + 1 );
+	size_t have = 0;
+	bool eof = false;
+	while ( ok && !eof )
+	{
+		const size_t got = fread( block + have, 1, CSVBLOCK - have, f );
+		have += got;
+		eof = got == 0 || feof( f );
+		char* line = block;
+		char* limit = block + have;
+		while ( ok && line < limit )
+		{
+			char* nl = (char*) memchr( line, '\n', limit - line );
+			if ( !nl )
+			{
+				if ( !eof )
+					break;
+				nl = limit;	// last line, without a newline.
+			}
+			*nl = 0;
+			linenr += 1;
+			char* s = line;
+			line = nl + 1;
+			while ( *s == ' ' || *s == '\t' )
+				++s;
+			if ( !( ( *s >= '0' && *s <= '9' ) || *s == '-' || *s == '+' || *s == '.' ) )
+				continue;	// header, comment or empty line.
+			if ( n == cap )
+			{
+				float* grown = (float*) malloc( 4 * 2 * cap * sizeof( float ) );
+				for ( int a=0; a<4; ++a )
+					memcpy( grown + a * 2 * cap, arrays + a * cap, cap * sizeof( float ) );
+				free( arrays );
+				arrays = grown;
+				cap *= 2;
+			}
+			float v[ 4 ] = { 0, 0, 0, 0 };
+			const bool haspos = parse_value( s, v[0] ) && parse_value( s, v[1] );
+			if ( haspos && *s && parse_value( s, v[2] ) && *s )
+				parse_value( s, v[3] );
+			if ( !haspos || *s )
+			{
+				LOGE( "%s:%d: expected x,y,vx,vy.", fname, linenr );
+				ok = false;
+				break;
+			}
+			if ( n >= MAXUIDS-1 )
+			{
+				LOGE( "%s holds too many stars.", fname );
+				ok = false;
+				break;
+			}
+			for ( int a=0; a<4; ++a )
+				arrays[ a * cap + n ] = v[ a ];
+			n += 1;
+		}
+		line = line > limit ? limit : line;
+		// Keep the partial line at the end, for the next block.
+		have = limit - line;
+		memmove( block, line, have );
+		if ( have == CSVBLOCK )
+		{
+			LOGE( "%s:%d: line too long.", fname, linenr+1 );
+			ok = false;
+		}
+	}
+	free( block );
+	fclose( f );
+
+	in.owned = arrays;
+	in.numstars = n;
+	in.px = arrays + 0 * cap;
+	in.py = arrays + 1 * cap;
+	in.vx = arrays + 2 * cap;
+	in.vy = arrays + 3 * cap;
+	return ok;
+}
+
+
+typedef struct
+{
+	const input_t* in;
+	int* cellof;				//! per star: index of its cell, or -1 if outside the grid.
+	int (*offsets)[ NUMCELLS ];		//! per share: counts per cell, then where its stars go.
+	int cellstart[ NUMCELLS + 1 ];		//! where the stars of each cell start in the sorted arrays.
+	float* spx;
+	float* spy;
+	float* svx;
+	float* svy;
+	int* sst;
+} binning_t;
+
+static binning_t bins;
+
+static const float zeros[ CELLCAP ] = { 0 };
+
+
+static inline int share_begin( int share, int n )
+{
+	return (int) ( (long long) n * share / NUMSHARES );
+}
+
+
+//! Find the cell of every star in a share, and count the stars per cell.
+static void count_share( int share, void* )
+{
+	const input_t& in = *bins.in;
+	int* counts = bins.offsets[ share ];
+	memset( counts, 0, NUMCELLS * sizeof( int ) );
+	const int i0 = share_begin( share, in.numstars );
+	const int i1 = share_begin( share+1, in.numstars );
+	for ( int i=i0; i<i1; ++i )
+	{
+		const float px = in.px[ i ];
+		const float py = in.py[ i ];
+		int c = -1;
+		// Also rules out NaN, and keeps floorf() in the range of int.
+		if ( fabsf( px ) <= GRIDRES && fabsf( py ) <= GRIDRES )
+		{
+			const int cx = POS2CELL( px );
+			const int cy = POS2CELL( py );
+			if ( cx >= 0 && cx < GRIDRES && cy >= 0 && cy < GRIDRES )
+				c = cx * GRIDRES + cy;
+		}
+		bins.cellof[ i ] = c;
+		if ( c >= 0 )
+			counts[ c ] += 1;
+	}
+}
+
+
+//! Scatter the stars of a share to their cells, keeping the order of the file within each cell.
+static void scatter_share( int share, void* )
+{
+	const input_t& in = *bins.in;
+	int* offsets = bins.offsets[ share ];
+	const int i0 = share_begin( share, in.numstars );
+	const int i1 = share_begin( share+1, in.numstars );
+	for ( int i=i0; i<i1; ++i )
+	{
+		const int c = bins.cellof[ i ];
+		if ( c < 0 )
+			continue;
+		const int k = offsets[ c ]++;
+		bins.spx[ k ] = in.px[ i ];
+		bins.spy[ k ] = in.py[ i ];
+		bins.svx[ k ] = in.vx[ i ];
+		bins.svy[ k ] = in.vy[ i ];
+		bins.sst[ k ] = i << 8;
+	}
+}
+
+
+//! Copy the sorted stars into the cells of a column.
+static void fill_column( int cx, void* )
+{
+	for ( int cy=0; cy<GRIDRES; ++cy )
+	{
+		const int c = cx * GRIDRES + cy;
+		const int k = bins.cellstart[ c ];
+		int cnt = bins.cellstart[ c+1 ] - k;
+		cnt = cnt > CELLCAP ? CELLCAP : cnt;
+		stars_load_cell( cx, cy, cnt, bins.spx+k, bins.spy+k, bins.svx+k, bins.svy+k, zeros, zeros, bins.sst+k, zeros );
+	}
+}
+
+
+//! Bin the stars into the cells, replacing the field.
+static void bin_stars( const input_t& in, icload_report_t& rep )
+{
+	const int n = in.numstars;
+	bins.in = &in;
+	bins.cellof = (int*) malloc( ( n ? n : 1 ) * sizeof( int ) );
+	bins.offsets = (int (*)[ NUMCELLS ]) malloc( NUMSHARES * sizeof( *bins.offsets ) );
+
+	stars_parallel( NUMSHARES, count_share, 0 );
+
+	// Turn the counts into offsets: by cell, then by share, so that each cell keeps the order of the file.
+	int running = 0;
+	for ( int c=0; c<NUMCELLS; ++c )
+	{
+		bins.cellstart[ c ] = running;
+		for ( int s=0; s<NUMSHARES; ++s )
+		{
+			const int cnt = bins.offsets[ s ][ c ];
+			bins.offsets[ s ][ c ] = running;
+			running += cnt;
+		}
+		const int incell = running - bins.cellstart[ c ];
+		if ( incell > CELLCAP )
+		{
+			rep.fullcells += 1;
+			rep.overfull += incell - CELLCAP;
+		}
+		const int placed = incell > CELLCAP ? CELLCAP : incell;
+		rep.peakcell = placed > rep.peakcell ? placed : rep.peakcell;
+	}
+	bins.cellstart[ NUMCELLS ] = running;
+	rep.offgrid = n - running;
+	rep.numloaded = running - rep.overfull;
+
+	const size_t sz = ( running ? running : 1 ) * sizeof( float );
+	bins.spx = (float*) malloc( sz );
+	bins.spy = (float*) malloc( sz );
+	bins.svx = (float*) malloc( sz );
+	bins.svy = (float*) malloc( sz );
+	bins.sst = (int*) malloc( sz );
+
+	stars_parallel( NUMSHARES, scatter_share, 0 );
+
+	stars_clear();
+	stars_parallel( GRIDRES, fill_column, 0 );
+
+	// New uids continue after those in the file, and the accelerations need computing.
+	stars_state_t state;
+	stars_get_state( &state );
+	state.numcreated = n;
+	state.accstale = 1;
+	stars_set_state( &state );
+
+	free( bins.spx );
+	free( bins.spy );
+	free( bins.svx );
+	free( bins.svy );
+	free( bins.sst );
+	free( bins.cellof );
+	free( bins.offsets );
+	memset( &bins, 0, sizeof( bins ) );
+}
+
+
+static void log_left_out( const icload_report_t& rep )
+{
+	if ( rep.offgrid )
+		LOGE( "Left out %d stars outside the grid of %d x %d.", rep.offgrid, GRIDRES, GRIDRES );
+	if ( rep.overfull )
+		LOGE( "Left out %d stars beyond the capacity of %d stars in %d cells.", rep.overfull, CELLCAP, rep.fullcells );
+}
+
+
+bool icload_load( const char* fname, icload_report_t* report )
+{
+	icload_report_t rep;
+	memset( &rep, 0, sizeof( rep ) );
+	const double t0 = wallclock_seconds();
+
+	char magic[ 8 ] = { 0 };
+	FILE* f = fopen( fname, "rb" );
+	if ( !f )
+	{
+		LOGE( "Cannot open initial conditions %s", fname );
+		return false;
+	}
+	const bool isbinary = fread( magic, 1, 8, f ) == 8 && !memcmp( magic, "NBODYICS", 8 );
+	fclose( f );
+
+	input_t in;
+	memset( &in, 0, sizeof( in ) );
+	const bool ok = isbinary ? read_binary( fname, in ) : read_csv( fname, in );
+	if ( !ok )
+	{
+		LOGE( "Cannot read initial conditions from %s", fname );
+		release_input( in );
+		return false;
+	}
+	rep.numread = in.numstars;
+	const double t1 = wallclock_seconds();
+	rep.readtime = t1 - t0;
+
+	bin_stars( in, rep );
+	release_input( in );
+	rep.bintime = wallclock_seconds() - t1;
+
+	LOGI
+	(
+		"Loaded %d of %d stars from %s in %.3f s (read %.3f s, bin %.3f s). Fullest cell holds %d of %d.",
+		rep.numloaded, rep.numread, fname, rep.readtime + rep.bintime, rep.readtime, rep.bintime, rep.peakcell, CELLCAP
+	);
+	log_left_out( rep );
+	if ( report )
+		*report = rep;
+	return true;
+}
+
+
+int icload_place( int numstars, const float* px, const float* py, const float* vx, const float* vy, icload_report_t* report )
+{
+	ASSERT( numstars >= 0 && numstars < MAXUIDS );
+	icload_report_t rep;
+	memset( &rep, 0, sizeof( rep ) );
+	input_t in;
+	memset( &in, 0, sizeof( in ) );
+	in.numstars = numstars;
+	in.px = px;
+	in.py = py;
+	in.vx = vx;
+	in.vy = vy;
+	rep.numread = numstars;
+	const double t0 = wallclock_seconds();
+	bin_stars( in, rep );
+	rep.bintime = wallclock_seconds() - t0;
+	log_left_out( rep );
+	if ( report )
+		*report = rep;
+	return rep.numloaded;
+}
+
+
+bool icload_save_binary( const char* fname, int numstars, const float* px, const float* py, const float* vx, const float* vy )
+{
+	FILE* f = fopen( fname, "wb" );
+	if ( !f )
+	{
+		LOGE( "Cannot write initial conditions to %s", fname );
+		return false;
+	}
+	icload_header_t hdr;
+	memset( &hdr, 0, sizeof( hdr ) );
+	memcpy( hdr.magic, "NBODYICS", 8 );
+	hdr.version = ICLOAD_VERSION;
+	hdr.numstars = numstars;
+	const size_t n = numstars;
+	bool ok = fwrite( &hdr, sizeof( hdr ), 1, f ) == 1;
+	ok = ok && fwrite( px, sizeof( float ), n, f ) == n;
+	ok = ok && fwrite( py, sizeof( float ), n, f ) == n;
+	ok = ok && fwrite( vx, sizeof( float ), n, f ) == n;
+	ok = ok && fwrite( vy, sizeof( float ), n, f ) == n;
+	ok = fclose( f ) == 0 && ok;
+	if ( !ok )
+		LOGE( "Failed to write initial conditions to %s", fname );
+	return ok;
+}
@@ -0,0 +1,52 @@
+// icload.h
+//
+// Loads initial conditions for large fields from a file, instead of spawning them star by star.
+//
+// Two formats are read:
+//   Binary: an icload_header_t, followed by the arrays px, py, vx and vy, each holding numstars little endian floats.
+//   CSV: one star per line as x,y,vx,vy. Lines that do not start with a number, like a header or a # comment, are skipped.
+// A binary file is mapped, a CSV file is read in large blocks.
+//
+// The stars are binned into cells with a counting sort over the worker threads of the simulation: each thread counts
+// the stars per cell in its share of the file, and after a prefix sum, scatters them to their place.
+// Stars outside the grid, and stars beyond CELLCAP in a cell, are left out and reported.
+// The uid of a star is its index in the file.
+
+#ifndef ICLOAD_H
+#define ICLOAD_H
+
+#include <stdint.h>
+
+#define ICLOAD_VERSION	1
+
+typedef struct
+{
+	char magic[ 8 ];	//! NBODYICS
+	uint32_t version;
+	uint32_t numstars;
+	uint32_t reserved[ 2 ];
+} icload_header_t;
+
+typedef struct
+{
+	int numread;		//! stars in the file.
+	int numloaded;		//! stars placed in the grid.
+	int offgrid;		//! stars left out for being outside the grid.
+	int overfull;		//! stars left out for being beyond CELLCAP in their cell.
+	int fullcells;		//! cells that had more than CELLCAP stars.
+	int peakcell;		//! most stars placed in a single cell.
+	double readtime;	//! seconds spent reading and parsing.
+	double bintime;		//! seconds spent binning and copying into the cells.
+} icload_report_t;
+
+//! Replace the star field with the stars from a file. Returns false, and leaves the field alone, if the file cannot be read or parsed.
+//! Stars that cannot be placed do not make the load fail, but are counted in the report, and logged.
+extern bool icload_load( const char* fname, icload_report_t* report=0 );
+
+//! Replace the star field with stars from arrays, binned the same way as those from a file. Returns the number of stars placed.
+extern int icload_place( int numstars, const float* px, const float* py, const float* vx, const float* vy, icload_report_t* report=0 );
+
+//! Write stars to a binary initial conditions file. Returns false if it cannot be written.
+extern bool icload_save_binary( const char* fname, int numstars, const float* px, const float* py, const float* vx, const float* vy );
+
+#endif
@@ -0,0 +1,168 @@
+// inputlog.cpp
+//
+// Records and replays the commands that change the stars.
+
+#include "inputlog.h"
+#include "checkpoint.h"
+#include "stars.h"
+
+// From GBase
+#include "logx.h"
+#include "nfy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define MAXCMDLEN	256
+
+typedef struct
+{
+	int step;
+	char cmd[ MAXCMDLEN ];
+} command_t;
+
+static FILE* logfile = 0;
+static int numrecorded = 0;
+
+static command_t* commands = 0;
+static int numcommands = 0;
+static int nextcommand = 0;
+
+
+bool inputlog_open( const char* fname, float dt )
+{
+	inputlog_close();
+	char cpname[ 512 ];
+	snprintf( cpname, sizeof( cpname ), "%s.nbc", fname );
+	checkpoint_wait();
+	if ( !checkpoint_save( cpname ) )
+		return false;
+	checkpoint_wait();
+
+	logfile = fopen( fname, "w" );
+	if ( !logfile )
+	{
+		LOGE( "Cannot write input log %s", fname );
+		return false;
+	}
+	// The checkpoint is named relative to the log, so the two can be moved together.
+	const char* slash = strrchr( cpname, '/' );
+	fprintf( logfile, "nbody inputlog 1\n" );
+	fprintf( logfile, "checkpoint %s\n", slash ? slash+1 : cpname );
+	fprintf( logfile, "dt %.9g\n", dt );
+	numrecorded = 0;
+
+	// The checkpoint holds the integrator, but not its tolerance.
+	char cmd[ MAXCMDLEN ];
+	snprintf( cmd, sizeof( cmd ), "integrator mode=%d eta=%.9g", stars_integrator, stars_block_eta );
+	inputlog_record( cmd );
+	LOGI( "Recording input to %s from step %d.", fname, stars_get_step_nr() );
+	return true;
+}
+
+
+void inputlog_close( void )
+{
+	if ( !logfile )
+		return;
+	const int step = stars_get_step_nr();
+	fprintf( logfile, "end %d\n", step );
+	fclose( logfile );
+	logfile = 0;
+	LOGI( "Recorded %d commands, up to step %d.", numrecorded - 1, step );
+}
+
+
+bool inputlog_is_open( void )
+{
+	return logfile != 0;
+}
+
+
+void inputlog_record( const char* cmd )
+{
+	if ( !logfile )
+		return;
+	fprintf( logfile, "%d %s\n", stars_get_step_nr(), cmd );
+	// A session that ends in a crash is the one most worth replaying.
+	fflush( logfile );
+	numrecorded += 1;
+}
+
+
+bool inputlog_load( const char* fname, float* dt, int* endstep )
+{
+	FILE* f = fopen( fname, "r" );
+	if ( !f )
+	{
+		LOGE( "Cannot open input log %s", fname );
+		return false;
+	}
+	char line[ 512 ];
+	char cpname[ 512 ] = "";
+	*dt = 0.0f;
+	*endstep = -1;
+	numcommands = nextcommand = 0;
+	int cap = 0;
+	bool ok = fgets( line, sizeof( line ), f ) && !strncmp( line, "nbody inputlog 1", 16 );
+	while ( ok && fgets( line, sizeof( line ), f ) )
+	{
+		line[ strcspn( line, "\r\n" ) ] = 0;
+		if ( !strncmp( line, "checkpoint ", 11 ) )
+		{
+			// Relative to the directory of the log.
+			const char* slash = strrchr( fname, '/' );
+			const int dirlen = slash && line[ 11 ] != '/' ? (int) ( slash - fname ) + 1 : 0;
+			snprintf( cpname, sizeof( cpname ), "%.*s%s", dirlen, fname, line+11 );
+		}
+		else if ( !strncmp( line, "dt ", 3 ) )
+			*dt = (float) atof( line+3 );
+		else if ( !strncmp( line, "end ", 4 ) )
+			*endstep = atoi( line+4 );
+		else
+		{
+			char* cmd = 0;
+			const int step = (int) strtol( line, &cmd, 10 );
+			ok = cmd != line && *cmd == ' ' && strlen( cmd+1 ) < MAXCMDLEN;
+			if ( !ok )
+				break;
+			if ( numcommands == cap )
+			{
+				cap = cap ? 2 * cap : 1024;
+				commands = (command_t*) realloc( commands, cap * sizeof( command_t ) );
+			}
+			commands[ numcommands ].step = step;
+			strcpy( commands[ numcommands ].cmd, cmd+1 );
+			numcommands += 1;
+		}
+	}
+	fclose( f );
+	if ( !ok || !cpname[ 0 ] || *dt <= 0.0f )
+	{
+		LOGE( "Input log %s is not valid, at: %s", fname, line );
+		return false;
+	}
+	if ( !checkpoint_load( cpname ) )
+		return false;
+	// A log that was cut short, by a crash, ends at its last command.
+	if ( *endstep < 0 )
+		*endstep = numcommands ? commands[ numcommands-1 ].step : stars_get_step_nr();
+	LOGI( "Replaying %d commands of %s, from step %d to step %d.", numcommands, fname, stars_get_step_nr(), *endstep );
+	return true;
+}
+
+
+int inputlog_apply( void )
+{
+	const int step = stars_get_step_nr();
+	int applied = 0;
+	while ( nextcommand < numcommands && commands[ nextcommand ].step <= step )
+	{
+		nfy_msg( commands[ nextcommand ].cmd );
+		nextcommand += 1;
+		applied += 1;
+	}
+	return applied;
+}
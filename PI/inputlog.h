@@ -0,0 +1,43 @@
+// inputlog.h
+//
+// Records the commands that change the stars during a session, so that it can be replayed, as a benchmark or to chase a bug.
+//
+// An input log is a text file. It names a checkpoint of the stars at the start of the recording, which is saved next to it,
+// followed by a line per command: the step nr it was applied at, and the command as an nfy message, like
+//
+//   nbody inputlog 1
+//   checkpoint session.nbr.nbc
+//   dt 0.00833333377
+//   1200 integrator mode=0 eta=0.0199999996
+//   1311 sprinkle x=0.252812505 y=-0.117187500 radius=0.0250000004 addrot=1 count=12 world=1
+//   1388 blackhole toggle=1
+//   end 2400
+//
+// Commands are recorded after the handler resolved them: positions in grid coordinates, and scenarios by nr and seed,
+// so that a replay does not depend on the camera, or on what was spawned before.
+// nbody-sim replay=FILE restores the checkpoint, and steps with the same dt, handing each command to nfy_msg() before the
+// step with its nr. As the steps only depend on the stars and the commands, that gives the same stars, bit for bit.
+
+#ifndef INPUTLOG_H
+#define INPUTLOG_H
+
+//! Start recording, from the stars as they are now, which are saved as fname.nbc. Returns false if either file cannot be written.
+extern bool inputlog_open( const char* fname, float dt );
+
+//! Note the step nr the recording ends at, and close the file.
+extern void inputlog_close( void );
+
+//! True while recording.
+extern bool inputlog_is_open( void );
+
+//! Record a command, at the current step nr. Does nothing unless recording.
+extern void inputlog_record( const char* cmd );
+
+//! Restore the checkpoint of an input log, and read its commands, to replay them with inputlog_apply().
+//! Returns the dt and the step nr the recording ended at. Returns false if the log or its checkpoint cannot be read.
+extern bool inputlog_load( const char* fname, float* dt, int* endstep );
+
+//! Hand the commands recorded at the current step nr to nfy_msg(). Call before each step. Returns the number of commands.
+extern int inputlog_apply( void );
+
+#endif
@@ -0,0 +1,220 @@
+// kernelbench.cpp
+//
+// Microbenchmark for the force kernel on its own, without gather, transits or aggregation.
+// Feeds every compiled kernel variant synthetic source and target arrays, the way the
+// inner loop of cell_update() does, and sweeps the number of sources.
+//
+// Usage: kernelbench [key=value ...]
+//
+//   targets=N      Number of stars that the sources pull on. (default: 256)
+//   minsrc=N       Smallest number of sources in the sweep. (default: 16)
+//   maxsrc=N       Largest number of sources in the sweep. (default: MAXSOURCES)
+//   mintime=S      Seconds to run each measurement for, at least. (default: 0.05)
+//   csv=FILE       Write the results as CSV. (default: kernelbench.csv)
+
+#include "stars.h"
+#include "forcekernel.h"
+#include "wallclock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#if defined( MSWIN )
+#       define ALIGNEDPRE __declspec(align(64))
+#       define ALIGNEDPST
+#else
+#       define ALIGNEDPRE
+#       define ALIGNEDPST __attribute__ ((aligned (64)))
+#endif
+
+#define MAXTARGETS	CELLCAP
+
+// Sources are padded to a multiple of 16, a whole number of batches for every kernel variant that is swept.
+#define MAXPADDED	( ( MAXSOURCES + 15 ) & ~15 )
+
+ALIGNEDPRE static float src_x  [ MAXPADDED ] ALIGNEDPST;
+ALIGNEDPRE static float src_y  [ MAXPADDED ] ALIGNEDPST;
+ALIGNEDPRE static float src_scl[ MAXPADDED ] ALIGNEDPST;
+
+static float tgt_x[ MAXTARGETS ];
+static float tgt_y[ MAXTARGETS ];
+
+//! Keeps the compiler from optimizing the kernel calls away.
+static volatile float sink;
+
+
+typedef force_t (*kernel_fn)( float curx, float cury, const float* src_x, const float* src_y, const float* src_scl, int numsrc );
+
+//! One pass of the kernel over all targets. The kernel is a template argument, so that it gets inlined like in cell_update().
+template <kernel_fn KERNEL>
+static void kernel_pass( int numtargets, int numsrc )
+{
+	float sx = 0.0f;
+	float sy = 0.0f;
+	for ( int i=0; i<numtargets; ++i )
+	{
+		const force_t f = KERNEL( tgt_x[i], tgt_y[i], src_x, src_y, src_scl, numsrc );
+		sx += f.x;
+		sy += f.y;
+	}
+	sink = sx + sy;
+}
+
+typedef void (*pass_fn)( int numtargets, int numsrc );
+
+
+//! A compiled variant of the kernel: instruction set and accuracy tier.
+typedef struct
+{
+	const char* isa;
+	int tier;
+	pass_fn pass;
+} kernelvariant_t;
+
+static const kernelvariant_t variants[] =
+{
+	{ "scalar", KERNEL_APPROX,  kernel_pass< forcekernel_scalar<KERNEL_APPROX>  > },
+	{ "scalar", KERNEL_NEWTON,  kernel_pass< forcekernel_scalar<KERNEL_NEWTON>  > },
+	{ "scalar", KERNEL_PRECISE, kernel_pass< forcekernel_scalar<KERNEL_PRECISE> > },
+#if defined( __AVX2__ )
+	{ "avx2",   KERNEL_APPROX,  kernel_pass< forcekernel_avx2<KERNEL_APPROX>    > },
+	{ "avx2",   KERNEL_NEWTON,  kernel_pass< forcekernel_avx2<KERNEL_NEWTON>    > },
+	{ "avx2",   KERNEL_PRECISE, kernel_pass< forcekernel_avx2<KERNEL_PRECISE>   > },
+#endif
+#if defined( __AVX512F__ )
+	{ "avx512", KERNEL_APPROX,  kernel_pass< forcekernel_avx512<KERNEL_APPROX>  > },
+	{ "avx512", KERNEL_NEWTON,  kernel_pass< forcekernel_avx512<KERNEL_NEWTON>  > },
+	{ "avx512", KERNEL_PRECISE, kernel_pass< forcekernel_avx512<KERNEL_PRECISE> > },
+#endif
+};
+
+#define NUMVARIANTS	( (int) ( sizeof( variants ) / sizeof( variants[0] ) ) )
+
+
+//! Floating point operations per interaction, per tier.
+//! Counted from the SIMD kernels: 12 for distance, cube and accumulation, plus the reciprocal square root.
+//! rsqrt, sqrt and div count as one operation each; min and max do not count.
+static const int flops_per_interaction[ KERNEL_NUMTIERS ] =
+{
+	13,	// approx: rsqrt.
+	18,	// newton: rsqrt and five for the Newton-Raphson step.
+	14,	// precise: sqrt and div.
+};
+
+//! Every interaction reads x, y and mass of one source.
+static const int bytes_per_interaction = 3 * sizeof( float );
+
+
+//! Uniformly distributed value in [lo,hi).
+static float randrange( float lo, float hi )
+{
+	return lo + ( hi - lo ) * ( rand() / ( RAND_MAX + 1.0f ) );
+}
+
+
+//! Fill the sources and targets: targets in one cell, sources spread over its neighbourhood, like a gathered cell.
+static void fill_arrays( void )
+{
+	srand( 1 );
+	for ( int i=0; i<MAXPADDED; ++i )
+	{
+		src_x  [ i ] = randrange( -1.5f, 1.5f );
+		src_y  [ i ] = randrange( -1.5f, 1.5f );
+		src_scl[ i ] = randrange( 1.0f, 4.0f );
+	}
+	for ( int i=0; i<MAXTARGETS; ++i )
+	{
+		tgt_x[ i ] = randrange( -0.5f, 0.5f );
+		tgt_y[ i ] = randrange( -0.5f, 0.5f );
+	}
+}
+
+
+//! Time passes of a variant until mintime has passed. Returns the seconds per pass.
+static double time_variant( const kernelvariant_t& v, int numtargets, int numsrc, double mintime )
+{
+	v.pass( numtargets, numsrc );	// warm up the caches.
+	int reps = 0;
+	const double t0 = wallclock_seconds();
+	double elapsed = 0.0;
+	do
+	{
+		v.pass( numtargets, numsrc );
+		reps++;
+		elapsed = wallclock_seconds() - t0;
+	} while ( elapsed < mintime );
+	return elapsed / reps;
+}
+
+
+int main( int argc, char* argv[] )
+{
+	int numtargets = 256;
+	int minsrc = 16;
+	int maxsrc = MAXSOURCES;
+	double mintime = 0.05;
+	const char* csvname = "kernelbench.csv";
+
+	for ( int i=1; i<argc; ++i )
+	{
+		const char* a = argv[ i ];
+		if ( !strncmp( a, "targets=", 8 ) ) numtargets = atoi( a+8 );
+		else if ( !strncmp( a, "minsrc=", 7 ) ) minsrc = atoi( a+7 );
+		else if ( !strncmp( a, "maxsrc=", 7 ) ) maxsrc = atoi( a+7 );
+		else if ( !strncmp( a, "mintime=", 8 ) ) mintime = atof( a+8 );
+		else if ( !strncmp( a, "csv=", 4 ) ) csvname = a+4;
+		else
+		{
+			fprintf( stderr, "Bad argument '%s'. See the top of kernelbench.cpp for usage.\n", a );
+			return 1;
+		}
+	}
+	numtargets = numtargets < 1 ? 1 : numtargets > MAXTARGETS ? MAXTARGETS : numtargets;
+	maxsrc = maxsrc > MAXSOURCES ? MAXSOURCES : maxsrc;
+	minsrc = minsrc < 16 ? 16 : minsrc;
+
+	fill_arrays();
+
+	FILE* csv = fopen( csvname, "w" );
+	if ( csv )
+		fprintf( csv, "isa,tier,sources,targets,ns_per_interaction,interactions_per_s,gflops,bytes_per_interaction,working_set_bytes\n" );
+	else
+		fprintf( stderr, "Cannot write %s\n", csvname );
+
+	fprintf( stdout, "%d targets, VECTORIZE=%d\n", numtargets, VECTORIZE );
+	fprintf( stdout, "%-7s %-8s %8s %10s %14s %9s %10s %12s\n", "isa", "tier", "sources", "ns/inter", "interacts/s", "GFLOP/s", "bytes/int", "working set" );
+
+	for ( int v=0; v<NUMVARIANTS; ++v )
+	{
+		const kernelvariant_t& var = variants[ v ];
+		for ( int n=minsrc; ; n *= 2 )
+		{
+			// Round up to a whole number of 16-wide batches, as cell_gather() pads.
+			const int numsrc = n < maxsrc ? ( ( n + 15 ) & ~15 ) : ( ( maxsrc + 15 ) & ~15 );
+			const double secs = time_variant( var, numtargets, numsrc, mintime );
+			const double interactions = (double) numtargets * numsrc;
+			const double ips = interactions / secs;
+			const double gflops = ips * flops_per_interaction[ var.tier ] * 1e-9;
+			const int workingset = numsrc * bytes_per_interaction;
+			fprintf
+			(
+				stdout, "%-7s %-8s %8d %10.4f %14.4g %9.2f %10d %9.1f KB\n",
+				var.isa, forcekernel_tier_names[ var.tier ], numsrc, 1e9 / ips, ips, gflops, bytes_per_interaction, workingset / 1024.0
+			);
+			if ( csv )
+				fprintf
+				(
+					csv, "%s,%s,%d,%d,%.5f,%.6g,%.4f,%d,%d\n",
+					var.isa, forcekernel_tier_names[ var.tier ], numsrc, numtargets, 1e9 / ips, ips, gflops, bytes_per_interaction, workingset
+				);
+			if ( n >= maxsrc )
+				break;
+		}
+	}
+
+	if ( csv )
+		fclose( csv );
+	return 0;
+}
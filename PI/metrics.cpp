@@ -0,0 +1,409 @@
+// metrics.cpp
+//
+// Optional listener that serves live statistics of the simulation, for monitoring a running process.
+
+#include "metrics.h"
+#include "stars.h"
+#include "phasetimers.h"
+#include "wallclock.h"
+
+// From GBase
+#include "logx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined( linux )
+#	include <pthread.h>
+#	include <poll.h>
+#	include <unistd.h>
+#	include <errno.h>
+#	include <sys/socket.h>
+#	include <sys/stat.h>
+#	include <sys/un.h>
+#	include <sys/resource.h>
+#	include <netinet/in.h>
+#	include <arpa/inet.h>
+#endif
+
+
+bool metrics_enabled = false;
+
+//! Rates and means are taken over a window of at least this many seconds.
+#define WINDOW		1.0
+
+enum
+{
+	METRICPHASE_AGGREGATION=0,
+	METRICPHASE_FORCES,
+	METRICPHASE_DRIFT,
+	METRICPHASE_SWAP,
+	METRICPHASE_TRANSITS,
+	METRICPHASE_AGEING,
+	METRICPHASE_NUMPHASES
+};
+
+static const char* const metricphase_names[ METRICPHASE_NUMPHASES ] =
+{
+	"aggregation",
+	"forces",
+	"drift",
+	"swap",
+	"transits",
+	"ageing",
+};
+
+
+//! What the listener serves. Written by the publishing thread, read by the listener, under the lock.
+typedef struct
+{
+	double uptime;				//! seconds since listening started.
+	int step;
+	double simtime;				//! simulated seconds.
+	int stars;
+	double step_ms;				//! wall time per step, over the window.
+	double phase_ms[ METRICPHASE_NUMPHASES ];	//! wall time per step in each phase, over the window.
+	double steps_per_s;
+	double transits_per_s;
+	double interactions_per_s;
+	long long transits;			//! summed since the stats were last reset.
+	int peakcell;				//! fullest cell in the last step.
+	int numthreads;				//! threads that recorded phase timings.
+	float busy[ PHASETIMERS_MAXTHREADS ];	//! share of wall time each thread spent in timed phases.
+	long long rss;				//! resident memory in bytes.
+	long long peakrss;
+} snapshot_t;
+
+#if defined( linux )
+
+static snapshot_t published;
+
+// Owned by the publishing thread.
+static snapshot_t pending;
+static stars_stats_t windowstats;
+static double windowstart = -1.0;
+static double liststart = 0.0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t listener;
+static int listenfd = -1;
+static char socketpath[ 108 ];
+static volatile bool quit = false;
+
+
+static void read_memory( long long* rss, long long* peakrss )
+{
+	*rss = 0;
+	FILE* f = fopen( "/proc/self/statm", "r" );
+	if ( f )
+	{
+		long long size=0, resident=0;
+		if ( fscanf( f, "%lld %lld", &size, &resident ) == 2 )
+			*rss = resident * sysconf( _SC_PAGESIZE );
+		fclose( f );
+	}
+	struct rusage usage;
+	*peakrss = getrusage( RUSAGE_SELF, &usage ) == 0 ? 1024LL * usage.ru_maxrss : 0;
+}
+
+
+//! Append to a reply. Output beyond the buffer is dropped.
+#define APPEND( ... ) \
+	if ( len < sz ) len += snprintf( buf+len, sz-len, __VA_ARGS__ );
+
+
+static int format_text( const snapshot_t& s, char* buf, int sz )
+{
+	int len = 0;
+	APPEND( "nbody_uptime_seconds %.3f\n", s.uptime );
+	APPEND( "nbody_step %d\n", s.step );
+	APPEND( "nbody_sim_time_seconds %.5f\n", s.simtime );
+	APPEND( "nbody_stars %d\n", s.stars );
+	APPEND( "nbody_step_ms %.4f\n", s.step_ms );
+	for ( int p=0; p<METRICPHASE_NUMPHASES; ++p )
+		APPEND( "nbody_phase_ms{phase=\"%s\"} %.4f\n", metricphase_names[ p ], s.phase_ms[ p ] );
+	APPEND( "nbody_steps_per_second %.3f\n", s.steps_per_s );
+	APPEND( "nbody_transits_per_second %.3f\n", s.transits_per_s );
+	APPEND( "nbody_interactions_per_second %.6g\n", s.interactions_per_s );
+	APPEND( "nbody_transits_total %lld\n", s.transits );
+	APPEND( "nbody_peak_cell %d\n", s.peakcell );
+	APPEND( "nbody_cell_capacity %d\n", CELLCAP );
+	for ( int t=0; t<s.numthreads; ++t )
+		APPEND( "nbody_thread_busy{thread=\"%d\"} %.4f\n", t, s.busy[ t ] );
+	APPEND( "nbody_resident_bytes %lld\n", s.rss );
+	APPEND( "nbody_peak_resident_bytes %lld\n", s.peakrss );
+	return len < sz ? len : sz-1;
+}
+
+
+static int format_json( const snapshot_t& s, char* buf, int sz )
+{
+	int len = 0;
+	APPEND( "{\"uptime_seconds\": %.3f, \"step\": %d, \"sim_time_seconds\": %.5f, \"stars\": %d, \"step_ms\": %.4f, ", s.uptime, s.step, s.simtime, s.stars, s.step_ms );
+	APPEND( "\"phase_ms\": {" );
+	for ( int p=0; p<METRICPHASE_NUMPHASES; ++p )
+		APPEND( "%s\"%s\": %.4f", p ? ", " : "", metricphase_names[ p ], s.phase_ms[ p ] );
+	APPEND( "}, \"steps_per_second\": %.3f, \"transits_per_second\": %.3f, \"interactions_per_second\": %.6g, ", s.steps_per_s, s.transits_per_s, s.interactions_per_s );
+	APPEND( "\"transits_total\": %lld, \"peak_cell\": %d, \"cell_capacity\": %d, ", s.transits, s.peakcell, CELLCAP );
+	APPEND( "\"thread_busy\": [" );
+	for ( int t=0; t<s.numthreads; ++t )
+		APPEND( "%s%.4f", t ? ", " : "", s.busy[ t ] );
+	APPEND( "], \"resident_bytes\": %lld, \"peak_resident_bytes\": %lld}\n", s.rss, s.peakrss );
+	return len < sz ? len : sz-1;
+}
+
+
+static void send_all( int fd, const char* buf, int len )
+{
+	while ( len > 0 )
+	{
+		const ssize_t n = send( fd, buf, len, MSG_NOSIGNAL );
+		if ( n <= 0 )
+			return;
+		buf += n;
+		len -= (int) n;
+	}
+}
+
+
+//! Read the request line, and answer it. A client that sends nothing within a second gets the text format.
+static void serve( int fd )
+{
+	char req[ 256 ];
+	int reqlen = 0;
+	while ( reqlen < (int) sizeof( req ) - 1 && !memchr( req, '\n', reqlen ) )
+	{
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if ( poll( &pfd, 1, 1000 ) <= 0 )
+			break;
+		const ssize_t n = recv( fd, req+reqlen, sizeof( req ) - 1 - reqlen, 0 );
+		if ( n <= 0 )
+			break;
+		reqlen += (int) n;
+	}
+	req[ reqlen ] = 0;
+	char* eol = strpbrk( req, "\r\n" );
+	if ( eol )
+		*eol = 0;
+
+	const bool http = !strncmp( req, "GET ", 4 );
+	const bool json = http ? strstr( req, ".json" ) != 0 : !strncmp( req, "json", 4 );
+
+	snapshot_t s;
+	pthread_mutex_lock( &lock );
+	s = published;
+	pthread_mutex_unlock( &lock );
+
+	static char body[ 8192 ];
+	const int len = json ? format_json( s, body, sizeof( body ) ) : format_text( s, body, sizeof( body ) );
+	if ( http )
+	{
+		char header[ 256 ];
+		const int hlen = snprintf
+		(
+			header, sizeof( header ),
+			"HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
+			json ? "application/json" : "text/plain; version=0.0.4", len
+		);
+		send_all( fd, header, hlen );
+	}
+	send_all( fd, body, len );
+}
+
+
+static void* listen_loop( void* )
+{
+	while ( !quit )
+	{
+		struct pollfd pfd = { listenfd, POLLIN, 0 };
+		if ( poll( &pfd, 1, 250 ) <= 0 )
+			continue;
+		const int fd = accept( listenfd, 0, 0 );
+		if ( fd < 0 )
+			continue;
+		serve( fd );
+		close( fd );
+	}
+	return 0;
+}
+
+
+//! Bind to a Unix domain socket. A stale socket file from an earlier run is replaced, any other file is left alone.
+static int bind_unix( const char* path )
+{
+	if ( strlen( path ) >= sizeof( socketpath ) )
+	{
+		LOGE( "Metrics socket path %s is too long.", path );
+		return -1;
+	}
+	struct stat st;
+	if ( stat( path, &st ) == 0 )
+	{
+		if ( !S_ISSOCK( st.st_mode ) )
+		{
+			LOGE( "Not replacing %s with the metrics socket: it is not a socket.", path );
+			return -1;
+		}
+		unlink( path );
+	}
+	const int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( fd < 0 )
+		return -1;
+	struct sockaddr_un addr;
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, path );
+	if ( bind( fd, (struct sockaddr*) &addr, sizeof( addr ) ) < 0 )
+	{
+		close( fd );
+		return -1;
+	}
+	strcpy( socketpath, path );
+	return fd;
+}
+
+
+//! Bind to a TCP port on the loopback interface only.
+static int bind_tcp( int port )
+{
+	const int fd = socket( AF_INET, SOCK_STREAM, 0 );
+	if ( fd < 0 )
+		return -1;
+	const int one = 1;
+	setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ) );
+	struct sockaddr_in addr;
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons( port );
+	addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	if ( bind( fd, (struct sockaddr*) &addr, sizeof( addr ) ) < 0 )
+	{
+		close( fd );
+		return -1;
+	}
+	return fd;
+}
+
+
+bool metrics_listen( const char* address )
+{
+	metrics_close();
+	if ( !strncmp( address, "unix:", 5 ) )
+		listenfd = bind_unix( address+5 );
+	else
+	{
+		const char* p = !strncmp( address, "tcp:", 4 ) ? address+4 : address;
+		const int port = atoi( p );
+		listenfd = port > 0 && port < 65536 ? bind_tcp( port ) : -1;
+	}
+	if ( listenfd < 0 || listen( listenfd, 8 ) < 0 )
+	{
+		LOGE( "Cannot serve metrics on %s: %s", address, strerror( errno ) );
+		metrics_close();
+		return false;
+	}
+
+	memset( &pending, 0, sizeof( pending ) );
+	memset( &published, 0, sizeof( published ) );
+	windowstart = -1.0;
+	liststart = wallclock_seconds();
+	quit = false;
+	if ( pthread_create( &listener, 0, listen_loop, 0 ) )
+	{
+		LOGE( "Cannot start the metrics listener." );
+		metrics_close();
+		return false;
+	}
+	metrics_enabled = true;
+	LOGI( "Serving metrics on %s", address );
+	return true;
+}
+
+
+void metrics_close( void )
+{
+	if ( metrics_enabled )
+	{
+		quit = true;
+		pthread_join( listener, 0 );
+		metrics_enabled = false;
+	}
+	if ( listenfd >= 0 )
+		close( listenfd );
+	listenfd = -1;
+	if ( socketpath[ 0 ] )
+		unlink( socketpath );
+	socketpath[ 0 ] = 0;
+}
+
+
+void metrics_publish( void )
+{
+	if ( !metrics_enabled )
+		return;
+	const double now = wallclock_seconds();
+	stars_stats_t s;
+	stars_get_stats( &s );
+
+	// Restart the window when the stats were reset under us.
+	if ( windowstart < 0 || s.steps < windowstats.steps )
+	{
+		windowstats = s;
+		windowstart = now;
+	}
+	const double elapsed = now - windowstart;
+	const int steps = s.steps - windowstats.steps;
+	if ( elapsed >= WINDOW )
+	{
+		const double perstep = steps ? 1000.0 / steps : 0.0;
+		pending.step_ms = perstep * ( s.total - windowstats.total );
+		pending.phase_ms[ METRICPHASE_AGGREGATION ] = perstep * ( s.aggregation - windowstats.aggregation );
+		pending.phase_ms[ METRICPHASE_FORCES ] = perstep * ( s.forces - windowstats.forces );
+		pending.phase_ms[ METRICPHASE_DRIFT ] = perstep * ( s.drift - windowstats.drift );
+		pending.phase_ms[ METRICPHASE_SWAP ] = perstep * ( s.swap - windowstats.swap );
+		pending.phase_ms[ METRICPHASE_TRANSITS ] = perstep * ( s.transits - windowstats.transits );
+		pending.phase_ms[ METRICPHASE_AGEING ] = perstep * ( s.ageing - windowstats.ageing );
+		pending.steps_per_s = steps / elapsed;
+		pending.transits_per_s = ( s.crossings - windowstats.crossings ) / elapsed;
+		pending.interactions_per_s = ( s.interactions - windowstats.interactions ) / elapsed;
+		pending.numthreads = phasetimers_numthreads();
+		for ( int t=0; t<pending.numthreads; ++t )
+			pending.busy[ t ] = phasetimers_busy( t );
+		read_memory( &pending.rss, &pending.peakrss );
+		windowstats = s;
+		windowstart = now;
+	}
+
+	stars_stats_t step;
+	stars_get_step_stats( &step );
+	pending.uptime = now - liststart;
+	pending.step = stars_get_step_nr( &pending.simtime );
+	pending.stars = stars_total_count();
+	pending.transits = s.crossings;
+	pending.peakcell = step.peakcell;
+
+	pthread_mutex_lock( &lock );
+	published = pending;
+	pthread_mutex_unlock( &lock );
+}
+
+#else
+
+bool metrics_listen( const char* address )
+{
+	LOGE( "Metrics are not supported on this platform." );
+	return false;
+}
+
+
+void metrics_close( void )
+{
+}
+
+
+void metrics_publish( void )
+{
+}
+
+#endif
@@ -0,0 +1,29 @@
+// metrics.h
+//
+// Optional listener that serves live statistics of the simulation, for monitoring a running process.
+// It listens on a Unix domain socket, or on a TCP port of localhost only.
+// A client sends one request line, and gets the metrics back, after which the connection closes:
+//
+//   text               Lines of "name value", in the Prometheus text format.
+//   json               One JSON object.
+//   GET /metrics       The text format, as an HTTP response, so that curl and scrapers work on the TCP port.
+//   GET /metrics.json  The JSON, as an HTTP response.
+//
+// The listener runs on a thread of its own, and only reads a snapshot that the main thread publishes.
+
+#ifndef METRICS_H
+#define METRICS_H
+
+//! Start listening. The address is "unix:PATH", "tcp:PORT", or a bare port number. Returns false if it cannot listen.
+extern bool metrics_listen( const char* address );
+
+//! Stop listening, and remove the socket file.
+extern void metrics_close( void );
+
+//! True while listening. Check this before calling metrics_publish(), so that the cost is nil when off.
+extern bool metrics_enabled;
+
+//! Take a snapshot of the statistics for the listener. Call it from the thread that steps the simulation, after the steps.
+extern void metrics_publish( void );
+
+#endif
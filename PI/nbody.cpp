@@ -0,0 +1,250 @@
+// nbody.cpp
+//
+// C API to embed the simulation in other programs. Each simulation is a universe of the stars module.
+
+#include "nbody.h"
+#include "stars.h"
+#include "forcekernel.h"
+#include "scenarios.h"
+#include "icload.h"
+
+// From GBase
+#include "logx.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if NBODY_GRIDRES != GRIDRES
+#	error "NBODY_GRIDRES does not match GRIDRES."
+#endif
+
+
+struct nbody_sim
+{
+	stars_universe_t* universe;
+};
+
+static bool started = false;
+
+
+static int find_name( const char* name, const char* const* names, int count )
+{
+	for ( int i=0; i<count; ++i )
+		if ( !strcmp( name, names[ i ] ) )
+			return i;
+	return -1;
+}
+
+
+int nbody_init( int numthreads )
+{
+	if ( started )
+		return 0;
+	numthreads = numthreads > 0 ? numthreads : (int) sysconf( _SC_NPROCESSORS_ONLN );
+	stars_init( false );
+	stars_set_threads( numthreads );
+	stars_create();
+	started = true;
+	return 1;
+}
+
+
+void nbody_exit( void )
+{
+	if ( started )
+		stars_exit();
+	started = false;
+}
+
+
+int nbody_set( const char* setting )
+{
+	const char* a = setting;
+	if ( !strncmp( a, "tier=", 5 ) )
+	{
+		const int tier = find_name( a+5, forcekernel_tier_names, KERNEL_NUMTIERS );
+		stars_kernel_tier = tier >= 0 ? tier : stars_kernel_tier;
+		return tier >= 0;
+	}
+	if ( !strncmp( a, "integrator=", 11 ) )
+	{
+		const int integrator = find_name( a+11, stars_integrator_names, INTEGRATOR_NUMMODES );
+		stars_integrator = integrator >= 0 ? integrator : stars_integrator;
+		return integrator >= 0;
+	}
+	if ( !strncmp( a, "blackhole=", 10 ) )
+	{
+		stars_add_blackhole = atoi( a+10 ) != 0;
+		return 1;
+	}
+	if ( !strncmp( a, "eta=", 4 ) )
+	{
+		const float eta = (float) atof( a+4 );
+		stars_block_eta = eta > 0.0f ? eta : stars_block_eta;
+		return eta > 0.0f;
+	}
+	return 0;
+}
+
+
+nbody_sim_t* nbody_create( void )
+{
+	ASSERTM( started, "Call nbody_init() first." );
+	nbody_sim_t* sim = (nbody_sim_t*) malloc( sizeof( nbody_sim_t ) );
+	sim->universe = stars_universe_create();
+	return sim;
+}
+
+
+void nbody_free( nbody_sim_t* sim )
+{
+	if ( !sim )
+		return;
+	stars_universe_free( sim->universe );
+	free( sim );
+}
+
+
+int nbody_spawn( nbody_sim_t* sim, const char* scenario, int numstars, unsigned int seed )
+{
+	const int nr = scenario_find( scenario );
+	if ( nr < 0 )
+		return -1;
+	stars_universe_t* prev = stars_universe_select( sim->universe );
+	const unsigned int prevseed = scenario_seed;
+	scenario_seed = seed;
+	const int rv = scenario_spawn( nr, numstars );
+	scenario_seed = prevseed;
+	stars_universe_select( prev );
+	return rv;
+}
+
+
+int nbody_load( nbody_sim_t* sim, const char* fname )
+{
+	stars_universe_t* prev = stars_universe_select( sim->universe );
+	icload_report_t report;
+	const int rv = icload_load( fname, &report ) ? report.numloaded : -1;
+	stars_universe_select( prev );
+	return rv;
+}
+
+
+int nbody_place( nbody_sim_t* sim, int numstars, const float* px, const float* py, const float* vx, const float* vy )
+{
+	stars_universe_t* prev = stars_universe_select( sim->universe );
+	const int rv = icload_place( numstars, px, py, vx, vy );
+	stars_universe_select( prev );
+	return rv;
+}
+
+
+void nbody_step( nbody_sim_t* sim, float dt, int steps )
+{
+	stars_universe_t* prev = stars_universe_select( sim->universe );
+	for ( int i=0; i<steps; ++i )
+		stars_update( dt );
+	stars_universe_select( prev );
+}
+
+
+void nbody_step_all( nbody_sim_t* const* sims, int numsims, float dt, int steps )
+{
+	stars_universe_t** universes = (stars_universe_t**) malloc( ( numsims ? numsims : 1 ) * sizeof( stars_universe_t* ) );
+	for ( int i=0; i<numsims; ++i )
+		universes[ i ] = sims[ i ]->universe;
+	stars_ensemble_update( universes, numsims, dt, steps );
+	free( universes );
+}
+
+
+int nbody_count( nbody_sim_t* sim )
+{
+	stars_universe_t* prev = stars_universe_select( sim->universe );
+	const int rv = stars_total_count();
+	stars_universe_select( prev );
+	return rv;
+}
+
+
+int nbody_step_nr( nbody_sim_t* sim, double* time )
+{
+	stars_universe_t* prev = stars_universe_select( sim->universe );
+	const int rv = stars_get_step_nr( time );
+	stars_universe_select( prev );
+	return rv;
+}
+
+
+unsigned int nbody_generation( nbody_sim_t* sim )
+{
+	stars_universe_t* prev = stars_universe_select( sim->universe );
+	const unsigned int rv = stars_generation();
+	stars_universe_select( prev );
+	return rv;
+}
+
+
+//! Point a view at stars first .. first+count-1 of a cell.
+static void set_view( nbody_view_t* view, const cell_t* cell, int cx, int cy, int first, int count, unsigned int generation )
+{
+	view->px = cell->px + first;
+	view->py = cell->py + first;
+	view->vx = cell->vx + first;
+	view->vy = cell->vy + first;
+	view->age = cell->age + first;
+	view->st = cell->st + first;
+	view->count = count;
+	view->cx = cx;
+	view->cy = cy;
+	view->generation = generation;
+}
+
+
+int nbody_cell_view( nbody_sim_t* sim, int cx, int cy, nbody_view_t* view )
+{
+	if ( cx < 0 || cx >= GRIDRES || cy < 0 || cy >= GRIDRES )
+		return 0;
+	stars_universe_t* prev = stars_universe_select( sim->universe );
+	const unsigned int generation = stars_generation();
+	const cell_t* cell = stars_cell( cx, cy );
+	set_view( view, cell, cx, cy, 0, cell->cnt, generation );
+	stars_universe_select( prev );
+	return view->count;
+}
+
+
+int nbody_range_view( nbody_sim_t* sim, int first, int count, nbody_view_t* views, int maxviews )
+{
+	stars_universe_t* prev = stars_universe_select( sim->universe );
+	const unsigned int generation = stars_generation();
+	int numviews = 0;
+	int idx = 0;	// index of the first star in the cell.
+	for ( int cx=0; cx<GRIDRES && count > 0 && numviews < maxviews; ++cx )
+		for ( int cy=0; cy<GRIDRES && count > 0 && numviews < maxviews; ++cy )
+		{
+			const cell_t* cell = stars_cell( cx, cy );
+			const int cnt = cell->cnt;
+			if ( first < idx + cnt )
+			{
+				const int from = first - idx;
+				const int n = cnt - from < count ? cnt - from : count;
+				set_view( views + numviews++, cell, cx, cy, from, n, generation );
+				first += n;
+				count -= n;
+			}
+			idx += cnt;
+		}
+	stars_universe_select( prev );
+	return numviews;
+}
+
+
+int nbody_view_valid( nbody_sim_t* sim, const nbody_view_t* view )
+{
+	// The stars were read before this: keep those reads from moving past the load of the generation.
+	__atomic_thread_fence( __ATOMIC_ACQUIRE );
+	const unsigned int generation = nbody_generation( sim );
+	return generation == view->generation && ( generation & 1 ) == 0;
+}
@@ -0,0 +1,100 @@
+// nbody.h
+//
+// C API to embed the simulation in other programs, built as the shared library libnbody.so.
+//
+// Create a simulation, fill it with stars, step it, and read the stars in place through views: pointers straight into
+// the arrays of the cells, without copying. The stars live in a grid of NBODY_GRIDRES x NBODY_GRIDRES cells, and each cell
+// keeps its stars as separate arrays of x, y, vx, vy, age and status bits, so a view holds a pointer per array.
+//
+// A view stays valid until the simulation changes: a step moves stars within and between cells, and a spawn or load
+// replaces them. Every change moves the generation counter on, and a view remembers the generation it was taken at.
+// The generation is odd while a step, spawn or load is under way, so another thread can read while the simulation changes:
+// take the views, read, and check with nbody_view_valid() that nothing changed meanwhile. If it did, read again.
+//
+// All simulations share the worker threads, the settings, and the scratch space of spawning and loading. So drive all
+// of them from one thread: the calls that create, fill, step or free simulations are not reentrant, not even for different
+// simulations. To step many at once, use nbody_step_all(). Other threads may only take views, read them and check them.
+
+#ifndef NBODY_H
+#define NBODY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NBODY_GRIDRES	32	//! Cells along each side of the grid. Each cell is one unit wide, the grid is centred on 0,0.
+
+//! The uid of a star, from its status bits.
+#define NBODY_UID( ST )	( (ST) >> 8 )
+
+typedef struct nbody_sim nbody_sim_t;
+
+//! Stars in a cell, or a run of them, read in place.
+typedef struct
+{
+	const float* px;		//! x coordinates.
+	const float* py;		//! y coordinates.
+	const float* vx;		//! velocities, x component.
+	const float* vy;		//! velocities, y component.
+	const float* age;		//! time since each star was spawned.
+	const int* st;			//! status bits. NBODY_UID() gives the uid.
+	int count;			//! number of stars in the view.
+	int cx;				//! cell of the stars.
+	int cy;
+	unsigned int generation;	//! generation of the simulation when the view was taken.
+} nbody_view_t;
+
+//! Start the library with this many worker threads, or one per core when 0. Call once, before anything else. Returns 0 if it was started already.
+extern int nbody_init( int numthreads );
+
+//! Stop the worker threads.
+extern void nbody_exit( void );
+
+//! Change a setting, given as key=value, like on the command line of nbody-sim: tier=, integrator=, blackhole=0/1 or eta=. Applies to all simulations. Returns 0 if not understood.
+extern int nbody_set( const char* setting );
+
+//! Create a simulation without stars.
+extern nbody_sim_t* nbody_create( void );
+
+//! Free a simulation. Its views can no longer be read.
+extern void nbody_free( nbody_sim_t* sim );
+
+//! Replace the stars with a named scenario, as for nbody-sim scenario=NAME. With numstars 0, the default count of the scenario. Returns the number of stars, or -1 for an unknown scenario.
+extern int nbody_spawn( nbody_sim_t* sim, const char* scenario, int numstars, unsigned int seed );
+
+//! Replace the stars with those in an initial conditions file, binary or CSV (see icload.h.) Returns the number of stars, or -1 if the file cannot be read.
+extern int nbody_load( nbody_sim_t* sim, const char* fname );
+
+//! Replace the stars with these. Star i gets uid i. Returns the number of stars placed: stars outside the grid, or in a full cell, are left out.
+extern int nbody_place( nbody_sim_t* sim, int numstars, const float* px, const float* py, const float* vx, const float* vy );
+
+//! Take steps steps of dt.
+extern void nbody_step( nbody_sim_t* sim, float dt, int steps );
+
+//! Take steps steps of dt in each of numsims simulations, with each simulation on a worker of its own.
+extern void nbody_step_all( nbody_sim_t* const* sims, int numsims, float dt, int steps );
+
+//! Number of stars.
+extern int nbody_count( nbody_sim_t* sim );
+
+//! Number of steps taken, and optionally the simulated time.
+extern int nbody_step_nr( nbody_sim_t* sim, double* time );
+
+//! Goes up with every change to the stars. Odd while a step, spawn or load is under way.
+extern unsigned int nbody_generation( nbody_sim_t* sim );
+
+//! View the stars of cell cx,cy. Returns the number of stars in it.
+extern int nbody_cell_view( nbody_sim_t* sim, int cx, int cy, nbody_view_t* view );
+
+//! View stars first .. first+count-1, counting through the cells in order of cx, then cy. A run spans several cells,
+//! so it comes as one view per cell, at most maxviews. Returns the number of views filled in.
+extern int nbody_range_view( nbody_sim_t* sim, int first, int count, nbody_view_t* views, int maxviews );
+
+//! Whether the stars in a view are still those of the simulation: it did not change since the view was taken, and was not in the middle of a step.
+extern int nbody_view_valid( nbody_sim_t* sim, const nbody_view_t* view );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
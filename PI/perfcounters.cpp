@@ -0,0 +1,298 @@
+// perfcounters.cpp
+//
+// Optional hardware performance counters, read around the phases of the simulation step on every thread.
+
+#include "perfcounters.h"
+
+// From GBase
+#include "logx.h"
+
+#include <string.h>
+
+#if defined( linux )
+#	include <linux/perf_event.h>
+#	include <sys/syscall.h>
+#	include <sys/ioctl.h>
+#	include <unistd.h>
+#endif
+
+
+const char* const perfcounter_names[ PERFCOUNTER_NUMCOUNTERS ] =
+{
+	"cycles",
+	"instructions",
+	"l1d_misses",
+	"llc_refs",
+	"llc_misses",
+	"branch_misses",
+};
+
+const char* const perfphase_names[ PERFPHASE_NUMPHASES ] =
+{
+	"aggregation",
+	"forces",
+	"drift",
+	"swap",
+	"transits",
+	"ageing",
+};
+
+bool perfcounters_enabled = false;
+
+//! Set once a reading shows that the counters did not run all the time they were enabled.
+static bool multiplexed = false;
+
+
+//! The counters of one thread.
+typedef struct
+{
+	int fds[ PERFCOUNTER_NUMCOUNTERS ];		//! -1 for counters that could not be opened.
+	int slots[ PERFCOUNTER_NUMCOUNTERS ];		//! where each counter is in a group read, or -1.
+	int numopen;
+	perfsample_t totals[ PERFPHASE_NUMPHASES ];
+} perfthread_t;
+
+static perfthread_t threads[ PERFCOUNTERS_MAXTHREADS ];
+static int numthreads = 0;
+
+//! Which counters opened on the first thread, all threads are alike in this.
+static bool available[ PERFCOUNTER_NUMCOUNTERS ];
+
+
+#if defined( linux )
+
+//! Index of the calling thread in threads[]: -1 before its first use, -2 if its counters cannot be opened.
+static __thread int threadidx = -1;
+
+
+static void counter_attr( int counter, struct perf_event_attr* attr )
+{
+	memset( attr, 0, sizeof( *attr ) );
+	attr->size = sizeof( *attr );
+	attr->exclude_kernel = 1;
+	attr->exclude_hv = 1;
+	attr->read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	const unsigned long long cacheread = ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 );
+	switch ( counter )
+	{
+		case PERFCOUNTER_CYCLES:
+			attr->type = PERF_TYPE_HARDWARE;
+			attr->config = PERF_COUNT_HW_CPU_CYCLES;
+			break;
+		case PERFCOUNTER_INSTRUCTIONS:
+			attr->type = PERF_TYPE_HARDWARE;
+			attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+			break;
+		case PERFCOUNTER_L1D_MISSES:
+			attr->type = PERF_TYPE_HW_CACHE;
+			attr->config = PERF_COUNT_HW_CACHE_L1D | cacheread;
+			break;
+		case PERFCOUNTER_LLC_REFERENCES:
+			attr->type = PERF_TYPE_HARDWARE;
+			attr->config = PERF_COUNT_HW_CACHE_REFERENCES;
+			break;
+		case PERFCOUNTER_LLC_MISSES:
+			attr->type = PERF_TYPE_HW_CACHE;
+			attr->config = PERF_COUNT_HW_CACHE_LL | cacheread;
+			break;
+		case PERFCOUNTER_BRANCH_MISSES:
+			attr->type = PERF_TYPE_HARDWARE;
+			attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+			break;
+	}
+}
+
+
+//! Open a group of counters for the calling thread, with the cycle counter as leader.
+static bool open_group( perfthread_t& t )
+{
+	t.numopen = 0;
+	for ( int c=0; c<PERFCOUNTER_NUMCOUNTERS; ++c )
+	{
+		struct perf_event_attr attr;
+		counter_attr( c, &attr );
+		const int leader = c ? t.fds[ 0 ] : -1;
+		t.fds[ c ] = (int) syscall( SYS_perf_event_open, &attr, 0, -1, leader, 0 );
+		t.slots[ c ] = t.fds[ c ] >= 0 ? t.numopen++ : -1;
+		if ( c == 0 && t.fds[ c ] < 0 )
+			return false;
+	}
+	ioctl( t.fds[ 0 ], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+	return true;
+}
+
+
+//! The counters of the calling thread, opened on first use. Null if they cannot be opened.
+static perfthread_t* this_thread( void )
+{
+	if ( threadidx >= 0 )
+		return threads + threadidx;
+	if ( threadidx == -2 )
+		return 0;
+	threadidx = -2;
+	const int idx = __sync_fetch_and_add( &numthreads, 1 );
+	if ( idx >= PERFCOUNTERS_MAXTHREADS )
+		return 0;
+	perfthread_t& t = threads[ idx ];
+	memset( &t, 0, sizeof( t ) );
+	if ( !open_group( t ) )
+		return 0;
+	threadidx = idx;
+	return threads + idx;
+}
+
+
+//! A group read gives the number of counters, the times enabled and running, and then the values.
+static void read_group( const perfthread_t& t, perfsample_t* s )
+{
+	unsigned long long buf[ 3 + PERFCOUNTER_NUMCOUNTERS ];
+	memset( s, 0, sizeof( *s ) );
+	if ( t.fds[ 0 ] < 0 || read( t.fds[ 0 ], buf, sizeof( buf ) ) <= 0 )
+		return;
+	s->enabled = buf[ 1 ];
+	s->running = buf[ 2 ];
+	for ( int c=0; c<PERFCOUNTER_NUMCOUNTERS; ++c )
+		if ( t.slots[ c ] >= 0 && t.slots[ c ] < (int) buf[ 0 ] )
+			s->v[ c ] = buf[ 3 + t.slots[ c ] ];
+}
+
+
+bool perfcounters_enable( bool on )
+{
+	if ( on && !perfcounters_enabled )
+	{
+		perfthread_t* t = this_thread();
+		if ( !t )
+		{
+			LOGE( "Hardware performance counters are not available." );
+			return false;
+		}
+		for ( int c=0; c<PERFCOUNTER_NUMCOUNTERS; ++c )
+		{
+			available[ c ] = t->fds[ c ] >= 0;
+			if ( !available[ c ] )
+				LOGI( "Performance counter %s is not available.", perfcounter_names[ c ] );
+		}
+	}
+	perfcounters_enabled = on;
+	return true;
+}
+
+
+void perfcounters_begin( perfsample_t* start )
+{
+	perfthread_t* t = this_thread();
+	if ( t )
+		read_group( *t, start );
+}
+
+
+void perfcounters_end( int phase, const perfsample_t* start )
+{
+	perfthread_t* t = this_thread();
+	if ( !t )
+		return;
+	perfsample_t now;
+	read_group( *t, &now );
+	const unsigned long long enabled = now.enabled - start->enabled;
+	const unsigned long long running = now.running - start->running;
+	if ( !running )
+		return;
+	// The group only counted for part of the phase: estimate the whole of it.
+	const double scale = running < enabled ? (double) enabled / running : 1.0;
+	multiplexed = multiplexed || running < enabled;
+	perfsample_t& total = t->totals[ phase ];
+	for ( int c=0; c<PERFCOUNTER_NUMCOUNTERS; ++c )
+		total.v[ c ] += (unsigned long long) ( scale * ( now.v[ c ] - start->v[ c ] ) );
+	total.enabled += enabled;
+	total.running += running;
+}
+
+
+void perfcounters_close( void )
+{
+	perfcounters_enabled = false;
+	const int n = perfcounters_numthreads();
+	for ( int i=0; i<n; ++i )
+		for ( int c=PERFCOUNTER_NUMCOUNTERS-1; c>=0; --c )
+			if ( threads[ i ].fds[ c ] >= 0 )
+			{
+				close( threads[ i ].fds[ c ] );
+				threads[ i ].fds[ c ] = -1;
+			}
+}
+
+#else
+
+bool perfcounters_enable( bool on )
+{
+	if ( on )
+		LOGE( "Hardware performance counters are only supported on Linux." );
+	return !on;
+}
+
+
+void perfcounters_begin( perfsample_t* start )
+{
+	memset( start, 0, sizeof( *start ) );
+}
+
+
+void perfcounters_end( int phase, const perfsample_t* start )
+{
+}
+
+
+void perfcounters_close( void )
+{
+	perfcounters_enabled = false;
+}
+
+#endif
+
+
+void perfcounters_reset( void )
+{
+	const int n = perfcounters_numthreads();
+	for ( int i=0; i<n; ++i )
+		memset( threads[ i ].totals, 0, sizeof( threads[ i ].totals ) );
+}
+
+
+int perfcounters_numthreads( void )
+{
+	return numthreads < PERFCOUNTERS_MAXTHREADS ? numthreads : PERFCOUNTERS_MAXTHREADS;
+}
+
+
+bool perfcounters_thread( int thread, int phase, perfsample_t* total )
+{
+	*total = threads[ thread ].totals[ phase ];
+	return total->v[ PERFCOUNTER_CYCLES ] != 0;
+}
+
+
+bool perfcounters_multiplexed( void )
+{
+	return multiplexed;
+}
+
+
+bool perfcounters_available( int counter )
+{
+	return available[ counter ];
+}
+
+
+void perfcounters_phase( int phase, perfsample_t* total )
+{
+	memset( total, 0, sizeof( *total ) );
+	const int n = perfcounters_numthreads();
+	for ( int i=0; i<n; ++i )
+	{
+		for ( int c=0; c<PERFCOUNTER_NUMCOUNTERS; ++c )
+			total->v[ c ] += threads[ i ].totals[ phase ].v[ c ];
+		total->enabled += threads[ i ].totals[ phase ].enabled;
+		total->running += threads[ i ].totals[ phase ].running;
+	}
+}
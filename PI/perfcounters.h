@@ -0,0 +1,85 @@
+// perfcounters.h
+//
+// Optional hardware performance counters, read around the phases of the simulation step on every thread.
+// Uses perf_event_open on Linux. Elsewhere, or when the kernel does not allow it, the counters stay off.
+
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+enum
+{
+	PERFCOUNTER_CYCLES=0,
+	PERFCOUNTER_INSTRUCTIONS,
+	PERFCOUNTER_L1D_MISSES,		//! L1 data cache read misses.
+	PERFCOUNTER_LLC_REFERENCES,	//! last level cache references. There is no generic L2 event, but on most parts these are the L2 misses.
+	PERFCOUNTER_LLC_MISSES,		//! last level cache read misses.
+	PERFCOUNTER_BRANCH_MISSES,
+	PERFCOUNTER_NUMCOUNTERS
+};
+
+//! Short names of the counters, for reports.
+extern const char* const perfcounter_names[ PERFCOUNTER_NUMCOUNTERS ];
+
+enum
+{
+	PERFPHASE_AGGREGATION=0,	//! make_aggregates, main thread.
+	PERFPHASE_FORCES,		//! gather, force kernel and kicks, on the workers.
+	PERFPHASE_DRIFT,		//! drift passes without forces, on the workers.
+	PERFPHASE_SWAP,			//! p/q swap, main thread.
+	PERFPHASE_TRANSITS,		//! moving stars between cells, main thread.
+	PERFPHASE_AGEING,		//! ageing, main thread.
+	PERFPHASE_NUMPHASES
+};
+
+//! Names of the phases, for reports.
+extern const char* const perfphase_names[ PERFPHASE_NUMPHASES ];
+
+//! Max number of threads that we keep counters for.
+#define PERFCOUNTERS_MAXTHREADS	256
+
+//! Counter values, or the difference between two readings.
+typedef struct
+{
+	unsigned long long v[ PERFCOUNTER_NUMCOUNTERS ];
+	unsigned long long enabled;	//! nanoseconds the counters were enabled, and running on the PMU. When the kernel multiplexes
+	unsigned long long running;	//! them with other events, running falls behind, and the counts are scaled up to make up for it.
+} perfsample_t;
+
+//! True while counting. Check this before calling perfcounters_begin/end, so that the cost is nil when off.
+extern bool perfcounters_enabled;
+
+//! Turn counting on or off. Returns false if the counters are not available on this system.
+extern bool perfcounters_enable( bool on );
+
+//! Take a reading of the counters of the calling thread. Opens them on the first call from a thread.
+extern void perfcounters_begin( perfsample_t* start );
+
+//! Add the counts since perfcounters_begin to the phase, for the calling thread.
+extern void perfcounters_end( int phase, const perfsample_t* start );
+
+//! Forget all counts. Threads keep their counters open.
+extern void perfcounters_reset( void );
+
+//! Stop counting, and close the counters of all threads. Call when the threads are done.
+extern void perfcounters_close( void );
+
+//! True if the counters were multiplexed with other events at some point, so that the counts are scaled estimates.
+extern bool perfcounters_multiplexed( void );
+
+//! Number of threads that have counters open.
+extern int perfcounters_numthreads( void );
+
+//! Counts of one thread for one phase. Returns false if that thread counted nothing at all.
+extern bool perfcounters_thread( int thread, int phase, perfsample_t* total );
+
+//! True if this counter could be opened. Counts of counters that could not be opened are zero.
+extern bool perfcounters_available( int counter );
+
+//! Counts of all threads for one phase.
+extern void perfcounters_phase( int phase, perfsample_t* total );
+
+// Wrap a phase on the calling thread. A phase only counts if counting was on at both ends.
+#define PERF_BEGIN( S )		perfsample_t S = { { 0 }, 0, 0 }; const bool S##_on = perfcounters_enabled; if ( S##_on ) perfcounters_begin( &S )
+#define PERF_END( S, PHASE )	if ( S##_on && perfcounters_enabled ) perfcounters_end( PHASE, &S )
+
+#endif
@@ -0,0 +1,177 @@
+// phasetimers.cpp
+//
+// Always-on timers for the phases of the simulation step and the drawing of the star field.
+
+#include "phasetimers.h"
+#include "wallclock.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+const char* const phasetimer_names[ PHASETIMER_NUMPHASES ] =
+{
+	"aggr",
+	"gather",
+	"force",
+	"drift",
+	"swap",
+	"transit",
+	"fill",
+	"upload",
+	"draw",
+};
+
+
+bool phasetimers_gather = false;
+
+
+//! Must be a power of two. Holds several frames worth of records, even when one thread runs all slices.
+#define RINGSIZE	4096
+
+//! A record packs the phase in the top 8 bits and nanoseconds in the low 56, so it is written and read in one go.
+#define RECORD_SHIFT	56
+#define RECORD_MASK	( ( 1ULL << RECORD_SHIFT ) - 1 )
+
+//! How often the averages for the HUD are updated.
+#define WINDOW		0.5
+
+
+//! Single producer, single consumer ring. Only its thread writes records and head, only the main thread moves tail.
+typedef struct
+{
+	unsigned long long records[ RINGSIZE ];
+	unsigned int head;
+	unsigned int tail;
+	long long pad[ 7 ];
+} phasering_t;
+
+static phasering_t rings[ PHASETIMERS_MAXTHREADS ];
+static int numrings = 0;
+
+//! Index of the calling thread in rings[]: -1 before its first record, -2 if all rings were taken.
+static __thread int ringidx = -1;
+
+static long long dropped = 0;
+
+// Sums over the current window, owned by the collecting thread.
+static unsigned long long window_phase_ns[ PHASETIMER_NUMPHASES ];
+static unsigned long long window_busy_ns[ PHASETIMERS_MAXTHREADS ];
+static int window_frames = 0;
+static double window_start = -1.0;
+
+// Averages over the last completed window.
+static float phase_ms[ PHASETIMER_NUMPHASES ];
+static float busy[ PHASETIMERS_MAXTHREADS ];
+
+
+int phasetimers_thread_index( void )
+{
+	if ( ringidx == -1 )
+	{
+		const int idx = __sync_fetch_and_add( &numrings, 1 );
+		ringidx = idx < PHASETIMERS_MAXTHREADS ? idx : -2;
+	}
+	return ringidx < 0 ? -1 : ringidx;
+}
+
+
+void phasetimers_record( int phase, double seconds )
+{
+	if ( ringidx < 0 && phasetimers_thread_index() < 0 )
+		return;
+	phasering_t& r = rings[ ringidx ];
+	const unsigned long long ns = seconds > 0 ? (unsigned long long) ( seconds * 1e9 ) : 0;
+	const unsigned int h = r.head;
+	__atomic_store_n( r.records + ( h & ( RINGSIZE-1 ) ), ( (unsigned long long) phase << RECORD_SHIFT ) | ( ns & RECORD_MASK ), __ATOMIC_RELAXED );
+	__atomic_store_n( &r.head, h+1, __ATOMIC_RELEASE );
+}
+
+
+void phasetimers_collect( void )
+{
+	const int n = phasetimers_numthreads();
+	for ( int t=0; t<n; ++t )
+	{
+		phasering_t& r = rings[ t ];
+		const unsigned int h = __atomic_load_n( &r.head, __ATOMIC_ACQUIRE );
+		unsigned int tail = r.tail;
+		if ( h - tail > RINGSIZE )
+		{
+			dropped += h - tail - RINGSIZE;
+			tail = h - RINGSIZE;
+		}
+		for ( ; tail != h; ++tail )
+		{
+			const unsigned long long rec = __atomic_load_n( r.records + ( tail & ( RINGSIZE-1 ) ), __ATOMIC_RELAXED );
+			const int phase = (int) ( rec >> RECORD_SHIFT );
+			const unsigned long long ns = rec & RECORD_MASK;
+			if ( phase < PHASETIMER_NUMPHASES )
+				window_phase_ns[ phase ] += ns;
+			window_busy_ns[ t ] += ns;
+		}
+		r.tail = h;
+	}
+	window_frames += 1;
+
+	const double now = wallclock_seconds();
+	if ( window_start < 0 )
+		window_start = now;
+	const double elapsed = now - window_start;
+	if ( elapsed < WINDOW )
+		return;
+
+	for ( int p=0; p<PHASETIMER_NUMPHASES; ++p )
+		phase_ms[ p ] = (float) ( 1e-6 * window_phase_ns[ p ] / window_frames );
+	for ( int t=0; t<n; ++t )
+		busy[ t ] = (float) ( 1e-9 * window_busy_ns[ t ] / elapsed );
+	memset( window_phase_ns, 0, sizeof( window_phase_ns ) );
+	memset( window_busy_ns, 0, sizeof( window_busy_ns ) );
+	window_frames = 0;
+	window_start = now;
+}
+
+
+float phasetimers_phase_ms( int phase )
+{
+	return phase_ms[ phase ];
+}
+
+
+float phasetimers_busy( int thread )
+{
+	return busy[ thread ];
+}
+
+
+int phasetimers_numthreads( void )
+{
+	return numrings < PHASETIMERS_MAXTHREADS ? numrings : PHASETIMERS_MAXTHREADS;
+}
+
+
+long long phasetimers_dropped( void )
+{
+	return dropped;
+}
+
+
+const char* phasetimers_phase_summary( void )
+{
+	static char line[ 256 ];
+	int len = snprintf( line, sizeof( line ), "ms/frame" );
+	for ( int p=0; p<PHASETIMER_NUMPHASES && len < (int) sizeof( line ); ++p )
+		len += snprintf( line+len, sizeof( line )-len, " %s %.2f", phasetimer_names[ p ], phase_ms[ p ] );
+	return line;
+}
+
+
+const char* phasetimers_busy_summary( void )
+{
+	static char line[ 256 ];
+	int len = snprintf( line, sizeof( line ), "busy%%" );
+	const int n = phasetimers_numthreads();
+	for ( int t=0; t<n && len < (int) sizeof( line ); ++t )
+		len += snprintf( line+len, sizeof( line )-len, " %d", (int) ( 100 * busy[ t ] + 0.5f ) );
+	return line;
+}
@@ -0,0 +1,62 @@
+// phasetimers.h
+//
+// Always-on timers for the phases of the simulation step and the drawing of the star field.
+// Every thread writes its timings into a ring buffer of its own, without locks.
+// The main thread collects them once per frame, for the HUD.
+
+#ifndef PHASETIMERS_H
+#define PHASETIMERS_H
+
+enum
+{
+	PHASETIMER_AGGREGATION=0,	//! make_aggregates, main thread.
+	PHASETIMER_GATHER,		//! gathering the sources of a cell, on the workers.
+	PHASETIMER_FORCE,		//! force kernel and kicks, on the workers.
+	PHASETIMER_DRIFT,		//! drift passes without forces, on the workers.
+	PHASETIMER_SWAP,		//! p/q swap, main thread.
+	PHASETIMER_TRANSITS,		//! moving stars between cells, main thread.
+	PHASETIMER_FILL,		//! filling the instance buffer for the stars.
+	PHASETIMER_UPLOAD,		//! uploading the instance buffer to GL.
+	PHASETIMER_DRAW,		//! issuing the draw call. GL runs asynchronously, so this is the CPU side only.
+	PHASETIMER_NUMPHASES
+};
+
+//! Short names of the phases, for the HUD.
+extern const char* const phasetimer_names[ PHASETIMER_NUMPHASES ];
+
+//! Max number of threads that get a ring buffer. Threads beyond this are not timed.
+#define PHASETIMERS_MAXTHREADS	32
+
+//! Time the gathering of sources apart from the force kernel. That takes a pair of clock reads per cell, so it is off
+//! unless the timers are shown. While off, the gather time is part of the force time.
+extern bool phasetimers_gather;
+
+//! Record time spent in a phase by the calling thread. Registers the thread on its first call.
+extern void phasetimers_record( int phase, double seconds );
+
+//! Index of the calling thread, as numbered by phasetimers_busy(). Registers the thread on its first call. -1 if it got no ring.
+extern int phasetimers_thread_index( void );
+
+//! Drain the ring buffers of all threads. Call this once per frame, from the main thread only.
+//! Averages are updated every half second.
+extern void phasetimers_collect( void );
+
+//! Milliseconds per frame spent in a phase, summed over the threads, averaged over the last half second.
+extern float phasetimers_phase_ms( int phase );
+
+//! Share of wallclock time that a thread spent in timed phases, over the last half second. Threads are numbered in order of their first record.
+extern float phasetimers_busy( int thread );
+
+//! Number of threads that have recorded timings.
+extern int phasetimers_numthreads( void );
+
+//! Number of records that were overwritten before they were collected.
+extern long long phasetimers_dropped( void );
+
+//! One line with the milliseconds per frame of each phase, for the HUD.
+extern const char* phasetimers_phase_summary( void );
+
+//! One line with the busy percentage of each thread, for the HUD.
+extern const char* phasetimers_busy_summary( void );
+
+#endif
@@ -0,0 +1,867 @@
+// rewind.cpp
+//
+// Keeps a compressed history of the recent states of the stars, to go back to.
+
+#include "rewind.h"
+#include "trajectory.h"
+#include "stars.h"
+
+// From GBase
+#include "logx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <zlib.h>
+
+#if defined( linux )
+#	include <pthread.h>
+#endif
+
+
+int rewind_interval = 4;
+float rewind_seconds = 10.0f;
+int rewind_budget = 256;
+
+//! Number of capture buffers in the queue to the compressing thread.
+#define NUMSLOTS		4
+
+//! Every this many frames is a keyframe.
+#define KEYFRAMEINTERVAL	30
+
+//! Room in the history, which is far more than the seconds or the budget allow, at any sensible interval.
+#define MAXFRAMES		8192
+
+//! Quantisation steps per unit of velocity.
+#define VQUANT			65536.0f
+
+#define NUMCELLS		( GRIDRES * GRIDRES )
+
+typedef trajectory_record_t record_t;
+
+//! The start of a copy of all stars. The arrays px, py, vx, vy, ax, ay, st and age follow, each with the stars of all cells, in cell order.
+typedef struct
+{
+	stars_state_t state;
+	int cnt[ NUMCELLS ];
+} imageheader_t;
+
+//! Pointers into such a copy.
+typedef struct
+{
+	imageheader_t* hdr;
+	float* px;
+	float* py;
+	float* vx;
+	float* vy;
+	float* ax;
+	float* ay;
+	int* st;
+	float* age;
+	int count;
+} image_t;
+
+typedef struct
+{
+	void* block;
+	size_t cap;
+	int count;
+} slot_t;
+
+typedef struct
+{
+	int step;
+	double time;
+	int keyframe;
+	int numstars;
+	unsigned char* data;	//! deflated.
+	uLong size;
+	uLong rawsize;
+} frame_t;
+
+//! A star in quantised form, to sort positions and velocities by uid in one go.
+typedef struct
+{
+	uint32_t uid;
+	uint32_t gx;
+	uint32_t gy;
+	uint32_t vx;
+	uint32_t vy;
+} quantised_t;
+
+//! What a keyframe knows about a star that the frames after it do not carry.
+typedef struct
+{
+	uint32_t uid;
+	int st;
+	float age;
+} extra_t;
+
+static bool opened = false;
+static float originx = 0.0f;
+static float originy = 0.0f;
+static float cellsize = 1.0f;
+
+static slot_t slots[ NUMSLOTS ];
+static int head = 0;		//! next slot for the compressing thread.
+static int numqueued = 0;	//! slots that are filled, and not yet compressed.
+static int dropped = 0;
+
+// The history, oldest first, which always starts with a keyframe.
+static frame_t frames[ MAXFRAMES ];
+static int first = 0;
+static int numframes = 0;
+static size_t memoryused = 0;
+static bool forcekey = true;	//! the next frame has nothing to refer to.
+
+// Owned by the compressing thread: the previous frame, sorted by uid, and the scratch for encoding.
+static quantised_t* quantised = 0;
+static int quantisedcap = 0;
+static record_t* refpos = 0;
+static record_t* refvel = 0;
+static int refcount = 0;
+static int refcap = 0;
+static double reftime = 0.0;
+static record_t* predicted = 0;
+static int predictedcap = 0;
+static record_t* curpos = 0;
+static record_t* curvel = 0;
+static int curcap = 0;
+static int sincekey = 0;
+static unsigned char* raw = 0;
+static size_t rawcap = 0;
+static unsigned char* packed = 0;
+static size_t packedcap = 0;
+
+#define FRAME( I )	frames[ ( first + ( I ) ) % MAXFRAMES ]
+
+#if defined( linux )
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER;
+static pthread_t encoder;
+static bool quit = false;
+#endif
+
+
+//! Lock the history, against the compressing thread.
+static inline void hold( void )
+{
+#if defined( linux )
+	pthread_mutex_lock( &lock );
+#endif
+}
+
+
+static inline void letgo( void )
+{
+#if defined( linux )
+	pthread_mutex_unlock( &lock );
+#endif
+}
+
+
+static size_t image_size( int n )
+{
+	return sizeof( imageheader_t ) + 8 * (size_t) n * sizeof( float );
+}
+
+
+static image_t image_view( void* block, int n )
+{
+	image_t im;
+	im.hdr = (imageheader_t*) block;
+	float* a = (float*) ( im.hdr + 1 );
+	im.px = a + 0 * n;
+	im.py = a + 1 * n;
+	im.vx = a + 2 * n;
+	im.vy = a + 3 * n;
+	im.ax = a + 4 * n;
+	im.ay = a + 5 * n;
+	im.st = (int*) ( a + 6 * n );
+	im.age = a + 7 * n;
+	im.count = n;
+	return im;
+}
+
+
+static void* grow( void* buf, size_t* cap, size_t needed )
+{
+	if ( needed <= *cap )
+		return buf;
+	*cap = needed;
+	return realloc( buf, needed );
+}
+
+
+static void reserve_records( record_t** a, record_t** b, int* cap, int n )
+{
+	if ( n <= *cap )
+		return;
+	*cap = n;
+	*a = (record_t*) realloc( *a, n * sizeof( record_t ) );
+	*b = (record_t*) realloc( *b, n * sizeof( record_t ) );
+}
+
+
+static int compare_uid( const void* a, const void* b )
+{
+	const uint32_t ua = ( (const quantised_t*) a )->uid;
+	const uint32_t ub = ( (const quantised_t*) b )->uid;
+	return ua < ub ? -1 : ( ua > ub ? 1 : 0 );
+}
+
+
+static int compare_extra( const void* a, const void* b )
+{
+	const uint32_t ua = ( (const extra_t*) a )->uid;
+	const uint32_t ub = ( (const extra_t*) b )->uid;
+	return ua < ub ? -1 : ( ua > ub ? 1 : 0 );
+}
+
+
+static inline uint32_t quantise_velocity( float v )
+{
+	float q = v * VQUANT;
+	q = q < -2e9f ? -2e9f : ( q > 2e9f ? 2e9f : q );
+	return (uint32_t) (int32_t) lrintf( q );
+}
+
+
+//! Quantise the positions and velocities of an image, as records sorted by uid. Positions as trajectory_quantise() does.
+static void quantise( const image_t& im, record_t* pos, record_t* vel )
+{
+	if ( im.count > quantisedcap )
+	{
+		quantisedcap = im.count;
+		quantised = (quantised_t*) realloc( quantised, quantisedcap * sizeof( quantised_t ) );
+	}
+	const float scl = TRAJECTORY_QUANT / cellsize;
+	int k = 0;
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			const float xlo = originx + cx * cellsize;
+			const float ylo = originy + cy * cellsize;
+			const int cnt = im.hdr->cnt[ cx * GRIDRES + cy ];
+			for ( int i=0; i<cnt; ++i, ++k )
+			{
+				int qx = (int) ( ( im.px[ k ] - xlo ) * scl );
+				int qy = (int) ( ( im.py[ k ] - ylo ) * scl );
+				qx = qx < 0 ? 0 : ( qx >= TRAJECTORY_QUANT ? TRAJECTORY_QUANT-1 : qx );
+				qy = qy < 0 ? 0 : ( qy >= TRAJECTORY_QUANT ? TRAJECTORY_QUANT-1 : qy );
+				quantised_t& q = quantised[ k ];
+				q.uid = (uint32_t) im.st[ k ] >> 8;
+				q.gx = cx * TRAJECTORY_QUANT + qx;
+				q.gy = cy * TRAJECTORY_QUANT + qy;
+				q.vx = quantise_velocity( im.vx[ k ] );
+				q.vy = quantise_velocity( im.vy[ k ] );
+			}
+		}
+	qsort( quantised, k, sizeof( quantised_t ), compare_uid );
+	for ( int i=0; i<k; ++i )
+	{
+		const quantised_t& q = quantised[ i ];
+		pos[ i ].uid = vel[ i ].uid = q.uid;
+		pos[ i ].gx = q.gx;
+		pos[ i ].gy = q.gy;
+		vel[ i ].gx = q.vx;
+		vel[ i ].gy = q.vy;
+	}
+}
+
+
+//! Where the stars of a frame would be after elapsed seconds, at the velocities of that frame, as the reference for the positions of the next frame.
+//! This leaves only the change in velocity to encode. The compressing thread and the rewinding thread compute it alike, bit for bit.
+static void predict( const record_t* pos, const record_t* vel, int n, double elapsed, record_t* out )
+{
+	const double scl = elapsed / VQUANT * TRAJECTORY_QUANT / cellsize;
+	for ( int i=0; i<n; ++i )
+	{
+		out[ i ].uid = pos[ i ].uid;
+		out[ i ].gx = pos[ i ].gx + (uint32_t) (int32_t) lrint( (int32_t) vel[ i ].gx * scl );
+		out[ i ].gy = pos[ i ].gy + (uint32_t) (int32_t) lrint( (int32_t) vel[ i ].gy * scl );
+	}
+}
+
+
+//! Drop the oldest keyframe, with the frames that depend on it.
+static void drop_oldest_segment( void )
+{
+	do
+	{
+		frame_t& f = FRAME( 0 );
+		free( f.data );
+		f.data = 0;
+		memoryused -= f.size;
+		first = ( first + 1 ) % MAXFRAMES;
+		numframes -= 1;
+	} while ( numframes && !FRAME( 0 ).keyframe );
+}
+
+
+//! Keep the history within rewind_seconds and rewind_budget, but never drop the newest keyframe.
+static void trim( void )
+{
+	while ( numframes > 1 )
+	{
+		int nextkey = -1;
+		for ( int i=1; i<numframes && nextkey < 0; ++i )
+			if ( FRAME( i ).keyframe )
+				nextkey = i;
+		if ( nextkey < 0 )
+			return;
+		const double newest = FRAME( numframes-1 ).time;
+		// Without the oldest segment, the history still covers rewind_seconds.
+		const bool expired = FRAME( nextkey ).time <= newest - rewind_seconds;
+		const bool over = memoryused > ( (size_t) rewind_budget << 20 ) || numframes >= MAXFRAMES - 1;
+		if ( !expired && !over )
+			return;
+		drop_oldest_segment();
+	}
+}
+
+
+//! Encode and deflate a frame, and add it to the history. Runs on the compressing thread, which holds the lock only to add the frame.
+static void encode_frame( slot_t& slot, bool keyframe )
+{
+	const image_t im = image_view( slot.block, slot.count );
+	const int n = slot.count;
+	reserve_records( &curpos, &curvel, &curcap, n );
+	quantise( im, curpos, curvel );
+
+	const unsigned char* src = (const unsigned char*) slot.block;
+	uLong rawsize = (uLong) image_size( n );
+	if ( !keyframe )
+	{
+		// The bookkeeping, the size of the positions, the positions, and the velocities.
+		raw = (unsigned char*) grow( raw, &rawcap, sizeof( stars_state_t ) + sizeof( uint32_t ) + 2 * TRAJECTORY_ENCODEDMAX( n ) );
+		memcpy( raw, &im.hdr->state, sizeof( stars_state_t ) );
+		unsigned char* w = raw + sizeof( stars_state_t ) + sizeof( uint32_t );
+		if ( refcount > predictedcap )
+		{
+			predictedcap = refcount;
+			predicted = (record_t*) realloc( predicted, predictedcap * sizeof( record_t ) );
+		}
+		predict( refpos, refvel, refcount, im.hdr->state.time - reftime, predicted );
+		const uint32_t possize = (uint32_t) trajectory_encode( curpos, n, predicted, refcount, w );
+		memcpy( raw + sizeof( stars_state_t ), &possize, sizeof( uint32_t ) );
+		w += possize;
+		w += trajectory_encode( curvel, n, refvel, refcount, w );
+		src = raw;
+		rawsize = (uLong) ( w - raw );
+	}
+	uLongf packedsize = compressBound( rawsize );
+	packed = (unsigned char*) grow( packed, &packedcap, packedsize );
+	unsigned char* data = 0;
+	if ( compress2( packed, &packedsize, src, rawsize, 1 ) == Z_OK )
+		data = (unsigned char*) malloc( packedsize );
+	if ( !data )
+	{
+		LOGE( "Failed to compress the rewind frame of step %d.", im.hdr->state.step );
+		sincekey = KEYFRAMEINTERVAL;	// the next frame cannot refer to this one.
+		return;
+	}
+	memcpy( data, packed, packedsize );
+
+	// This frame is the reference for the next one.
+	record_t* tmp = refpos;
+	refpos = curpos;
+	curpos = tmp;
+	tmp = refvel;
+	refvel = curvel;
+	curvel = tmp;
+	const int tmpcap = refcap;
+	refcap = curcap;
+	curcap = tmpcap;
+	refcount = n;
+	reftime = im.hdr->state.time;
+	sincekey = keyframe ? 1 : sincekey + 1;
+
+	frame_t f;
+	f.step = im.hdr->state.step;
+	f.time = im.hdr->state.time;
+	f.keyframe = keyframe;
+	f.numstars = n;
+	f.data = data;
+	f.size = packedsize;
+	f.rawsize = rawsize;
+	hold();
+	if ( keyframe || numframes )
+	{
+		FRAME( numframes ) = f;
+		numframes += 1;
+		memoryused += f.size;
+		trim();
+	}
+	else
+		free( data );	// the history was emptied since the keyframe this frame refers to.
+	letgo();
+}
+
+
+//! Copy all stars into a slot.
+static void fill_slot( slot_t& slot )
+{
+	const int n = stars_total_count();
+	slot.block = grow( slot.block, &slot.cap, image_size( n ) );
+	const image_t im = image_view( slot.block, n );
+	stars_get_state( &im.hdr->state );
+	int k = 0;
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			const cell_t* cell = stars_cell( cx, cy );
+			const int cnt = cell->cnt;
+			const size_t sz = cnt * sizeof( float );
+			im.hdr->cnt[ cx * GRIDRES + cy ] = cnt;
+			memcpy( im.px + k, cell->px, sz );
+			memcpy( im.py + k, cell->py, sz );
+			memcpy( im.vx + k, cell->vx, sz );
+			memcpy( im.vy + k, cell->vy, sz );
+			memcpy( im.ax + k, cell->ax, sz );
+			memcpy( im.ay + k, cell->ay, sz );
+			memcpy( im.st + k, cell->st, sz );
+			memcpy( im.age + k, cell->age, sz );
+			k += cnt;
+		}
+	slot.count = k;
+}
+
+
+//! Replace the stars with those of an image.
+static void load_image( const image_t& im )
+{
+	int k = 0;
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			const int cnt = im.hdr->cnt[ cx * GRIDRES + cy ];
+			stars_load_cell( cx, cy, cnt, im.px+k, im.py+k, im.vx+k, im.vy+k, im.ax+k, im.ay+k, im.st+k, im.age+k );
+			k += cnt;
+		}
+	stars_set_state( &im.hdr->state );
+}
+
+
+// Scratch of the thread that rewinds.
+static unsigned char* inflated = 0;
+static size_t inflatedcap = 0;
+static void* rebuilt = 0;
+static size_t rebuiltcap = 0;
+static record_t* decpos[ 2 ] = { 0, 0 };
+static record_t* decvel[ 2 ] = { 0, 0 };
+static record_t* decpredicted = 0;
+static int deccap = 0;
+static extra_t* extras = 0;
+static int extrascap = 0;
+
+
+static bool inflate_frame( const frame_t& f )
+{
+	inflated = (unsigned char*) grow( inflated, &inflatedcap, f.rawsize );
+	uLongf sz = f.rawsize;
+	return uncompress( inflated, &sz, f.data, f.size ) == Z_OK && sz == f.rawsize;
+}
+
+
+//! Restore frame nr idx of the history: the keyframe before it, and the changes since.
+//! Called with the history locked, and the compressing thread idle, as this shares its scratch for quantising.
+static bool restore( int idx )
+{
+	int key = idx;
+	while ( !FRAME( key ).keyframe )
+		key -= 1;
+	const frame_t& kf = FRAME( key );
+	if ( !inflate_frame( kf ) )
+		return false;
+	image_t im = image_view( inflated, kf.numstars );
+	if ( key == idx )
+	{
+		load_image( im );
+		return true;
+	}
+
+	// Quantise the keyframe as the compressing thread did, and keep the levels and ages of its stars.
+	int maxn = 0;
+	for ( int i=key; i<=idx; ++i )
+		maxn = FRAME( i ).numstars > maxn ? FRAME( i ).numstars : maxn;
+	if ( maxn > deccap )
+	{
+		deccap = maxn;
+		for ( int b=0; b<2; ++b )
+		{
+			decpos[ b ] = (record_t*) realloc( decpos[ b ], deccap * sizeof( record_t ) );
+			decvel[ b ] = (record_t*) realloc( decvel[ b ], deccap * sizeof( record_t ) );
+		}
+		decpredicted = (record_t*) realloc( decpredicted, deccap * sizeof( record_t ) );
+	}
+	quantise( im, decpos[ 0 ], decvel[ 0 ] );
+	const int numextras = kf.numstars;
+	if ( numextras > extrascap )
+	{
+		extrascap = numextras;
+		extras = (extra_t*) realloc( extras, extrascap * sizeof( extra_t ) );
+	}
+	for ( int i=0; i<numextras; ++i )
+	{
+		extras[ i ].uid = (uint32_t) im.st[ i ] >> 8;
+		extras[ i ].st = im.st[ i ] & ~( ST_CROSSED_LO_X | ST_CROSSED_HI_X | ST_CROSSED_LO_Y | ST_CROSSED_HI_Y );
+		extras[ i ].age = im.age[ i ];
+	}
+	qsort( extras, numextras, sizeof( extra_t ), compare_extra );
+	const double keytime = kf.time;
+	double prevtime = keytime;
+
+	int cur = 0;
+	int count = kf.numstars;
+	stars_state_t state = im.hdr->state;
+	for ( int i=key+1; i<=idx; ++i )
+	{
+		const frame_t& f = FRAME( i );
+		if ( !inflate_frame( f ) || f.rawsize < sizeof( stars_state_t ) + sizeof( uint32_t ) )
+			return false;
+		uint32_t possize;
+		memcpy( &state, inflated, sizeof( stars_state_t ) );
+		memcpy( &possize, inflated + sizeof( stars_state_t ), sizeof( uint32_t ) );
+		const unsigned char* pos = inflated + sizeof( stars_state_t ) + sizeof( uint32_t );
+		if ( possize > f.rawsize - sizeof( stars_state_t ) - sizeof( uint32_t ) )
+			return false;
+		const size_t velsize = f.rawsize - sizeof( stars_state_t ) - sizeof( uint32_t ) - possize;
+		predict( decpos[ cur ], decvel[ cur ], count, state.time - prevtime, decpredicted );
+		if
+		(
+			trajectory_decode( pos, possize, f.numstars, decpredicted, count, decpos[ 1-cur ] ) != f.numstars ||
+			trajectory_decode( pos + possize, velsize, f.numstars, decvel[ cur ], count, decvel[ 1-cur ] ) != f.numstars
+		)
+			return false;
+		cur = 1 - cur;
+		count = f.numstars;
+		prevtime = state.time;
+	}
+
+	// Bin the stars into cells, with a counting sort, as a new image.
+	rebuilt = grow( rebuilt, &rebuiltcap, image_size( count ) );
+	const image_t out = image_view( rebuilt, count );
+	memset( out.hdr->cnt, 0, sizeof( out.hdr->cnt ) );
+	const record_t* p = decpos[ cur ];
+	const record_t* v = decvel[ cur ];
+	for ( int i=0; i<count; ++i )
+		out.hdr->cnt[ ( p[ i ].gx / TRAJECTORY_QUANT ) * GRIDRES + ( p[ i ].gy / TRAJECTORY_QUANT ) ] += 1;
+	// Stars beyond the capacity of a cell are left out.
+	static int fill[ NUMCELLS ];
+	static int end[ NUMCELLS ];
+	int k = 0;
+	for ( int c=0; c<NUMCELLS; ++c )
+	{
+		out.hdr->cnt[ c ] = out.hdr->cnt[ c ] > CELLCAP ? CELLCAP : out.hdr->cnt[ c ];
+		fill[ c ] = k;
+		k += out.hdr->cnt[ c ];
+		end[ c ] = k;
+	}
+	const float scl = cellsize / TRAJECTORY_QUANT;
+	const float age = (float) ( state.time - keytime );
+	int j = 0;
+	for ( int i=0; i<count; ++i )
+	{
+		const int c = ( p[ i ].gx / TRAJECTORY_QUANT ) * GRIDRES + ( p[ i ].gy / TRAJECTORY_QUANT );
+		if ( fill[ c ] == end[ c ] )
+			continue;
+		while ( j < numextras && extras[ j ].uid < p[ i ].uid )
+			++j;
+		const bool known = j < numextras && extras[ j ].uid == p[ i ].uid;
+		const int slot = fill[ c ]++;
+		out.px[ slot ] = originx + ( p[ i ].gx + 0.5f ) * scl;
+		out.py[ slot ] = originy + ( p[ i ].gy + 0.5f ) * scl;
+		out.vx[ slot ] = (int32_t) v[ i ].gx / VQUANT;
+		out.vy[ slot ] = (int32_t) v[ i ].gy / VQUANT;
+		out.ax[ slot ] = 0.0f;
+		out.ay[ slot ] = 0.0f;
+		out.st[ slot ] = known ? extras[ j ].st : (int) ( p[ i ].uid << 8 );
+		out.age[ slot ] = known ? extras[ j ].age + age : 0.0f;
+	}
+	state.accstale = 1;
+	out.hdr->state = state;
+	load_image( out );
+	return true;
+}
+
+
+//! Free the history, the buffers, and the scratch.
+static void finish( void )
+{
+	LOGI( "Rewind history closed with %d frames in %.1f MB, dropped %d.", numframes, memoryused / ( 1024.0 * 1024.0 ), dropped );
+	while ( numframes )
+		drop_oldest_segment();
+	first = 0;
+	memoryused = 0;
+	for ( int i=0; i<NUMSLOTS; ++i )
+	{
+		free( slots[ i ].block );
+		slots[ i ].block = 0;
+		slots[ i ].cap = 0;
+	}
+	free( quantised );
+	free( predicted );
+	free( refpos );
+	free( refvel );
+	free( curpos );
+	free( curvel );
+	free( raw );
+	free( packed );
+	quantised = 0;
+	predicted = 0;
+	predictedcap = 0;
+	refpos = refvel = curpos = curvel = 0;
+	raw = packed = 0;
+	quantisedcap = refcount = refcap = curcap = 0;
+	rawcap = packedcap = 0;
+	free( inflated );
+	free( rebuilt );
+	free( extras );
+	free( decpredicted );
+	decpredicted = 0;
+	for ( int b=0; b<2; ++b )
+	{
+		free( decpos[ b ] );
+		free( decvel[ b ] );
+		decpos[ b ] = decvel[ b ] = 0;
+	}
+	inflated = 0;
+	rebuilt = 0;
+	extras = 0;
+	inflatedcap = rebuiltcap = 0;
+	deccap = extrascap = 0;
+	opened = false;
+}
+
+
+static void reset( void )
+{
+	trajectory_header_t hdr;
+	trajectory_fill_header( &hdr, KEYFRAMEINTERVAL );
+	originx = hdr.originx;
+	originy = hdr.originy;
+	cellsize = hdr.cellsize;
+	head = 0;
+	numqueued = 0;
+	dropped = 0;
+	forcekey = true;
+	sincekey = 0;
+}
+
+
+bool rewind_is_open( void )
+{
+	return opened;
+}
+
+
+void rewind_after_step( void )
+{
+	if ( !opened || rewind_interval <= 0 )
+		return;
+	if ( stars_get_step_nr() % rewind_interval == 0 )
+		rewind_capture();
+}
+
+
+//! Wait for the compressing thread to take in all captures. Called with the history locked.
+static void wait_idle( void )
+{
+#if defined( linux )
+	while ( numqueued )
+		pthread_cond_wait( &idle, &lock );
+#endif
+}
+
+
+bool rewind_back( double seconds )
+{
+	if ( !opened )
+		return false;
+	hold();
+	wait_idle();
+	bool ok = numframes > 0;
+	if ( ok )
+	{
+		const double target = FRAME( numframes-1 ).time - seconds;
+		int idx = 0;
+		while ( idx+1 < numframes && FRAME( idx+1 ).time <= target )
+			idx += 1;
+		ok = restore( idx );
+		if ( ok )
+		{
+			// Continue from here: what came after it will not happen.
+			while ( numframes > idx+1 )
+			{
+				frame_t& f = FRAME( numframes-1 );
+				free( f.data );
+				f.data = 0;
+				memoryused -= f.size;
+				numframes -= 1;
+			}
+			forcekey = true;
+			LOGI( "Rewound to step %d, at %.2f s.", FRAME( idx ).step, FRAME( idx ).time );
+		}
+		else
+			LOGE( "Cannot restore the rewind frame of step %d.", FRAME( idx ).step );
+	}
+	letgo();
+	return ok;
+}
+
+
+void rewind_clear( void )
+{
+	if ( !opened )
+		return;
+	hold();
+	// The captures still queued are of the stars from before.
+	wait_idle();
+	while ( numframes )
+		drop_oldest_segment();
+	forcekey = true;
+	letgo();
+}
+
+
+bool rewind_span( double* oldest, double* newest )
+{
+	hold();
+	const bool any = numframes > 0;
+	if ( any )
+	{
+		*oldest = FRAME( 0 ).time;
+		*newest = FRAME( numframes-1 ).time;
+	}
+	letgo();
+	return any;
+}
+
+
+int rewind_frames( void )
+{
+	return numframes;
+}
+
+
+size_t rewind_memory( void )
+{
+	return memoryused;
+}
+
+
+#if defined( linux )
+
+static void* encode_loop( void* )
+{
+	pthread_mutex_lock( &lock );
+	while ( true )
+	{
+		while ( !numqueued && !quit )
+			pthread_cond_wait( &wakeup, &lock );
+		if ( !numqueued )
+			break;
+		slot_t& slot = slots[ head ];
+		const bool keyframe = forcekey || sincekey >= KEYFRAMEINTERVAL;
+		forcekey = false;
+		pthread_mutex_unlock( &lock );
+
+		encode_frame( slot, keyframe );
+
+		pthread_mutex_lock( &lock );
+		head = ( head + 1 ) % NUMSLOTS;
+		numqueued -= 1;
+		if ( !numqueued )
+			pthread_cond_broadcast( &idle );
+	}
+	pthread_mutex_unlock( &lock );
+	return 0;
+}
+
+
+bool rewind_open( void )
+{
+	rewind_close();
+	reset();
+	quit = false;
+	if ( pthread_create( &encoder, 0, encode_loop, 0 ) )
+	{
+		LOGE( "Cannot start the rewind compressor." );
+		return false;
+	}
+	opened = true;
+	LOGI( "Keeping %.0f s of rewind history, every %d steps, in at most %d MB.", rewind_seconds, rewind_interval, rewind_budget );
+	return true;
+}
+
+
+void rewind_close( void )
+{
+	if ( !opened )
+		return;
+	pthread_mutex_lock( &lock );
+	quit = true;
+	pthread_cond_signal( &wakeup );
+	pthread_mutex_unlock( &lock );
+	pthread_join( encoder, 0 );
+	finish();
+}
+
+
+bool rewind_capture( void )
+{
+	if ( !opened )
+		return false;
+	pthread_mutex_lock( &lock );
+	const bool full = numqueued == NUMSLOTS;
+	const int tail = ( head + numqueued ) % NUMSLOTS;
+	if ( full )
+		dropped += 1;
+	pthread_mutex_unlock( &lock );
+	if ( full )
+		return false;
+
+	// The compressing thread does not touch this slot until it is queued.
+	fill_slot( slots[ tail ] );
+
+	pthread_mutex_lock( &lock );
+	numqueued += 1;
+	pthread_cond_signal( &wakeup );
+	pthread_mutex_unlock( &lock );
+	return true;
+}
+
+#else
+
+// Without threads, frames are compressed on the calling thread.
+
+bool rewind_open( void )
+{
+	rewind_close();
+	reset();
+	opened = true;
+	return true;
+}
+
+
+void rewind_close( void )
+{
+	if ( opened )
+		finish();
+}
+
+
+bool rewind_capture( void )
+{
+	if ( !opened )
+		return false;
+	fill_slot( slots[ 0 ] );
+	encode_frame( slots[ 0 ], forcekey || sincekey >= KEYFRAMEINTERVAL );
+	forcekey = false;
+	return true;
+}
+
+#endif
@@ -0,0 +1,60 @@
+// rewind.h
+//
+// Keeps a history of the last seconds of the simulation in memory, compressed, to go back to and continue from.
+//
+// Every rewind_interval steps, the stepping thread copies the cells into one of four buffers, and a thread of its own
+// compresses them. Every 30th frame is a keyframe: all arrays of all cells, deflated, which restores the stars exactly.
+// The frames in between hold the positions quantised to 16 bits within their cell, and the velocities quantised to
+// 1/65536, as changes per uid since the previous frame, like a trajectory file (see trajectory.h.)
+// Positions change from where the velocity of the previous frame would have taken the star, which saves about a fifth.
+// Going back to such a frame restores the stars to within one quantum, with the block integrator levels of the keyframe
+// before it, no accelerations, and ages estimated from that keyframe.
+//
+// The oldest keyframe, with the frames that depend on it, is dropped once the next keyframe is older than rewind_seconds,
+// or when the history outgrows rewind_budget. The newest keyframe, and the frames after it, always stay.
+
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+
+//! Start keeping a history, from the next frame on. Returns false if the thread cannot be started.
+extern bool rewind_open( void );
+
+//! Stop, and free the history.
+extern void rewind_close( void );
+
+//! True while keeping a history.
+extern bool rewind_is_open( void );
+
+//! Capture a frame every this many steps from rewind_after_step(). (default: 4)
+extern int rewind_interval;
+
+//! Keep at least this many seconds of simulated time. (default: 10)
+extern float rewind_seconds;
+
+//! Keep no more than this many megabytes of compressed frames. (default: 256)
+extern int rewind_budget;
+
+//! Call after each step: captures a frame when the step nr is a multiple of rewind_interval.
+extern void rewind_after_step( void );
+
+//! Queue a frame of the current stars. Returns false if it was dropped, because the compressing thread fell behind.
+extern bool rewind_capture( void );
+
+//! Replace the stars with the frame of this many seconds before the newest frame, or the oldest frame if the history is shorter.
+//! The frames after it are dropped, so the simulation continues from there. Returns false if the history is empty.
+extern bool rewind_back( double seconds );
+
+//! Forget the history, and start again with a keyframe. Call when the stars are replaced other than by stepping, like by a
+//! checkpoint or a new scenario: the frames from before would not lead up to them, and their times may be out of order.
+extern void rewind_clear( void );
+
+//! The simulated time of the oldest and newest frames. Returns false if the history is empty.
+extern bool rewind_span( double* oldest, double* newest );
+
+//! Frames in the history, and the bytes they take.
+extern int rewind_frames( void );
+extern size_t rewind_memory( void );
+
+#endif
@@ -0,0 +1,166 @@
+// scenarios.cpp
+//
+// Named initial star fields, shared by the bench and the demo spawner of the app.
+
+#include "scenarios.h"
+#include "stars.h"
+#include "generators.h"
+#include "icload.h"
+
+// From GBase
+#include "logx.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+const char* const scenario_names[ SCENARIO_NUMSCENARIOS ] =
+{
+	"demo",
+	"disk",
+	"uniform",
+	"merger",
+	"cluster",
+	"sparse",
+	"plummer",
+	"hernquist",
+	"expdisk",
+	"collision",
+	"collapse",
+};
+
+
+const int scenario_default_counts[ SCENARIO_NUMSCENARIOS ] =
+{
+	30000,	// demo
+	30000,	// disk
+	30000,	// uniform
+	30000,	// merger
+	12000,	// cluster
+	2000,	// sparse
+	30000,	// plummer
+	20000,	// hernquist
+	30000,	// expdisk
+	30000,	// collision
+	30000,	// collapse
+};
+
+
+unsigned int scenario_seed = 1;
+
+float scenario_scale = 1.0f;
+
+
+int scenario_find( const char* name )
+{
+	for ( int i=0; i<SCENARIO_NUMSCENARIOS; ++i )
+		if ( !strcmp( name, scenario_names[ i ] ) )
+			return i;
+	return -1;
+}
+
+
+//! Draw the stars of one or more models, and place them in the field.
+static void spawn_models( const generator_t* models, int nummodels )
+{
+	int n = 0;
+	for ( int m=0; m<nummodels; ++m )
+		n += models[ m ].numstars;
+	float* arrays = (float*) malloc( 4 * ( n ? n : 1 ) * sizeof( float ) );
+	float* px = arrays + 0 * n;
+	float* py = arrays + 1 * n;
+	float* vx = arrays + 2 * n;
+	float* vy = arrays + 3 * n;
+	int first = 0;
+	for ( int m=0; m<nummodels; ++m )
+	{
+		generator_run( models + m, px, py, vx, vy, first );
+		first += models[ m ].numstars;
+	}
+	icload_place( n, px, py, vx, vy );
+	free( arrays );
+}
+
+
+static void spawn_model( int model, int n, float scale )
+{
+	generator_t g;
+	generator_defaults( &g, model, n, scenario_seed );
+	g.scale = scale * scenario_scale;
+	spawn_models( &g, 1 );
+}
+
+
+static void spawn_collision( int n )
+{
+	generator_t g[ 2 ];
+	generator_defaults( g+0, GENERATOR_EXPDISK, n/2, scenario_seed );
+	generator_defaults( g+1, GENERATOR_EXPDISK, n-n/2, scenario_seed + 1 );
+	// Far enough apart to start as two separate disks, and moving at half the speed of a parabolic encounter.
+	const float separation = GRIDRES / 2.25f;
+	const float speed = 0.5f * sqrtf( 2.0f * STARS_G * n / separation );
+	for ( int i=0; i<2; ++i )
+	{
+		const float side = i ? 1.0f : -1.0f;
+		g[ i ].scale = GRIDRES / 24.0f * scenario_scale;
+		g[ i ].cutoff = GRIDRES / 6.0f;
+		g[ i ].centre[ 0 ] = side * separation / 2;
+		g[ i ].centre[ 1 ] = side * GRIDRES / 16.0f;
+		g[ i ].velocity[ 0 ] = -side * speed / 2;
+		g[ i ].spin = -side;
+	}
+	spawn_models( g, 2 );
+}
+
+
+int scenario_spawn( int nr, int numstars )
+{
+	ASSERT( nr >= 0 && nr < SCENARIO_NUMSCENARIOS );
+	const int n = numstars > 0 ? numstars : scenario_default_counts[ nr ];
+	stars_clear();
+	stars_add_blackhole = ( nr == SCENARIO_DEMO );
+	switch ( nr )
+	{
+		case SCENARIO_DEMO:
+		case SCENARIO_DISK:
+			stars_spawn( n, 0,0,  0,0,  GRIDRES/2.3, true, true );
+			break;
+		case SCENARIO_UNIFORM:
+			stars_spawn( n, 0,0,  0,0,  GRIDRES/2.05, false, false );
+			break;
+		case SCENARIO_MERGER:
+			stars_spawn( n/2,     -GRIDRES/5.0f, -GRIDRES/12.0f,   0.6f, 0.1f,  GRIDRES/6.0f, false, true );
+			stars_spawn( n-n/2,    GRIDRES/5.0f,  GRIDRES/12.0f,  -0.6f,-0.1f,  GRIDRES/6.0f, false, true );
+			break;
+		case SCENARIO_CLUSTER:
+			stars_spawn( n, 0,0,  0,0,  GRIDRES/8.0f, true, true );
+			break;
+		case SCENARIO_SPARSE:
+			stars_spawn( n, 0,0,  0,0,  GRIDRES/2.2, true, true );
+			break;
+		case SCENARIO_PLUMMER:
+			spawn_model( GENERATOR_PLUMMER, n, GRIDRES/16.0f );
+			break;
+		case SCENARIO_HERNQUIST:
+			spawn_model( GENERATOR_HERNQUIST, n, GRIDRES/10.0f );
+			break;
+		case SCENARIO_EXPDISK:
+			spawn_model( GENERATOR_EXPDISK, n, GRIDRES/12.0f );
+			break;
+		case SCENARIO_COLLISION:
+			spawn_collision( n );
+			break;
+		case SCENARIO_COLLAPSE:
+		{
+			generator_t g;
+			generator_defaults( &g, GENERATOR_UNIFORM, n, scenario_seed );
+			g.cutoff = GRIDRES / 4.0f * scenario_scale;
+			spawn_models( &g, 1 );
+			break;
+		}
+	}
+	const int total = stars_total_count();
+	LOGI( "Spawned scenario %s with %d stars.", scenario_names[ nr ], total );
+	return total;
+}
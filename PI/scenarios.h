@@ -0,0 +1,42 @@
+// scenarios.h
+//
+// Named initial star fields, shared by the bench and the demo spawner of the app.
+
+#ifndef SCENARIOS_H
+#define SCENARIOS_H
+
+enum
+{
+	SCENARIO_DEMO=0,	//! rotating disk around a black hole, as spawned by F2.
+	SCENARIO_DISK,		//! the same disk, without the black hole.
+	SCENARIO_UNIFORM,	//! stars at rest, evenly spread over the whole grid.
+	SCENARIO_MERGER,	//! two disks on a collision course.
+	SCENARIO_CLUSTER,	//! a small, dense, rotating cluster in the centre.
+	SCENARIO_SPARSE,	//! few stars, spread over the whole grid.
+	SCENARIO_PLUMMER,	//! Plummer sphere, projected onto the plane.
+	SCENARIO_HERNQUIST,	//! Hernquist sphere, projected onto the plane: a cusp in the centre.
+	SCENARIO_EXPDISK,	//! exponential disk in rotational equilibrium.
+	SCENARIO_COLLISION,	//! two exponential disks, spinning in opposite directions, on a collision course.
+	SCENARIO_COLLAPSE,	//! cold collapse of a uniform disk of stars at rest.
+	SCENARIO_NUMSCENARIOS
+};
+
+//! Names of the scenarios, for the command line and reports.
+extern const char* const scenario_names[ SCENARIO_NUMSCENARIOS ];
+
+//! Number of stars in each scenario, when no count is given.
+extern const int scenario_default_counts[ SCENARIO_NUMSCENARIOS ];
+
+//! Seed for the scenarios drawn from models, from SCENARIO_PLUMMER on. The others are spawned from a fixed sequence. (default: 1)
+extern unsigned int scenario_seed;
+
+//! Factor on the scale radii of the scenarios drawn from models. (default: 1)
+extern float scenario_scale;
+
+//! Look up a scenario by name. Returns -1 if there is no such scenario.
+extern int scenario_find( const char* name );
+
+//! Clear the field, and spawn a scenario with numstars stars, or its default count if numstars is 0. Returns the number of stars in the field.
+extern int scenario_spawn( int nr, int numstars );
+
+#endif
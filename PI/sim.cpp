@@ -0,0 +1,489 @@
+// sim.cpp
+//
+// Headless simulation, for running large fields on machines without a display.
+// Links the simulation and the thread pool only: stars.cpp is compiled with HEADLESS, which strips all drawing from the step.
+//
+// Usage: nbody-sim [key=value ...]
+//
+//   scenario=NAME      demo, disk, uniform, merger, cluster, sparse, plummer, hernquist, expdisk, collision or collapse. (default: demo)
+//   seed=N             Seed for the scenarios drawn from models, from plummer on. (default: 1)
+//   scale=F            Factor on the scale radii of those scenarios. (default: 1)
+//   stars=N            Number of stars, instead of the default of the scenario.
+//   steps=N            Number of steps, or -1 to run until interrupted. (default: 1000)
+//   threads=N          Number of worker threads. (default: number of cores)
+//   dt=SECONDS         Length of a step. (default: 1/120)
+//   tier=NAME          Force kernel tier: approx, newton or precise.
+//   integrator=NAME    euler, kdk, yoshida4 or block.
+//   report=N           Log progress every N steps. 0 for none. (default: 100)
+//   diagnostics=N      Compute energy and momentum every N steps, and write them to diagnostics.csv.
+//   series=FILE        Write the work counters of every step to a CSV file.
+//   metrics=ADDRESS    Serve live metrics while running: unix:PATH, or a localhost TCP port.
+//   summary=FILE       Write the totals as JSON at the end.
+//   restore=FILE       Continue from a checkpoint, instead of spawning the scenario.
+//   initial=FILE       Start from the stars in a binary or CSV initial conditions file, instead of spawning the scenario.
+//   export=FILE        Write the stars at the start as a binary initial conditions file.
+//   checkpoint=FILE    Save a checkpoint at the end of the run.
+//   every=N            Also save the checkpoint every N steps, in the background.
+//   trajectory=FILE    Write the positions of all stars to a compressed trajectory file.
+//   trajevery=N        Write a trajectory frame every N steps. (default: 10)
+//   shm=NAME           Publish the stars to a frame ring in shared memory, like /nbody, for nbody-watch and other readers.
+//   shmevery=N         Publish a frame every N steps. (default: 1)
+//   shmstars=N         Room for this many stars per frame. (default: twice the stars at the start)
+//   serve=ADDRESS      Stream the stars over TCP, and take commands back: a localhost port, or HOST:PORT. See streamserver.h.
+//   rate=FPS           Frames per second to stream. (default: 30)
+//   realtime=1         Step no faster than dt per step of wall clock time, for viewers of the stream.
+//   record=FILE        Record the commands of stream clients to an input log, with a checkpoint of the start. See inputlog.h.
+//   replay=FILE        Replay an input log, recorded here or in the game, instead of spawning the scenario.
+//                      Runs to the end of the recording, unless steps= is given, and takes dt from the log.
+
+#include "stars.h"
+#include "forcekernel.h"
+#include "scenarios.h"
+#include "diagnostics.h"
+#include "stepseries.h"
+#include "metrics.h"
+#include "checkpoint.h"
+#include "trajectory.h"
+#include "framepub.h"
+#include "streamserver.h"
+#include "inputlog.h"
+#include "icload.h"
+#include "phasetimers.h"
+#include "wallclock.h"
+#include "threadtracer.h"
+
+// From GBase
+#include "logx.h"
+#include "nfy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+
+
+static const char* scenarioname = "demo";
+static int numstars = 0;
+static int numsteps = 1000;
+static int numthreads = 0;
+static float dt = 1/120.0f;
+static int reportinterval = 100;
+static int diagnosticsinterval = 0;
+static const char* seriesname = 0;
+static const char* metricsaddress = 0;
+static const char* summaryname = 0;
+static const char* restorename = 0;
+static const char* checkpointname = 0;
+static const char* trajectoryname = 0;
+static const char* shmname = 0;
+static int shmcapacity = 0;
+static const char* initialname = 0;
+static const char* exportname = 0;
+static const char* serveaddress = 0;
+static const char* recordname = 0;
+static const char* replayname = 0;
+static bool stepsgiven = false;
+static bool realtime = false;
+static bool paused = false;
+static volatile sig_atomic_t stopping = 0;
+
+
+static int find_name( const char* name, const char* const* names, int count )
+{
+	for ( int i=0; i<count; ++i )
+		if ( !strcmp( name, names[ i ] ) )
+			return i;
+	return -1;
+}
+
+
+#define PERSTEP( S, V )		( (S).steps ? 1000.0 * (V) / (S).steps : 0.0 )
+
+
+static void print_summary( FILE* f, const stars_stats_t& s, double elapsed )
+{
+	fprintf( f, "%d steps of %d stars in %.2f s: %.3f ms/step, %.3g stars/s, %.3g interactions/s.\n",
+		s.steps, stars_total_count(), elapsed, PERSTEP( s, s.total ),
+		elapsed > 0 ? s.starsteps / elapsed : 0.0, elapsed > 0 ? s.interactions / elapsed : 0.0 );
+	fprintf( f, "ms/step: aggr %.3f forces %.3f drift %.3f swap %.3f transit %.3f ageing %.3f\n",
+		PERSTEP( s, s.aggregation ), PERSTEP( s, s.forces ), PERSTEP( s, s.drift ),
+		PERSTEP( s, s.swap ), PERSTEP( s, s.transits ), PERSTEP( s, s.ageing ) );
+	fprintf( f, "%lld transits. Fullest cell held %d of %d stars, most sources for a cell were %d of %d.\n",
+		s.crossings, s.peakcell, CELLCAP, s.peaksources, MAXGATHERED );
+}
+
+
+static void write_summary( const char* fname, const stars_stats_t& s, double elapsed )
+{
+	FILE* f = fopen( fname, "w" );
+	if ( !f )
+	{
+		fprintf( stderr, "Cannot write %s\n", fname );
+		return;
+	}
+	double simtime = 0.0;
+	stars_get_step_nr( &simtime );
+	fprintf( f, "{\n" );
+	fprintf( f, "  \"vectorize\": %d,\n", VECTORIZE );
+	fprintf( f, "  \"scenario\": \"%s\", \"seed\": %u, \"scale\": %.3f, \"stars\": %d, \"threads\": %d,\n", scenarioname, scenario_seed, scenario_scale, stars_total_count(), numthreads );
+	fprintf( f, "  \"tier\": \"%s\", \"integrator\": \"%s\", \"dt\": %.6f,\n", forcekernel_tier_names[ stars_kernel_tier ], stars_integrator_names[ stars_integrator ], dt );
+	fprintf( f, "  \"steps\": %d, \"sim_time\": %.5f, \"elapsed_s\": %.4f, \"ms_per_step\": %.4f,\n", s.steps, simtime, elapsed, PERSTEP( s, s.total ) );
+	fprintf( f, "  \"evaluations\": %lld, \"interactions\": %lld, \"crossings\": %lld,\n", s.evaluations, s.interactions, s.crossings );
+	fprintf( f, "  \"peakcell\": %d, \"peaksources\": %d,\n", s.peakcell, s.peaksources );
+	fprintf
+	(
+		f, "  \"phases_ms_per_step\": { \"aggregation\": %.4f, \"forces\": %.4f, \"drift\": %.4f, \"swap\": %.4f, \"transits\": %.4f, \"ageing\": %.4f }\n",
+		PERSTEP( s, s.aggregation ), PERSTEP( s, s.forces ), PERSTEP( s, s.drift ),
+		PERSTEP( s, s.swap ), PERSTEP( s, s.transits ), PERSTEP( s, s.ageing )
+	);
+	fprintf( f, "}\n" );
+	fclose( f );
+}
+
+
+static void on_signal( int )
+{
+	stopping = 1;
+}
+
+
+// The commands that stream clients can send, and that input logs hold, as the game handles them, with positions in grid coordinates.
+// Each is recorded as it was resolved, when recording an input log.
+
+static void onSprinkle( const char* m )
+{
+	const float x = nfy_flt( m, "x" );
+	const float y = nfy_flt( m, "y" );
+	const float radius = nfy_flt( m, "radius" );
+	const int addrot = nfy_int( m, "addrot" );
+	const int count = nfy_int( m, "count" );
+	const int cnt = count > MAXSPRINKLE ? MAXSPRINKLE : count > 0 ? count : 12;
+	const float rad = radius > 0 ? radius : 0.02f;
+	char cmd[ 160 ];
+	snprintf( cmd, sizeof( cmd ), "sprinkle x=%.9g y=%.9g radius=%.9g addrot=%d count=%d world=1", x, y, rad, addrot > 0 ? 1 : 0, cnt );
+	inputlog_record( cmd );
+	stars_sprinkle( cnt, x, y, rad, addrot > 0 );
+}
+
+
+static void onClearcell( const char* m )
+{
+	const float x = nfy_flt( m, "x" );
+	const float y = nfy_flt( m, "y" );
+	char cmd[ 128 ];
+	snprintf( cmd, sizeof( cmd ), "clearcell x=%.9g y=%.9g world=1", x, y );
+	inputlog_record( cmd );
+	stars_clear_cell( x, y );
+}
+
+
+static void onClearfield( const char* m )
+{
+	inputlog_record( "clearfield" );
+	stars_clear();
+}
+
+
+static void onBlackhole( const char* m )
+{
+	if ( nfy_int( m, "toggle" ) > 0 )
+	{
+		inputlog_record( "blackhole toggle=1" );
+		stars_add_blackhole = !stars_add_blackhole;
+	}
+}
+
+
+static void onKerneltier( const char* m )
+{
+	const int tier = nfy_int( m, "tier" );
+	if ( tier >= 0 && tier < KERNEL_NUMTIERS )
+		stars_kernel_tier = tier;
+}
+
+
+static void onIntegrator( const char* m )
+{
+	const int mode = nfy_int( m, "mode" );
+	const float eta = nfy_flt( m, "eta" );
+	if ( eta > 0.0f )
+		stars_block_eta = eta;
+	if ( mode >= 0 && mode < INTEGRATOR_NUMMODES )
+		stars_integrator = mode;
+}
+
+
+static void onSpawndemo( const char* m )
+{
+	static int lastnr = scenario_find( scenarioname );
+	int nr = nfy_int( m, "nr" );
+	// Stream clients are not trusted with the size of the field.
+	const int asked = nfy_int( m, "stars" );
+	const int stars = asked > MAXSTARS ? MAXSTARS : asked;
+	// The seed is unsigned, and 0 is a seed too: only its absence keeps the current one.
+	char seed[ 16 ] = "";
+	nfy_str( m, "seed", seed, sizeof( seed )-1 );
+	if ( seed[ 0 ] )
+		scenario_seed = (unsigned int) strtoul( seed, 0, 10 );
+	if ( nfy_int( m, "next" ) > 0 )
+		nr = ( lastnr + 1 ) % SCENARIO_NUMSCENARIOS;
+	if ( nr >= 0 && nr < SCENARIO_NUMSCENARIOS )
+	{
+		char cmd[ 96 ];
+		snprintf( cmd, sizeof( cmd ), "spawndemo nr=%d stars=%d seed=%u", nr, stars > 0 ? stars : 0, scenario_seed );
+		inputlog_record( cmd );
+		scenario_spawn( nr, stars > 0 ? stars : 0 );
+		lastnr = nr;
+	}
+	else
+		onClearfield( "clearfield" );
+}
+
+
+static void onPause( const char* m )
+{
+	if ( nfy_int( m, "toggle" ) > 0 )
+		paused = !paused;
+}
+
+
+//! Write the stars in the grid as initial conditions, in the order of the cells.
+static bool export_stars( const char* fname )
+{
+	const int n = stars_total_count();
+	float* arrays = (float*) malloc( 4 * ( n ? n : 1 ) * sizeof( float ) );
+	float* px = arrays + 0 * n;
+	float* py = arrays + 1 * n;
+	float* vx = arrays + 2 * n;
+	float* vy = arrays + 3 * n;
+	int k = 0;
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			const cell_t* cell = stars_cell( cx, cy );
+			const size_t sz = cell->cnt * sizeof( float );
+			memcpy( px+k, cell->px, sz );
+			memcpy( py+k, cell->py, sz );
+			memcpy( vx+k, cell->vx, sz );
+			memcpy( vy+k, cell->vy, sz );
+			k += cell->cnt;
+		}
+	const bool ok = icload_save_binary( fname, n, px, py, vx, vy );
+	free( arrays );
+	return ok;
+}
+
+
+int main( int argc, char* argv[] )
+{
+	tt_signin( -1, "mainthread" );
+
+	numthreads = (int) sysconf( _SC_NPROCESSORS_ONLN );
+	for ( int i=1; i<argc; ++i )
+	{
+		const char* a = argv[ i ];
+		bool ok = true;
+		if ( !strncmp( a, "scenario=", 9 ) )
+		{
+			scenarioname = a+9;
+			ok = scenario_find( scenarioname ) >= 0;
+		}
+		else if ( !strncmp( a, "stars=", 6 ) ) numstars = atoi( a+6 );
+		else if ( !strncmp( a, "seed=", 5 ) ) scenario_seed = (unsigned int) strtoul( a+5, 0, 10 );
+		else if ( !strncmp( a, "scale=", 6 ) ) { scenario_scale = (float) atof( a+6 ); ok = scenario_scale > 0.0f; }
+		else if ( !strncmp( a, "steps=", 6 ) ) { numsteps = atoi( a+6 ); stepsgiven = true; }
+		else if ( !strncmp( a, "threads=", 8 ) ) numthreads = atoi( a+8 );
+		else if ( !strncmp( a, "dt=", 3 ) ) { dt = (float) atof( a+3 ); ok = dt > 0.0f; }
+		else if ( !strncmp( a, "report=", 7 ) ) reportinterval = atoi( a+7 );
+		else if ( !strncmp( a, "diagnostics=", 12 ) ) diagnosticsinterval = atoi( a+12 );
+		else if ( !strncmp( a, "series=", 7 ) ) seriesname = a+7;
+		else if ( !strncmp( a, "metrics=", 8 ) ) metricsaddress = a+8;
+		else if ( !strncmp( a, "summary=", 8 ) ) summaryname = a+8;
+		else if ( !strncmp( a, "restore=", 8 ) ) restorename = a+8;
+		else if ( !strncmp( a, "initial=", 8 ) ) initialname = a+8;
+		else if ( !strncmp( a, "export=", 7 ) ) exportname = a+7;
+		else if ( !strncmp( a, "checkpoint=", 11 ) ) checkpointname = a+11;
+		else if ( !strncmp( a, "every=", 6 ) ) checkpoint_interval = atoi( a+6 );
+		else if ( !strncmp( a, "trajectory=", 11 ) ) trajectoryname = a+11;
+		else if ( !strncmp( a, "trajevery=", 10 ) ) { trajectory_interval = atoi( a+10 ); ok = trajectory_interval > 0; }
+		else if ( !strncmp( a, "shm=", 4 ) ) shmname = a+4;
+		else if ( !strncmp( a, "shmevery=", 9 ) ) { framepub_interval = atoi( a+9 ); ok = framepub_interval > 0; }
+		else if ( !strncmp( a, "shmstars=", 9 ) ) { shmcapacity = atoi( a+9 ); ok = shmcapacity > 0; }
+		else if ( !strncmp( a, "serve=", 6 ) ) serveaddress = a+6;
+		else if ( !strncmp( a, "rate=", 5 ) ) { streamserver_rate = (float) atof( a+5 ); ok = streamserver_rate > 0.0f; }
+		else if ( !strncmp( a, "realtime=", 9 ) ) realtime = atoi( a+9 ) > 0;
+		else if ( !strncmp( a, "record=", 7 ) ) recordname = a+7;
+		else if ( !strncmp( a, "replay=", 7 ) ) replayname = a+7;
+		else if ( !strncmp( a, "tier=", 5 ) )
+		{
+			const int tier = find_name( a+5, forcekernel_tier_names, KERNEL_NUMTIERS );
+			ok = tier >= 0;
+			stars_kernel_tier = ok ? tier : stars_kernel_tier;
+		}
+		else if ( !strncmp( a, "integrator=", 11 ) )
+		{
+			const int integrator = find_name( a+11, stars_integrator_names, INTEGRATOR_NUMMODES );
+			ok = integrator >= 0;
+			stars_integrator = ok ? integrator : stars_integrator;
+		}
+		else ok = false;
+		if ( !ok )
+		{
+			fprintf( stderr, "Bad argument '%s'. See the top of sim.cpp for usage.\n", a );
+			return 1;
+		}
+	}
+	numthreads = numthreads < 1 ? 1 : numthreads;
+
+	stars_init( false );
+	stars_set_threads( numthreads );
+	stars_create();
+
+	if ( restorename )
+	{
+		if ( !checkpoint_load( restorename ) )
+			return 1;
+	}
+	else if ( initialname )
+	{
+		if ( !icload_load( initialname ) )
+			return 1;
+	}
+	else if ( replayname )
+	{
+		int endstep = 0;
+		if ( !inputlog_load( replayname, &dt, &endstep ) )
+			return 1;
+		if ( !stepsgiven )
+			numsteps = endstep - stars_get_step_nr();
+	}
+	else
+		scenario_spawn( scenario_find( scenarioname ), numstars );
+
+	if ( exportname && !export_stars( exportname ) )
+		return 1;
+
+	if ( diagnosticsinterval > 0 )
+	{
+		stars_diagnostics_interval = diagnosticsinterval;
+		diagnostics_open_csv( "diagnostics.csv" );
+	}
+	if ( seriesname )
+		stepseries_open( seriesname );
+	if ( metricsaddress )
+		metrics_listen( metricsaddress );
+	if ( trajectoryname && !trajectory_open( trajectoryname ) )
+		return 1;
+	if ( shmname )
+	{
+		if ( !framepub_open( shmname, shmcapacity ) )
+			return 1;
+		framepub_publish();
+	}
+	if ( serveaddress && !streamserver_listen( serveaddress ) )
+		return 1;
+	if ( recordname && !inputlog_open( recordname, dt ) )
+		return 1;
+	if ( serveaddress || replayname )
+	{
+		nfy_obs_add( "sprinkle", onSprinkle );
+		nfy_obs_add( "clearcell", onClearcell );
+		nfy_obs_add( "clearfield", onClearfield );
+		nfy_obs_add( "blackhole", onBlackhole );
+		nfy_obs_add( "spawndemo", onSpawndemo );
+		nfy_obs_add( "kerneltier", onKerneltier );
+		nfy_obs_add( "integrator", onIntegrator );
+		nfy_obs_add( "pause", onPause );
+	}
+	if ( numsteps < 0 )
+	{
+		// Run until interrupted, and then wrap up as after the last step.
+		signal( SIGINT, on_signal );
+		signal( SIGTERM, on_signal );
+	}
+
+	const double t0 = wallclock_seconds();
+	double pacestart = t0;
+	int pacesteps = 0;
+	int i = 0;
+	while ( ( numsteps < 0 || i < numsteps ) && !stopping )
+	{
+		if ( replayname )
+			inputlog_apply();
+		if ( serveaddress )
+		{
+			streamserver_process_commands();
+			if ( paused )
+			{
+				usleep( 10000 );
+				pacestart = wallclock_seconds();
+				pacesteps = 0;
+				continue;
+			}
+		}
+		if ( realtime )
+		{
+			const double ahead = pacestart + pacesteps * dt - wallclock_seconds();
+			if ( ahead > 0 )
+				usleep( (useconds_t) ( ahead * 1e6 ) );
+			pacesteps += 1;
+		}
+
+		stars_update( dt );
+		stepseries_record( scenarioname );
+		if ( checkpointname )
+			checkpoint_after_step( checkpointname );
+		trajectory_after_step();
+		framepub_after_step();
+		streamserver_after_step();
+		i += 1;
+
+		stars_diagnostics_t diag;
+		if ( stars_diagnostics( &diag ) )
+			diagnostics_record( &diag );
+
+		if ( metrics_enabled )
+		{
+			phasetimers_collect();
+			metrics_publish();
+		}
+
+		if ( reportinterval > 0 && i % reportinterval == 0 )
+		{
+			stars_stats_t s;
+			stars_get_stats( &s );
+			LOGI( "Step %d of %d: %d stars, %.3f ms/step, %s", i, numsteps, stars_total_count(), PERSTEP( s, s.total ), diagnostics_summary() );
+		}
+	}
+	const double elapsed = wallclock_seconds() - t0;
+
+	stars_stats_t s;
+	stars_get_stats( &s );
+	print_summary( stdout, s, elapsed );
+	if ( summaryname )
+		write_summary( summaryname, s, elapsed );
+
+	// Unless the last step already saved one.
+	if ( checkpointname && ( checkpoint_interval <= 0 || stars_get_step_nr() % checkpoint_interval ) )
+	{
+		checkpoint_wait();
+		checkpoint_save( checkpointname );
+	}
+	inputlog_close();
+	checkpoint_exit();
+	trajectory_close();
+	framepub_close();
+	streamserver_close();
+
+	metrics_close();
+	stepseries_close();
+	diagnostics_close_csv();
+	stars_exit();
+
+#if defined(linux)
+	tt_report( "sim.json" );
+#endif
+
+	return 0;
+}
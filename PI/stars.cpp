@@ -1,16 +1,20 @@
 #pragma clang fp contract(on)
 
-typedef float floatx16 __attribute__((vector_size(4*16)));
-
 #include "stars.h"
+#include "forcekernel.h"
+#include "wallclock.h"
+#include "perfcounters.h"
+#include "phasetimers.h"
 
 // From GBase
 #include "logx.h"
 #include "math.h"
-#include "checkogl.h"
-#include "vmath.h"
-#include "rendercontext.h"
-#include "glpr.h"
+#if !defined( HEADLESS )
+#	include "checkogl.h"
+#	include "vmath.h"
+#	include "rendercontext.h"
+#	include "glpr.h"
+#endif
 #include "approximation.h"
 
 // PI
@@ -22,8 +26,10 @@ extern "C"
 #	include "sdlthreadpool.h"
 #endif
 }
-#include "cam.h"
-#include "debugdraw.h"
+#if !defined( HEADLESS )
+#	include "cam.h"
+#	include "debugdraw.h"
+#endif
 
 
 #if defined(linux)
@@ -37,10 +43,6 @@ extern "C"
 #include <float.h>
 #include <immintrin.h>
 
-#define MAXSTARS		120000
-
-#define MAXCONTRIBS		500
-
 #define NUMCONCURRENTTASKS	12
 
 #define ENCODECONTRIB( LEVEL, X, Y ) \
@@ -55,21 +57,11 @@ extern "C"
 #endif
 
 
-static const float G = 0.0002f;
-static const float BLACKHOLEMASS = 20000.0f;
-
-static cell_t cells[ GRIDRES ][ GRIDRES ];
-
-static aggregate_t* aggregates[ 1+NUMDIMS ] = { 0,0,0,0,0 };
-
-static int numcreated = 0;
+static const float G = STARS_G;
+static const float BLACKHOLEMASS = STARS_BLACKHOLEMASS;
 
 #define MAXTRACK	5000
 #define TRACKADV(P)	P = (P+1) % MAXTRACK
-static int	tracked_id = -1;
-static float	tracked_pts[ MAXTRACK ][ 2 ];
-static int	tracked_head = 0;
-static int	tracked_tail = 0;
 
 static const int circle_sz = 12;
 static float circle_scl = 0.03f;
@@ -87,13 +79,6 @@ typedef struct
 
 static vdata_t vdata;	//!< Vertex data for the VBO.
 
-//! Convenience struct, so we can return two floats from a function that sums forces.
-typedef struct
-{
-	float x;
-	float y;
-} force_t;
-
 
 typedef struct
 {
@@ -108,6 +93,131 @@ static contribinfo_t contribs[ GRIDRES ][ GRIDRES ];
 
 static threadpool_t* starsthreadpool = 0;
 
+//! Per column sums for the diagnostics, padded to a cache line so that workers do not share lines.
+typedef struct
+{
+	double kinetic;
+	double potential;
+	double external;	// potential energy from the black hole, which is not a pair between stars.
+	double momentum[ 2 ];
+	double angular;
+	double pad[ 2 ];
+} diagsums_t;
+
+
+//! Work done by each column of cells in a pass, padded to a cache line so that workers do not share lines.
+typedef struct
+{
+	long long evaluations;		//! stars whose force was evaluated.
+	long long interactions;		//! star-source pairs that went through the force kernel.
+	double gather;			//! seconds spent gathering sources.
+	long long sources;		//! sources gathered, without padding.
+	long long nearfield;		//! interactions with individual stars.
+	long long farfield;		//! interactions with aggregates and the black hole.
+	long long padding;		//! interactions with padding.
+	int peaksources;		//! most sources gathered for a cell.
+	int pad;
+} slicework_t;
+
+
+//! A star that crossed the boundary of its cell, while it moves to the next.
+typedef struct
+{
+	float px, py, vx, vy, ax, ay, age;
+	int st;
+} transit_t;
+
+
+//! A universe: the stars, and everything the simulation keeps about them between steps.
+//! The contribution tables, the thread pool and the settings are shared by all universes.
+struct stars_universe
+{
+	cell_t (*cells)[ GRIDRES ];		//! GRIDRES x GRIDRES cells.
+	aggregate_t* aggregates[ 1+NUMDIMS ];	//! aggregates[0] is unused, levels count from 1 to NUMDIMS.
+	int numcreated;
+
+	int tracked_id;
+#if !defined( HEADLESS )
+	float tracked_pts[ MAXTRACK ][ 2 ];
+#endif
+	int tracked_head;
+	int tracked_tail;
+
+	//! Cost per cell in the current step. Each column is written by the worker that runs it only.
+	float cell_cost_step[ GRIDRES ][ GRIDRES ];
+	//! Cost per cell, smoothed over the steps.
+	float cell_cost[ GRIDRES ][ GRIDRES ];
+	//! Index of the thread that ran the last force pass of each column, as numbered by the phase timers.
+	int column_owner[ GRIDRES ];
+	//! Cost mode of the smoothed costs.
+	int foldedmode;
+
+	//! Work and time spent since the last stars_reset_stats().
+	stars_stats_t stats;
+	//! Stats of the last step only.
+	stars_stats_t stepstats;
+	bool warnedcell;
+	bool warnedsources;
+
+	//! Stars that left their cell in stars_move(), on their way to the next. Grows with the field, up to one per star.
+	transit_t* transits;
+	int transitcap;
+
+	//! Set when the accelerations stored in the cells do not belong to the current star positions.
+	bool acc_stale;
+	//! Integrator of the last step, to tell when the scheme changed.
+	int prev_integrator;
+	//! Index into the halton sequence for spawning, restarted when the field is cleared, so that runs are reproducible.
+	int spawn_idx;
+
+	float pass_kick;
+	float pass_drift;
+	bool pass_diagnose;
+	int pass_tick;
+
+	int step_nr;
+	double time;
+
+	//! Counts the changes to the stars, see stars_generation(). Odd while a step, spawn, clear or load is under way.
+	unsigned int generation;
+
+	stars_diagnostics_t diag;
+	bool diag_fresh;
+
+	//! Position in the block schedule, counted in finest steps. Every star is in sync when it is 0.
+	int block_tick;
+	//! Set when diagnostics are due, but the stars are not in sync yet.
+	bool block_diag_pending;
+
+	// Output of stars_accelerations() and friends, while they run.
+	float* accel_x;
+	float* accel_y;
+	int accel_stride;
+	bool accel_exact;
+	int accel_offsets[ GRIDRES ][ GRIDRES ];
+
+	// The reference solver sums over every star in the field, so its sources do not fit on the stack.
+	float* ref_src_x;
+	float* ref_src_y;
+	float* ref_src_scl;
+	int ref_numsrc;
+	int level_cap;
+
+	ALIGNEDPRE diagsums_t diag_slices[ GRIDRES ] ALIGNEDPST;
+	ALIGNEDPRE slicework_t work_slices[ GRIDRES ] ALIGNEDPST;
+};
+
+static cell_t maincells[ GRIDRES ][ GRIDRES ];
+
+//! The universe that the application starts with.
+static stars_universe_t mainuniverse;
+
+//! The universe that the stars_* calls of this thread act on.
+static __thread stars_universe_t* uni = &mainuniverse;
+
+//! Set on a worker that steps a universe of an ensemble: it runs the slices of that universe itself.
+static __thread bool inline_slices = false;
+
 
 bool stars_show_grid = true;
 
@@ -115,6 +225,37 @@ bool stars_show_aggr = false;
 
 bool stars_add_blackhole = false;
 
+int stars_cost_mode = STARS_COST_OFF;
+
+const char* const stars_cost_names[ STARS_COST_NUMMODES ] =
+{
+	"off",
+	"time",
+	"interactions",
+};
+
+bool stars_show_owners = false;
+
+int stars_diagnostics_interval = 0;
+
+int stars_integrator = INTEGRATOR_EULER;
+
+const char* const stars_integrator_names[ INTEGRATOR_NUMMODES ] =
+{
+	"euler",
+	"kdk",
+	"yoshida4",
+	"block",
+};
+
+float stars_block_eta = 0.025f;
+
+#if VECTORIZE > 1
+int stars_kernel_tier = KERNEL_APPROX;
+#else
+int stars_kernel_tier = KERNEL_PRECISE;
+#endif
+
 static int stars_hue_mapping = 0;
 
 
@@ -126,7 +267,18 @@ void stars_init( bool multithreaded )
 		starsthreadpool = threadpool_create( NUMCONCURRENTTASKS );
 	LOGI( "Multithreaded operation, using %d threads.", NUMCONCURRENTTASKS );
 #endif
-	LOGI( "sizeof(cells) = %d", (int) sizeof(cells) );
+	LOGI( "sizeof(cells) = %d", (int) sizeof(maincells) );
+}
+
+
+void stars_set_threads( int numthreads )
+{
+	if ( starsthreadpool )
+		threadpool_free( starsthreadpool );
+	starsthreadpool = 0;
+	if ( numthreads > 1 )
+		starsthreadpool = threadpool_create( numthreads );
+	LOGI( "Simulating with %d thread%s.", numthreads > 1 ? numthreads : 1, numthreads > 1 ? "s" : "" );
 }
 
 
@@ -157,7 +309,7 @@ static float halton( int idx, int base )
 void remove_from_cell( int idx, int cx, int cy )
 {
 	ASSERT( cx >= 0 && cx < GRIDRES && cy >= 0 && cy < GRIDRES );
-	cell_t& cell = cells[ cx ][ cy ];
+	cell_t& cell = uni->cells[ cx ][ cy ];
 	ASSERTM( idx >= 0 && idx < cell.cnt, "idx %d not in range 0..%d", idx, cell.cnt );
 	const int last = cell.cnt-1;
 	if ( last != idx )
@@ -168,15 +320,18 @@ void remove_from_cell( int idx, int cx, int cy )
 		cell.qy[idx] = cell.qy[last];
 		cell.vx[idx] = cell.vx[last];
 		cell.vy[idx] = cell.vy[last];
+		cell.ax[idx] = cell.ax[last];
+		cell.ay[idx] = cell.ay[last];
 		cell.st[idx] = cell.st[last];
+		cell.age[idx] = cell.age[last];
 	}
 	cell.cnt--;
 }
 
 
-static int add_to_cell( int cx, int cy, float px, float py, float vx, float vy, int uid, float age )
+static int add_to_cell( int cx, int cy, float px, float py, float vx, float vy, int uid, float age, float ax, float ay, int level )
 {
-	cell_t& cell = cells[ cx ][ cy ];
+	cell_t& cell = uni->cells[ cx ][ cy ];
 	const float EPS = 10e-6;
 	ASSERTM
 	(
@@ -193,34 +348,54 @@ static int add_to_cell( int cx, int cy, float px, float py, float vx, float vy,
 	const int i = cell.cnt++;
 	ASSERT( i < CELLCAP );
 	if ( uid < 0 )
-		uid = numcreated++;
+		uid = uni->numcreated++;
 	cell.px[ i ] = px;
 	cell.py[ i ] = py;
 	cell.vx[ i ] = vx;
 	cell.vy[ i ] = vy;
-	cell.st[ i ] = 0 | ( uid << 8 );
+	cell.ax[ i ] = ax;
+	cell.ay[ i ] = ay;
+	cell.st[ i ] = 0 | ( uid << 8 ) | ( level << ST_LEVEL_SHIFT );
 	cell.age[ i ] = age;
 	return i;
 }
 
 
-static int add_star( float px, float py, float vx, float vy, int uid, float age )
+static int add_star( float px, float py, float vx, float vy, int uid, float age, float ax=0.0f, float ay=0.0f, int level=0 )
 {
 	const int cx = POS2CELL(px);
 	const int cy = POS2CELL(py);
 	if ( cx < 0 || cx >= GRIDRES ) return -1;
 	if ( cy < 0 || cy >= GRIDRES ) return -1;
 	ASSERTM( cx >= 0 && cx < GRIDRES && cy >= 0 && cy < GRIDRES, "Cell coordinate %d,%d is out of grid bounds for star position %f,%f", cx, cy, px, py );
-	return add_to_cell( cx, cy, px, py, vx, vy, uid, age );
+	return add_to_cell( cx, cy, px, py, vx, vy, uid, age, ax, ay, level );
+}
+
+
+//! Make the generation odd before changing the stars, so that a reader on another thread can tell that it read stars in motion.
+//! The workers may start a load at the same time, by filling cells in parallel: setting the bit is the same whoever does it first.
+static inline void generation_begin( void )
+{
+	__atomic_fetch_or( &uni->generation, 1u, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_RELEASE );
+}
+
+
+//! Make the generation even again, once the change is done: a step, a spawn, a clear or a load.
+static inline void generation_end( void )
+{
+	const unsigned int generation = __atomic_load_n( &uni->generation, __ATOMIC_RELAXED );
+	__atomic_store_n( &uni->generation, ( generation | 1u ) + 1, __ATOMIC_RELEASE );
 }
 
 
 void stars_spawn( int num, float centrex, float centrey, float velx, float vely, float radius, bool addrot, bool presetage )
 {
-	static int idx=0;
 	int numstars = stars_total_count();
 	float totalmass = (numstars+num) + (stars_add_blackhole ? BLACKHOLEMASS : 0.0f);
 	const float magicfactor = totalmass / 55000.0f;
+	int leftout = 0;
+	generation_begin();
 
 	for ( int i=0; i<num; ++i )
 	{
@@ -228,9 +403,9 @@ void stars_spawn( int num, float centrex, float centrey, float velx, float vely,
 		float px,py;
 		do
 		{
-			px = -1 + 2 * halton( idx, 2 );
-			py = -1 + 2 * halton( idx, 3 );
-			idx++;
+			px = -1 + 2 * halton( uni->spawn_idx, 2 );
+			py = -1 + 2 * halton( uni->spawn_idx, 3 );
+			uni->spawn_idx++;
 			dsqr = px*px + py*py;
 		} while ( dsqr >= 1.0f );
 
@@ -247,6 +422,14 @@ void stars_spawn( int num, float centrex, float centrey, float velx, float vely,
 		const float vx = velx - stary * speedscale;
 		const float vy = vely + starx * speedscale;
 		const float age = presetage ? radius*dsqr : 0.0f;
+		// Spawns come from commands, some of them remote: leave out what does not fit, rather than overflow the cell.
+		const int cx = POS2CELL( starx );
+		const int cy = POS2CELL( stary );
+		if ( cx >= 0 && cx < GRIDRES && cy >= 0 && cy < GRIDRES && uni->cells[ cx ][ cy ].cnt == CELLCAP )
+		{
+			leftout += 1;
+			continue;
+		}
 		add_star
 		(
 			starx, stary,	// position.
@@ -255,6 +438,10 @@ void stars_spawn( int num, float centrex, float centrey, float velx, float vely,
 			age		// new star: age is 0.
 		);
 	}
+	if ( leftout )
+		LOGE( "Left out %d of %d spawned stars, as their cells were full.", leftout, num );
+	uni->acc_stale = true;
+	generation_end();
 }
 
 
@@ -284,14 +471,20 @@ void stars_change_splat_radius( float d )
 }
 
 
-void stars_create( void )
+//! Set up an empty universe, with its cells in the given array.
+static void universe_setup( stars_universe_t* u, cell_t (*cells)[ GRIDRES ] )
 {
-	numcreated = 0;
-	tracked_head = tracked_tail = 0;
+	u->cells = cells;
+	u->numcreated = 0;
+	u->tracked_id = -1;
+	u->tracked_head = u->tracked_tail = 0;
+	u->acc_stale = true;
+	u->prev_integrator = INTEGRATOR_EULER;
+	u->accel_stride = 1;
 	for ( int cx=0; cx<GRIDRES; ++cx )
 		for ( int cy=0; cy<GRIDRES; ++cy )
 		{
-			cell_t& cell = cells[ cx ][ cy ];
+			cell_t& cell = u->cells[ cx ][ cy ];
 			cell.cnt = 0;
 			cell.xrng[0] = CELL2POS(cx) - 0.5f;
 			cell.xrng[1] = CELL2POS(cx) + 0.5f;
@@ -299,18 +492,24 @@ void stars_create( void )
 			cell.yrng[1] = CELL2POS(cy) + 0.5f;
 		}
 
-	{
-		const cell_t& cell = cells[GRIDRES/2][GRIDRES/2];
-		LOGI( "center cell has x range %f,%f", cell.xrng[0], cell.xrng[1] );
-		LOGI( "px 0.0 falls in cx %d", POS2CELL(0.0f) );
-	}
-
 	for ( int lvl=1; lvl<=NUMDIMS; ++lvl )
 	{
 		const int res = grid_resolutions[ lvl ];
 		const size_t sz = res * res * sizeof( aggregate_t );
-		aggregates[ lvl ] = (aggregate_t*) malloc( sz );
-		memset( aggregates[ lvl ], 0, sz );
+		u->aggregates[ lvl ] = (aggregate_t*) malloc( sz );
+		memset( u->aggregates[ lvl ], 0, sz );
+	}
+}
+
+
+void stars_create( void )
+{
+	universe_setup( &mainuniverse, maincells );
+
+	{
+		const cell_t& cell = mainuniverse.cells[GRIDRES/2][GRIDRES/2];
+		LOGI( "center cell has x range %f,%f", cell.xrng[0], cell.xrng[1] );
+		LOGI( "px 0.0 falls in cx %d", POS2CELL(0.0f) );
 	}
 	LOGI( "Allocated %d aggregation levels.", NUMDIMS );
 
@@ -321,16 +520,54 @@ void stars_create( void )
 }
 
 
+stars_universe_t* stars_universe_create( void )
+{
+	stars_universe_t* u = (stars_universe_t*) _mm_malloc( sizeof( stars_universe_t ), 64 );
+	ASSERT( u );
+	memset( u, 0, sizeof( stars_universe_t ) );
+	// The pages of the cells are only touched as far as stars fill them, so a small universe stays small.
+	cell_t (*cells)[ GRIDRES ] = (cell_t (*)[ GRIDRES ]) calloc( GRIDRES, sizeof( cell_t[ GRIDRES ] ) );
+	ASSERT( cells );
+	universe_setup( u, cells );
+	return u;
+}
+
+
+void stars_universe_free( stars_universe_t* u )
+{
+	ASSERT( u != &mainuniverse );
+	if ( uni == u )
+		uni = &mainuniverse;
+	for ( int lvl=1; lvl<=NUMDIMS; ++lvl )
+		free( u->aggregates[ lvl ] );
+	free( u->transits );
+	free( u->cells );
+	_mm_free( u );
+}
+
+
+stars_universe_t* stars_universe_select( stars_universe_t* u )
+{
+	stars_universe_t* prev = uni == &mainuniverse ? 0 : uni;
+	uni = u ? u : &mainuniverse;
+	return prev;
+}
+
+
 void stars_clear( void )
 {
+	generation_begin();
 	for ( int x=0; x<GRIDRES; ++x )
 		for ( int y=0; y<GRIDRES; ++y )
 		{
-			cell_t& cell = cells[ x ][ y ];
+			cell_t& cell = uni->cells[ x ][ y ];
 			cell.cnt = 0;
 		}
-	tracked_id = -1;
-	numcreated = 0;
+	uni->tracked_id = -1;
+	uni->numcreated = 0;
+	uni->spawn_idx = 0;
+	uni->acc_stale = true;
+	generation_end();
 }
 
 
@@ -340,8 +577,11 @@ void stars_clear_cell( float x, float y )
 	const int cy = POS2CELL( y );
 	if ( cx >= 0 && cx < GRIDRES && cy >= 0 && cy < GRIDRES )
 	{
-		cell_t& cell = cells[ cx ][ cy ];
+		generation_begin();
+		cell_t& cell = uni->cells[ cx ][ cy ];
 		cell.cnt = 0;
+		uni->acc_stale = true;
+		generation_end();
 	}
 }
 
@@ -362,7 +602,7 @@ bool stars_select( float x, float y )
 		return false;
 	int closest = -1;
 	float closestDistSq = FLT_MAX;
-	const cell_t& cell = cells[ cx ][ cy ];
+	const cell_t& cell = uni->cells[ cx ][ cy ];
 	for ( int i=0; i<cell.cnt; ++i )
 	{
 		const float dx = x - cell.px[i];
@@ -374,32 +614,45 @@ bool stars_select( float x, float y )
 			closestDistSq = dsqr;
 		}
 	}
-	tracked_id = cell.st[ closest ] >> 8;
-	tracked_head = 0;
-	tracked_tail = 0;
+	uni->tracked_id = cell.st[ closest ] >> 8;
+	uni->tracked_head = 0;
+	uni->tracked_tail = 0;
 	return true;
 }
 
 
-int stars_total_count( void )
+const cell_t* stars_cell( int cx, int cy )
+{
+	ASSERT( cx >= 0 && cx < GRIDRES && cy >= 0 && cy < GRIDRES );
+	return &uni->cells[ cx ][ cy ];
+}
+
+
+static int count_stars( const stars_universe_t* u )
 {
 	int rv = 0;
 	for ( int x=0; x<GRIDRES; ++x )
 		for ( int y=0; y<GRIDRES; ++y )
 		{
-			const cell_t& cell = cells[ x ][ y ];
+			const cell_t& cell = u->cells[ x ][ y ];
 			rv += cell.cnt;
 		}
 	return rv;
 }
 
 
+int stars_total_count( void )
+{
+	return count_stars( uni );
+}
+
+
 bool stars_find( int uid, int* idx, int* cx, int* cy )
 {
 	for ( int x=0; x<GRIDRES; ++x )
 		for ( int y=0; y<GRIDRES; ++y )
 		{
-			const cell_t& cell = cells[ x ][ y ];
+			const cell_t& cell = uni->cells[ x ][ y ];
 			const int cnt = cell.cnt;
 			for ( int i=0; i<cnt; ++i )
 				if ( ( cell.st[ i ] >> 8 ) == uid )
@@ -421,13 +674,13 @@ void aggregate_cells( void )
 {
 	TT_SCOPE( "aggregate_cells" );
 	// note aggregates[0] is unused, we count aggregate levels from 1 to NUMDIMS
-	ASSERT( aggregates[0] == 0 );
-	aggregate_t* a = aggregates[ 1 ];
+	ASSERT( uni->aggregates[0] == 0 );
+	aggregate_t* a = uni->aggregates[ 1 ];
 	int nr = 0;
 	for ( int x=0; x<GRIDRES; ++x )
 		for ( int y=0; y<GRIDRES; ++y )
 		{
-			const cell_t& cell = cells[ x ][ y ];
+			const cell_t& cell = uni->cells[ x ][ y ];
 			const int cnt = cell.cnt;
 			a[nr].cnt = cnt;
 			memcpy( a[nr].xrng, cell.xrng, sizeof( cell.xrng ) );
@@ -458,8 +711,8 @@ int aggregate_level( int lvl )
 {
 	//TT_SCOPE( "aggregate_level" );
 	ASSERT( lvl >= 2 && lvl <= NUMDIMS );
-	const aggregate_t* reader = aggregates[ lvl-1 ];
-	aggregate_t* writer = aggregates[ lvl ];
+	const aggregate_t* reader = uni->aggregates[ lvl-1 ];
+	aggregate_t* writer = uni->aggregates[ lvl ];
 	const int res = grid_resolutions[ lvl ];
 	const int dres = res*2;
 	int highcnt = 0;
@@ -597,9 +850,10 @@ void stars_calculate_contribution_info( void )
 }
 
 
+#if !defined( HEADLESS )
 static void cell_draw_aggregates( int cx, int cy )
 {
-	cell_t& cell = cells[ cx ][ cy ];
+	cell_t& cell = uni->cells[ cx ][ cy ];
 	const int cnt = cell.cnt;
 	if ( !cnt ) return;
 
@@ -617,7 +871,7 @@ static void cell_draw_aggregates( int cx, int cy )
 			const int code = contrib.sortedcoords[ reader++ ];
 			const int x = ( code >> 0 ) & 0xff;
 			const int y = ( code >> 8 ) & 0xff;
-			aggregate_t& ag = aggregates[ level ][ x * res + y ];
+			aggregate_t& ag = uni->aggregates[ level ][ x * res + y ];
 			if ( ag.cnt )
 			{
 #if 0
@@ -636,22 +890,21 @@ static void cell_draw_aggregates( int cx, int cy )
 		}
 	}
 }
+#endif
 
 
-#define MAXSOURCES	( MAXCONTRIBS + 8 * CELLCAP )
-void cell_update( int cx, int cy, float dt )
+//! How the sources gathered for a cell break down.
+typedef struct
+{
+	int stars;		//! individual stars: the near field.
+	int aggregates;		//! aggregates and the black hole: the far field.
+	int padding;		//! zero-mass sources that fill up the last batch.
+} gathered_t;
+
+//! Find all the sources that generate gravity for a cell (individual stars, and aggregates.)
+//! Returns the number of sources, padded with zero-mass sources to a whole number of SOURCEBATCH for the SIMD kernels.
+static int cell_gather( int cx, int cy, float* src_x, float* src_y, float* src_scl, gathered_t* gathered=0 )
 {
-	//TT_SCOPE( "cell_update" );
-	cell_t& cell = cells[ cx ][ cy ];
-	const int cnt = cell.cnt;
-	if ( !cnt ) return;
-
-	ALIGNEDPRE float src_x  [ MAXSOURCES ] ALIGNEDPST;
-	ALIGNEDPRE float src_y  [ MAXSOURCES ] ALIGNEDPST;
-	ALIGNEDPRE float src_scl[ MAXSOURCES ] ALIGNEDPST;
-
-	//TT_BEGIN( "gather contribs" );
-	// Find all the sources that generate gravity for this cell (individual stars, and aggregates.)
 	const contribinfo_t& contrib = contribs[ cx ][ cy ];
 	int reader = 0;
 	int numsrc = 0;
@@ -662,7 +915,7 @@ void cell_update( int cx, int cy, float dt )
 		const int code = contrib.sortedcoords[ reader++ ];
 		const int x = ( code >> 0 ) & 0xff;
 		const int y = ( code >> 8 ) & 0xff;
-		const cell_t& other = cells[ x ][ y ];
+		const cell_t& other = uni->cells[ x ][ y ];
 		for ( int j=0; j<other.cnt; ++j )
 		{
 			src_x  [ numsrc ] = other.px[ j ];
@@ -671,6 +924,7 @@ void cell_update( int cx, int cy, float dt )
 			numsrc++;
 		}
 	}
+	const int numstars = numsrc;
 	// level [1..NUMDIMS] (inclusive) are aggregates.
 	for ( int level=1; level<=NUMDIMS; ++level )
 	{
@@ -681,7 +935,7 @@ void cell_update( int cx, int cy, float dt )
 			const int code = contrib.sortedcoords[ reader++ ];
 			const int x = ( code >> 0 ) & 0xff;
 			const int y = ( code >> 8 ) & 0xff;
-			aggregate_t& ag = aggregates[ level ][ x * res + y ];
+			aggregate_t& ag = uni->aggregates[ level ][ x * res + y ];
 			src_x  [ numsrc ] = ag.cx;
 			src_y  [ numsrc ] = ag.cy;
 			src_scl[ numsrc ] = ag.cnt;
@@ -697,258 +951,896 @@ void cell_update( int cx, int cy, float dt )
 		src_scl[ numsrc ] = BLACKHOLEMASS;
 		numsrc++;
 	}
-	ASSERT( numsrc <= MAXSOURCES );
+	ASSERT( numsrc <= MAXGATHERED );
+	const int unpadded = numsrc;
 
-#if VECTORIZE > 1
-	// Make it an even nr of batches.
-	while ( numsrc & 0xf )
+	// Make it a whole nr of batches.
+	while ( numsrc % SOURCEBATCH )
 	{
 		src_x  [ numsrc ] = 0;
 		src_y  [ numsrc ] = 0;
 		src_scl[ numsrc ] = 0;
 		numsrc++;
 	}
-	const int numbatches = numsrc / VECTORIZE;
-#endif
-	//TT_END( "gather contribs" );
 
-	// Traverse the stars in this cell, and sum all forces on it.
+	if ( gathered )
+	{
+		gathered->stars = numstars;
+		gathered->aggregates = unpadded - numstars;
+		gathered->padding = numsrc - unpadded;
+	}
+	return numsrc;
+}
 
-	//TT_BEGIN( "Compute forces" );
 
+//! Sum the gravitational acceleration on each of the cnt stars at px,py.
+template <int TIER>
+static void accelerations( const float* px, const float* py, int cnt, const float* src_x, const float* src_y, const float* src_scl, int numsrc, float* acc_x, float* acc_y )
+{
 	for ( int i=0; i<cnt; ++i )
 	{
-		float ax = 0.0f;
-		float ay = 0.0f;
+		const force_t f = forcekernel<TIER>( px[i], py[i], src_x, src_y, src_scl, numsrc );
+		acc_x[i] = G * f.x;
+		acc_y[i] = G * f.y;
+	}
+}
+
+
+//! Sum the gravitational acceleration on each of the cnt stars at px,py, using the kernel tier that is currently selected.
+static void tier_accelerations( const float* px, const float* py, int cnt, const float* src_x, const float* src_y, const float* src_scl, int numsrc, float* acc_x, float* acc_y )
+{
+	switch ( stars_kernel_tier )
+	{
+		case KERNEL_APPROX:
+			accelerations<KERNEL_APPROX> ( px, py, cnt, src_x, src_y, src_scl, numsrc, acc_x, acc_y );
+			break;
+		case KERNEL_NEWTON:
+			accelerations<KERNEL_NEWTON> ( px, py, cnt, src_x, src_y, src_scl, numsrc, acc_x, acc_y );
+			break;
+		default:
+			accelerations<KERNEL_PRECISE>( px, py, cnt, src_x, src_y, src_scl, numsrc, acc_x, acc_y );
+			break;
+	}
+}
 
-		const float curx = cell.px[i];
-		const float cury = cell.py[i];
 
-#if VECTORIZE == 8	// AVX2
-		const __m256 curx8 = _mm256_set1_ps( curx );
-		const __m256 cury8 = _mm256_set1_ps( cury );
-		const __m256 G8    = _mm256_set1_ps( G );
+//! Sum the gravitational acceleration on each star in the cell, using the kernel tier that is currently selected.
+static void cell_accelerations( const cell_t& cell, const float* src_x, const float* src_y, const float* src_scl, int numsrc, float* acc_x, float* acc_y )
+{
+	tier_accelerations( cell.px, cell.py, cell.cnt, src_x, src_y, src_scl, numsrc, acc_x, acc_y );
+}
 
-		__m256 forcex8 = _mm256_setzero_ps();	// all batches accumulate in these.
-		__m256 forcey8 = _mm256_setzero_ps();
-		for ( int batch=0; batch<numbatches; ++batch )
-		{
-			const __m256 x8   = _mm256_load_ps( src_x + 8*batch );
-			const __m256 y8   = _mm256_load_ps( src_y + 8*batch );
-			const __m256 scl8 = _mm256_load_ps( src_scl + 8*batch );
-			const __m256 dx8  = _mm256_sub_ps ( x8, curx8 );
-			const __m256 dy8  = _mm256_sub_ps ( y8, cury8 );
-			const __m256 dsqr8 = _mm256_add_ps
-			(
-			 	_mm256_mul_ps( dx8, dx8 ),
-				_mm256_mul_ps( dy8, dy8 )
-			);
-			__m256 idist8  = _mm256_rsqrt_ps( dsqr8 );
-			idist8 = _mm256_min_ps( idist8, _mm256_set1_ps( 100.0 ) );
-			__m256 denom8 = _mm256_mul_ps( _mm256_mul_ps( idist8, idist8 ), idist8 );
-			__m256 numer8 = _mm256_mul_ps( scl8, G8 );
-			__m256 magn8  = _mm256_mul_ps( numer8, denom8 );
-			__m256 addx8  = _mm256_mul_ps( magn8, dx8 );
-			__m256 addy8  = _mm256_mul_ps( magn8, dy8 );
-			forcex8 = _mm256_add_ps( forcex8, addx8 );
-			forcey8 = _mm256_add_ps( forcey8, addy8 );
-		}
-		// Now we need to sum all 8 lanes in the force vector.
-		__m256 sumx8 = _mm256_hadd_ps( forcex8, forcex8 );
-		__m256 sumy8 = _mm256_hadd_ps( forcey8, forcey8 );
-		sumx8 = _mm256_hadd_ps( sumx8, sumx8 );
-		sumy8 = _mm256_hadd_ps( sumy8, sumy8 );
-		const __m128 lox4 = _mm256_extractf128_ps( sumx8, 0x00 );
-		const __m128 hix4 = _mm256_extractf128_ps( sumx8, 0x01 );
-		const __m128 loy4 = _mm256_extractf128_ps( sumy8, 0x00 );
-		const __m128 hiy4 = _mm256_extractf128_ps( sumy8, 0x01 );
-		ax += _mm_cvtss_f32( _mm_add_ps( lox4, hix4 ) );	// finally use the scalar float for x.
-		ay += _mm_cvtss_f32( _mm_add_ps( loy4, hiy4 ) );	// finally use the scalar float for y.
-#elif VECTORIZE == 16	// AVX512
-		const floatx16 curx16 = _mm512_set1_ps( curx );
-		const floatx16 cury16 = _mm512_set1_ps( cury );
-		const floatx16 G16    = _mm512_set1_ps( G    );
-		floatx16 forcex16     = _mm512_set1_ps( 0.0f );	// all batches accumulate in these.
-		floatx16 forcey16     = _mm512_set1_ps( 0.0f );
-		for ( int batch=0; batch<numbatches; ++batch )
+
+//! Energy and momentum of the stars in a cell, at the start of the step, using the same sources as the force calculation.
+static void cell_diagnostics( const cell_t& cell, const float* src_x, const float* src_y, const float* src_scl, int numsrc, diagsums_t& sums )
+{
+	for ( int i=0; i<cell.cnt; ++i )
+	{
+		const float x  = cell.px[i];
+		const float y  = cell.py[i];
+		const float vx = cell.vx[i];
+		const float vy = cell.vy[i];
+		// The star itself is one of the sources, at distance zero: take it out again.
+		const float phi = potentialkernel( x, y, src_x, src_y, src_scl, numsrc ) - 1.0f / FORCEKERNEL_MINDIST;
+		sums.kinetic += 0.5f * ( vx*vx + vy*vy );
+		sums.potential -= G * phi;
+		if ( stars_add_blackhole )
 		{
-			const floatx16 x16    = _mm512_load_ps( src_x   + 16*batch );
-			const floatx16 y16    = _mm512_load_ps( src_y   + 16*batch );
-			const floatx16 scl16  = _mm512_load_ps( src_scl + 16*batch );
-			const floatx16 dx16   =  x16 - curx16;
-			const floatx16 dy16   =  y16 - cury16;
-			const floatx16 dsqr16 =  dx16*dx16 + dy16*dy16;
-			floatx16 idist16    = _mm512_rsqrt14_ps( dsqr16 );
-			idist16 = _mm512_min_ps( idist16, _mm512_set1_ps( 100.0f ) );
-			const floatx16 magn16 = ( scl16 * G16 ) * ( idist16 * idist16 * idist16 );
-			forcex16 += magn16 * dx16;
-			forcey16 += magn16 * dy16;
+			float dist = sqrtf( x*x + y*y );
+			dist = dist < FORCEKERNEL_MINDIST ? FORCEKERNEL_MINDIST : dist;
+			sums.external -= G * BLACKHOLEMASS / dist;
 		}
-		// Now we need to sum all 16 lanes in the force vector.
-		ax += _mm512_reduce_add_ps( forcex16 );
-		ay += _mm512_reduce_add_ps( forcey16 );
-#else	// SCALAR CODE
-		for ( int s=0; s<numsrc; ++s )
+		sums.momentum[ 0 ] += vx;
+		sums.momentum[ 1 ] += vy;
+		sums.angular += x * vy - y * vx;
+	}
+}
+
+
+
+//! Add the sources gathered for a cell, and the interactions of its evaluated stars with them, to the work.
+static inline void count_work( slicework_t& work, const gathered_t& gathered, int evaluated )
+{
+	const int numsrc = gathered.stars + gathered.aggregates;
+	work.sources += numsrc;
+	work.nearfield += (long long) evaluated * gathered.stars;
+	work.farfield += (long long) evaluated * gathered.aggregates;
+	work.padding += (long long) evaluated * gathered.padding;
+	work.peaksources = numsrc > work.peaksources ? numsrc : work.peaksources;
+}
+
+
+//! Evaluate the forces on the stars in a cell, and kick their velocities with it.
+//! With a non-zero drift, the stars also move, into qx,qy. The accelerations are kept in the cell for the next kick.
+void cell_update( int cx, int cy, float kick, float drift, bool diagnose, slicework_t& work )
+{
+	//TT_SCOPE( "cell_update" );
+	cell_t& cell = uni->cells[ cx ][ cy ];
+	const int cnt = cell.cnt;
+	if ( !cnt ) return;
+
+	ALIGNEDPRE float src_x  [ MAXSOURCES ] ALIGNEDPST;
+	ALIGNEDPRE float src_y  [ MAXSOURCES ] ALIGNEDPST;
+	ALIGNEDPRE float src_scl[ MAXSOURCES ] ALIGNEDPST;
+
+	//TT_BEGIN( "gather contribs" );
+	const bool timed = phasetimers_gather;
+	const double t0 = timed ? wallclock_seconds() : 0.0;
+	gathered_t gathered;
+	const int numsrc = cell_gather( cx, cy, src_x, src_y, src_scl, &gathered );
+	if ( timed )
+		work.gather += wallclock_seconds() - t0;
+	count_work( work, gathered, cnt );
+	//TT_END( "gather contribs" );
+
+	// Traverse the stars in this cell, and sum all forces on it.
+
+	//TT_BEGIN( "Compute forces" );
+	cell_accelerations( cell, src_x, src_y, src_scl, numsrc, cell.ax, cell.ay );
+	//TT_END( "Compute forces" );
+	work.evaluations += cnt;
+	work.interactions += (long long) cnt * numsrc;
+
+	if ( !drift )
+	{
+		// Closing kick of a kick-drift-kick step: afterwards, velocities are in sync with the positions.
+		for ( int i=0; i<cnt; ++i )
 		{
-			const float dx =  src_x[s] - curx;
-			const float dy =  src_y[s] - cury;
-			const float scl = src_scl[s];
-			const float dsqr = dx*dx + dy*dy;
-			float dist = sqrtf( dsqr );
-			dist = dist < 1e-2 ? 1e-2 : dist;
-			const float magn = ( scl * G ) / ( dist*dist*dist );
-			ax += magn * dx;
-			ay += magn * dy;
+			cell.vx[i] += cell.ax[i] * kick;
+			cell.vy[i] += cell.ay[i] * kick;
 		}
-#endif
+		if ( diagnose )
+			cell_diagnostics( cell, src_x, src_y, src_scl, numsrc, uni->diag_slices[ cx ] );
+		return;
+	}
 
+	if ( diagnose )
+		cell_diagnostics( cell, src_x, src_y, src_scl, numsrc, uni->diag_slices[ cx ] );
+
+	for ( int i=0; i<cnt; ++i )
+	{
 		// apply forces to change velocity.
-		cell.vx[i] += ax * dt;
-		cell.vy[i] += ay * dt;
+		cell.vx[i] += cell.ax[i] * kick;
+		cell.vy[i] += cell.ay[i] * kick;
 		// apply velocity to change position.
-		cell.qx[i] = cell.px[i] + cell.vx[i] * dt;
-		cell.qy[i] = cell.py[i] + cell.vy[i] * dt;
+		cell.qx[i] = cell.px[i] + cell.vx[i] * drift;
+		cell.qy[i] = cell.py[i] + cell.vy[i] * drift;
 		// see if we transitioned into another cell.
 		if ( cell.qx[i] < cell.xrng[0] ) ST_SET_CROSSED_LO_X( cell.st[i] );
 		if ( cell.qx[i] > cell.xrng[1] ) ST_SET_CROSSED_HI_X( cell.st[i] );
 		if ( cell.qy[i] < cell.yrng[0] ) ST_SET_CROSSED_LO_Y( cell.st[i] );
 		if ( cell.qy[i] > cell.yrng[1] ) ST_SET_CROSSED_HI_Y( cell.st[i] );
 	}
-	//TT_END( "Compute forces" );
 }
 
 
-static float stars_dt = 0.0f;
-static void stars_update_slice( argument_t* arg )
+//! Kick the stars in a cell with the accelerations from the last force evaluation, and move them into qx,qy. No forces are evaluated.
+static void cell_drift( int cx, int cy, float kick, float drift )
 {
-	TT_SCOPE( "slice" );
-	const int cx = (int) (long) arg->arg;
-	for ( int cy=0; cy<GRIDRES; ++cy )
-		cell_update( cx, cy, stars_dt );
+	cell_t& cell = uni->cells[ cx ][ cy ];
+	const int cnt = cell.cnt;
+	for ( int i=0; i<cnt; ++i )
+	{
+		cell.vx[i] += cell.ax[i] * kick;
+		cell.vy[i] += cell.ay[i] * kick;
+		cell.qx[i] = cell.px[i] + cell.vx[i] * drift;
+		cell.qy[i] = cell.py[i] + cell.vy[i] * drift;
+		if ( cell.qx[i] < cell.xrng[0] ) ST_SET_CROSSED_LO_X( cell.st[i] );
+		if ( cell.qx[i] > cell.xrng[1] ) ST_SET_CROSSED_HI_X( cell.st[i] );
+		if ( cell.qy[i] < cell.yrng[0] ) ST_SET_CROSSED_LO_Y( cell.st[i] );
+		if ( cell.qy[i] > cell.yrng[1] ) ST_SET_CROSSED_HI_Y( cell.st[i] );
+	}
 }
 
 
-void stars_update( float dt )
+
+//! The time step for a star at a block level, as a multiple of the finest step.
+#define LEVEL_STEPS( L )	( 1 << ( L ) )
+
+
+//! Pick the block level for a star with acceleration ax,ay: the coarsest one whose step stays under the star's own time step.
+//! The level is capped so that the new step starts on a boundary of the block schedule.
+static int block_level( float ax, float ay, float dt, int tick )
 {
-	stars_dt = dt;
-	make_aggregates();
+	const float amag = sqrtf( ax*ax + ay*ay );
+	// Time in which a star starting at rest would move eta^2/2 cell widths.
+	const float ts = amag > 0.0f ? stars_block_eta * sqrtf( 1.0f / amag ) : FLT_MAX;
+	int level = 0;
+	while ( level < STARS_MAXBLOCKLEVEL && dt * LEVEL_STEPS( level+1 ) <= ts )
+		level++;
+	while ( tick % LEVEL_STEPS( level ) )
+		level--;
+	return level;
+}
 
-	// Update position and velocity of stars in cells.
-	if ( starsthreadpool )
+
+//! Opening half kick for the stars whose block step starts at this tick, then move all stars by one finest step.
+//! The stars that are not kicked coast on their mid-step velocities, which predicts their positions as sources.
+static void cell_block_drift( int cx, int cy, int tick, float dt )
+{
+	cell_t& cell = uni->cells[ cx ][ cy ];
+	const int cnt = cell.cnt;
+	for ( int i=0; i<cnt; ++i )
 	{
-		// Parallel version.
-		for ( int cx=0; cx<GRIDRES; ++cx )
+		const int level = ST_GET_LEVEL( cell.st[i] );
+		if ( ( tick % LEVEL_STEPS( level ) ) == 0 )
 		{
-			argument_t arg = { (void*)(long) cx, NO_DELETE, 0 };
-			threadpool_add( starsthreadpool, stars_update_slice, arg, MEDIUM );
+			const float kick = 0.5f * dt * LEVEL_STEPS( level );
+			cell.vx[i] += cell.ax[i] * kick;
+			cell.vy[i] += cell.ay[i] * kick;
 		}
-		threadpool_wait( starsthreadpool );
+		cell.qx[i] = cell.px[i] + cell.vx[i] * dt;
+		cell.qy[i] = cell.py[i] + cell.vy[i] * dt;
+		if ( cell.qx[i] < cell.xrng[0] ) ST_SET_CROSSED_LO_X( cell.st[i] );
+		if ( cell.qx[i] > cell.xrng[1] ) ST_SET_CROSSED_HI_X( cell.st[i] );
+		if ( cell.qy[i] < cell.yrng[0] ) ST_SET_CROSSED_LO_Y( cell.st[i] );
+		if ( cell.qy[i] > cell.yrng[1] ) ST_SET_CROSSED_HI_Y( cell.st[i] );
 	}
-	else
+}
+
+
+//! Evaluate forces for the stars whose block step ends at this tick only, give them their closing half kick, and pick their next level.
+//! The kick is half of the finest step, scaled by the level of each star. A kick of zero only evaluates and assigns levels.
+static void cell_block_update( int cx, int cy, int tick, float dt, float kick, bool diagnose, slicework_t& work )
+{
+	cell_t& cell = uni->cells[ cx ][ cy ];
+	const int cnt = cell.cnt;
+
+	int active[ CELLCAP ];
+	int numactive = 0;
+	for ( int i=0; i<cnt; ++i )
+		if ( ( tick % LEVEL_STEPS( ST_GET_LEVEL( cell.st[i] ) ) ) == 0 )
+			active[ numactive++ ] = i;
+	if ( !numactive )
+		return;
+
+	ALIGNEDPRE float src_x  [ MAXSOURCES ] ALIGNEDPST;
+	ALIGNEDPRE float src_y  [ MAXSOURCES ] ALIGNEDPST;
+	ALIGNEDPRE float src_scl[ MAXSOURCES ] ALIGNEDPST;
+	const bool timed = phasetimers_gather;
+	const double t0 = timed ? wallclock_seconds() : 0.0;
+	gathered_t gathered;
+	const int numsrc = cell_gather( cx, cy, src_x, src_y, src_scl, &gathered );
+	if ( timed )
+		work.gather += wallclock_seconds() - t0;
+	count_work( work, gathered, numactive );
+
+	if ( numactive == cnt )
 	{
-		// Sequential version.
-		for ( int cx=0; cx<GRIDRES; ++cx )
-			for ( int cy=0; cy<GRIDRES; ++cy )
-				cell_update( cx, cy, dt );
+		tier_accelerations( cell.px, cell.py, cnt, src_x, src_y, src_scl, numsrc, cell.ax, cell.ay );
 	}
-
-	TT_BEGIN( "p/q swap" );
-	for ( int cx=0; cx<GRIDRES; ++cx )
-		for ( int cy=0; cy<GRIDRES; ++cy )
+	else
+	{
+		float act_x [ CELLCAP ];
+		float act_y [ CELLCAP ];
+		float act_ax[ CELLCAP ];
+		float act_ay[ CELLCAP ];
+		for ( int j=0; j<numactive; ++j )
 		{
-			cell_t& cell = cells[ cx ][ cy ];
-			const int cnt = cell.cnt;
-			if ( cnt )
-			{
-				memcpy( cell.px, cell.qx, cnt*sizeof(float) );
-				memcpy( cell.py, cell.qy, cnt*sizeof(float) );
-			}
+			act_x[ j ] = cell.px[ active[ j ] ];
+			act_y[ j ] = cell.py[ active[ j ] ];
 		}
-	TT_END( "p/q swap" );
-
-	// Age the stars.
-	for ( int cx=0; cx<GRIDRES; ++cx )
-		for ( int cy=0; cy<GRIDRES; ++cy )
+		tier_accelerations( act_x, act_y, numactive, src_x, src_y, src_scl, numsrc, act_ax, act_ay );
+		for ( int j=0; j<numactive; ++j )
 		{
-			cell_t& cell = cells[ cx ][ cy ];
-			const int cnt = cell.cnt;
-			for ( int i=0; i<cnt; ++i )
-				cell.age[i] += dt;
+			cell.ax[ active[ j ] ] = act_ax[ j ];
+			cell.ay[ active[ j ] ] = act_ay[ j ];
 		}
+	}
 
-	TT_BEGIN( "transits" );
+	for ( int j=0; j<numactive; ++j )
+	{
+		const int i = active[ j ];
+		const int level = ST_GET_LEVEL( cell.st[i] );
+		const float levelkick = kick * LEVEL_STEPS( level );
+		cell.vx[i] += cell.ax[i] * levelkick;
+		cell.vy[i] += cell.ay[i] * levelkick;
+		ST_SET_LEVEL( cell.st[i], block_level( cell.ax[i], cell.ay[i], dt, tick ) );
+	}
 
-	const int MAXTRANSITS = MAXSTARS/20;
-	float px[ MAXTRANSITS ];
-	float py[ MAXTRANSITS ];
-	float vx[ MAXTRANSITS ];
-	float vy[ MAXTRANSITS ];
-	int   st[ MAXTRANSITS ];
-	float age[ MAXTRANSITS ];
-	int numtransits = 0;
+	// Only called at the end of a block, when every star is active and in sync.
+	if ( diagnose )
+		cell_diagnostics( cell, src_x, src_y, src_scl, numsrc, uni->diag_slices[ cx ] );
 
-	// Remove stars that went out of cell bounds.
-	for ( int cx=0; cx<GRIDRES; ++cx )
-		for ( int cy=0; cy<GRIDRES; ++cy )
+	work.evaluations += numactive;
+	work.interactions += (long long) numactive * numsrc;
+}
+
+
+//! Run a slice function for every column of cells, on the thread pool if we have one.
+//! Each slice gets the universe of the calling thread in arg->result, see SLICE_UNIVERSE.
+static void stars_run_slices( work_function fn )
+{
+	if ( starsthreadpool && !inline_slices )
+	{
+		for ( int cx=0; cx<GRIDRES; ++cx )
 		{
-			cell_t& cell = cells[ cx ][ cy ];
-			const int cnt = cell.cnt;
-			for ( int i=cnt-1; i>=0; --i )
-			{	
-				if ( ( cell.st[i] & 0xf ) != 0 )
-				{
-					int j = numtransits++;
-					ASSERT( j < MAXTRANSITS );
-					px[j] = cell.px[i];
-					py[j] = cell.py[i];
-					vx[j] = cell.vx[i];
-					vy[j] = cell.vy[i];
-					st[j] = cell.st[i];
-					age[j]= cell.age[i];
-					remove_from_cell( i, cx, cy );
-				}
-			}
+			argument_t arg = { (void*)(long) cx, NO_DELETE, uni };
+			threadpool_add( starsthreadpool, fn, arg, MEDIUM );
+		}
+		threadpool_wait( starsthreadpool );
+	}
+	else
+	{
+		for ( int cx=0; cx<GRIDRES; ++cx )
+		{
+			argument_t arg = { (void*)(long) cx, NO_DELETE, uni };
+			fn( &arg );
+		}
+	}
+}
+
+
+//! A slice runs on whichever worker picks it up: make it act on the universe that ran the slices.
+#define SLICE_UNIVERSE( ARG )	uni = (stars_universe_t*) (ARG)->result
+
+
+typedef struct
+{
+	void (*fn)( int job, void* ctx );
+	void* ctx;
+	stars_universe_t* universe;
+} paralleljob_t;
+
+
+static void run_parallel_job( argument_t* arg )
+{
+	const paralleljob_t* job = (const paralleljob_t*) arg->result;
+	stars_universe_t* prev = uni;
+	uni = job->universe;
+	job->fn( (int)(long) arg->arg, job->ctx );
+	uni = prev;
+}
+
+
+void stars_parallel( int numjobs, void (*fn)( int job, void* ctx ), void* ctx )
+{
+	paralleljob_t job = { fn, ctx, uni };
+	const bool pooled = starsthreadpool && !inline_slices;
+	for ( int j=0; j<numjobs; ++j )
+	{
+		argument_t arg = { (void*)(long) j, NO_DELETE, &job };
+		if ( pooled )
+			threadpool_add( starsthreadpool, run_parallel_job, arg, MEDIUM );
+		else
+			run_parallel_job( &arg );
+	}
+	if ( pooled )
+		threadpool_wait( starsthreadpool );
+}
+
+
+//! A reading to subtract from, for charging the cost of a cell in the current cost mode.
+static inline double cost_reading( const slicework_t& work )
+{
+	if ( stars_cost_mode == STARS_COST_TIME )
+		return wallclock_seconds();
+	if ( stars_cost_mode == STARS_COST_INTERACTIONS )
+		return (double) work.interactions;
+	return 0.0;
+}
+
+static void stars_update_slice( argument_t* arg )
+{
+	TT_SCOPE( "slice" );
+	SLICE_UNIVERSE( arg );
+	const int cx = (int) (long) arg->arg;
+	PERF_BEGIN( perf );
+	const double t0 = wallclock_seconds();
+	slicework_t& work = uni->work_slices[ cx ];
+	memset( &work, 0, sizeof( work ) );
+	for ( int cy=0; cy<GRIDRES; ++cy )
+	{
+		const double c0 = cost_reading( work );
+		cell_update( cx, cy, uni->pass_kick, uni->pass_drift, uni->pass_diagnose, work );
+		if ( stars_cost_mode )
+			uni->cell_cost_step[ cx ][ cy ] += (float) ( cost_reading( work ) - c0 );
+	}
+	if ( stars_cost_mode )
+		uni->column_owner[ cx ] = phasetimers_thread_index();
+	phasetimers_record( PHASETIMER_GATHER, work.gather );
+	phasetimers_record( PHASETIMER_FORCE, wallclock_seconds() - t0 - work.gather );
+	PERF_END( perf, PERFPHASE_FORCES );
+}
+
+
+static void stars_block_drift_slice( argument_t* arg )
+{
+	TT_SCOPE( "block drift slice" );
+	SLICE_UNIVERSE( arg );
+	const int cx = (int) (long) arg->arg;
+	PERF_BEGIN( perf );
+	const double t0 = wallclock_seconds();
+	for ( int cy=0; cy<GRIDRES; ++cy )
+		cell_block_drift( cx, cy, uni->pass_tick, uni->pass_drift );
+	phasetimers_record( PHASETIMER_DRIFT, wallclock_seconds() - t0 );
+	PERF_END( perf, PERFPHASE_DRIFT );
+}
+
+
+static void stars_block_update_slice( argument_t* arg )
+{
+	TT_SCOPE( "block slice" );
+	SLICE_UNIVERSE( arg );
+	const int cx = (int) (long) arg->arg;
+	PERF_BEGIN( perf );
+	const double t0 = wallclock_seconds();
+	slicework_t& work = uni->work_slices[ cx ];
+	memset( &work, 0, sizeof( work ) );
+	for ( int cy=0; cy<GRIDRES; ++cy )
+	{
+		const double c0 = cost_reading( work );
+		cell_block_update( cx, cy, uni->pass_tick, uni->pass_drift, uni->pass_kick, uni->pass_diagnose, work );
+		if ( stars_cost_mode )
+			uni->cell_cost_step[ cx ][ cy ] += (float) ( cost_reading( work ) - c0 );
+	}
+	if ( stars_cost_mode )
+		uni->column_owner[ cx ] = phasetimers_thread_index();
+	phasetimers_record( PHASETIMER_GATHER, work.gather );
+	phasetimers_record( PHASETIMER_FORCE, wallclock_seconds() - t0 - work.gather );
+	PERF_END( perf, PERFPHASE_FORCES );
+}
+
+
+//! Run a force pass over all columns, and add its work and time to the stats.
+static void stars_run_force_slices( work_function fn )
+{
+	const double t0 = wallclock_seconds();
+	stars_run_slices( fn );
+	uni->stats.forces += wallclock_seconds() - t0;
+	for ( int cx=0; cx<GRIDRES; ++cx )
+	{
+		uni->stats.evaluations += uni->work_slices[ cx ].evaluations;
+		uni->stats.interactions += uni->work_slices[ cx ].interactions;
+		uni->stats.sources += uni->work_slices[ cx ].sources;
+		uni->stats.nearfield += uni->work_slices[ cx ].nearfield;
+		uni->stats.farfield += uni->work_slices[ cx ].farfield;
+		uni->stats.padding += uni->work_slices[ cx ].padding;
+		const int peak = uni->work_slices[ cx ].peaksources;
+		uni->stats.peaksources = peak > uni->stats.peaksources ? peak : uni->stats.peaksources;
+	}
+}
+
+
+//! Build the aggregates, and add the time to the stats.
+static void stars_aggregate( void )
+{
+	const double t0 = wallclock_seconds();
+	PERF_BEGIN( perf );
+	make_aggregates();
+	PERF_END( perf, PERFPHASE_AGGREGATION );
+	const double elapsed = wallclock_seconds() - t0;
+	uni->stats.aggregation += elapsed;
+	phasetimers_record( PHASETIMER_AGGREGATION, elapsed );
+}
+
+
+static void stars_drift_slice( argument_t* arg )
+{
+	TT_SCOPE( "drift slice" );
+	SLICE_UNIVERSE( arg );
+	const int cx = (int) (long) arg->arg;
+	PERF_BEGIN( perf );
+	const double t0 = wallclock_seconds();
+	for ( int cy=0; cy<GRIDRES; ++cy )
+		cell_drift( cx, cy, uni->pass_kick, uni->pass_drift );
+	phasetimers_record( PHASETIMER_DRIFT, wallclock_seconds() - t0 );
+	PERF_END( perf, PERFPHASE_DRIFT );
+}
+
+
+void stars_get_stats( stars_stats_t* s )
+{
+	*s = uni->stats;
+}
+
+
+void stars_reset_stats( void )
+{
+	memset( &uni->stats, 0, sizeof( uni->stats ) );
+}
+
+
+void stars_get_step_stats( stars_stats_t* s )
+{
+	*s = uni->stepstats;
+}
+
+
+int stars_get_step_nr( double* time )
+{
+	if ( time )
+		*time = uni->time;
+	return uni->step_nr;
+}
+
+
+unsigned int stars_generation( void )
+{
+	return __atomic_load_n( &uni->generation, __ATOMIC_ACQUIRE );
+}
+
+
+//! Add the stats of a step to a sum.
+static void stats_add( stars_stats_t& sum, const stars_stats_t& s )
+{
+	sum.steps += s.steps;
+	sum.starsteps += s.starsteps;
+	sum.evaluations += s.evaluations;
+	sum.interactions += s.interactions;
+	sum.crossings += s.crossings;
+	sum.sources += s.sources;
+	sum.nearfield += s.nearfield;
+	sum.farfield += s.farfield;
+	sum.padding += s.padding;
+	sum.peakcell = s.peakcell > sum.peakcell ? s.peakcell : sum.peakcell;
+	sum.peaksources = s.peaksources > sum.peaksources ? s.peaksources : sum.peaksources;
+	sum.total += s.total;
+	sum.aggregation += s.aggregation;
+	sum.forces += s.forces;
+	sum.drift += s.drift;
+	sum.swap += s.swap;
+	sum.transits += s.transits;
+	sum.ageing += s.ageing;
+}
+
+
+//! Warn once when a cell, or the sources gathered for one, come close to the capacity.
+static void check_capacity( const stars_stats_t& s )
+{
+	if ( !uni->warnedcell && s.peakcell > CELLCAP * 9 / 10 )
+	{
+		LOGE( "Step %d: a cell holds %d stars, close to CELLCAP of %d.", uni->step_nr, s.peakcell, CELLCAP );
+		uni->warnedcell = true;
+	}
+	if ( !uni->warnedsources && s.peaksources > MAXGATHERED * 9 / 10 )
+	{
+		LOGE( "Step %d: a cell gathered %d sources, close to MAXGATHERED of %d.", uni->step_nr, s.peaksources, MAXGATHERED );
+		uni->warnedsources = true;
+	}
+}
+
+
+bool stars_diagnostics( stars_diagnostics_t* d )
+{
+	if ( !uni->diag_fresh )
+		return false;
+	*d = uni->diag;
+	uni->diag_fresh = false;
+	return true;
+}
+
+
+//! Reduce the per-worker diagnostics sums.
+static void stars_reduce_diagnostics( void )
+{
+	// Every pair of stars was counted twice in the potential.
+	diagsums_t total;
+	memset( &total, 0, sizeof( total ) );
+	for ( int cx=0; cx<GRIDRES; ++cx )
+	{
+		const diagsums_t& sums = uni->diag_slices[ cx ];
+		total.kinetic += sums.kinetic;
+		total.potential += sums.potential;
+		total.external += sums.external;
+		total.momentum[ 0 ] += sums.momentum[ 0 ];
+		total.momentum[ 1 ] += sums.momentum[ 1 ];
+		total.angular += sums.angular;
+	}
+	uni->diag.step = uni->step_nr;
+	uni->diag.time = uni->time;
+	uni->diag.numstars = stars_total_count();
+	uni->diag.kinetic = total.kinetic;
+	uni->diag.potential = 0.5 * total.potential + total.external;
+	uni->diag.momentum[ 0 ] = total.momentum[ 0 ];
+	uni->diag.momentum[ 1 ] = total.momentum[ 1 ];
+	uni->diag.angular = total.angular;
+	uni->diag_fresh = true;
+}
+
+
+//! Copy the new positions over the old ones, and move the stars that left their cell into their new cell.
+static void stars_move( void )
+{
+	TT_BEGIN( "p/q swap" );
+	const double t0 = wallclock_seconds();
+	PERF_BEGIN( perfswap );
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			cell_t& cell = uni->cells[ cx ][ cy ];
+			const int cnt = cell.cnt;
+			if ( cnt )
+			{
+				memcpy( cell.px, cell.qx, cnt*sizeof(float) );
+				memcpy( cell.py, cell.qy, cnt*sizeof(float) );
+			}
+		}
+	PERF_END( perfswap, PERFPHASE_SWAP );
+	const double t1 = wallclock_seconds();
+	uni->stats.swap += t1 - t0;
+	phasetimers_record( PHASETIMER_SWAP, t1 - t0 );
+	TT_END( "p/q swap" );
+
+	TT_BEGIN( "transits" );
+	PERF_BEGIN( perftransits );
+
+	int numtransits = 0;
+
+	// Remove stars that went out of cell bounds.
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			cell_t& cell = uni->cells[ cx ][ cy ];
+			const int cnt = cell.cnt;
+			for ( int i=cnt-1; i>=0; --i )
+			{	
+				if ( ( cell.st[i] & 0xf ) != 0 )
+				{
+					if ( numtransits == uni->transitcap )
+					{
+						uni->transitcap = uni->transitcap ? 2 * uni->transitcap : 4096;
+						uni->transits = (transit_t*) realloc( uni->transits, uni->transitcap * sizeof( transit_t ) );
+						ASSERT( uni->transits );
+					}
+					transit_t& t = uni->transits[ numtransits++ ];
+					t.px = cell.px[i];
+					t.py = cell.py[i];
+					t.vx = cell.vx[i];
+					t.vy = cell.vy[i];
+					t.ax = cell.ax[i];
+					t.ay = cell.ay[i];
+					t.st = cell.st[i];
+					t.age= cell.age[i];
+					remove_from_cell( i, cx, cy );
+				}
+			}
 		}
 
 	// Add transitionary stars back into the grid, in a new cell.
 	//LOGI( "Num transits: %d", numtransits );
 	for ( int i=0; i<numtransits; ++i )
 	{
-		add_star( px[i], py[i], vx[i], vy[i], st[i]>>8, age[i] );
+		const transit_t& t = uni->transits[ i ];
+		add_star( t.px, t.py, t.vx, t.vy, t.st>>8, t.age, t.ax, t.ay, ST_GET_LEVEL( t.st ) );
 	}
+	PERF_END( perftransits, PERFPHASE_TRANSITS );
+	const double t2 = wallclock_seconds();
+	uni->stats.transits += t2 - t1;
+	uni->stats.crossings += numtransits;
+	phasetimers_record( PHASETIMER_TRANSITS, t2 - t1 );
 	TT_END( "transits" );
+}
+
+
+//! Evaluate forces at the current positions, kick with them, and optionally move the stars.
+static void stars_force_pass( float kick, float drift, bool diagnose )
+{
+	stars_aggregate();
+
+	if ( diagnose )
+		memset( uni->diag_slices, 0, sizeof( uni->diag_slices ) );
+
+	uni->pass_kick = kick;
+	uni->pass_drift = drift;
+	uni->pass_diagnose = diagnose;
+
+	// Update position and velocity of stars in cells.
+	stars_run_force_slices( stars_update_slice );
+
+	if ( diagnose )
+		stars_reduce_diagnostics();
+
+	if ( drift )
+		stars_move();
+	uni->acc_stale = drift != 0.0f;
+}
+
+
+//! Kick with the stored accelerations and move the stars, without evaluating forces.
+static void stars_drift_pass( float kick, float drift )
+{
+	uni->pass_kick = kick;
+	uni->pass_drift = drift;
+	const double t0 = wallclock_seconds();
+	stars_run_slices( stars_drift_slice );
+	uni->stats.drift += wallclock_seconds() - t0;
+	stars_move();
+	uni->acc_stale = true;
+}
+
+
+//! Second order kick-drift-kick leapfrog step: one force evaluation.
+static void stars_kdk( float h, bool diagnose )
+{
+	if ( uni->acc_stale )
+		stars_force_pass( 0.0f, 0.0f, false );
+	stars_drift_pass( 0.5f * h, h );
+	stars_force_pass( 0.5f * h, 0.0f, diagnose );
+}
+
+
+// Fourth order composition of three leapfrog steps (Yoshida 1990, Forest & Ruth 1990.)
+static const float YOSHIDA_W1 =  1.3512071919596578f;	// 1 / ( 2 - 2^(1/3) )
+static const float YOSHIDA_W0 = -1.7024143839193153f;	// -2^(1/3) / ( 2 - 2^(1/3) )
+
+
+//! One finest step of the hierarchical block scheme: each star takes kick-drift-kick steps of dt times a power of two, chosen from its acceleration.
+//! Forces are only evaluated for the stars whose step ends on this tick.
+static void stars_block( float dt, bool diagnose )
+{
+	const int period = LEVEL_STEPS( STARS_MAXBLOCKLEVEL );
+
+	uni->pass_drift = dt;
+	uni->pass_diagnose = false;
+
+	if ( uni->acc_stale )
+	{
+		// Start a new block schedule: evaluate all stars, and assign their levels, without kicking them.
+		// Stars that were halfway a step keep their mid-step velocity, which is a small error at an interactive event.
+		uni->block_tick = 0;
+		stars_aggregate();
+		uni->pass_tick = 0;
+		uni->pass_kick = 0.0f;
+		stars_run_force_slices( stars_block_update_slice );
+		uni->acc_stale = false;
+	}
+
+	uni->pass_tick = uni->block_tick;
+	const double t0 = wallclock_seconds();
+	stars_run_slices( stars_block_drift_slice );
+	uni->stats.drift += wallclock_seconds() - t0;
+	stars_move();
+
+	uni->block_tick = ( uni->block_tick + 1 ) % period;
+	uni->block_diag_pending = uni->block_diag_pending || diagnose;
+	const bool synced = uni->block_tick == 0;
+	uni->pass_tick = uni->block_tick;
+	uni->pass_kick = 0.5f * dt;
+	uni->pass_diagnose = uni->block_diag_pending && synced;
+
+	stars_aggregate();
+	if ( uni->pass_diagnose )
+		memset( uni->diag_slices, 0, sizeof( uni->diag_slices ) );
+	stars_run_force_slices( stars_block_update_slice );
+	if ( uni->pass_diagnose )
+	{
+		stars_reduce_diagnostics();
+		uni->block_diag_pending = false;
+	}
+}
+
 
+void stars_get_state( stars_state_t* s )
+{
+	s->numcreated = uni->numcreated;
+	s->spawnidx = uni->spawn_idx;
+	s->step = uni->step_nr;
+	s->time = uni->time;
+	s->integrator = stars_integrator;
+	s->kerneltier = stars_kernel_tier;
+	s->blackhole = stars_add_blackhole;
+	s->blocktick = uni->block_tick;
+	s->accstale = uni->acc_stale;
+}
+
+
+void stars_set_state( const stars_state_t* s )
+{
+	uni->numcreated = s->numcreated;
+	uni->spawn_idx = s->spawnidx;
+	uni->step_nr = s->step;
+	uni->time = s->time;
+	stars_integrator = s->integrator >= 0 && s->integrator < INTEGRATOR_NUMMODES ? s->integrator : stars_integrator;
+	stars_kernel_tier = s->kerneltier >= 0 && s->kerneltier < KERNEL_NUMTIERS ? s->kerneltier : stars_kernel_tier;
+	stars_add_blackhole = s->blackhole != 0;
+	uni->block_tick = s->blocktick;
+	uni->acc_stale = s->accstale != 0;
+	uni->prev_integrator = stars_integrator;
+	// Ends the load that the first stars_load_cell() began.
+	generation_end();
+}
+
+
+bool stars_load_cell( int cx, int cy, int cnt, const float* px, const float* py, const float* vx, const float* vy, const float* ax, const float* ay, const int* st, const float* age )
+{
+	ASSERT( cx >= 0 && cx < GRIDRES && cy >= 0 && cy < GRIDRES );
+	if ( cnt < 0 || cnt > CELLCAP )
+		return false;
+	generation_begin();
+	cell_t& cell = uni->cells[ cx ][ cy ];
+	const size_t sz = cnt * sizeof( float );
+	memcpy( cell.px, px, sz );
+	memcpy( cell.py, py, sz );
+	memcpy( cell.vx, vx, sz );
+	memcpy( cell.vy, vy, sz );
+	memcpy( cell.ax, ax, sz );
+	memcpy( cell.ay, ay, sz );
+	memcpy( cell.st, st, cnt * sizeof( int ) );
+	memcpy( cell.age, age, sz );
+	cell.cnt = cnt;
+	return true;
+}
+
+
+//! Fold the costs of this step into the smoothed costs. Starts over when the cost mode changes, as the units differ.
+static void fold_costs( void )
+{
+	if ( stars_cost_mode != uni->foldedmode )
+		memset( uni->cell_cost, 0, sizeof( uni->cell_cost ) );
+	uni->foldedmode = stars_cost_mode;
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			uni->cell_cost[ cx ][ cy ] = 0.9f * uni->cell_cost[ cx ][ cy ] + 0.1f * uni->cell_cost_step[ cx ][ cy ];
+			uni->cell_cost_step[ cx ][ cy ] = 0.0f;
+		}
+}
+
+
+#if !defined( HEADLESS )
+void stars_draw_cost( void )
+{
+	float maxcost = 0.0f;
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+			maxcost = uni->cell_cost[ cx ][ cy ] > maxcost ? uni->cell_cost[ cx ][ cy ] : maxcost;
+	if ( maxcost <= 0.0f )
+		return;
+
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			const cell_t& cell = uni->cells[ cx ][ cy ];
+			if ( !cell.cnt )
+				continue;
+			const int level = (int) ( DEBUGDRAW_HEATCOLOURS * uni->cell_cost[ cx ][ cy ] / maxcost );
+			debugdraw_fill( cell.xrng[0], cell.yrng[0], cell.xrng[1], cell.yrng[1], level < DEBUGDRAW_HEATCOLOURS ? level : DEBUGDRAW_HEATCOLOURS-1 );
+			if ( stars_show_owners && uni->column_owner[ cx ] >= 0 )
+			{
+				// A square in the corner of the cell, in the colour of its worker.
+				const float x0 = cell.xrng[0] + 0.1f;
+				const float y0 = cell.yrng[0] + 0.1f;
+				debugdraw_fill( x0, y0, x0 + 0.25f, y0 + 0.25f, DEBUGDRAW_HEATCOLOURS + uni->column_owner[ cx ] % DEBUGDRAW_WORKERCOLOURS );
+			}
+		}
+}
+
+
+//! Add the grid centre, the track of the selected star and the black hole to the debug draw.
+static void stars_debug_draw( void )
+{
 	if ( stars_show_grid )
 		debugdraw_crosshairs( 0, 0, 0.3f );
 
 	// Draw the track of the selected star.
-	if ( tracked_id >= 0 )
+	if ( uni->tracked_id >= 0 )
 	{
 		int idx,cx,cy;
-		stars_find( tracked_id, &idx, &cx, &cy );
+		stars_find( uni->tracked_id, &idx, &cx, &cy );
 		if ( idx < 0 )
 		{
-			tracked_id = -1;
-			tracked_head = 0;
-			tracked_tail = 0;
+			uni->tracked_id = -1;
+			uni->tracked_head = 0;
+			uni->tracked_tail = 0;
 		}
 		else
 		{
-			const cell_t& cell = cells[ cx ][ cy ];
+			const cell_t& cell = uni->cells[ cx ][ cy ];
 			const float x = cell.px[ idx ];
 			const float y = cell.py[ idx ];
-			tracked_pts[ tracked_tail ][ 0 ] = x;
-			tracked_pts[ tracked_tail ][ 1 ] = y;
-			TRACKADV( tracked_tail );
-			if ( tracked_tail == tracked_head )
-				TRACKADV( tracked_head );
+			uni->tracked_pts[ uni->tracked_tail ][ 0 ] = x;
+			uni->tracked_pts[ uni->tracked_tail ][ 1 ] = y;
+			TRACKADV( uni->tracked_tail );
+			if ( uni->tracked_tail == uni->tracked_head )
+				TRACKADV( uni->tracked_head );
 			debugdraw_diamond( x, y, 0.01f / cam_scl );
 			float prvx = FLT_MAX;
 			float prvy = FLT_MAX;
-			for ( int i=tracked_head; i!=tracked_tail; TRACKADV(i) )
+			for ( int i=uni->tracked_head; i!=uni->tracked_tail; TRACKADV(i) )
 			{
-				const float tx = tracked_pts[ i ][ 0 ];
-				const float ty = tracked_pts[ i ][ 1 ];
+				const float tx = uni->tracked_pts[ i ][ 0 ];
+				const float ty = uni->tracked_pts[ i ][ 1 ];
 				if ( prvx < FLT_MAX && prvy < FLT_MAX )
 					if ( i&1 )
 						debugdraw_line( prvx, prvy, tx, ty );
@@ -970,6 +1862,372 @@ void stars_update( float dt )
 			debugdraw_arrow( 1.2f*x, 1.2f*y, 0.7f*x, 0.7f*y );
 		}
 }
+#endif
+
+
+void stars_update( float dt )
+{
+	const double tstart = wallclock_seconds();
+	// Odd until the step is done.
+	generation_begin();
+	// Sum this step on its own, and add it to the running stats at the end.
+	const stars_stats_t summed = uni->stats;
+	memset( &uni->stats, 0, sizeof( uni->stats ) );
+	const bool diagnose = stars_diagnostics_interval > 0 && ( uni->step_nr % stars_diagnostics_interval ) == 0;
+
+	// The accelerations and velocities of one scheme do not carry over to another.
+	if ( stars_integrator != uni->prev_integrator )
+		uni->acc_stale = true;
+	uni->prev_integrator = stars_integrator;
+
+	switch ( stars_integrator )
+	{
+		case INTEGRATOR_KDK:
+			stars_kdk( dt, diagnose );
+			break;
+		case INTEGRATOR_YOSHIDA4:
+			stars_kdk( YOSHIDA_W1 * dt, false );
+			stars_kdk( YOSHIDA_W0 * dt, false );
+			stars_kdk( YOSHIDA_W1 * dt, diagnose );
+			break;
+		case INTEGRATOR_BLOCK:
+			stars_block( dt, diagnose );
+			break;
+		default:
+			// Semi-implicit Euler: kick and drift in one pass.
+			stars_force_pass( dt, dt, diagnose );
+			break;
+	}
+
+	uni->step_nr += 1;
+	uni->time += dt;
+
+	// Age the stars.
+	const double tage = wallclock_seconds();
+	PERF_BEGIN( perfage );
+	int numstars = 0;
+	int peakcell = 0;
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			cell_t& cell = uni->cells[ cx ][ cy ];
+			const int cnt = cell.cnt;
+			for ( int i=0; i<cnt; ++i )
+				cell.age[i] += dt;
+			numstars += cnt;
+			peakcell = cnt > peakcell ? cnt : peakcell;
+		}
+	PERF_END( perfage, PERFPHASE_AGEING );
+	generation_end();
+	const double tend = wallclock_seconds();
+	uni->stats.ageing += tend - tage;
+	uni->stats.steps += 1;
+	uni->stats.starsteps += numstars;
+	uni->stats.total += tend - tstart;
+	uni->stats.peakcell = peakcell;
+	uni->stepstats = uni->stats;
+	uni->stats = summed;
+	stats_add( uni->stats, uni->stepstats );
+	check_capacity( uni->stepstats );
+
+	if ( stars_cost_mode )
+		fold_costs();
+#if !defined( HEADLESS )
+	if ( uni == &mainuniverse && !inline_slices )
+		stars_debug_draw();
+#endif
+}
+
+
+typedef struct
+{
+	stars_universe_t* universe;
+	int numstars;
+} ensemblemember_t;
+
+typedef struct
+{
+	const ensemblemember_t* members;
+	float dt;
+	int steps;
+} ensemble_t;
+
+
+static int compare_members( const void* a, const void* b )
+{
+	const ensemblemember_t* ma = (const ensemblemember_t*) a;
+	const ensemblemember_t* mb = (const ensemblemember_t*) b;
+	return mb->numstars - ma->numstars;
+}
+
+
+//! Take all the steps of one member of an ensemble, on the thread that picked it up. Its slices run on that thread too.
+static void ensemble_step_member( int job, void* ctx )
+{
+	const ensemble_t* e = (const ensemble_t*) ctx;
+	const bool wasinline = inline_slices;
+	uni = e->members[ job ].universe;
+	inline_slices = true;
+	for ( int i=0; i<e->steps; ++i )
+		stars_update( e->dt );
+	inline_slices = wasinline;
+}
+
+
+void stars_ensemble_update( stars_universe_t* const* universes, int numuniverses, float dt, int steps )
+{
+	TT_SCOPE( "ensemble" );
+	ensemblemember_t* members = (ensemblemember_t*) malloc( numuniverses * sizeof( ensemblemember_t ) );
+	ASSERT( members );
+	for ( int i=0; i<numuniverses; ++i )
+	{
+		members[ i ].universe = universes[ i ] ? universes[ i ] : &mainuniverse;
+		members[ i ].numstars = count_stars( members[ i ].universe );
+	}
+	// Largest first: the big universes start early, and the small ones fill up the workers towards the end.
+	qsort( members, numuniverses, sizeof( ensemblemember_t ), compare_members );
+	ensemble_t e = { members, dt, steps };
+	stars_parallel( numuniverses, ensemble_step_member, &e );
+	free( members );
+}
+
+
+float stars_cell_cost( int cx, int cy )
+{
+	return uni->cell_cost[ cx ][ cy ];
+}
+
+
+//! Where each cell writes its stars in the output arrays, in draw order. Cells that do not fit get -1.
+static int stars_cell_offsets( int maxstars )
+{
+	int total = 0;
+	bool full = false;
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			const int cnt = uni->cells[ cx ][ cy ].cnt;
+			full = full || total + cnt > maxstars;
+			uni->accel_offsets[ cx ][ cy ] = full ? -1 : total;
+			total += full ? 0 : cnt;
+		}
+	return total;
+}
+
+
+static void stars_accelerations_slice( argument_t* arg )
+{
+	TT_SCOPE( "accel slice" );
+	SLICE_UNIVERSE( arg );
+	const int cx = (int) (long) arg->arg;
+	ALIGNEDPRE float src_x  [ MAXSOURCES ] ALIGNEDPST;
+	ALIGNEDPRE float src_y  [ MAXSOURCES ] ALIGNEDPST;
+	ALIGNEDPRE float src_scl[ MAXSOURCES ] ALIGNEDPST;
+	for ( int cy=0; cy<GRIDRES; ++cy )
+	{
+		const cell_t& cell = uni->cells[ cx ][ cy ];
+		const int off = uni->accel_offsets[ cx ][ cy ];
+		if ( !cell.cnt || off < 0 ) continue;
+		const int numsrc = cell_gather( cx, cy, src_x, src_y, src_scl );
+		cell_accelerations( cell, src_x, src_y, src_scl, numsrc, uni->accel_x + off, uni->accel_y + off );
+	}
+}
+
+
+int stars_accelerations( float* ax, float* ay, int maxstars )
+{
+	make_aggregates();
+	const int total = stars_cell_offsets( maxstars );
+	uni->accel_x = ax;
+	uni->accel_y = ay;
+	stars_run_slices( stars_accelerations_slice );
+	uni->accel_x = uni->accel_y = 0;
+	return total;
+}
+
+
+static void stars_reference_slice( argument_t* arg )
+{
+	TT_SCOPE( "reference slice" );
+	SLICE_UNIVERSE( arg );
+	const int cx = (int) (long) arg->arg;
+	for ( int cy=0; cy<GRIDRES; ++cy )
+	{
+		const cell_t& cell = uni->cells[ cx ][ cy ];
+		const int off = uni->accel_offsets[ cx ][ cy ];
+		if ( !cell.cnt || off < 0 ) continue;
+		accelerations<KERNEL_PRECISE>( cell.px, cell.py, cell.cnt, uni->ref_src_x, uni->ref_src_y, uni->ref_src_scl, uni->ref_numsrc, uni->accel_x + off, uni->accel_y + off );
+	}
+}
+
+
+int stars_reference_accelerations( float* ax, float* ay, int maxstars )
+{
+	TT_SCOPE( "reference accelerations" );
+	const int total = stars_cell_offsets( maxstars );
+	const int numstars = stars_total_count();
+	const int cap = numstars + 1 + 16;
+	uni->ref_src_x   = (float*) _mm_malloc( cap * sizeof(float), 64 );
+	uni->ref_src_y   = (float*) _mm_malloc( cap * sizeof(float), 64 );
+	uni->ref_src_scl = (float*) _mm_malloc( cap * sizeof(float), 64 );
+	ASSERT( uni->ref_src_x && uni->ref_src_y && uni->ref_src_scl );
+
+	// Every star is a source: no aggregation.
+	int numsrc = 0;
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			const cell_t& cell = uni->cells[ cx ][ cy ];
+			memcpy( uni->ref_src_x + numsrc, cell.px, cell.cnt * sizeof(float) );
+			memcpy( uni->ref_src_y + numsrc, cell.py, cell.cnt * sizeof(float) );
+			for ( int i=0; i<cell.cnt; ++i )
+				uni->ref_src_scl[ numsrc+i ] = 1;
+			numsrc += cell.cnt;
+		}
+	if ( stars_add_blackhole )
+	{
+		uni->ref_src_x  [ numsrc ] = 0.0f;
+		uni->ref_src_y  [ numsrc ] = 0.0f;
+		uni->ref_src_scl[ numsrc ] = BLACKHOLEMASS;
+		numsrc++;
+	}
+	while ( numsrc % SOURCEBATCH )
+	{
+		uni->ref_src_x  [ numsrc ] = 0;
+		uni->ref_src_y  [ numsrc ] = 0;
+		uni->ref_src_scl[ numsrc ] = 0;
+		numsrc++;
+	}
+	ASSERT( numsrc <= cap );
+	uni->ref_numsrc = numsrc;
+
+	uni->accel_x = ax;
+	uni->accel_y = ay;
+	stars_run_slices( stars_reference_slice );
+	uni->accel_x = uni->accel_y = 0;
+
+	_mm_free( uni->ref_src_x );
+	_mm_free( uni->ref_src_y );
+	_mm_free( uni->ref_src_scl );
+	uni->ref_src_x = uni->ref_src_y = uni->ref_src_scl = 0;
+	uni->ref_numsrc = 0;
+	return total;
+}
+
+
+//! Gather the sources of a single contribution level for a cell. With exact set, the stars inside the aggregates are used, instead of the aggregates.
+//! The black hole is counted as part of level 0, as it is always exact.
+static int cell_gather_level( int cx, int cy, int level, bool exact, float* src_x, float* src_y, float* src_scl, int cap )
+{
+	const contribinfo_t& contrib = contribs[ cx ][ cy ];
+	int reader = 0;
+	for ( int l=0; l<level; ++l )
+		reader += contrib.counts[ l ];
+	const int countn = contrib.counts[ level ];
+	const int res = grid_resolutions[ level ];
+	const int sz = cell_sizes[ level ];
+	int numsrc = 0;
+	for ( int i=0; i<countn; ++i )
+	{
+		const int code = contrib.sortedcoords[ reader++ ];
+		const int x = ( code >> 0 ) & 0xff;
+		const int y = ( code >> 8 ) & 0xff;
+		if ( level == 0 || exact )
+		{
+			for ( int ox=0; ox<sz; ++ox )
+				for ( int oy=0; oy<sz; ++oy )
+				{
+					const cell_t& other = uni->cells[ x*sz+ox ][ y*sz+oy ];
+					ASSERT( numsrc + other.cnt <= cap );
+					memcpy( src_x + numsrc, other.px, other.cnt * sizeof(float) );
+					memcpy( src_y + numsrc, other.py, other.cnt * sizeof(float) );
+					for ( int j=0; j<other.cnt; ++j )
+						src_scl[ numsrc+j ] = 1;
+					numsrc += other.cnt;
+				}
+		}
+		else
+		{
+			const aggregate_t& ag = uni->aggregates[ level ][ x * res + y ];
+			if ( ag.cnt )
+			{
+				src_x  [ numsrc ] = ag.cx;
+				src_y  [ numsrc ] = ag.cy;
+				src_scl[ numsrc ] = ag.cnt;
+				numsrc++;
+			}
+		}
+	}
+	if ( level == 0 && stars_add_blackhole )
+	{
+		src_x  [ numsrc ] = 0.0f;
+		src_y  [ numsrc ] = 0.0f;
+		src_scl[ numsrc ] = BLACKHOLEMASS;
+		numsrc++;
+	}
+	while ( numsrc % SOURCEBATCH )
+	{
+		src_x  [ numsrc ] = 0;
+		src_y  [ numsrc ] = 0;
+		src_scl[ numsrc ] = 0;
+		numsrc++;
+	}
+	ASSERT( numsrc <= cap );
+	return numsrc;
+}
+
+
+static void stars_level_slice( argument_t* arg )
+{
+	TT_SCOPE( "level slice" );
+	SLICE_UNIVERSE( arg );
+	const int cx = (int) (long) arg->arg;
+	const int cap = uni->level_cap;
+	float* src_x   = (float*) _mm_malloc( cap * sizeof(float), 64 );
+	float* src_y   = (float*) _mm_malloc( cap * sizeof(float), 64 );
+	float* src_scl = (float*) _mm_malloc( cap * sizeof(float), 64 );
+	float acc_x[ CELLCAP ];
+	float acc_y[ CELLCAP ];
+	for ( int cy=0; cy<GRIDRES; ++cy )
+	{
+		const cell_t& cell = uni->cells[ cx ][ cy ];
+		const int off = uni->accel_offsets[ cx ][ cy ];
+		if ( !cell.cnt || off < 0 ) continue;
+		for ( int level=0; level<=NUMDIMS; ++level )
+		{
+			const int numsrc = cell_gather_level( cx, cy, level, uni->accel_exact, src_x, src_y, src_scl, cap );
+			if ( uni->accel_exact )
+				accelerations<KERNEL_PRECISE>( cell.px, cell.py, cell.cnt, src_x, src_y, src_scl, numsrc, acc_x, acc_y );
+			else
+				cell_accelerations( cell, src_x, src_y, src_scl, numsrc, acc_x, acc_y );
+			for ( int i=0; i<cell.cnt; ++i )
+			{
+				uni->accel_x[ ( off+i ) * uni->accel_stride + level ] = acc_x[ i ];
+				uni->accel_y[ ( off+i ) * uni->accel_stride + level ] = acc_y[ i ];
+			}
+		}
+	}
+	_mm_free( src_x );
+	_mm_free( src_y );
+	_mm_free( src_scl );
+}
+
+
+int stars_level_accelerations( bool exact, float* ax, float* ay, int maxstars )
+{
+	TT_SCOPE( "level accelerations" );
+	make_aggregates();
+	const int total = stars_cell_offsets( maxstars );
+	uni->accel_x = ax;
+	uni->accel_y = ay;
+	uni->accel_stride = 1+NUMDIMS;
+	uni->accel_exact = exact;
+	uni->level_cap = stars_total_count() + 1 + 16;
+	stars_run_slices( stars_level_slice );
+	uni->accel_x = uni->accel_y = 0;
+	uni->accel_stride = 1;
+	return total;
+}
 
 
 void stars_next_hue_mapping(void)
@@ -980,6 +2238,7 @@ void stars_next_hue_mapping(void)
 }
 
 
+#if !defined( HEADLESS )
 void stars_draw_grid( void )
 {
 	if ( !stars_show_grid ) return;
@@ -995,7 +2254,7 @@ void stars_draw_grid( void )
 	for ( int cx=0; cx<GRIDRES; ++cx )
 		for ( int cy=0; cy<GRIDRES; ++cy )
 		{
-			const cell_t& cell = cells[ cx ][ cy ];
+			const cell_t& cell = uni->cells[ cx ][ cy ];
 			const float x0 = cell.xrng[0];
 			const float x1 = cell.xrng[1];
 			const float y0 = cell.yrng[0];
@@ -1049,11 +2308,12 @@ void stars_draw_field( void )
 	float v = 0.002f * cam_scl / (circle_scl*circle_scl);
 	glUniform1f( gainUniform, v );
 
+	const double t0 = wallclock_seconds();
 	int totalv = 0;
 	for ( int cx=0; cx<GRIDRES; ++cx )
 		for ( int cy=0; cy<GRIDRES; ++cy )
 		{
-			cell_t& cell = cells[ cx ][ cy ];
+			cell_t& cell = uni->cells[ cx ][ cy ];
 			totalv += cell.cnt;
 		}
 
@@ -1070,7 +2330,7 @@ void stars_draw_field( void )
 	for ( int cx=0; cx<GRIDRES; ++cx )
 		for ( int cy=0; cy<GRIDRES; ++cy )
 		{
-			cell_t& cell = cells[ cx ][ cy ];
+			cell_t& cell = uni->cells[ cx ][ cy ];
 			for ( int i=0; i<cell.cnt && writer < MAXSTARS; ++i )
 			{
 				vdata.perinstance[ writer ].displacements[ 0 ] = cell.px[ i ];
@@ -1090,6 +2350,8 @@ void stars_draw_field( void )
 		}
 
 	ASSERT( writer == totalv );
+	const double t1 = wallclock_seconds();
+	phasetimers_record( PHASETIMER_FILL, t1 - t0 );
 
 	GLuint vbooff = (GLuint) ( sizeof( vdata.circle ) );
 	GLuint vbosz  = (GLuint) ( vbooff + totalv * sizeof(perinstance_t) );
@@ -1102,6 +2364,8 @@ void stars_draw_field( void )
 	glBindBuffer( GL_ARRAY_BUFFER, vbo );
 	glBufferData( GL_ARRAY_BUFFER, vbosz, (void*) &vdata, GL_STREAM_DRAW );
 	CHECK_OGL
+	const double t2 = wallclock_seconds();
+	phasetimers_record( PHASETIMER_UPLOAD, t2 - t1 );
 	const size_t stride = 3 * sizeof(float);
 	glVertexAttribPointer( ATTRIB_VERTEX, 2, GL_FLOAT, 0, stride, (void*) 0 );
 	CHECK_OGL
@@ -1136,5 +2400,7 @@ void stars_draw_field( void )
 	glBindBuffer( GL_ARRAY_BUFFER, 0 );
 	glDeleteBuffers( 1, &vbo );
 	CHECK_OGL
+	phasetimers_record( PHASETIMER_DRAW, wallclock_seconds() - t2 );
 }
+#endif
 
@@ -1,11 +1,33 @@
+#ifndef STARS_H
+#define STARS_H
 #define	GRIDRES		32	//! Grid resolution.
 #define CELLCAP		3900	//! Max stars per cell.
+#define MAXSTARS	120000	//! Max stars drawn, and that a spawn command may ask for. Loaded fields can be larger.
+#define MAXCONTRIBS	500	//! Max aggregates that pull on a cell.
+#define MAXGATHERED	( MAXCONTRIBS + 8 * CELLCAP + 1 )	//! Max gravity sources for the stars in a cell: stars, aggregates and the black hole.
+
+//! The SIMD force kernels take their sources in batches of this many. Gathered sources are padded with zero-mass sources to a multiple of it.
+#if VECTORIZE > 1
+#	define SOURCEBATCH	VECTORIZE
+#else
+#	define SOURCEBATCH	1
+#endif
+
+//! Max gravity sources for the stars in a cell, with room for the padding.
+#define MAXSOURCES	( ( MAXGATHERED + SOURCEBATCH - 1 ) / SOURCEBATCH * SOURCEBATCH )
+
+#define STARS_G			0.0002f		//! Gravitational constant. Every star has unit mass.
+#define STARS_BLACKHOLEMASS	20000.0f	//! Mass of the black hole in the centre, when stars_add_blackhole is set.
 
 #define ST_CROSSED_LO_X		(1<<0)
 #define ST_CROSSED_HI_X		(1<<1)
 #define ST_CROSSED_LO_Y		(1<<2)
 #define ST_CROSSED_HI_Y		(1<<3)
 
+// Bits 4..7 hold the block time-step level of the star, see INTEGRATOR_BLOCK.
+#define ST_LEVEL_SHIFT		4
+#define ST_LEVEL_MASK		(0xf<<ST_LEVEL_SHIFT)
+
 #define ST_IS_SET( ST, B ) \
 	( ( ST & B ) != 0 )
 
@@ -24,6 +46,9 @@
 #define ST_CLR_CROSSED_LO_Y( ST )	ST &= ~ST_CROSSED_LO_Y
 #define ST_CLR_CROSSED_HI_Y( ST )	ST &= ~ST_CROSSED_HI_Y
 
+#define ST_GET_LEVEL( ST )		( ( (ST) & ST_LEVEL_MASK ) >> ST_LEVEL_SHIFT )
+#define ST_SET_LEVEL( ST, L )		ST = ( (ST) & ~ST_LEVEL_MASK ) | ( (L) << ST_LEVEL_SHIFT )
+
 typedef struct
 {
 	float px[ CELLCAP ];	//! x coordinates of all the stars in this cell.
@@ -32,6 +57,8 @@ typedef struct
 	float qy[ CELLCAP ];	//! new y coordinates of all the stars in this cell.
 	float vx[ CELLCAP ];	//! velocities, x component.
 	float vy[ CELLCAP ];	//! velocities, y component.
+	float ax[ CELLCAP ];	//! accelerations from the last force evaluation, x component.
+	float ay[ CELLCAP ];	//! accelerations from the last force evaluation, y component.
 	int   st[ CELLCAP ];	//! status bits for each star.
 	float age[ CELLCAP ];	//! how old is each star.
 	float xrng[2];		//! cell's low and high x.
@@ -102,9 +129,104 @@ extern bool stars_show_aggr;
 //! Optionally add a black hole at the centre of the grid.
 extern bool stars_add_blackhole;
 
+enum
+{
+	STARS_COST_OFF=0,		//! no per cell costs are kept.
+	STARS_COST_TIME,		//! seconds spent in the force pass of each cell.
+	STARS_COST_INTERACTIONS,	//! star-source pairs that went through the force kernel, for each cell.
+	STARS_COST_NUMMODES
+};
+
+//! What the force pass records per cell, one of STARS_COST_*. When not off, it is shown as a heatmap over the grid.
+extern int stars_cost_mode;
+
+//! Printable names of the cost modes.
+extern const char* const stars_cost_names[ STARS_COST_NUMMODES ];
+
+//! Toggle to mark each cell of the heatmap with the worker thread that ran its force pass.
+extern bool stars_show_owners;
+
+//! Cost of a cell per step, smoothed over recent steps, in the unit of stars_cost_mode.
+extern float stars_cell_cost( int cx, int cy );
+
+#if !defined( HEADLESS )
+//! Add the heatmap of the cell costs to the debug draw. Call once per frame.
+extern void stars_draw_cost( void );
+#endif
+
+//! Accuracy of the reciprocal square root in the force kernel: KERNEL_APPROX, KERNEL_NEWTON or KERNEL_PRECISE (see forcekernel.h.)
+extern int stars_kernel_tier;
+
+enum
+{
+	INTEGRATOR_EULER=0,	//! Semi-implicit Euler, first order.
+	INTEGRATOR_KDK,		//! Kick-drift-kick leapfrog, second order, one force evaluation per step.
+	INTEGRATOR_YOSHIDA4,	//! Fourth order symplectic composition of three leapfrog steps.
+	INTEGRATOR_BLOCK,	//! Kick-drift-kick with per star power-of-two steps, only evaluating the stars that are due.
+	INTEGRATOR_NUMMODES
+};
+
+//! Which integrator advances the stars, one of INTEGRATOR_*.
+extern int stars_integrator;
+
+//! Printable names of the integrators.
+extern const char* const stars_integrator_names[ INTEGRATOR_NUMMODES ];
+
+//! Coarsest block level: the slowest stars step 2^STARS_MAXBLOCKLEVEL times the finest step.
+#define STARS_MAXBLOCKLEVEL	4
+
+//! Accuracy of the block time steps: a star's step is eta*sqrt(1/|a|), with lengths in cell widths. Smaller is finer.
+extern float stars_block_eta;
+
+//! Work done and wall time spent in each phase of stars_update(), summed over the steps since the last reset.
+typedef struct
+{
+	int steps;			//! number of calls to stars_update().
+	long long starsteps;		//! stars advanced, summed over the steps.
+	long long evaluations;		//! stars whose force was evaluated.
+	long long interactions;		//! star-source pairs that went through the force kernel.
+	long long crossings;		//! stars that crossed into another cell.
+	long long sources;		//! gravity sources gathered, summed over the cells whose forces were evaluated. Excludes padding.
+	long long nearfield;		//! interactions with individual stars.
+	long long farfield;		//! interactions with aggregates and the black hole.
+	long long padding;		//! interactions with the zero-mass sources that pad a batch: wasted lanes.
+	int peakcell;			//! most stars in a single cell, to hold against CELLCAP.
+	int peaksources;		//! most sources gathered for a single cell, to hold against MAXGATHERED.
+	double total;			//! whole of stars_update(), excluding the debug draw.
+	double aggregation;		//! building the aggregates.
+	double forces;			//! gather, force kernel and kicks, on the workers.
+	double drift;			//! drift passes that evaluate no forces.
+	double swap;			//! copying new positions over old ones.
+	double transits;		//! moving stars to the cells they crossed into.
+	double ageing;			//! ageing the stars.
+} stars_stats_t;
+
+//! Get the stats summed since the last reset.
+extern void stars_get_stats( stars_stats_t* s );
+
+//! Start summing the stats from zero.
+extern void stars_reset_stats( void );
+
+//! Get the stats of the last call to stars_update() only. The peaks are those of that step.
+extern void stars_get_step_stats( stars_stats_t* s );
+
+//! Number of steps taken since launch, and the simulated time.
+extern int stars_get_step_nr( double* time=0 );
+
+//! Counts the changes to the stars: it goes up with every step, spawn, clear and load, so that a reader can tell that
+//! what it read went stale. It is odd while any of those is under way, a load from the first stars_load_cell() to stars_set_state():
+//! read it before and after reading stars from another thread, with an acquire fence before the second read, and if it was odd, or changed, read again.
+extern unsigned int stars_generation( void );
+
 //! Upon program launch.
 extern void stars_init( bool multithreaded = true );
 
+//! Set the number of worker threads for the simulation. With 1 or less, it runs on the calling thread.
+extern void stars_set_threads( int numthreads );
+
+//! Run fn( job, ctx ) for every job in 0..numjobs-1, on the worker threads of the simulation if it has them. Returns when all are done.
+extern void stars_parallel( int numjobs, void (*fn)( int job, void* ctx ), void* ctx );
+
 //! Upon program exit.
 extern void stars_exit( void );
 
@@ -123,6 +245,9 @@ extern void stars_clear_cell( float x, float y );
 //! Calculate aggregate gravitation.
 extern void stars_calculate_contribution_info( void );
 
+//! Most stars a sprinkle command may ask for. Larger counts, from a stream client or an input log, are clamped to it.
+#define MAXSPRINKLE	256
+
 //! Add stars at specified location.
 extern void stars_sprinkle( int cnt, float x, float y, float rad, bool addrot );
 
@@ -132,14 +257,89 @@ extern bool stars_select( float px, float py );
 //! Total number of stars in the simulation: sum of stars in each cell.
 extern int  stars_total_count( void );
 
+//! Read access to a cell of the grid.
+extern const cell_t* stars_cell( int cx, int cy );
+
+//! Bookkeeping of the simulation outside the cells, which a checkpoint needs to continue exactly where it left off.
+typedef struct
+{
+	int numcreated;		//! uids handed out so far.
+	int spawnidx;		//! position in the halton sequence for spawning.
+	int step;		//! step nr, see stars_get_step_nr().
+	double time;		//! simulated time.
+	int integrator;		//! stars_integrator.
+	int kerneltier;		//! stars_kernel_tier.
+	int blackhole;		//! stars_add_blackhole.
+	int blocktick;		//! position in the block schedule of INTEGRATOR_BLOCK.
+	int accstale;		//! set if the accelerations in the cells do not belong to the positions.
+} stars_state_t;
+
+//! Get the bookkeeping, to go with the contents of the cells.
+extern void stars_get_state( stars_state_t* s );
+
+//! Restore the bookkeeping, after the cells were filled with stars_load_cell(). This ends the load, see stars_generation().
+extern void stars_set_state( const stars_state_t* s );
+
+//! Replace the stars of a cell with cnt stars, copied from arrays laid out like those of cell_t. Returns false if cnt exceeds CELLCAP.
+extern bool stars_load_cell( int cx, int cy, int cnt, const float* px, const float* py, const float* vx, const float* vy, const float* ax, const float* ay, const int* st, const float* age );
+
 //! Update the simulation.
 extern void stars_update( float dt );
 
+//! A star field of its own, with its own step count, stats and diagnostics.
+//! The stars_* calls act on the universe selected by the calling thread, which starts out as the one of stars_create().
+//! The contribution tables, the worker threads and the settings, like stars_integrator, are shared by all universes.
+typedef struct stars_universe stars_universe_t;
+
+//! Create an empty universe. Call stars_create() first.
+extern stars_universe_t* stars_universe_create( void );
+
+//! Free a universe made with stars_universe_create(). If the calling thread had it selected, it goes back to the first universe.
+extern void stars_universe_free( stars_universe_t* u );
+
+//! Make the stars_* calls of the calling thread act on universe u, or on the first universe if u is 0. Returns the universe selected before, to restore it with.
+extern stars_universe_t* stars_universe_select( stars_universe_t* u );
+
+//! Take steps steps of dt in each of the universes, 0 meaning the first one.
+//! Each universe is stepped whole by a single worker, so that many small universes keep all the workers busy, where the
+//! columns of a small field are too little work to spread. Returns when all are done.
+extern void stars_ensemble_update( stars_universe_t* const* universes, int numuniverses, float dt, int steps );
+
+//! Conserved quantities of the star field, for judging integration quality. All stars have unit mass.
+typedef struct
+{
+	int step;		//! step nr at which these were computed.
+	double time;		//! simulated time.
+	int numstars;		//! nr of stars in the field.
+	double kinetic;		//! total kinetic energy.
+	double potential;	//! total potential energy, approximated through the same aggregates as the forces.
+	double momentum[2];	//! total linear momentum.
+	double angular;		//! total angular momentum around the grid centre.
+} stars_diagnostics_t;
+
+//! Compute the diagnostics during every Nth step. Zero disables them.
+extern int stars_diagnostics_interval;
+
+//! Fetch the diagnostics. Returns false if none were computed since the previous call.
+extern bool stars_diagnostics( stars_diagnostics_t* d );
+
+//! Compute the acceleration on every star, without advancing the simulation. Stars are written in cell order, same as the draw order. Returns nr of stars written.
+extern int  stars_accelerations( float* ax, float* ay, int maxstars );
+
+//! Reference solver: exact acceleration on every star by direct summation over all pairs, no aggregation. Same order as stars_accelerations().
+extern int  stars_reference_accelerations( float* ax, float* ay, int maxstars );
+
+//! Acceleration on every star, split out per contribution level (1+NUMDIMS values per star.) Level 0 holds the neighbouring stars and the black hole.
+//! With exact set, each level sums the individual stars inside its aggregates instead of the aggregates themselves.
+extern int  stars_level_accelerations( bool exact, float* ax, float* ay, int maxstars );
+
+#if !defined( HEADLESS )
 //! Draw a background grid showing the cells.
 extern void stars_draw_grid( void );
 
 //! Draw the stars.
 extern void stars_draw_field( void );
+#endif
 
 //! The size of the particles on screen.
 extern void stars_change_splat_radius( float d );
@@ -147,3 +347,4 @@ extern void stars_change_splat_radius( float d );
 //! Go to next hue mapping.
 extern void stars_next_hue_mapping(void);
 
+#endif
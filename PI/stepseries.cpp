@@ -0,0 +1,75 @@
+// stepseries.cpp
+//
+// Writes the work counters of every simulation step as a time series, to a CSV file.
+
+#include "stepseries.h"
+#include "stars.h"
+
+// From GBase
+#include "logx.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+static FILE* csv = 0;
+
+//! Step nr of the last row, so that a frame without steps writes no duplicate.
+static int laststep = -1;
+
+
+bool stepseries_open( const char* fname )
+{
+	stepseries_close();
+	csv = fopen( fname, "w" );
+	if ( !csv )
+	{
+		LOGE( "Cannot write step series to %s", fname );
+		return false;
+	}
+	laststep = -1;
+	fprintf
+	(
+		csv,
+		"label,step,time,stars,evaluations,sources,nearfield,farfield,padding,padding_pct,crossings,"
+		"peakcell,cellcap,peaksources,maxgathered,ms\n"
+	);
+	return true;
+}
+
+
+void stepseries_close( void )
+{
+	if ( csv )
+		fclose( csv );
+	csv = 0;
+}
+
+
+bool stepseries_is_open( void )
+{
+	return csv != 0;
+}
+
+
+void stepseries_record( const char* label )
+{
+	if ( !csv )
+		return;
+	double time = 0.0;
+	const int step = stars_get_step_nr( &time );
+	if ( step == laststep )
+		return;
+	laststep = step;
+
+	stars_stats_t s;
+	stars_get_step_stats( &s );
+	const long long lanes = s.nearfield + s.farfield + s.padding;
+	fprintf
+	(
+		csv, "%s,%d,%.5f,%lld,%lld,%lld,%lld,%lld,%lld,%.2f,%lld,%d,%d,%d,%d,%.4f\n",
+		label ? label : "", step, time, s.starsteps, s.evaluations, s.sources, s.nearfield, s.farfield, s.padding,
+		lanes ? 100.0 * s.padding / lanes : 0.0, s.crossings,
+		s.peakcell, CELLCAP, s.peaksources, MAXGATHERED, 1000 * s.total
+	);
+}
@@ -0,0 +1,20 @@
+// stepseries.h
+//
+// Writes the work counters of every simulation step as a time series, to a CSV file.
+
+#ifndef STEPSERIES_H
+#define STEPSERIES_H
+
+//! Start writing a row per step to a CSV file.
+extern bool stepseries_open( const char* fname );
+
+//! Stop writing the CSV file.
+extern void stepseries_close( void );
+
+//! Whether a CSV file is open.
+extern bool stepseries_is_open( void );
+
+//! Write a row for the last call to stars_update(). Call it after every step. The label goes into the row, to tell runs apart.
+extern void stepseries_record( const char* label );
+
+#endif
@@ -0,0 +1,474 @@
+// streamclient.cpp
+//
+// Watches and steers a simulation that runs elsewhere, through the stream of a streamserver.
+
+#include "streamclient.h"
+#include "trajectory.h"
+#include "stars.h"
+
+// From GBase
+#include "logx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#if defined( linux )
+#	include <pthread.h>
+#	include <poll.h>
+#	include <unistd.h>
+#	include <errno.h>
+#	include <netdb.h>
+#	include <sys/socket.h>
+#	include <netinet/in.h>
+#	include <netinet/tcp.h>
+#endif
+
+
+typedef trajectory_record_t record_t;
+
+//! A frame turned back into grid coordinates.
+typedef struct
+{
+	float* px;
+	float* py;
+	float* vx;
+	float* vy;
+	int* uid;
+	int* cell;		//! cx * GRIDRES + cy.
+	int cap;
+	int count;
+	int step;
+	double time;
+} decoded_t;
+
+
+#if defined( linux )
+
+// The decoded frames form a triple buffer: the receiver fills back, and swaps it with front. Adopting swaps front with mine.
+static decoded_t decoded[ 3 ];
+static int back = 0;
+static int front = 1;
+static int mine = 2;
+static bool fresh = false;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t receiver;
+static bool started = false;
+static int sockfd = -1;
+static volatile bool connected = false;
+static volatile bool quit = false;
+static volatile int received = 0;
+static int adopted = 0;
+
+// Owned by the receiver.
+static trajectory_header_t header;
+static record_t* ref = 0;	// the previous frame, sorted by uid.
+static int refcount = 0;
+static int refcap = 0;
+static double reftime = 0.0;
+static record_t* cur = 0;
+static int curcap = 0;
+static unsigned char* packed = 0;
+static size_t packedcap = 0;
+static unsigned char* raw = 0;
+static size_t rawcap = 0;
+
+
+static void reserve( decoded_t& d, int n )
+{
+	if ( n <= d.cap )
+		return;
+	d.cap = n;
+	d.px = (float*) realloc( d.px, n * sizeof( float ) );
+	d.py = (float*) realloc( d.py, n * sizeof( float ) );
+	d.vx = (float*) realloc( d.vx, n * sizeof( float ) );
+	d.vy = (float*) realloc( d.vy, n * sizeof( float ) );
+	d.uid = (int*) realloc( d.uid, n * sizeof( int ) );
+	d.cell = (int*) realloc( d.cell, n * sizeof( int ) );
+}
+
+
+static void release( decoded_t& d )
+{
+	free( d.px );
+	free( d.py );
+	free( d.vx );
+	free( d.vy );
+	free( d.uid );
+	free( d.cell );
+	memset( &d, 0, sizeof( decoded_t ) );
+}
+
+
+static void* grow( void* buf, size_t* cap, size_t needed )
+{
+	if ( needed <= *cap )
+		return buf;
+	*cap = needed;
+	return realloc( buf, needed );
+}
+
+
+//! Read exactly sz bytes. Returns false when the server is gone, or on closing.
+static bool receive_all( void* buf, size_t sz )
+{
+	char* w = (char*) buf;
+	while ( sz > 0 )
+	{
+		if ( quit )
+			return false;
+		struct pollfd pfd = { sockfd, POLLIN, 0 };
+		const int rv = poll( &pfd, 1, 250 );
+		if ( rv < 0 && errno != EINTR )
+			return false;
+		if ( rv <= 0 )
+			continue;
+		const ssize_t n = recv( sockfd, w, sz, 0 );
+		if ( n <= 0 )
+			return false;
+		w += n;
+		sz -= n;
+	}
+	return true;
+}
+
+
+//! True if all records lie in the grid. Their cells index the tables of streamclient_adopt(), so a frame that does not is corrupt.
+static bool in_grid( const record_t* records, int n )
+{
+	const uint32_t limit = GRIDRES * TRAJECTORY_QUANT;
+	for ( int i=0; i<n; ++i )
+		if ( records[ i ].gx >= limit || records[ i ].gy >= limit )
+			return false;
+	return true;
+}
+
+
+//! Turn the decoded records into positions, with velocities from the previous frame, and hand them to the simulation thread.
+static void publish( const trajectory_frame_t& frame, int n )
+{
+	decoded_t& d = decoded[ back ];
+	reserve( d, n );
+	const float scl = header.cellsize / TRAJECTORY_QUANT;
+	const double dt = frame.time - reftime;
+	const float invdt = dt > 0.0 ? (float) ( 1.0 / dt ) : 0.0f;
+	int j = 0;
+	for ( int i=0; i<n; ++i )
+	{
+		const record_t& r = cur[ i ];
+		d.px[ i ] = header.originx + ( r.gx + 0.5f ) * scl;
+		d.py[ i ] = header.originy + ( r.gy + 0.5f ) * scl;
+		d.uid[ i ] = (int) r.uid;
+		d.cell[ i ] = ( r.gx / TRAJECTORY_QUANT ) * GRIDRES + ( r.gy / TRAJECTORY_QUANT );
+		while ( j < refcount && ref[ j ].uid < r.uid )
+			++j;
+		const bool known = j < refcount && ref[ j ].uid == r.uid;
+		d.vx[ i ] = known ? ( (int32_t) ( r.gx - ref[ j ].gx ) ) * scl * invdt : 0.0f;
+		d.vy[ i ] = known ? ( (int32_t) ( r.gy - ref[ j ].gy ) ) * scl * invdt : 0.0f;
+	}
+	d.count = n;
+	d.step = frame.step;
+	d.time = frame.time;
+
+	pthread_mutex_lock( &lock );
+	const int tmp = front;
+	front = back;
+	back = tmp;
+	fresh = true;
+	pthread_mutex_unlock( &lock );
+}
+
+
+static void* receive_loop( void* )
+{
+	bool ok = receive_all( &header, sizeof( header ) );
+	if ( ok && ( memcmp( header.magic, "NBODYTRJ", 8 ) || header.version != TRAJECTORY_VERSION || header.gridres != GRIDRES ) )
+	{
+		LOGE( "The stream does not match this build." );
+		ok = false;
+	}
+	while ( ok )
+	{
+		trajectory_frame_t frame;
+		if ( !receive_all( &frame, sizeof( frame ) ) )
+			break;
+		if
+		(
+			memcmp( frame.magic, "TRJF", 4 ) ||
+			frame.numstars > GRIDRES * GRIDRES * CELLCAP ||
+			frame.rawsize > TRAJECTORY_ENCODEDMAX( frame.numstars ) ||
+			frame.packedsize > compressBound( frame.rawsize )
+		)
+		{
+			LOGE( "Corrupt frame in the stream." );
+			break;
+		}
+		packed = (unsigned char*) grow( packed, &packedcap, frame.packedsize );
+		raw = (unsigned char*) grow( raw, &rawcap, frame.rawsize );
+		if ( !receive_all( packed, frame.packedsize ) )
+			break;
+		uLongf rawsize = frame.rawsize;
+		const int n = (int) frame.numstars;
+		if ( n > curcap )
+		{
+			curcap = n;
+			cur = (record_t*) realloc( cur, curcap * sizeof( record_t ) );
+		}
+		if
+		(
+			uncompress( raw, &rawsize, packed, frame.packedsize ) != Z_OK ||
+			trajectory_decode( raw, rawsize, n, frame.keyframe ? 0 : ref, refcount, cur ) != n
+		)
+		{
+			LOGE( "Cannot decode the frame of step %d in the stream.", frame.step );
+			break;
+		}
+		if ( !in_grid( cur, n ) )
+		{
+			LOGE( "The frame of step %d in the stream has stars outside the grid.", frame.step );
+			break;
+		}
+		publish( frame, n );
+		received += 1;
+
+		// This frame is the reference for the next one.
+		record_t* tmp = ref;
+		ref = cur;
+		cur = tmp;
+		const int tmpcap = refcap;
+		refcap = curcap;
+		curcap = tmpcap;
+		refcount = n;
+		reftime = frame.time;
+	}
+	if ( !quit )
+		LOGI( "The stream server went away, after %d frames.", received );
+	connected = false;
+	return 0;
+}
+
+
+bool streamclient_connect( const char* address )
+{
+	streamclient_close();
+	char host[ 128 ];
+	const char* colon = strrchr( address, ':' );
+	const char* port = colon ? colon+1 : address;
+	const size_t len = colon ? colon - address : 0;
+	if ( len >= sizeof( host ) )
+		return false;
+	memcpy( host, address, len );
+	host[ len ] = 0;
+
+	struct addrinfo hints;
+	memset( &hints, 0, sizeof( hints ) );
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo* res = 0;
+	if ( getaddrinfo( len ? host : "127.0.0.1", port, &hints, &res ) != 0 || !res )
+	{
+		LOGE( "Cannot resolve stream server %s", address );
+		return false;
+	}
+	sockfd = socket( res->ai_family, res->ai_socktype, res->ai_protocol );
+	if ( sockfd < 0 || connect( sockfd, res->ai_addr, res->ai_addrlen ) < 0 )
+	{
+		LOGE( "Cannot connect to stream server %s: %s", address, strerror( errno ) );
+		freeaddrinfo( res );
+		streamclient_close();
+		return false;
+	}
+	freeaddrinfo( res );
+	const int one = 1;
+	setsockopt( sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+
+	refcount = 0;
+	reftime = 0.0;
+	received = 0;
+	adopted = 0;
+	fresh = false;
+	quit = false;
+	connected = true;
+	if ( pthread_create( &receiver, 0, receive_loop, 0 ) )
+	{
+		LOGE( "Cannot start the stream receiver." );
+		connected = false;
+		streamclient_close();
+		return false;
+	}
+	started = true;
+	LOGI( "Connected to stream server %s", address );
+	return true;
+}
+
+
+void streamclient_close( void )
+{
+	if ( started )
+	{
+		quit = true;
+		pthread_join( receiver, 0 );
+		started = false;
+	}
+	connected = false;
+	if ( sockfd >= 0 )
+		close( sockfd );
+	sockfd = -1;
+	for ( int i=0; i<3; ++i )
+		release( decoded[ i ] );
+	free( ref );
+	free( cur );
+	free( packed );
+	free( raw );
+	ref = cur = 0;
+	packed = raw = 0;
+	refcount = refcap = curcap = 0;
+	packedcap = rawcap = 0;
+}
+
+
+bool streamclient_connected( void )
+{
+	return connected;
+}
+
+
+bool streamclient_send( const char* cmd )
+{
+	if ( !connected )
+		return false;
+	char line[ 256 ];
+	const int len = snprintf( line, sizeof( line ), "%s\n", cmd );
+	if ( len <= 0 || len >= (int) sizeof( line ) )
+		return false;
+	return send( sockfd, line, len, MSG_NOSIGNAL ) == len;
+}
+
+
+int streamclient_received( void )
+{
+	return received;
+}
+
+
+int streamclient_adopted( void )
+{
+	return adopted;
+}
+
+
+bool streamclient_adopt( void )
+{
+	pthread_mutex_lock( &lock );
+	const bool take = fresh;
+	if ( take )
+	{
+		const int tmp = mine;
+		mine = front;
+		front = tmp;
+		fresh = false;
+	}
+	pthread_mutex_unlock( &lock );
+	if ( !take )
+		return false;
+
+	// Sort the stars by cell, and fill the cells with them.
+	const decoded_t& d = decoded[ mine ];
+	static int cellstart[ GRIDRES * GRIDRES + 1 ];
+	memset( cellstart, 0, sizeof( cellstart ) );
+	for ( int i=0; i<d.count; ++i )
+		cellstart[ d.cell[ i ] + 1 ] += 1;
+	for ( int c=0; c<GRIDRES*GRIDRES; ++c )
+		cellstart[ c+1 ] += cellstart[ c ];
+
+	static decoded_t sorted;
+	reserve( sorted, d.count );
+	static int* st = 0;
+	static int stcap = 0;
+	if ( d.count > stcap )
+	{
+		stcap = d.count;
+		st = (int*) realloc( st, stcap * sizeof( int ) );
+	}
+	static int fill[ GRIDRES * GRIDRES ];
+	memcpy( fill, cellstart, sizeof( fill ) );
+	int maxuid = -1;
+	for ( int i=0; i<d.count; ++i )
+	{
+		const int k = fill[ d.cell[ i ] ]++;
+		sorted.px[ k ] = d.px[ i ];
+		sorted.py[ k ] = d.py[ i ];
+		sorted.vx[ k ] = d.vx[ i ];
+		sorted.vy[ k ] = d.vy[ i ];
+		st[ k ] = d.uid[ i ] << 8;
+		maxuid = d.uid[ i ] > maxuid ? d.uid[ i ] : maxuid;
+	}
+
+	static float zeros[ CELLCAP ];
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			const int c = cx * GRIDRES + cy;
+			const int first = cellstart[ c ];
+			int cnt = cellstart[ c+1 ] - first;
+			cnt = cnt > CELLCAP ? CELLCAP : cnt;
+			stars_load_cell( cx, cy, cnt, sorted.px + first, sorted.py + first, sorted.vx + first, sorted.vy + first, zeros, zeros, st + first, zeros );
+		}
+
+	stars_state_t state;
+	stars_get_state( &state );
+	state.numcreated = maxuid + 1;
+	state.step = d.step;
+	state.time = d.time;
+	state.accstale = 1;
+	stars_set_state( &state );
+	adopted += 1;
+	return true;
+}
+
+#else
+
+bool streamclient_connect( const char* address )
+{
+	LOGE( "Streaming is not supported on this platform." );
+	return false;
+}
+
+
+void streamclient_close( void )
+{
+}
+
+
+bool streamclient_connected( void )
+{
+	return false;
+}
+
+
+bool streamclient_send( const char* cmd )
+{
+	return false;
+}
+
+
+bool streamclient_adopt( void )
+{
+	return false;
+}
+
+
+int streamclient_received( void )
+{
+	return 0;
+}
+
+
+int streamclient_adopted( void )
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,32 @@
+// streamclient.h
+//
+// Watches and steers a simulation that runs elsewhere, through the stream of a streamserver (see streamserver.h.)
+//
+// A thread of its own receives the frames, inflates and decodes them, and turns the quantised positions back into
+// grid coordinates. Velocities are estimated from the change in position of each uid since the previous frame.
+// The thread that steps the simulation calls streamclient_adopt() instead, which replaces the stars with the newest
+// frame, so that drawing works as for a local simulation. Stars that arrive this way have an age of 0.
+
+#ifndef STREAMCLIENT_H
+#define STREAMCLIENT_H
+
+//! Connect to a server at HOST:PORT, or at a port of localhost. Returns false if it cannot connect.
+extern bool streamclient_connect( const char* address );
+
+//! Disconnect.
+extern void streamclient_close( void );
+
+//! True while connected. When the server goes away, this turns false, and the stars of the last frame stay.
+extern bool streamclient_connected( void );
+
+//! Send a command line to the server, as described in streamserver.h. Returns false if not connected.
+extern bool streamclient_send( const char* cmd );
+
+//! Replace the stars with the newest frame, if one arrived since the last call. Returns true if it did.
+extern bool streamclient_adopt( void );
+
+//! Frames received, and frames adopted.
+extern int streamclient_received( void );
+extern int streamclient_adopted( void );
+
+#endif
@@ -0,0 +1,556 @@
+// streamserver.cpp
+//
+// Streams the star field over TCP to viewers on other machines, and takes commands back from them.
+
+#include "streamserver.h"
+#include "trajectory.h"
+#include "stars.h"
+#include "wallclock.h"
+
+// From GBase
+#include "logx.h"
+#include "nfy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#if defined( linux )
+#	include <pthread.h>
+#	include <poll.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#	include <errno.h>
+#	include <sys/socket.h>
+#	include <netinet/in.h>
+#	include <netinet/tcp.h>
+#	include <arpa/inet.h>
+#endif
+
+
+bool streamserver_enabled = false;
+float streamserver_rate = 30.0f;
+
+//! Clients served at the same time.
+#define MAXCLIENTS	8
+
+//! Every this many frames sent to a client is a keyframe.
+#define KEYFRAMEINTERVAL	100
+
+//! Longest command line, and most commands waiting for the simulation.
+#define MAXCMDLEN	256
+#define MAXCMDS		64
+
+//! Commands that clients may send.
+static const char* const allowed[] =
+{
+	"sprinkle",
+	"clearcell",
+	"clearfield",
+	"blackhole",
+	"spawndemo",
+	"pause",
+};
+
+typedef trajectory_record_t record_t;
+
+//! Quantised positions of a captured frame.
+typedef struct
+{
+	record_t* records;
+	int cap;
+	int count;
+	int step;
+	double time;
+	int nr;			//! counts the captures, from 1.
+} capture_t;
+
+typedef struct
+{
+	int fd;			//! -1 for a free entry.
+	record_t* ref;		//! the last frame sent, sorted by uid.
+	int refcount;
+	int refcap;
+	int sent;		//! frames sent.
+	int skipped;		//! frames captured while it was still taking in the previous one.
+	int lastnr;		//! capture nr of the last frame sent.
+	unsigned char* out;	//! bytes still to send, from outpos to outlen.
+	size_t outcap;
+	size_t outlen;
+	size_t outpos;
+	char in[ MAXCMDLEN ];	//! the command line being received.
+	int inlen;
+	bool overlong;		//! the line in progress does not fit, and is dropped.
+	char name[ 32 ];
+} client_t;
+
+
+#if defined( linux )
+
+// The captures form a triple buffer: the simulation fills spare, and swaps it with latest. The server swaps latest with current.
+static capture_t captures[ 3 ];
+static int spare = 0;
+static int latest = 1;
+static int current = 2;
+static int latestnr = 0;
+static int capturenr = 0;
+static double lastcapture = -1.0;
+
+static char commands[ MAXCMDS ][ MAXCMDLEN ];
+static int numcommands = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t server;
+static int listenfd = -1;
+static int wakefd[ 2 ] = { -1, -1 };
+static volatile bool quit = false;
+static volatile int numclients = 0;
+
+// Owned by the server thread.
+static client_t clients[ MAXCLIENTS ];
+static unsigned char* raw = 0;
+static size_t rawcap = 0;
+
+
+static bool is_allowed( const char* cmd )
+{
+	for ( size_t i=0; i<sizeof( allowed ) / sizeof( allowed[0] ); ++i )
+	{
+		const size_t len = strlen( allowed[ i ] );
+		if ( !strncmp( cmd, allowed[ i ], len ) && ( cmd[ len ] == 0 || cmd[ len ] == ' ' ) )
+			return true;
+	}
+	return false;
+}
+
+
+static void append( client_t& c, const void* data, size_t sz )
+{
+	if ( c.outlen + sz > c.outcap )
+	{
+		c.outcap = 2 * ( c.outlen + sz );
+		c.out = (unsigned char*) realloc( c.out, c.outcap );
+	}
+	memcpy( c.out + c.outlen, data, sz );
+	c.outlen += sz;
+}
+
+
+static void drop_client( client_t& c, const char* why )
+{
+	LOGI( "Stream client %s %s after %d frames, %d skipped.", c.name, why, c.sent, c.skipped );
+	close( c.fd );
+	c.fd = -1;
+	free( c.ref );
+	free( c.out );
+	memset( &c, 0, sizeof( client_t ) );
+	c.fd = -1;
+	numclients -= 1;
+}
+
+
+static void accept_client( void )
+{
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof( addr );
+	const int fd = accept( listenfd, (struct sockaddr*) &addr, &addrlen );
+	if ( fd < 0 )
+		return;
+	int slot = -1;
+	for ( int i=0; i<MAXCLIENTS && slot < 0; ++i )
+		slot = clients[ i ].fd < 0 ? i : slot;
+	if ( slot < 0 )
+	{
+		LOGE( "Refused a stream client: already serving %d.", MAXCLIENTS );
+		close( fd );
+		return;
+	}
+	fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+	const int one = 1;
+	setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+
+	client_t& c = clients[ slot ];
+	memset( &c, 0, sizeof( client_t ) );
+	c.fd = fd;
+	snprintf( c.name, sizeof( c.name ), "%s:%d", inet_ntoa( addr.sin_addr ), ntohs( addr.sin_port ) );
+	trajectory_header_t hdr;
+	trajectory_fill_header( &hdr, KEYFRAMEINTERVAL );
+	append( c, &hdr, sizeof( hdr ) );
+	numclients += 1;
+	LOGI( "Stream client %s connected.", c.name );
+}
+
+
+//! Queue the newest frame for a client, against the last frame it was sent.
+static void encode_frame( client_t& c, const capture_t& cap )
+{
+	const int n = cap.count;
+	const size_t needed = TRAJECTORY_ENCODEDMAX( n );
+	if ( needed > rawcap )
+	{
+		rawcap = needed;
+		raw = (unsigned char*) realloc( raw, rawcap );
+	}
+	const bool keyframe = ( c.sent % KEYFRAMEINTERVAL ) == 0;
+	const uLong rawsize = (uLong) trajectory_encode( cap.records, n, keyframe ? 0 : c.ref, c.refcount, raw );
+
+	// Deflate straight into the send buffer, behind the frame header.
+	trajectory_frame_t frame;
+	uLongf packedsize = compressBound( rawsize );
+	c.outlen = c.outpos = 0;
+	if ( sizeof( frame ) + packedsize > c.outcap )
+	{
+		c.outcap = sizeof( frame ) + packedsize;
+		c.out = (unsigned char*) realloc( c.out, c.outcap );
+	}
+	if ( compress2( c.out + sizeof( frame ), &packedsize, raw, rawsize, 1 ) != Z_OK )
+	{
+		LOGE( "Failed to deflate stream frame of step %d.", cap.step );
+		return;
+	}
+	memcpy( frame.magic, "TRJF", 4 );
+	frame.keyframe = keyframe;
+	frame.step = cap.step;
+	frame.numstars = n;
+	frame.time = cap.time;
+	frame.rawsize = (uint32_t) rawsize;
+	frame.packedsize = (uint32_t) packedsize;
+	memcpy( c.out, &frame, sizeof( frame ) );
+	c.outlen = sizeof( frame ) + packedsize;
+
+	if ( c.lastnr && cap.nr > c.lastnr + 1 )
+		c.skipped += cap.nr - c.lastnr - 1;
+	c.lastnr = cap.nr;
+	c.sent += 1;
+	if ( n > c.refcap )
+	{
+		c.refcap = n;
+		c.ref = (record_t*) realloc( c.ref, c.refcap * sizeof( record_t ) );
+	}
+	memcpy( c.ref, cap.records, n * sizeof( record_t ) );
+	c.refcount = n;
+}
+
+
+//! Send what the socket takes. Returns false if the client is gone.
+static bool send_pending( client_t& c )
+{
+	while ( c.outpos < c.outlen )
+	{
+		const ssize_t n = send( c.fd, c.out + c.outpos, c.outlen - c.outpos, MSG_NOSIGNAL );
+		if ( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+			return true;
+		if ( n <= 0 )
+			return false;
+		c.outpos += n;
+	}
+	c.outpos = c.outlen = 0;
+	return true;
+}
+
+
+//! Take in the command lines of a client. Returns false if the client is gone.
+static bool receive_commands( client_t& c )
+{
+	char buf[ 1024 ];
+	const ssize_t n = recv( c.fd, buf, sizeof( buf ), 0 );
+	if ( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+		return true;
+	if ( n <= 0 )
+		return false;
+	for ( ssize_t i=0; i<n; ++i )
+	{
+		const char ch = buf[ i ];
+		if ( ch != '\n' )
+		{
+			if ( ch == '\r' )
+				continue;
+			if ( c.inlen < MAXCMDLEN-1 )
+				c.in[ c.inlen++ ] = ch;
+			else
+				c.overlong = true;
+			continue;
+		}
+		c.in[ c.inlen ] = 0;
+		if ( c.overlong || !is_allowed( c.in ) )
+			LOGE( "Refused command from stream client %s: %.40s", c.name, c.in );
+		else
+		{
+			pthread_mutex_lock( &lock );
+			const bool full = numcommands == MAXCMDS;
+			if ( !full )
+				memcpy( commands[ numcommands++ ], c.in, c.inlen+1 );
+			pthread_mutex_unlock( &lock );
+			if ( full )
+				LOGE( "Dropped command from stream client %s: too many waiting.", c.name );
+		}
+		c.inlen = 0;
+		c.overlong = false;
+	}
+	return true;
+}
+
+
+static void* serve_loop( void* )
+{
+	struct pollfd pfds[ 2 + MAXCLIENTS ];
+	int owner[ 2 + MAXCLIENTS ];
+	while ( !quit )
+	{
+		int numfds = 0;
+		pfds[ numfds ].fd = listenfd;
+		pfds[ numfds ].events = POLLIN;
+		owner[ numfds++ ] = -1;
+		pfds[ numfds ].fd = wakefd[ 0 ];
+		pfds[ numfds ].events = POLLIN;
+		owner[ numfds++ ] = -1;
+		for ( int i=0; i<MAXCLIENTS; ++i )
+			if ( clients[ i ].fd >= 0 )
+			{
+				pfds[ numfds ].fd = clients[ i ].fd;
+				pfds[ numfds ].events = POLLIN | ( clients[ i ].outpos < clients[ i ].outlen ? POLLOUT : 0 );
+				owner[ numfds++ ] = i;
+			}
+		for ( int i=0; i<numfds; ++i )
+			pfds[ i ].revents = 0;
+		if ( poll( pfds, numfds, 250 ) < 0 && errno != EINTR )
+			break;
+
+		if ( pfds[ 1 ].revents & POLLIN )
+		{
+			char drain[ 64 ];
+			while ( read( wakefd[ 0 ], drain, sizeof( drain ) ) > 0 )
+				;
+		}
+		if ( pfds[ 0 ].revents & POLLIN )
+			accept_client();
+
+		// Take the newest capture, if there is one.
+		pthread_mutex_lock( &lock );
+		const bool fresh = latestnr > captures[ current ].nr;
+		if ( fresh )
+		{
+			const int tmp = current;
+			current = latest;
+			latest = tmp;
+		}
+		pthread_mutex_unlock( &lock );
+		capture_t& cap = captures[ current ];
+		if ( fresh )
+			trajectory_sort( cap.records, cap.count );
+
+		for ( int i=2; i<numfds; ++i )
+		{
+			client_t& c = clients[ owner[ i ] ];
+			if ( ( pfds[ i ].revents & ( POLLERR | POLLHUP ) ) && !( pfds[ i ].revents & POLLIN ) )
+			{
+				drop_client( c, "hung up" );
+				continue;
+			}
+			if ( ( pfds[ i ].revents & POLLIN ) && !receive_commands( c ) )
+			{
+				drop_client( c, "disconnected" );
+				continue;
+			}
+		}
+		for ( int i=0; i<MAXCLIENTS; ++i )
+		{
+			client_t& c = clients[ i ];
+			if ( c.fd < 0 )
+				continue;
+			if ( c.outpos == c.outlen && cap.nr > c.lastnr )
+				encode_frame( c, cap );
+			if ( !send_pending( c ) )
+				drop_client( c, "disconnected" );
+		}
+	}
+	for ( int i=0; i<MAXCLIENTS; ++i )
+		if ( clients[ i ].fd >= 0 )
+			drop_client( clients[ i ], "closed" );
+	return 0;
+}
+
+
+//! Bind to a TCP port, on localhost unless a host is given.
+static int bind_tcp( const char* address )
+{
+	struct sockaddr_in addr;
+	memset( &addr, 0, sizeof( addr ) );
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	const char* colon = strrchr( address, ':' );
+	const int port = atoi( colon ? colon+1 : address );
+	if ( colon )
+	{
+		char host[ 64 ];
+		const size_t len = colon - address;
+		if ( len >= sizeof( host ) )
+			return -1;
+		memcpy( host, address, len );
+		host[ len ] = 0;
+		if ( !strcmp( host, "*" ) )
+			addr.sin_addr.s_addr = htonl( INADDR_ANY );
+		else if ( strcmp( host, "localhost" ) && inet_pton( AF_INET, host, &addr.sin_addr ) != 1 )
+			return -1;
+	}
+	if ( port <= 0 || port >= 65536 )
+		return -1;
+	addr.sin_port = htons( port );
+	const int fd = socket( AF_INET, SOCK_STREAM, 0 );
+	if ( fd < 0 )
+		return -1;
+	const int one = 1;
+	setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ) );
+	if ( bind( fd, (struct sockaddr*) &addr, sizeof( addr ) ) < 0 )
+	{
+		close( fd );
+		return -1;
+	}
+	return fd;
+}
+
+
+bool streamserver_listen( const char* address )
+{
+	streamserver_close();
+	listenfd = bind_tcp( address );
+	if ( listenfd < 0 || listen( listenfd, MAXCLIENTS ) < 0 || pipe( wakefd ) < 0 )
+	{
+		LOGE( "Cannot stream on %s: %s", address, strerror( errno ) );
+		streamserver_close();
+		return false;
+	}
+	fcntl( wakefd[ 0 ], F_SETFL, O_NONBLOCK );
+	fcntl( wakefd[ 1 ], F_SETFL, O_NONBLOCK );
+
+	for ( int i=0; i<MAXCLIENTS; ++i )
+	{
+		memset( clients + i, 0, sizeof( client_t ) );
+		clients[ i ].fd = -1;
+	}
+	numclients = 0;
+	numcommands = 0;
+	latestnr = 0;
+	capturenr = 0;
+	lastcapture = -1.0;
+	quit = false;
+	if ( pthread_create( &server, 0, serve_loop, 0 ) )
+	{
+		LOGE( "Cannot start the stream server." );
+		streamserver_close();
+		return false;
+	}
+	streamserver_enabled = true;
+	LOGI( "Streaming on %s at %.0f frames per second.", address, streamserver_rate );
+	return true;
+}
+
+
+void streamserver_close( void )
+{
+	if ( streamserver_enabled )
+	{
+		quit = true;
+		const char wake = 1;
+		if ( write( wakefd[ 1 ], &wake, 1 ) < 0 )
+			LOGE( "Cannot wake the stream server." );
+		pthread_join( server, 0 );
+		streamserver_enabled = false;
+	}
+	if ( listenfd >= 0 )
+		close( listenfd );
+	listenfd = -1;
+	for ( int i=0; i<2; ++i )
+	{
+		if ( wakefd[ i ] >= 0 )
+			close( wakefd[ i ] );
+		wakefd[ i ] = -1;
+	}
+	for ( int i=0; i<3; ++i )
+	{
+		free( captures[ i ].records );
+		memset( captures + i, 0, sizeof( capture_t ) );
+	}
+	free( raw );
+	raw = 0;
+	rawcap = 0;
+}
+
+
+void streamserver_after_step( void )
+{
+	if ( !streamserver_enabled || !numclients )
+		return;
+	const double now = wallclock_seconds();
+	if ( lastcapture >= 0 && now - lastcapture < 1.0 / streamserver_rate )
+		return;
+	lastcapture = now;
+
+	// The server does not touch the spare capture.
+	capture_t& cap = captures[ spare ];
+	const int numstars = stars_total_count();
+	if ( numstars > cap.cap )
+	{
+		cap.cap = numstars;
+		cap.records = (record_t*) realloc( cap.records, cap.cap * sizeof( record_t ) );
+	}
+	cap.count = trajectory_quantise( cap.records );
+	cap.step = stars_get_step_nr( &cap.time );
+	cap.nr = ++capturenr;
+
+	pthread_mutex_lock( &lock );
+	const int tmp = latest;
+	latest = spare;
+	spare = tmp;
+	latestnr = cap.nr;
+	pthread_mutex_unlock( &lock );
+	const char wake = 1;
+	if ( write( wakefd[ 1 ], &wake, 1 ) < 0 && errno != EAGAIN )
+		LOGE( "Cannot wake the stream server." );
+}
+
+
+int streamserver_process_commands( void )
+{
+	if ( !streamserver_enabled )
+		return 0;
+	static char taken[ MAXCMDS ][ MAXCMDLEN ];
+	pthread_mutex_lock( &lock );
+	const int n = numcommands;
+	memcpy( taken, commands, n * MAXCMDLEN );
+	numcommands = 0;
+	pthread_mutex_unlock( &lock );
+	for ( int i=0; i<n; ++i )
+	{
+		LOGI( "Stream command: %s", taken[ i ] );
+		nfy_msg( taken[ i ] );
+	}
+	return n;
+}
+
+#else
+
+bool streamserver_listen( const char* address )
+{
+	LOGE( "Streaming is not supported on this platform." );
+	return false;
+}
+
+
+void streamserver_close( void )
+{
+}
+
+
+void streamserver_after_step( void )
+{
+}
+
+
+int streamserver_process_commands( void )
+{
+	return 0;
+}
+
+#endif
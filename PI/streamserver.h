@@ -0,0 +1,47 @@
+// streamserver.h
+//
+// Streams the star field over TCP to viewers on other machines, and takes commands back from them.
+//
+// A client that connects gets a trajectory_header_t, followed by frames as in a trajectory file (see trajectory.h):
+// a trajectory_frame_t and its deflated payload of quantised positions. Saving the stream gives a trajectory file.
+// Each client starts with a keyframe, and then gets the changes since the last frame that was sent to it,
+// with a keyframe every so many frames.
+//
+// Frames are captured at streamserver_rate, and a client only gets a new frame once it took in the previous one.
+// The frames captured meanwhile are skipped for that client, so a slow client gets fewer frames, but never old ones,
+// and holds up neither the other clients nor the simulation.
+//
+// A client can send commands, one per line, as the nfy messages of the game. Positions are in grid coordinates, marked with world=1:
+//
+//   sprinkle x=X y=Y [radius=R] [addrot=1] world=1    spawn stars around X,Y.
+//   clearcell x=X y=Y world=1                         remove the stars of the cell at X,Y.
+//   clearfield                                        remove all stars.
+//   blackhole toggle=1                                toggle the black hole in the centre.
+//   spawndemo nr=N [stars=N] [seed=N], or next=1      spawn a scenario.
+//   pause toggle=1                                    pause or resume stepping.
+//
+// Other messages are refused. The simulation takes the commands in with streamserver_process_commands(), between steps.
+// The server runs on a thread of its own, and only reads the frames that the simulation captures for it.
+
+#ifndef STREAMSERVER_H
+#define STREAMSERVER_H
+
+//! Start listening. The address is a port, for localhost only, or HOST:PORT to listen on an interface, like 0.0.0.0:9200 for all of them. Returns false if it cannot listen.
+extern bool streamserver_listen( const char* address );
+
+//! Disconnect the clients, and stop listening.
+extern void streamserver_close( void );
+
+//! True while listening.
+extern bool streamserver_enabled;
+
+//! Frames per second to capture for the clients. (default: 30)
+extern float streamserver_rate;
+
+//! Call after each step: captures a frame when one is due, and a client is connected.
+extern void streamserver_after_step( void );
+
+//! Hand the commands that the clients sent to nfy_msg(). Call it from the thread that steps the simulation. Returns the number of commands.
+extern int streamserver_process_commands( void );
+
+#endif
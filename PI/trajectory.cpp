@@ -0,0 +1,488 @@
+// trajectory.cpp
+//
+// Streams the positions of all stars to a file every few steps, for offline analysis.
+
+#include "trajectory.h"
+#include "stars.h"
+
+// From GBase
+#include "logx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#if defined( linux )
+#	include <pthread.h>
+#endif
+
+
+int trajectory_interval = 10;
+
+//! Number of frame buffers in the queue to the I/O thread.
+#define NUMSLOTS		4
+
+//! Every this many frames is a keyframe.
+#define KEYFRAMEINTERVAL	100
+
+typedef trajectory_record_t record_t;
+
+typedef struct
+{
+	record_t* records;
+	int cap;
+	int count;
+	int step;
+	double time;
+} slot_t;
+
+static FILE* file = 0;
+
+static slot_t slots[ NUMSLOTS ];
+static int head = 0;		//! next slot for the I/O thread.
+static int numqueued = 0;	//! slots that are filled, and not yet written.
+
+static int written = 0;
+static int dropped = 0;
+static long long bytesraw = 0;
+static long long bytespacked = 0;
+
+// Owned by the I/O thread: the previous frame, sorted by uid, and the scratch for encoding.
+static record_t* prev = 0;
+static int prevcount = 0;
+static int prevcap = 0;
+static unsigned char* raw = 0;
+static size_t rawcap = 0;
+static unsigned char* packed = 0;
+static size_t packedcap = 0;
+
+
+static int compare_uid( const void* a, const void* b )
+{
+	const uint32_t ua = ( (const record_t*) a )->uid;
+	const uint32_t ub = ( (const record_t*) b )->uid;
+	return ua < ub ? -1 : ( ua > ub ? 1 : 0 );
+}
+
+
+static inline unsigned char* put_varint( unsigned char* w, uint32_t v )
+{
+	while ( v >= 0x80 )
+	{
+		*w++ = (unsigned char) ( v | 0x80 );
+		v >>= 7;
+	}
+	*w++ = (unsigned char) v;
+	return w;
+}
+
+
+static inline uint32_t zigzag( int32_t v )
+{
+	return ( (uint32_t) v << 1 ) ^ (uint32_t) ( v >> 31 );
+}
+
+
+static inline const unsigned char* get_varint( const unsigned char* r, const unsigned char* end, uint32_t* v )
+{
+	uint32_t val = 0;
+	for ( int shift=0; r < end && shift < 35; shift += 7 )
+	{
+		const unsigned char b = *r++;
+		val |= (uint32_t) ( b & 0x7f ) << shift;
+		if ( b < 0x80 )
+		{
+			*v = val;
+			return r;
+		}
+	}
+	return 0;
+}
+
+
+static inline int32_t unzigzag( uint32_t v )
+{
+	return (int32_t) ( v >> 1 ) ^ -(int32_t) ( v & 1 );
+}
+
+
+void trajectory_sort( trajectory_record_t* rec, int n )
+{
+	qsort( rec, n, sizeof( record_t ), compare_uid );
+}
+
+
+size_t trajectory_encode( const trajectory_record_t* rec, int n, const trajectory_record_t* ref, int refcount, unsigned char* out )
+{
+	const bool keyframe = ref == 0;
+	unsigned char* w = out;
+	int64_t prevuid = -1;
+	int j = 0;
+	for ( int i=0; i<n; ++i )
+	{
+		const record_t& r = rec[ i ];
+		while ( !keyframe && j < refcount && ref[ j ].uid < r.uid )
+			++j;
+		const bool known = !keyframe && j < refcount && ref[ j ].uid == r.uid;
+		w = put_varint( w, (uint32_t) ( ( r.uid - prevuid ) << 1 ) | ( known ? 1 : 0 ) );
+		if ( known )
+		{
+			w = put_varint( w, zigzag( (int32_t) ( r.gx - ref[ j ].gx ) ) );
+			w = put_varint( w, zigzag( (int32_t) ( r.gy - ref[ j ].gy ) ) );
+		}
+		else
+		{
+			w = put_varint( w, r.gx );
+			w = put_varint( w, r.gy );
+		}
+		prevuid = r.uid;
+	}
+	return (size_t) ( w - out );
+}
+
+
+int trajectory_decode( const unsigned char* in, size_t sz, int numstars, const trajectory_record_t* ref, int refcount, trajectory_record_t* out )
+{
+	const unsigned char* r = in;
+	const unsigned char* end = in + sz;
+	int64_t uid = -1;
+	int j = 0;
+	for ( int i=0; i<numstars; ++i )
+	{
+		uint32_t token, a, b;
+		if ( !( r = get_varint( r, end, &token ) ) || !( r = get_varint( r, end, &a ) ) || !( r = get_varint( r, end, &b ) ) )
+			return -1;
+		uid += token >> 1;
+		record_t& o = out[ i ];
+		o.uid = (uint32_t) uid;
+		if ( token & 1 )
+		{
+			while ( j < refcount && ref[ j ].uid < o.uid )
+				++j;
+			if ( j == refcount || ref[ j ].uid != o.uid )
+				return -1;
+			o.gx = ref[ j ].gx + unzigzag( a );
+			o.gy = ref[ j ].gy + unzigzag( b );
+		}
+		else
+		{
+			o.gx = a;
+			o.gy = b;
+		}
+	}
+	return numstars;
+}
+
+
+//! Sort, encode, deflate and write a frame. Runs on the I/O thread.
+static void write_frame( slot_t& slot )
+{
+	record_t* rec = slot.records;
+	const int n = slot.count;
+	trajectory_sort( rec, n );
+
+	const size_t needed = TRAJECTORY_ENCODEDMAX( n );
+	if ( needed > rawcap )
+	{
+		rawcap = needed;
+		raw = (unsigned char*) realloc( raw, rawcap );
+	}
+
+	const bool keyframe = ( written % KEYFRAMEINTERVAL ) == 0;
+	const uLong rawsize = (uLong) trajectory_encode( rec, n, keyframe ? 0 : prev, prevcount, raw );
+
+	uLongf packedsize = compressBound( rawsize );
+	if ( packedsize > packedcap )
+	{
+		packedcap = packedsize;
+		packed = (unsigned char*) realloc( packed, packedcap );
+	}
+	if ( compress2( packed, &packedsize, raw, rawsize, 1 ) != Z_OK )
+	{
+		LOGE( "Failed to deflate trajectory frame of step %d.", slot.step );
+		return;
+	}
+
+	trajectory_frame_t frame;
+	memcpy( frame.magic, "TRJF", 4 );
+	frame.keyframe = keyframe;
+	frame.step = slot.step;
+	frame.numstars = n;
+	frame.time = slot.time;
+	frame.rawsize = (uint32_t) rawsize;
+	frame.packedsize = (uint32_t) packedsize;
+	if ( fwrite( &frame, sizeof( frame ), 1, file ) != 1 || fwrite( packed, 1, packedsize, file ) != packedsize )
+		LOGE( "Failed to write trajectory frame of step %d.", slot.step );
+	bytesraw += rawsize;
+	bytespacked += sizeof( frame ) + packedsize;
+
+	// This frame is the reference for the next one.
+	if ( n > prevcap )
+	{
+		prevcap = n;
+		prev = (record_t*) realloc( prev, prevcap * sizeof( record_t ) );
+	}
+	memcpy( prev, rec, n * sizeof( record_t ) );
+	prevcount = n;
+	written += 1;
+}
+
+
+int trajectory_quantise( trajectory_record_t* records )
+{
+	int n = 0;
+	for ( int cx=0; cx<GRIDRES; ++cx )
+		for ( int cy=0; cy<GRIDRES; ++cy )
+		{
+			const cell_t* cell = stars_cell( cx, cy );
+			const float sx = TRAJECTORY_QUANT / ( cell->xrng[1] - cell->xrng[0] );
+			const float sy = TRAJECTORY_QUANT / ( cell->yrng[1] - cell->yrng[0] );
+			for ( int i=0; i<cell->cnt; ++i )
+			{
+				int qx = (int) ( ( cell->px[ i ] - cell->xrng[0] ) * sx );
+				int qy = (int) ( ( cell->py[ i ] - cell->yrng[0] ) * sy );
+				qx = qx < 0 ? 0 : ( qx >= TRAJECTORY_QUANT ? TRAJECTORY_QUANT-1 : qx );
+				qy = qy < 0 ? 0 : ( qy >= TRAJECTORY_QUANT ? TRAJECTORY_QUANT-1 : qy );
+				record_t& r = records[ n++ ];
+				r.uid = (uint32_t) cell->st[ i ] >> 8;
+				r.gx = cx * TRAJECTORY_QUANT + qx;
+				r.gy = cy * TRAJECTORY_QUANT + qy;
+			}
+		}
+	return n;
+}
+
+
+//! Quantise the positions of all stars into a slot.
+static void fill_slot( slot_t& slot )
+{
+	const int numstars = stars_total_count();
+	if ( numstars > slot.cap )
+	{
+		slot.cap = numstars;
+		slot.records = (record_t*) realloc( slot.records, slot.cap * sizeof( record_t ) );
+	}
+	slot.count = trajectory_quantise( slot.records );
+	slot.step = stars_get_step_nr( &slot.time );
+}
+
+
+void trajectory_fill_header( trajectory_header_t* hdr, int keyframeinterval )
+{
+	const cell_t* first = stars_cell( 0, 0 );
+	memset( hdr, 0, sizeof( trajectory_header_t ) );
+	memcpy( hdr->magic, "NBODYTRJ", 8 );
+	hdr->version = TRAJECTORY_VERSION;
+	hdr->gridres = GRIDRES;
+	hdr->originx = first->xrng[0];
+	hdr->originy = first->yrng[0];
+	hdr->cellsize = first->xrng[1] - first->xrng[0];
+	hdr->keyframeinterval = keyframeinterval;
+}
+
+
+static bool write_header( void )
+{
+	trajectory_header_t hdr;
+	trajectory_fill_header( &hdr, KEYFRAMEINTERVAL );
+	return fwrite( &hdr, sizeof( hdr ), 1, file ) == 1;
+}
+
+
+//! Log what was written, and free the buffers.
+static void finish( void )
+{
+	LOGI
+	(
+		"Wrote %d trajectory frames, dropped %d. %.1f MB, %.2f bytes per star per frame.",
+		written, dropped, bytespacked / ( 1024.0 * 1024.0 ),
+		prevcount && written ? (double) bytespacked / written / prevcount : 0.0
+	);
+	fclose( file );
+	file = 0;
+	for ( int i=0; i<NUMSLOTS; ++i )
+	{
+		free( slots[ i ].records );
+		slots[ i ].records = 0;
+		slots[ i ].cap = 0;
+	}
+	free( prev );
+	free( raw );
+	free( packed );
+	prev = 0;
+	raw = packed = 0;
+	prevcount = prevcap = 0;
+	rawcap = packedcap = 0;
+}
+
+
+static void reset_counts( void )
+{
+	head = 0;
+	numqueued = 0;
+	written = 0;
+	dropped = 0;
+	bytesraw = 0;
+	bytespacked = 0;
+}
+
+
+bool trajectory_is_open( void )
+{
+	return file != 0;
+}
+
+
+int trajectory_written( void )
+{
+	return written;
+}
+
+
+int trajectory_dropped( void )
+{
+	return dropped;
+}
+
+
+void trajectory_after_step( void )
+{
+	if ( !file || trajectory_interval <= 0 )
+		return;
+	if ( stars_get_step_nr() % trajectory_interval == 0 )
+		trajectory_capture();
+}
+
+
+#if defined( linux )
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_t iothread;
+static bool quit = false;
+
+
+static void* io_loop( void* )
+{
+	pthread_mutex_lock( &lock );
+	while ( true )
+	{
+		while ( !numqueued && !quit )
+			pthread_cond_wait( &wakeup, &lock );
+		if ( !numqueued )
+			break;
+		slot_t& slot = slots[ head ];
+		pthread_mutex_unlock( &lock );
+
+		write_frame( slot );
+
+		pthread_mutex_lock( &lock );
+		head = ( head + 1 ) % NUMSLOTS;
+		numqueued -= 1;
+	}
+	pthread_mutex_unlock( &lock );
+	return 0;
+}
+
+
+bool trajectory_open( const char* fname )
+{
+	trajectory_close();
+	file = fopen( fname, "wb" );
+	if ( !file || !write_header() )
+	{
+		LOGE( "Cannot write trajectory to %s", fname );
+		if ( file )
+			fclose( file );
+		file = 0;
+		return false;
+	}
+	reset_counts();
+	quit = false;
+	if ( pthread_create( &iothread, 0, io_loop, 0 ) )
+	{
+		LOGE( "Cannot start the trajectory writer." );
+		fclose( file );
+		file = 0;
+		return false;
+	}
+	LOGI( "Writing a trajectory frame every %d steps to %s", trajectory_interval, fname );
+	return true;
+}
+
+
+void trajectory_close( void )
+{
+	if ( !file )
+		return;
+	pthread_mutex_lock( &lock );
+	quit = true;
+	pthread_cond_signal( &wakeup );
+	pthread_mutex_unlock( &lock );
+	pthread_join( iothread, 0 );
+	finish();
+}
+
+
+bool trajectory_capture( void )
+{
+	if ( !file )
+		return false;
+	pthread_mutex_lock( &lock );
+	const bool full = numqueued == NUMSLOTS;
+	const int tail = ( head + numqueued ) % NUMSLOTS;
+	if ( full )
+		dropped += 1;
+	pthread_mutex_unlock( &lock );
+	if ( full )
+		return false;
+
+	// The I/O thread does not touch this slot until it is queued.
+	fill_slot( slots[ tail ] );
+
+	pthread_mutex_lock( &lock );
+	numqueued += 1;
+	pthread_cond_signal( &wakeup );
+	pthread_mutex_unlock( &lock );
+	return true;
+}
+
+#else
+
+// Without threads, frames are written on the calling thread.
+
+bool trajectory_open( const char* fname )
+{
+	trajectory_close();
+	file = fopen( fname, "wb" );
+	if ( !file || !write_header() )
+	{
+		LOGE( "Cannot write trajectory to %s", fname );
+		if ( file )
+			fclose( file );
+		file = 0;
+		return false;
+	}
+	reset_counts();
+	return true;
+}
+
+
+void trajectory_close( void )
+{
+	if ( file )
+		finish();
+}
+
+
+bool trajectory_capture( void )
+{
+	if ( !file )
+		return false;
+	fill_slot( slots[ 0 ] );
+	write_frame( slots[ 0 ] );
+	return true;
+}
+
+#endif
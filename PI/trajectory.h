@@ -0,0 +1,101 @@
+// trajectory.h
+//
+// Streams the positions of all stars to a file every few steps, for offline analysis.
+//
+// Positions are quantised to 16 bits within their cell, and kept as one integer per axis over the whole grid.
+// Frames are sorted by uid, and store for each star the difference with its position in the previous frame.
+// Every so many frames a keyframe stores all positions in full, so that a reader can start there.
+// The frame is then deflated with zlib.
+//
+// The calling thread only quantises the positions into a free buffer. Sorting, encoding, compressing and writing
+// happen on an I/O thread. The buffers form a bounded queue: when all are still waiting to be written, the frame is dropped.
+//
+// File layout: a trajectory_header_t, then per frame a trajectory_frame_t followed by its deflated payload.
+// Tools/trajectory.py reads the file back.
+
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TRAJECTORY_VERSION	1
+
+//! Quantisation steps per cell, per axis.
+#define TRAJECTORY_QUANT	65536
+
+typedef struct
+{
+	char magic[ 8 ];		//! NBODYTRJ
+	uint32_t version;
+	uint32_t gridres;
+	float originx;			//! low x of the grid.
+	float originy;			//! low y of the grid.
+	float cellsize;			//! width of a cell. A grid coordinate g decodes to origin + ( g + 0.5 ) * cellsize / TRAJECTORY_QUANT.
+	uint32_t keyframeinterval;	//! every this many frames is a keyframe.
+} trajectory_header_t;
+
+typedef struct
+{
+	char magic[ 4 ];		//! TRJF
+	uint32_t keyframe;		//! 1 if the payload has no references to the previous frame.
+	int32_t step;
+	uint32_t numstars;
+	double time;
+	uint32_t rawsize;		//! size of the payload before deflating.
+	uint32_t packedsize;		//! size of the payload in the file.
+} trajectory_frame_t;
+
+// The payload holds, per star in increasing uid order, a varint token of ( uid - previous uid ) << 1 | known.
+// If known, the star was in the previous frame, and two zigzag varints follow with the change in its grid coordinates.
+// Otherwise two varints follow with its grid coordinates in full. The first previous uid of a frame is -1.
+
+//! A star as captured: its uid and grid coordinates, cx * TRAJECTORY_QUANT + the quantised position within cell cx.
+typedef struct
+{
+	uint32_t uid;
+	uint32_t gx;
+	uint32_t gy;
+} trajectory_record_t;
+
+//! Room that trajectory_encode() needs for n stars: a token and two coordinates of at most 5 bytes each.
+#define TRAJECTORY_ENCODEDMAX( N )	( 15 * (size_t) (N) + 16 )
+
+//! Quantise the positions of all stars, in cell order. records needs room for stars_total_count(). Returns the number of records.
+extern int trajectory_quantise( trajectory_record_t* records );
+
+//! Sort records by uid, as the encoding needs.
+extern void trajectory_sort( trajectory_record_t* records, int n );
+
+//! Encode records sorted by uid as a payload, against the previous frame ref, or as a keyframe if ref is 0. Returns the size, before deflating.
+extern size_t trajectory_encode( const trajectory_record_t* rec, int n, const trajectory_record_t* ref, int refcount, unsigned char* out );
+
+//! Decode an inflated payload of numstars stars against the previous frame ref, into records sorted by uid. Returns -1 if the payload is corrupt.
+extern int trajectory_decode( const unsigned char* in, size_t sz, int numstars, const trajectory_record_t* ref, int refcount, trajectory_record_t* out );
+
+//! Fill in the header for the grid of the simulation.
+extern void trajectory_fill_header( trajectory_header_t* hdr, int keyframeinterval );
+
+//! Start writing a trajectory. Returns false if the file cannot be created.
+extern bool trajectory_open( const char* fname );
+
+//! Write the frames that are queued, stop the I/O thread and close the file.
+extern void trajectory_close( void );
+
+//! True while a trajectory is open.
+extern bool trajectory_is_open( void );
+
+//! Capture a frame every this many steps from trajectory_after_step(). (default: 10)
+extern int trajectory_interval;
+
+//! Call after each step: captures a frame when the step nr is a multiple of trajectory_interval.
+extern void trajectory_after_step( void );
+
+//! Queue a frame of the current positions. Returns false if the frame was dropped, because the I/O thread fell behind.
+extern bool trajectory_capture( void );
+
+//! Frames written, and frames dropped, since the trajectory was opened.
+extern int trajectory_written( void );
+extern int trajectory_dropped( void );
+
+#endif
@@ -587,6 +587,12 @@ if ( view_enabled[ VIEWMAIN ] )
 			nfy_msg( "show toggle_help=1" );
 		if ( keysym == 0x4000003B && down )	// F2
 			nfy_msg( "spawndemo nr=0" );
+		if ( keysym == 0x4000003C && down )	// F3
+			nfy_msg( "spawndemo next=1" );
+		if ( keysym == 0x4000003E && down )	// F5
+			nfy_msg( "checkpoint save=1" );
+		if ( keysym == 0x40000042 && down )	// F9
+			nfy_msg( "checkpoint load=1" );
 	}
 
 	switch( keysym )
@@ -614,6 +620,42 @@ if ( view_enabled[ VIEWMAIN ] )
 		case 'h':
 			if ( down ) snprintf( m, sizeof(m), "huemapping delta=1" );
 			break;
+		case 'k':
+			if ( down && !repeat ) snprintf( m, sizeof(m), "kerneltier next=1" );
+			break;
+		case 'e':
+			if ( down && !repeat ) snprintf( m, sizeof(m), "diagnostics toggle=1" );
+			break;
+		case 'i':
+			if ( down && !repeat ) snprintf( m, sizeof(m), "integrator next=1" );
+			break;
+		case 't':
+			if ( down && !repeat ) snprintf( m, sizeof(m), "show toggle_timers=1" );
+			break;
+		case 'm':
+			if ( down && !repeat ) snprintf( m, sizeof(m), "show next_cost=1" );
+			break;
+		case 'w':
+			if ( down && !repeat ) snprintf( m, sizeof(m), "show toggle_owners=1" );
+			break;
+		case 's':
+			if ( down && !repeat ) snprintf( m, sizeof(m), "stepseries toggle=1" );
+			break;
+		case 'r':
+			if ( down && !repeat ) snprintf( m, sizeof(m), "trajectory toggle=1" );
+			break;
+		case 'o':
+			if ( down && !repeat ) snprintf( m, sizeof(m), "framering toggle=1" );
+			break;
+		case 'l':
+			if ( down && !repeat ) snprintf( m, sizeof(m), "inputlog toggle=1" );
+			break;
+		case 'v':
+			if ( down && !repeat ) snprintf( m, sizeof(m), "rewind toggle=1" );
+			break;
+		case 'z':
+			if ( down ) snprintf( m, sizeof(m), "rewind back=1" );
+			break;
 		case 0x4000004B:	// SDLK_PAGEUP
 			if ( down ) snprintf( m, sizeof(m), "splatradius delta=0.01" );
 			break;
@@ -0,0 +1,29 @@
+// wallclock.h
+//
+// High resolution monotonic clock, for timing the simulation.
+
+#ifndef WALLCLOCK_H
+#define WALLCLOCK_H
+
+#if defined( MSWIN )
+#	include <windows.h>
+#else
+#	include <time.h>
+#endif
+
+//! Seconds since an arbitrary, fixed point in time.
+static inline double wallclock_seconds( void )
+{
+#if defined( MSWIN )
+	LARGE_INTEGER freq, cnt;
+	QueryPerformanceFrequency( &freq );
+	QueryPerformanceCounter( &cnt );
+	return cnt.QuadPart / (double) freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+#endif
+}
+
+#endif
@@ -0,0 +1,156 @@
+// watch.cpp
+//
+// Watches the frames that a simulation publishes to shared memory, and reports on each, reading the stars in place.
+// Start the simulation with shm=/nbody, or send `framering toggle=1` to the game, and run nbody-watch alongside it.
+// Any number of watchers can read the same ring.
+//
+// Usage: nbody-watch [key=value ...]
+//
+//   name=NAME      Shared memory object to watch. (default: /nbody)
+//   frames=N       Stop after N frames. 0 to watch until the simulation closes the ring. (default: 0)
+//   every=N        Report every Nth frame that is read. (default: 1)
+//   wait=S         Seconds to wait for the ring to appear. (default: 10)
+//   poll=MS        Milliseconds to sleep while there is no new frame. (default: 1)
+
+#include "framering.h"
+#include "wallclock.h"
+
+// From GBase
+#include "logx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+static const char* name = "/nbody";
+static int maxframes = 0;
+static int reportinterval = 1;
+static float waitseconds = 10.0f;
+static int pollms = 1;
+
+//! What a watcher learns from a frame.
+typedef struct
+{
+	int step;
+	double time;
+	int numstars;
+	double cx;		//! centre of mass.
+	double cy;
+	double kinetic;		//! kinetic energy, with unit mass per star.
+	int fullestcell;
+	int64_t uidsum;
+} summary_t;
+
+
+//! Sum over the stars of a slot, in place.
+static void summarise( const framering_t* r, const framering_slot_t* slot, summary_t* s )
+{
+	const float* px = (const float*) framering_array( r, slot, FRAMERING_PX );
+	const float* py = (const float*) framering_array( r, slot, FRAMERING_PY );
+	const float* vx = (const float*) framering_array( r, slot, FRAMERING_VX );
+	const float* vy = (const float*) framering_array( r, slot, FRAMERING_VY );
+	const int32_t* uid = (const int32_t*) framering_array( r, slot, FRAMERING_UID );
+	// A torn read could show any count, so never trust it beyond the capacity.
+	const uint32_t cap = r->hdr->capacity;
+	const int n = slot->numstars < cap ? slot->numstars : cap;
+	double sx = 0, sy = 0, ke = 0;
+	int64_t us = 0;
+	for ( int i=0; i<n; ++i )
+	{
+		sx += px[ i ];
+		sy += py[ i ];
+		ke += 0.5 * ( vx[ i ] * vx[ i ] + vy[ i ] * vy[ i ] );
+		us += uid[ i ];
+	}
+	int fullest = 0;
+	for ( int c=0; c<FRAMERING_GRIDRES*FRAMERING_GRIDRES; ++c )
+	{
+		const int cnt = (int) ( slot->offsets[ c+1 ] - slot->offsets[ c ] );
+		fullest = cnt > fullest ? cnt : fullest;
+	}
+	s->step = slot->step;
+	s->time = slot->time;
+	s->numstars = n;
+	s->cx = n ? sx / n : 0.0;
+	s->cy = n ? sy / n : 0.0;
+	s->kinetic = ke;
+	s->fullestcell = fullest;
+	s->uidsum = us;
+}
+
+
+int main( int argc, char* argv[] )
+{
+	for ( int i=1; i<argc; ++i )
+	{
+		const char* a = argv[ i ];
+		bool ok = true;
+		if ( !strncmp( a, "name=", 5 ) ) name = a+5;
+		else if ( !strncmp( a, "frames=", 7 ) ) maxframes = atoi( a+7 );
+		else if ( !strncmp( a, "every=", 6 ) ) { reportinterval = atoi( a+6 ); ok = reportinterval > 0; }
+		else if ( !strncmp( a, "wait=", 5 ) ) waitseconds = (float) atof( a+5 );
+		else if ( !strncmp( a, "poll=", 5 ) ) { pollms = atoi( a+5 ); ok = pollms >= 0; }
+		else ok = false;
+		if ( !ok )
+		{
+			fprintf( stderr, "Bad argument '%s'. See the top of watch.cpp for usage.\n", a );
+			return 1;
+		}
+	}
+
+	framering_t ring;
+	const double t0 = wallclock_seconds();
+	while ( !framering_attach( &ring, name ) )
+	{
+		if ( wallclock_seconds() - t0 > waitseconds )
+		{
+			LOGE( "No frame ring %s to watch.", name );
+			return 1;
+		}
+		usleep( 100000 );
+	}
+	LOGI( "Watching %s of process %u: %u slots of %u stars.", name, ring.hdr->writerpid, ring.hdr->numslots, ring.hdr->capacity );
+
+	uint64_t lastframe = 0;
+	int numread = 0;
+	int nummissed = 0;	// frames published that this watcher never saw.
+	int numretries = 0;	// reads that the writer overtook.
+	const double tstart = wallclock_seconds();
+	while ( maxframes <= 0 || numread < maxframes )
+	{
+		uint64_t seq = 0;
+		const framering_slot_t* slot = framering_read_begin( &ring, &seq );
+		if ( !slot || slot->frame == lastframe )
+		{
+			if ( __atomic_load_n( &ring.hdr->closed, __ATOMIC_ACQUIRE ) )
+				break;
+			if ( pollms )
+				usleep( 1000 * pollms );
+			continue;
+		}
+		const uint64_t frame = slot->frame;
+		summary_t s;
+		summarise( &ring, slot, &s );
+		if ( !framering_read_end( slot, seq ) )
+		{
+			numretries += 1;
+			continue;
+		}
+		if ( lastframe && frame > lastframe + 1 )
+			nummissed += (int) ( frame - lastframe - 1 );
+		lastframe = frame;
+		numread += 1;
+		if ( numread % reportinterval == 0 )
+			printf
+			(
+				"frame %llu step %d time %.3f: %d stars, centre %.4f,%.4f, kinetic %.4f, fullest cell %d, uid sum %lld\n",
+				(unsigned long long) frame, s.step, s.time, s.numstars, s.cx, s.cy, s.kinetic, s.fullestcell, (long long) s.uidsum
+			);
+	}
+	const double elapsed = wallclock_seconds() - tstart;
+	LOGI( "Read %d frames in %.2f s, missed %d, retried %d reads.", numread, elapsed, nummissed, numretries );
+	framering_close( &ring );
+	return 0;
+}
@@ -0,0 +1,61 @@
+#!/usr/bin/python3
+
+# Fetches the live metrics from a running game, bench or headless simulation that was started with metrics=ADDRESS.
+#
+# Usage: metrics.py ADDRESS [json|text] [INTERVAL]
+#
+#   ADDRESS    unix:PATH, tcp:PORT or a bare port number on localhost, as passed to metrics=.
+#   json|text  Format to ask for. (default: text)
+#   INTERVAL   Keep polling every INTERVAL seconds, until interrupted.
+
+import sys
+import socket
+import time
+
+
+def fetch(address, fmt) :
+	if address.startswith("unix:") :
+		s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+		s.connect(address[5:])
+	else :
+		port = int(address[4:] if address.startswith("tcp:") else address)
+		s = socket.create_connection(("127.0.0.1", port))
+	s.sendall((fmt + "\n").encode())
+	chunks = []
+	while True :
+		chunk = s.recv(4096)
+		if not chunk :
+			break
+		chunks.append(chunk)
+	s.close()
+	return b"".join(chunks).decode()
+
+
+def __main__() :
+	if len(sys.argv) < 2 :
+		print("Usage:", sys.argv[0], "unix:PATH|tcp:PORT [json|text] [INTERVAL]")
+		sys.exit(1)
+
+	address = sys.argv[1]
+	fmt = sys.argv[2] if len(sys.argv) > 2 else "text"
+	interval = float(sys.argv[3]) if len(sys.argv) > 3 else 0
+
+	if fmt not in ("json", "text") :
+		print("Format must be json or text, not", fmt)
+		sys.exit(2)
+
+	while True :
+		try :
+			sys.stdout.write(fetch(address, fmt))
+			sys.stdout.flush()
+		except OSError as e :
+			print("Cannot fetch metrics from", address + ":", e)
+			sys.exit(3)
+		if interval <= 0 :
+			break
+		time.sleep(interval)
+
+try :
+	__main__()
+except KeyboardInterrupt :
+	pass
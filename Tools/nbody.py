@@ -0,0 +1,86 @@
+#!/usr/bin/python3
+
+# Steps a simulation through libnbody.so, and reads the stars in place with numpy, without copying them.
+#
+# Usage: nbody.py [SCENARIO] [STARS] [STEPS]
+#
+#   SCENARIO  Scenario to spawn, as for nbody-sim scenario=. (default: plummer)
+#   STARS     Number of stars, 0 for the default of the scenario. (default: 0)
+#   STEPS     Steps to take between reports. (default: 100)
+#
+# Looks for libnbody.so next to the current directory first, so run it from the top of the repository after make libnbody.so.
+
+import sys
+import ctypes
+import numpy
+
+GRIDRES = 32
+
+FP = ctypes.POINTER(ctypes.c_float)
+IP = ctypes.POINTER(ctypes.c_int)
+
+
+class View(ctypes.Structure) :
+	_fields_ = [
+		("px", FP), ("py", FP), ("vx", FP), ("vy", FP), ("age", FP), ("st", IP),
+		("count", ctypes.c_int), ("cx", ctypes.c_int), ("cy", ctypes.c_int),
+		("generation", ctypes.c_uint),
+	]
+
+
+def load() :
+	try :
+		lib = ctypes.CDLL("./libnbody.so")
+	except OSError :
+		lib = ctypes.CDLL("libnbody.so")
+	lib.nbody_create.restype = ctypes.c_void_p
+	lib.nbody_free.argtypes = [ctypes.c_void_p]
+	lib.nbody_spawn.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_uint]
+	lib.nbody_step.argtypes = [ctypes.c_void_p, ctypes.c_float, ctypes.c_int]
+	lib.nbody_count.argtypes = [ctypes.c_void_p]
+	lib.nbody_step_nr.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_double)]
+	lib.nbody_range_view.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int, ctypes.POINTER(View), ctypes.c_int]
+	lib.nbody_view_valid.argtypes = [ctypes.c_void_p, ctypes.POINTER(View)]
+	return lib
+
+
+def arrays(view) :
+	'''Returns numpy arrays over the memory of the simulation: no copies are made.'''
+	n = view.count
+	return [numpy.ctypeslib.as_array(p, shape=(n,)) for p in (view.px, view.py, view.vx, view.vy, view.age)]
+
+
+def report(lib, sim) :
+	views = (View * (GRIDRES*GRIDRES))()
+	numviews = lib.nbody_range_view(sim, 0, lib.nbody_count(sim), views, len(views))
+	n = 0
+	sx = sy = ke = 0.0
+	for i in range(numviews) :
+		px, py, vx, vy, age = arrays(views[i])
+		n += views[i].count
+		sx += float(px.sum())
+		sy += float(py.sum())
+		ke += 0.5 * float((vx*vx + vy*vy).sum())
+	time = ctypes.c_double()
+	step = lib.nbody_step_nr(sim, ctypes.byref(time))
+	valid = all(lib.nbody_view_valid(sim, ctypes.byref(views[i])) for i in range(numviews))
+	print("step %d time %.3f: %d stars in %d cells, centre %.4f,%.4f, kinetic energy %.4f%s" %
+		(step, time.value, n, numviews, sx/max(n, 1), sy/max(n, 1), ke, "" if valid else " (changed while reading)"))
+
+
+scenario = sys.argv[1] if len(sys.argv) > 1 else "plummer"
+numstars = int(sys.argv[2]) if len(sys.argv) > 2 else 0
+steps = int(sys.argv[3]) if len(sys.argv) > 3 else 100
+
+lib = load()
+lib.nbody_init(0)
+sim = lib.nbody_create()
+if lib.nbody_spawn(sim, scenario.encode(), numstars, 1) < 0 :
+	print("Unknown scenario %s" % scenario)
+	sys.exit(1)
+for i in range(5) :
+	report(lib, sim)
+	lib.nbody_step(sim, 1/120.0, steps)
+report(lib, sim)
+lib.nbody_free(sim)
+lib.nbody_exit()
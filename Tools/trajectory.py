@@ -0,0 +1,97 @@
+#!/usr/bin/python3
+
+# Reads a trajectory file, as written with trajectory=FILE by the headless simulation, or with R in the game.
+#
+# Usage: trajectory.py FILE [FRAME]
+#
+#   FILE     Trajectory to read. Without FRAME, lists the frames with their sizes.
+#   FRAME    Print the positions of the stars in this frame as CSV: uid,x,y.
+
+import sys
+import struct
+import zlib
+
+HEADER = struct.Struct("<8sIIfffI")
+FRAME = struct.Struct("<4sIiId II")
+
+
+def varint(buf, pos) :
+	v = 0
+	shift = 0
+	while True :
+		b = buf[pos]
+		pos += 1
+		v |= (b & 0x7f) << shift
+		shift += 7
+		if b < 0x80 :
+			return v, pos
+
+
+def unzigzag(v) :
+	return (v >> 1) ^ -(v & 1)
+
+
+def decode(payload, numstars, prev) :
+	'''Returns a dict from uid to grid coordinates, given the one of the previous frame.'''
+	stars = {}
+	uid = -1
+	pos = 0
+	for i in range(numstars) :
+		token, pos = varint(payload, pos)
+		a, pos = varint(payload, pos)
+		b, pos = varint(payload, pos)
+		uid += token >> 1
+		if token & 1 :
+			px, py = prev[uid]
+			stars[uid] = (px + unzigzag(a), py + unzigzag(b))
+		else :
+			stars[uid] = (a, b)
+	return stars
+
+
+def frames(f) :
+	'''Yields the header and decoded stars of every frame.'''
+	magic, version, gridres, ox, oy, cellsize, keyint = HEADER.unpack(f.read(HEADER.size))
+	if magic != b"NBODYTRJ" or version != 1 :
+		raise ValueError("not a version 1 trajectory")
+	prev = {}
+	while True :
+		raw = f.read(FRAME.size)
+		if len(raw) < FRAME.size :
+			return
+		fmagic, keyframe, step, numstars, time, rawsize, packedsize = FRAME.unpack(raw)
+		if fmagic != b"TRJF" :
+			raise ValueError("bad frame at offset %d" % (f.tell() - FRAME.size))
+		packed = f.read(packedsize)
+		payload = zlib.decompress(packed)
+		prev = decode(payload, numstars, prev)
+		yield (step, time, keyframe, numstars, rawsize, packedsize), prev
+
+
+def __main__() :
+	if len(sys.argv) < 2 :
+		print("Usage:", sys.argv[0], "FILE [FRAME]")
+		sys.exit(1)
+
+	f = open(sys.argv[1], "rb")
+	_, _, _, ox, oy, cellsize, _ = HEADER.unpack(f.read(HEADER.size))
+	f.seek(0)
+	scale = cellsize / 65536.0
+	wanted = int(sys.argv[2]) if len(sys.argv) > 2 else -1
+	if wanted < 0 :
+		print("frame,step,time,keyframe,stars,raw_bytes,packed_bytes")
+	for nr, (info, stars) in enumerate(frames(f)) :
+		step, time, keyframe, numstars, rawsize, packedsize = info
+		if wanted < 0 :
+			print("%d,%d,%.5f,%d,%d,%d,%d" % (nr, step, time, keyframe, numstars, rawsize, packedsize))
+		elif nr == wanted :
+			print("uid,x,y")
+			for uid in sorted(stars) :
+				gx, gy = stars[uid]
+				print("%d,%.6f,%.6f" % (uid, ox + (gx + 0.5) * scale, oy + (gy + 0.5) * scale))
+			break
+
+try :
+	__main__()
+except (KeyboardInterrupt, BrokenPipeError) :
+	pass
@@ -17,6 +17,12 @@
 
 #include "ctrl.h"
 #include "view.h"
+#include "frametimes.h"
+#include "metrics.h"
+#include "icload.h"
+#include "streamserver.h"
+#include "streamclient.h"
+#include "wallclock.h"
 
 #if defined(linux)
 #	include "threadtracer.h"
@@ -129,7 +135,9 @@ static void draw_screen( void )
 	(void) returnCode;
 
 	TT_BEGIN( "SwapWindow" );
+	const double t0 = wallclock_seconds();
 	SDL_GL_SwapWindow( window );
+	frametimes_record( FRAMETIME_SWAP, wallclock_seconds() - t0 );
 	TT_END  ( "SwapWindow" );
 }
 
@@ -488,8 +496,16 @@ static bool make_window( bool use_aa )
 int main( int argc, char* argv[] )
 {
 	int vsync=0;
+	const char* metricsaddress = 0;
+	const char* initialname = 0;
+	const char* serveaddress = 0;
+	const char* connectaddress = 0;
 	for ( int i=1; i<argc; ++i )
 	{
+		if ( !strncmp( argv[ i ], "metrics=", 8 ) ) metricsaddress = argv[i]+8;
+		if ( !strncmp( argv[ i ], "initial=", 8 ) ) initialname = argv[i]+8;
+		if ( !strncmp( argv[ i ], "serve=", 6 ) ) serveaddress = argv[i]+6;
+		if ( !strncmp( argv[ i ], "connect=", 8 ) ) connectaddress = argv[i]+8;
 		if ( !strncmp( argv[ i ], "fs=", 3 ) ) ctrl_fullScreen=atoi(argv[i]+3);
 		if ( !strncmp( argv[ i ], "vsync=", 6 ) ) vsync = atoi(argv[i]+6);
 		if ( !strncmp( argv[ i ], "w=", 2 ) ) fbw = atoi(argv[i]+2);
@@ -577,6 +593,15 @@ int main( int argc, char* argv[] )
 
 	ctrl_create( fbw, fbh, csf );
 
+	if ( metricsaddress )
+		metrics_listen( metricsaddress );
+	if ( initialname )
+		icload_load( initialname );
+	if ( serveaddress )
+		streamserver_listen( serveaddress );
+	if ( connectaddress )
+		streamclient_connect( connectaddress );
+
 	ctrl_enablePremium( true );
 
 	if ( ctrl_fullScreen )